@@ -0,0 +1,195 @@
+/**
+ * @file eventlog.h
+ * @brief Append-only per-execution event log with columnar, bit-packed storage
+ *
+ * The trie keeps only a frequency and a last-used time per command. The event
+ * log keeps every execution (command, time, working directory, exit status)
+ * so recency windows, decay changes or context features can be recomputed
+ * later.
+ *
+ * On-disk layout (all files live in the cache directory):
+ * - events.log  : sealed blocks of EVENT_BLOCK_SIZE events, one column at a
+ *                 time: command ids, zigzag timestamp deltas, cwd ids and
+ *                 exit statuses, each bit-packed at the block's own width
+ * - events.tail : the not-yet-sealed rows, fixed-size and uncompressed
+ * - events.cmds : command dictionary, one string per line (line = id)
+ * - events.cwds : working-directory dictionary, same format
+ *
+ * Sealing turns a full tail into one block, so a scan decodes whole columns
+ * with shifts and masks only.
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Events per sealed block */
+#define EVENT_BLOCK_SIZE 1024
+
+/** Exit status recorded when it is unknown (e.g. history backfill) */
+#define EVENT_STATUS_UNKNOWN (-1)
+
+/**
+ * @struct EventRecord
+ * @brief One decoded execution event
+ */
+typedef struct {
+    /** Id in the command dictionary */
+    uint32_t command_id;
+
+    /** Id in the working-directory dictionary */
+    uint32_t cwd_id;
+
+    /** Unix time of execution */
+    int64_t timestamp;
+
+    /** Exit status, or EVENT_STATUS_UNKNOWN */
+    int32_t status;
+} EventRecord;
+
+/**
+ * @struct EventDict
+ * @brief Append-only string dictionary with an open-addressing hash index
+ */
+typedef struct {
+    /** Strings indexed by id */
+    char** strings;
+
+    /** Number of strings */
+    int count;
+
+    /** Allocated entries in strings */
+    int capacity;
+
+    /** Strings already present in the dictionary file */
+    int saved;
+
+    /** Hash slots holding id + 1 (0 = empty) */
+    uint32_t* slots;
+
+    /** Number of slots (power of two) */
+    int slot_count;
+} EventDict;
+
+/**
+ * @struct EventLog
+ * @brief Open handle on the event log (holds an exclusive lock until closed)
+ */
+typedef struct {
+    /** Directory holding the event files */
+    char dir[4096];
+
+    /** Lock file descriptor (events.tail, flock'ed) */
+    int lock_fd;
+
+    /** Command dictionary */
+    EventDict commands;
+
+    /** Working-directory dictionary */
+    EventDict cwds;
+
+    /** Unsealed rows (loaded from events.tail plus new appends) */
+    EventRecord* tail;
+
+    /** Number of unsealed rows */
+    int tail_count;
+
+    /** True once tail differs from events.tail */
+    bool dirty;
+} EventLog;
+
+/**
+ * Callback for eventlog_scan().
+ *
+ * @param event    Decoded event
+ * @param command  Command string for event->command_id
+ * @param cwd      Working directory for event->cwd_id
+ * @param ctx      Caller context
+ */
+typedef void (*EventCallback)(const EventRecord* event, const char* command,
+                              const char* cwd, void* ctx);
+
+/**
+ * Open (creating if needed) the event log in a directory.
+ *
+ * Takes an exclusive flock so concurrent shells serialise their appends and
+ * block sealing, then loads both dictionaries and the unsealed tail. A torn
+ * final block left by a crash mid-seal is cut off events.log here.
+ *
+ * @param dir  Cache directory
+ * @return Handle (close with eventlog_close()), or NULL on failure
+ */
+EventLog* eventlog_open(const char* dir);
+
+/**
+ * Write pending rows and dictionary entries, release the lock and free.
+ *
+ * @param log  Handle (can be NULL)
+ */
+void eventlog_close(EventLog* log);
+
+/**
+ * Append one execution event.
+ *
+ * Unknown commands and directories get new dictionary ids. A tail reaching
+ * EVENT_BLOCK_SIZE rows is sealed into a columnar block immediately.
+ *
+ * @param log        Open handle
+ * @param command    Executed command
+ * @param cwd        Working directory ("" if unknown)
+ * @param timestamp  Unix time of execution
+ * @param status     Exit status, or EVENT_STATUS_UNKNOWN
+ * @return true on success
+ */
+bool eventlog_append(EventLog* log, const char* command, const char* cwd,
+                     int64_t timestamp, int32_t status);
+
+/**
+ * Check whether the log holds no events at all (sealed or not).
+ *
+ * @param log  Open handle
+ * @return true if empty
+ */
+bool eventlog_is_empty(const EventLog* log);
+
+/**
+ * Decode every event at or after since, oldest first.
+ *
+ * Sealed blocks are read through a read-only mapping of events.log; blocks
+ * that end before since are skipped from their header alone.
+ *
+ * @param log       Open handle
+ * @param since     Only events with timestamp >= since (0 for all)
+ * @param callback  Called once per event
+ * @param ctx       Passed to callback
+ * @return Number of events delivered, or -1 on a corrupt log
+ */
+long eventlog_scan(EventLog* log, int64_t since, EventCallback callback, void* ctx);
+
+/**
+ * Encode events into one sealed block.
+ *
+ * @param events  Events in time order
+ * @param count   Number of events (1..EVENT_BLOCK_SIZE)
+ * @param size    Output: block size in bytes
+ * @return Newly allocated block (caller must free), or NULL
+ */
+void* eventlog_encode_block(const EventRecord* events, int count, uint32_t* size);
+
+/**
+ * Decode one sealed block.
+ *
+ * @param block   Block bytes
+ * @param avail   Bytes available from block onwards
+ * @param events  Output: at least EVENT_BLOCK_SIZE records
+ * @param size    Output: block size in bytes
+ * @return Number of events decoded, or -1 if the block is corrupt
+ */
+int eventlog_decode_block(const void* block, uint64_t avail, EventRecord* events, uint32_t* size);
+
+#endif // EVENTLOG_H
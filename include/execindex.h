@@ -0,0 +1,84 @@
+/**
+ * @file execindex.h
+ * @brief Set of command names that can run on this host
+ *
+ * Histories are shared between machines, so the index holds commands whose
+ * programs are not installed here. An ExecIndex is a hash set of the
+ * executables in the $PATH directories, plus shell builtins, reserved words
+ * and whatever names the shell adds (aliases, functions). Asking whether a
+ * name is in it is one hash probe: no stat.
+ *
+ * The set is rebuilt only when a $PATH directory changes. exec_index_refresh()
+ * stats the directories (one call each, at most every EXEC_INDEX_RECHECK_MS)
+ * and rescans them when an mtime differs, i.e. when a program was installed
+ * or removed.
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#ifndef EXECINDEX_H
+#define EXECINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** $PATH directories watched; later ones are ignored */
+#define EXEC_INDEX_MAX_DIRS 64
+
+/** Minimum interval between two mtime checks of the $PATH directories */
+#define EXEC_INDEX_RECHECK_MS 2000
+
+/**
+ * @struct ExecIndex
+ * @brief The name set and the directories it was built from
+ */
+typedef struct ExecIndex ExecIndex;
+
+/**
+ * Scan the directories of a search path.
+ *
+ * @param path         Colon-separated directories (e.g. getenv("PATH"); NULL: none)
+ * @param shell_names  Extra runnable names separated by blanks (aliases,
+ *                     functions...; NULL: none)
+ * @return Index (free with exec_index_destroy()), or NULL
+ */
+ExecIndex* exec_index_create(const char* path, const char* shell_names);
+
+/**
+ * Free an index.
+ *
+ * @param index  Index (NULL is ignored)
+ */
+void exec_index_destroy(ExecIndex* index);
+
+/**
+ * Rescan if a directory changed since the last check; does nothing (and
+ * no system call) within EXEC_INDEX_RECHECK_MS of that check.
+ *
+ * @param index  Index
+ * @return true if the set was rebuilt
+ */
+bool exec_index_refresh(ExecIndex* index);
+
+/**
+ * Whether a command word can run here. Words that are not a plain name -
+ * paths, expansions, quoted or escaped words, subshells - cannot be judged
+ * from the set and are reported present.
+ *
+ * @param index   Index
+ * @param word    Command word
+ * @param length  Bytes in word
+ * @return false only for a plain name that is not in the set
+ */
+bool exec_index_has(const ExecIndex* index, const char* word, size_t length);
+
+/**
+ * Names in the set.
+ *
+ * @param index  Index
+ * @return Executables, builtins and shell names, each counted once
+ */
+size_t exec_index_count(const ExecIndex* index);
+
+#endif // EXECINDEX_H
@@ -0,0 +1,153 @@
+/**
+ * @file heavy.h
+ * @brief Space-Saving summaries of the most used commands
+ *
+ * "Top commands" over the whole trie means ranking every leaf. A
+ * HeavySummary instead follows the stream of uses with a fixed number of
+ * counters (Space-Saving, Metwally et al.): a command without a counter
+ * takes over the one with the smallest count and inherits that count as
+ * its error. Any command used more than total / capacity times is
+ * guaranteed a counter, and no count is off by more than its error.
+ *
+ * Counters are kept sorted by count, so the top N is the first N of them:
+ * heavy_top() copies N entries and does no ranking. An update is one hash
+ * probe plus, usually, one swap.
+ *
+ * A HeavyWindow covers a sliding time span with two rotating summaries: the
+ * current aligned period and the one before it. When the current period is
+ * a fraction f through, the previous one counts for (1 - f), the share of
+ * it still inside the span.
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#ifndef HEAVY_H
+#define HEAVY_H
+
+/** Counters per summary; errors are at most total / HEAVY_COUNTERS */
+#define HEAVY_COUNTERS 256
+
+/**
+ * @struct HeavyItem
+ * @brief One entry of a top-N answer
+ */
+typedef struct {
+    const char* command;        /**< Valid until the summary is next updated */
+    long count;                 /**< Estimated uses (never below the true count in a plain summary) */
+    long error;                 /**< count minus error is a lower bound */
+} HeavyItem;
+
+/**
+ * @struct HeavySummary
+ * @brief Counters, their order by count and a hash from command to counter
+ */
+typedef struct HeavySummary HeavySummary;
+
+/**
+ * @struct HeavyWindow
+ * @brief Current and previous period of a sliding window
+ */
+typedef struct HeavyWindow HeavyWindow;
+
+/**
+ * Create an empty summary.
+ *
+ * @param capacity  Counters (e.g. HEAVY_COUNTERS)
+ * @return Summary (free with heavy_destroy()), or NULL
+ */
+HeavySummary* heavy_create(int capacity);
+
+/**
+ * Free a summary.
+ *
+ * @param summary  Summary (NULL is ignored)
+ */
+void heavy_destroy(HeavySummary* summary);
+
+/**
+ * Count uses of a command.
+ *
+ * @param summary  Summary
+ * @param command  Command text (copied)
+ * @param weight   Uses to add (ignored unless positive)
+ */
+void heavy_add(HeavySummary* summary, const char* command, long weight);
+
+/**
+ * The most used commands, most used first.
+ *
+ * @param summary  Summary
+ * @param out      Output entries
+ * @param n        Capacity of out
+ * @return Entries stored (fewer than n when fewer commands were seen)
+ */
+int heavy_top(const HeavySummary* summary, HeavyItem* out, int n);
+
+/**
+ * Estimated count of one command.
+ *
+ * @param summary  Summary
+ * @param command  Command text
+ * @param error    Output (optional): error of the count
+ * @return Count, or 0 if the command has no counter
+ */
+long heavy_count(const HeavySummary* summary, const char* command, long* error);
+
+/**
+ * Total weight counted (true counts sum to this).
+ *
+ * @param summary  Summary
+ * @return Sum of all weights added
+ */
+long heavy_total(const HeavySummary* summary);
+
+/**
+ * Create a sliding window.
+ *
+ * @param capacity  Counters per period
+ * @param span      Window length in seconds (periods are aligned to it)
+ * @return Window (free with heavy_window_destroy()), or NULL
+ */
+HeavyWindow* heavy_window_create(int capacity, long span);
+
+/**
+ * Free a window.
+ *
+ * @param window  Window (NULL is ignored)
+ */
+void heavy_window_destroy(HeavyWindow* window);
+
+/**
+ * Window length.
+ *
+ * @param window  Window
+ * @return Span in seconds
+ */
+long heavy_window_span(const HeavyWindow* window);
+
+/**
+ * Count uses at a time. Periods rotate as time moves forward; a use older
+ * than the previous period is dropped.
+ *
+ * @param window   Window
+ * @param command  Command text (copied)
+ * @param weight   Uses to add
+ * @param when     Unix time of the use
+ */
+void heavy_window_add(HeavyWindow* window, const char* command, long weight, long when);
+
+/**
+ * The most used commands over the span ending now: both periods merged,
+ * the previous one scaled by the share of it still inside the span. Both
+ * are walked in count order only until the rest cannot make the top N.
+ *
+ * @param window  Window
+ * @param now     Current Unix time
+ * @param out     Output entries
+ * @param n       Capacity of out
+ * @return Entries stored
+ */
+int heavy_window_top(HeavyWindow* window, long now, HeavyItem* out, int n);
+
+#endif // HEAVY_H
@@ -0,0 +1,127 @@
+/**
+ * @file pathcache.h
+ * @brief Cached directory listings for path-argument completion
+ *
+ * Completing `vim src/ma` from the filesystem means an opendir/readdir on
+ * every keystroke. The serve loop keeps the listings instead: a lookup only
+ * reads memory, and anything that touches the disk - listing a directory
+ * seen for the first time, re-listing one that changed - is queued and done
+ * by pathcache_refresh() once the pending replies have been written.
+ *
+ * A listing stays valid until its directory changes. Changes are reported
+ * by inotify (pathcache_fd() becomes readable; call pathcache_events()).
+ * Without inotify, or once its watch limit is reached, a directory is
+ * revalidated by its mtime, at most every PATHCACHE_RECHECK_MS while it is
+ * being used.
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Directories kept; the least recently used listing goes first */
+#define PATHCACHE_MAX_DIRS 256
+
+/** Names kept per directory (larger listings are truncated) */
+#define PATHCACHE_MAX_ENTRIES 8192
+
+/** Minimum interval between mtime checks of an unwatched directory */
+#define PATHCACHE_RECHECK_MS 2000
+
+/**
+ * @struct PathCache
+ * @brief Listings, their inotify watches and the queue of work to do
+ */
+typedef struct PathCache PathCache;
+
+/**
+ * @struct PathEntry
+ * @brief One name in a listing (valid until the next pathcache_refresh())
+ */
+typedef struct {
+    const char* name;           /**< NUL-terminated */
+    size_t length;              /**< Bytes in name */
+    bool directory;             /**< A directory, or a symlink to one */
+} PathEntry;
+
+/**
+ * Create an empty cache.
+ *
+ * @param watch  Use inotify (false, or not Linux: mtime checks only)
+ * @return Cache (free with pathcache_destroy()), or NULL
+ */
+PathCache* pathcache_create(bool watch);
+
+/**
+ * Free a cache and its watches.
+ *
+ * @param cache  Cache (NULL is ignored)
+ */
+void pathcache_destroy(PathCache* cache);
+
+/**
+ * How changes are noticed.
+ *
+ * @param cache  Cache
+ * @return "inotify" or "mtime"
+ */
+const char* pathcache_backend(const PathCache* cache);
+
+/**
+ * Descriptor that becomes readable when a watched directory changes.
+ *
+ * @param cache  Cache
+ * @return inotify descriptor, or -1 when not watching
+ */
+int pathcache_fd(const PathCache* cache);
+
+/**
+ * Read pending inotify events and queue the directories they name for
+ * re-listing. Never blocks.
+ *
+ * @param cache  Cache
+ */
+void pathcache_events(PathCache* cache);
+
+/**
+ * Do the queued filesystem work: list new and changed directories, and
+ * check the mtime of unwatched directories in use.
+ *
+ * @param cache  Cache
+ * @return Directories (re)listed
+ */
+int pathcache_refresh(PathCache* cache);
+
+/**
+ * Queue a directory for listing without looking anything up (e.g. a
+ * command's working directory, or one a completion just descended into).
+ *
+ * @param cache  Cache
+ * @param dir    Absolute directory path
+ */
+void pathcache_prefetch(PathCache* cache, const char* dir);
+
+/**
+ * Names in a directory starting with partial, in byte order; no system
+ * calls. Dot files are only listed when partial starts with '.'.
+ *
+ * @param cache      Cache
+ * @param dir        Absolute directory path
+ * @param partial    Start of the name
+ * @param length     Bytes in partial
+ * @param out        Output entries
+ * @param max        Capacity of out
+ * @param complete   Output (optional): false if the listing was truncated,
+ *                   so a name missing from it may still exist
+ * @return Matches stored (at most max), or -1 if the directory is not
+ *         listed yet (it is queued)
+ */
+int pathcache_lookup(PathCache* cache, const char* dir, const char* partial, size_t length,
+                     PathEntry* out, int max, bool* complete);
+
+#endif // PATHCACHE_H
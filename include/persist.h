@@ -0,0 +1,124 @@
+/**
+ * @file persist.h
+ * @brief Asynchronous file persistence for the serve loop
+ *
+ * A Persister takes ownership of a buffer and writes it out without blocking
+ * the caller: either through io_uring, as one linked chain per job
+ * (write -> fsync -> close [-> rename]), or, when io_uring is unavailable
+ * (not Linux, or a kernel without those opcodes), on a worker thread doing
+ * the same steps with plain syscalls.
+ *
+ * Jobs run one at a time in submission order, so an append never lands in a
+ * file that a queued replace is about to swap out. While a job is in flight,
+ * queued work is coalesced: appends to the same file are concatenated (one
+ * fdatasync for the group) and a replace drops queued jobs it supersedes.
+ *
+ * Completion is reported on a pollable descriptor (persist_fd()); the owner
+ * calls persist_reap() when it becomes readable.
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @struct Persister
+ * @brief Job queue plus the io_uring ring or worker thread that runs it
+ */
+typedef struct Persister Persister;
+
+/**
+ * Create a persister.
+ *
+ * @param use_uring  Try io_uring first (false forces the worker thread)
+ * @return Persister (free with persist_destroy()), or NULL
+ */
+Persister* persist_create(bool use_uring);
+
+/**
+ * Backend in use.
+ *
+ * @param persister  Persister
+ * @return "io_uring" or "thread"
+ */
+const char* persist_backend(const Persister* persister);
+
+/**
+ * Atomically replace a file: data goes to a new path.tmp.XXXXXX (mkstemp),
+ * is fsync'ed, and is renamed over path.
+ *
+ * @param persister  Persister
+ * @param path       Destination file
+ * @param data       malloc'ed contents (ownership taken, even on failure)
+ * @param size       Bytes in data
+ * @return false if the job could not be queued (also when data is NULL)
+ */
+bool persist_replace(Persister* persister, const char* path, char* data, size_t size);
+
+/**
+ * Blocking persist_replace() for callers without a persister (one-shot
+ * commands): same kind of temp file, fsync and rename, done before returning.
+ *
+ * @param path  Destination file
+ * @param data  Contents (borrowed)
+ * @param size  Bytes in data
+ * @return false on a write, fsync or rename error
+ */
+bool persist_replace_now(const char* path, const char* data, size_t size);
+
+/**
+ * Append to a file (created if missing), optionally followed by fdatasync.
+ *
+ * @param persister  Persister
+ * @param path       File to append to
+ * @param data       malloc'ed bytes (ownership taken, even on failure)
+ * @param size       Bytes in data
+ * @param sync       fdatasync after the write
+ * @return false if the job could not be queued (also when data is NULL)
+ */
+bool persist_append(Persister* persister, const char* path, char* data, size_t size, bool sync);
+
+/**
+ * Descriptor that becomes readable when jobs complete.
+ *
+ * @param persister  Persister
+ * @return File descriptor for poll()
+ */
+int persist_fd(const Persister* persister);
+
+/**
+ * Handle finished jobs and start the next one, without blocking.
+ *
+ * @param persister  Persister
+ * @return Jobs still queued or in flight
+ */
+int persist_reap(Persister* persister);
+
+/**
+ * Block until every queued job has finished.
+ *
+ * @param persister  Persister
+ */
+void persist_drain(Persister* persister);
+
+/**
+ * Number of jobs that failed so far (write, fsync or rename errors).
+ *
+ * @param persister  Persister
+ * @return Failed job count
+ */
+long persist_failures(const Persister* persister);
+
+/**
+ * Drain, then free the persister.
+ *
+ * @param persister  Persister (can be NULL)
+ */
+void persist_destroy(Persister* persister);
+
+#endif // PERSIST_H
@@ -0,0 +1,206 @@
+/**
+ * @file protocol.h
+ * @brief Length-prefixed binary framing for the serve mode
+ *
+ * Requests and replies share one frame layout (all integers little-endian):
+ *
+ *   uint32 length   bytes after this field
+ *   uint32 id       chosen by the client, echoed in the reply
+ *   uint8  code     request: ProtoOp; reply: ProtoStatus
+ *   uint8  count    number of fields
+ *   count x { uint32 size; size bytes }
+ *
+ * Fields are raw bytes, so commands may contain '|', tabs or newlines.
+ * Clients can write many requests at once and match replies by id; the
+ * server answers them in order, each exactly once (PROTO_ERROR with no
+ * fields if the reply does not fit in a frame).
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Largest accepted frame (length field included) */
+#define PROTO_MAX_FRAME 65536
+
+/** Most fields in one frame */
+#define PROTO_MAX_FIELDS 255
+
+/** Bytes before the first field */
+#define PROTO_HEADER_SIZE 10
+
+/**
+ * Fields up to this size are copied next to their header by ProtoWriter; a
+ * longer one is cheaper as its own iovec (`bench protocol`, long replies).
+ * Must stay well below MAX_COMMAND_LENGTH or nothing is ever borrowed
+ */
+#define PROTO_INLINE_MAX 256
+
+/**
+ * @enum ProtoOp
+ * @brief Request codes; fields are the one-shot call's arguments
+ */
+typedef enum {
+    PROTO_GHOST = 1,            /**< prefix [suffix] [cwd] -> completion */
+    PROTO_HISTORY = 2,          /**< prefix dir index [window] -> entry, index */
+    PROTO_UPDATE = 3,           /**< command [status] [cwd] [start] -> nothing */
+    PROTO_STATS = 4,            /**< -> loaded, total */
+    PROTO_TABLE = 5,            /**< prefix -> (next char, completion) pairs */
+    PROTO_TOP = 6,              /**< [n] [window] -> (command, count) pairs */
+    PROTO_RESTART = 7           /**< -> nothing; the server re-executes itself after the batch */
+} ProtoOp;
+
+/**
+ * @enum ProtoStatus
+ * @brief Reply codes
+ */
+typedef enum {
+    PROTO_OK = 0,
+    PROTO_PARTIAL = 1,          /**< Answered while the index is still loading */
+    PROTO_ERROR = 2             /**< Unknown op or bad arguments */
+} ProtoStatus;
+
+/**
+ * @struct ProtoField
+ * @brief One field: a byte slice (not NUL-terminated on the wire)
+ */
+typedef struct {
+    const char* data;
+    uint32_t size;
+} ProtoField;
+
+/**
+ * @struct ProtoFrame
+ * @brief A parsed frame; fields point into the parsed buffer
+ */
+typedef struct {
+    uint32_t id;
+    uint8_t code;
+    uint8_t count;
+    ProtoField fields[PROTO_MAX_FIELDS];
+} ProtoFrame;
+
+/**
+ * @struct ProtoBuffer
+ * @brief Growable output buffer frames are appended to
+ */
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} ProtoBuffer;
+
+/**
+ * @struct ProtoSlice
+ * @brief One pending iovec: bytes in ProtoWriter::headers, or borrowed bytes
+ */
+typedef struct {
+    const char* data;           /**< Borrowed bytes, or NULL for headers + offset */
+    size_t offset;
+    size_t size;
+} ProtoSlice;
+
+/**
+ * @struct ProtoWriter
+ * @brief Replies gathered for a single writev()
+ *
+ * Frame headers and field size prefixes are encoded into a small buffer;
+ * field bytes larger than PROTO_INLINE_MAX are referenced where they already
+ * live (trie strings, the mapped snapshot) instead of being copied. Borrowed
+ * bytes and kept allocations must stay valid until the next flush: text that
+ * only lives until the next call must be copied or handed to
+ * proto_writer_keep().
+ */
+typedef struct {
+    int fd;
+    ProtoBuffer headers;
+    ProtoSlice* slices;
+    int slice_count;
+    int slice_capacity;
+    void** kept;                /**< Freed after each flush */
+    int kept_count;
+    int kept_capacity;
+} ProtoWriter;
+
+/**
+ * Parse one frame from the start of a buffer.
+ *
+ * @param buf    Received bytes
+ * @param size   Number of bytes in buf
+ * @param frame  Output: parsed frame (fields point into buf)
+ * @return Bytes consumed, 0 if the frame is incomplete, -1 if malformed
+ */
+long proto_parse(const uint8_t* buf, size_t size, ProtoFrame* frame);
+
+/**
+ * Append one encoded frame.
+ *
+ * @param out     Output buffer
+ * @param id      Request id
+ * @param code    ProtoOp or ProtoStatus
+ * @param fields  Field slices
+ * @param count   Number of fields (at most PROTO_MAX_FIELDS)
+ * @return false if out of memory or the frame would exceed PROTO_MAX_FRAME
+ */
+bool proto_append(ProtoBuffer* out, uint32_t id, uint8_t code,
+                  const ProtoField* fields, int count);
+
+/**
+ * Field from a C string.
+ *
+ * @param text  NUL-terminated text (NULL gives an empty field)
+ * @return Field slice
+ */
+ProtoField proto_field(const char* text);
+
+/**
+ * Queue one frame whose fields are borrowed, not copied.
+ *
+ * @param writer  Writer
+ * @param id      Request id
+ * @param code    ProtoOp or ProtoStatus
+ * @param fields  Field slices (must stay valid until proto_writer_flush())
+ * @param count   Number of fields (at most PROTO_MAX_FIELDS)
+ * @return false (nothing queued) if out of memory or the frame would exceed
+ *         PROTO_MAX_FRAME
+ */
+bool proto_writer_add(ProtoWriter* writer, uint32_t id, uint8_t code,
+                      const ProtoField* fields, int count);
+
+/**
+ * Free an allocation after the next flush (e.g. a reply's owned text).
+ *
+ * @param writer  Writer
+ * @param owned   malloc'ed block (freed now if it cannot be queued)
+ */
+void proto_writer_keep(ProtoWriter* writer, void* owned);
+
+/**
+ * Write everything queued with one writev() per IOV_MAX slices.
+ *
+ * @param writer  Writer
+ * @return false on a write error
+ */
+bool proto_writer_flush(ProtoWriter* writer);
+
+/**
+ * Free a writer's storage (and anything still kept).
+ *
+ * @param writer  Writer
+ */
+void proto_writer_free(ProtoWriter* writer);
+
+/**
+ * Free a buffer's storage.
+ *
+ * @param out  Buffer
+ */
+void proto_buffer_free(ProtoBuffer* out);
+
+#endif // PROTOCOL_H
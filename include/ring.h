@@ -0,0 +1,189 @@
+/**
+ * @file ring.h
+ * @brief Shared, memory-mapped ring of executed commands
+ *
+ * Every shell on a machine maps the same fixed-size file. A shell appends a
+ * command by reserving slots with one atomic fetch-add on the shared tail and
+ * writing them in place: no lock, no syscall once the file is mapped. Long
+ * commands take several consecutive slots.
+ *
+ * Layout: RingHeader | RING_SLOTS x RingSlot
+ *
+ * Each slot carries a sequence marker (reservation number + 1) that is
+ * cleared while the slot is written and set last, so readers can tell a
+ * finished record from one in progress or one overwritten by a later lap.
+ *
+ * Readers keep their own cursor. The header's folded mark says how much of
+ * the ring is already part of the cache file; moving it (a "fold") and
+ * reading the cache take an flock on the ring, appends never do.
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Slots in a ring (a power of two) */
+#define RING_SLOTS 4096
+
+/** Bytes per slot, marker and record header included */
+#define RING_SLOT_SIZE 128
+
+/** Record bytes a slot holds */
+#define RING_SLOT_DATA (RING_SLOT_SIZE - 24)
+
+/** Most slots one record may span */
+#define RING_MAX_SPAN 16
+
+/** A reader gives up on a reserved but unwritten slot after this long */
+#define RING_STALL_MS 1000
+
+/**
+ * @struct RingHeader
+ * @brief First RING_SLOT_SIZE bytes of the file; tail has a cache line to itself
+ */
+typedef struct {
+    char magic[8];              /**< "ZACRING1" */
+    uint32_t slot_size;
+    uint32_t slot_count;
+    uint64_t folded;            /**< Slots before this are in the cache file */
+    uint8_t reserved[40];
+    uint64_t tail;              /**< Next slot to reserve (fetch-add) */
+    uint8_t padding[56];
+} RingHeader;
+
+/**
+ * @struct RingSlot
+ * @brief One slot; a record's first slot holds its length, span and time
+ */
+typedef struct {
+    uint64_t seq;               /**< Reservation number + 1 once written, else 0 */
+    int64_t when;               /**< Execution time (first slot) */
+    uint32_t length;            /**< Record bytes (first slot) */
+    uint16_t span;              /**< Slots in the record (first slot; 0 = continuation) */
+    uint16_t reserved;
+    char data[RING_SLOT_DATA];
+} RingSlot;
+
+/**
+ * @struct HistoryRing
+ * @brief A mapped ring file
+ */
+typedef struct {
+    int fd;
+    RingHeader* header;
+    RingSlot* slots;
+    size_t size;
+} HistoryRing;
+
+/**
+ * @struct RingCursor
+ * @brief One reader's position
+ */
+typedef struct {
+    uint64_t next;              /**< Next slot to read */
+    uint64_t lost;              /**< Slots skipped (overwritten or abandoned) */
+    uint64_t stalled_at;        /**< Unwritten slot the last read stopped at */
+    int64_t stalled_since;      /**< When that was first seen (ms, monotonic) */
+} RingCursor;
+
+/**
+ * Called for each record, oldest first.
+ *
+ * @param text    Command bytes (not NUL-terminated)
+ * @param length  Bytes in text
+ * @param when    Execution time
+ * @param ctx     Caller context
+ */
+typedef void (*RingCallback)(const char* text, uint32_t length, int64_t when, void* ctx);
+
+/**
+ * Map a ring file, creating (or re-creating, if its geometry differs) it.
+ *
+ * @param path  Ring file
+ * @return Ring (free with ring_close()), or NULL
+ */
+HistoryRing* ring_open(const char* path);
+
+/**
+ * Unmap and close a ring.
+ *
+ * @param ring  Ring (can be NULL)
+ */
+void ring_close(HistoryRing* ring);
+
+/**
+ * Append one record without locking.
+ *
+ * @param ring    Ring
+ * @param text    Command bytes
+ * @param length  Bytes in text (at most RING_MAX_SPAN * RING_SLOT_DATA)
+ * @param when    Execution time
+ * @return false if the record is too long
+ */
+bool ring_append(HistoryRing* ring, const char* text, size_t length, int64_t when);
+
+/**
+ * Deliver finished records from the cursor up to the tail.
+ *
+ * Stops at a slot that is reserved but not yet written, unless it stays
+ * that way for RING_STALL_MS (its writer died) or the ring has moved a
+ * quarter lap past it. Records overwritten before they were read are
+ * skipped and counted in cursor->lost.
+ *
+ * @param ring      Ring
+ * @param cursor    Reader position (advanced)
+ * @param callback  Called per record
+ * @param ctx       Passed to callback
+ * @return Records delivered
+ */
+long ring_read(HistoryRing* ring, RingCursor* cursor, RingCallback callback, void* ctx);
+
+/**
+ * Slots reserved so far.
+ *
+ * @param ring  Ring
+ * @return Tail position
+ */
+uint64_t ring_tail(const HistoryRing* ring);
+
+/**
+ * Position up to which records are in the cache file.
+ *
+ * @param ring  Ring
+ * @return Folded mark
+ */
+uint64_t ring_folded(const HistoryRing* ring);
+
+/**
+ * Move the folded mark (hold the exclusive lock).
+ *
+ * @param ring  Ring
+ * @param seq   New mark
+ */
+void ring_set_folded(HistoryRing* ring, uint64_t seq);
+
+/**
+ * flock the ring: shared to read the cache file and the folded mark
+ * together, exclusive to fold.
+ *
+ * @param ring       Ring
+ * @param exclusive  Exclusive rather than shared
+ * @param wait       Block until granted
+ * @return false if not granted
+ */
+bool ring_lock(HistoryRing* ring, bool exclusive, bool wait);
+
+/**
+ * Release ring_lock().
+ *
+ * @param ring  Ring
+ */
+void ring_unlock(HistoryRing* ring);
+
+#endif // RING_H
@@ -0,0 +1,118 @@
+/**
+ * @file simd.h
+ * @brief Byte-scanning kernels with the instruction set chosen at run time
+ *
+ * One binary serves every machine: each kernel has a scalar, SSE2, AVX2 and
+ * AVX-512 version, and the first call fills a table of function pointers
+ * with the best set the CPU reports (cpuid, via __builtin_cpu_supports).
+ * ZSH_AUTOCOMPLETE_SIMD=scalar|sse2|avx2|avx512 caps that choice, to test a
+ * variant or rule one out; simd_select() does the same from code.
+ *
+ * Kernels:
+ * - simd_mismatch():   common prefix length of two byte ranges (prefix
+ *                      matching against known-length texts)
+ * - simd_scan_line():  end of a line and its last two field separators in
+ *                      one pass (cache file parsing)
+ * - simd_child_mask(): bitmap of the non-NULL entries of a child array (the
+ *                      subtree walks that rank completions)
+ *
+ * Kernels only read the bytes they are given; none needs padding.
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** "No separator" in SimdLine */
+#define SIMD_NONE SIZE_MAX
+
+/**
+ * @enum SimdLevel
+ * @brief Instruction set a kernel table was built for (ascending)
+ */
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512,                /**< AVX-512 F + BW */
+    SIMD_LEVELS
+} SimdLevel;
+
+/**
+ * @struct SimdLine
+ * @brief One line found by simd_scan_line()
+ */
+typedef struct {
+    size_t length;              /**< Bytes before the newline (all of them if there is none) */
+    size_t last;                /**< Offset of the line's last separator, or SIMD_NONE */
+    size_t previous;            /**< Offset of the separator before that, or SIMD_NONE */
+} SimdLine;
+
+/**
+ * Level in use (picks one on first call).
+ *
+ * @return Active level
+ */
+SimdLevel simd_level(void);
+
+/**
+ * Best level this CPU supports, ignoring the override.
+ *
+ * @return Level
+ */
+SimdLevel simd_supported(void);
+
+/**
+ * Switch every kernel to a level.
+ *
+ * @param level  Level to use
+ * @return false (and no change) if the CPU or build lacks it
+ */
+bool simd_select(SimdLevel level);
+
+/**
+ * Name of a level, as accepted by ZSH_AUTOCOMPLETE_SIMD.
+ *
+ * @param level  Level
+ * @return "scalar", "sse2", "avx2" or "avx512"
+ */
+const char* simd_level_name(SimdLevel level);
+
+/**
+ * Length of the common prefix of a and b, at most n.
+ *
+ * @param a  First range (n readable bytes)
+ * @param b  Second range (n readable bytes)
+ * @param n  Bytes to compare
+ * @return Index of the first differing byte, or n
+ */
+size_t simd_mismatch(const char* a, const char* b, size_t n);
+
+/**
+ * Find the end of the line starting at text and the last two separators
+ * before it.
+ *
+ * @param text  Buffer
+ * @param n     Bytes in buffer
+ * @param sep   Field separator
+ * @param line  Output
+ * @return Bytes consumed: the line plus its newline, if any
+ */
+size_t simd_scan_line(const char* text, size_t n, char sep, SimdLine* line);
+
+/**
+ * Set bit i of mask for every non-NULL slots[i].
+ *
+ * @param slots  Pointer array
+ * @param count  Entries (a multiple of 64)
+ * @param mask   Output, count / 64 words
+ */
+void simd_child_mask(const void* slots, size_t count, uint64_t* mask);
+
+#endif // SIMD_H
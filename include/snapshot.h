@@ -0,0 +1,362 @@
+/**
+ * @file snapshot.h
+ * @brief Frozen, position-independent command index that can be mmap'ed read-only
+ *
+ * A snapshot is an immutable image of a command corpus built for sharing: it
+ * contains no pointers, only offsets, so it can be mapped read-only by every
+ * process on a host and the kernel keeps one copy of its pages.
+ *
+ * Layout (all sections 8-byte aligned, offsets from the start of the file):
+ * - SnapshotHeader
+ * - leaves  : SnapshotLeaf[leaf_count]
+ * - nodes   : SnapshotNode[node_count], a path-compressed trie over the
+ *             commands in byte order
+ * - edges   : uint32_t child node ids, each node's children contiguous and
+ *             in byte order
+ * - labels  : uint8_t first byte of each edge's child, parallel to edges
+ * - order   : uint32_t leaf ids sorted by command (byte order)
+ * - hash    : uint16_t displacement per bucket, then SnapshotSlot[hash_slots]
+ * - strings : NUL-terminated command texts
+ *
+ * Because commands are sorted, every trie node covers a contiguous range of
+ * the order section and caches the best leaf in that range, so a
+ * best-completion query is one walk down the prefix with no subtree scan.
+ *
+ * The writer emits leaves in command order and nodes children first.
+ * snapshot_write_packed() instead puts the nodes, edges, leaves and strings
+ * that queries actually touched at the front of their sections; the header's
+ * warm_* counts bound that region so a server can prefetch or lock just it
+ * (snapshot_warm()).
+ *
+ * Exact lookups go through a minimal perfect hash (CHD: hash, bucket,
+ * displace) built by the writer: a command's hash picks a bucket, the
+ * bucket's displacement picks its slot, and the slot names the leaf and
+ * holds a 32-bit fingerprint, so a miss is usually rejected without touching
+ * the leaf or string sections. The displacements cost about 3 bits per
+ * command; version 2 files have no hash and fall back to a binary search of
+ * the order section.
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "trie.h"
+
+/** File magic ("ZSNP") */
+#define SNAPSHOT_MAGIC "ZSNP"
+
+/** Current format version (3: hash section; 2 is still readable) */
+#define SNAPSHOT_VERSION 3
+
+/** Commands per hash bucket, on average */
+#define SNAPSHOT_HASH_LOAD 5
+
+/** Hash slots per 100 commands (a little slack keeps the last buckets placeable) */
+#define SNAPSHOT_HASH_SLOTS 101
+
+/** Marker for "no leaf" in SnapshotNode::best */
+#define SNAPSHOT_NONE UINT32_MAX
+
+/**
+ * @struct SnapshotHeader
+ * @brief Fixed header at offset 0
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t leaf_count;
+    uint32_t node_count;
+    uint32_t edge_count;
+    uint32_t root;              /**< Id of the root node */
+    uint64_t leaves_offset;
+    uint64_t nodes_offset;
+    uint64_t edges_offset;
+    uint64_t labels_offset;
+    uint64_t order_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t file_size;
+    int64_t created;            /**< Unix time the snapshot was written */
+    uint32_t warm_leaves;       /**< Leading leaves that queries touched */
+    uint32_t warm_nodes;        /**< Leading nodes that queries touched */
+    uint32_t warm_edges;        /**< Leading edges (and labels) of the warm nodes */
+    uint32_t reserved;          /**< 0 */
+    uint64_t warm_strings;      /**< Leading string bytes, the warm leaves' texts */
+    uint64_t hash_offset;       /**< Displacements; the slots follow, 8-byte aligned */
+    uint32_t hash_buckets;      /**< 0 if the file has no hash section */
+    uint32_t hash_slots;        /**< Slot count (at least leaf_count) */
+    uint64_t hash_seed;         /**< Seed the writer settled on */
+} SnapshotHeader;
+
+/**
+ * @struct SnapshotLeaf
+ * @brief One command and its usage statistics
+ */
+typedef struct {
+    uint32_t text;              /**< Offset of the command in the string section */
+    uint32_t length;            /**< Command length in bytes */
+    uint32_t frequency;
+    uint32_t flags;             /**< Reserved, 0 */
+    int64_t last_used;
+} SnapshotLeaf;
+
+/**
+ * @struct SnapshotSlot
+ * @brief One hash slot: the leaf placed there and its command's fingerprint
+ */
+typedef struct {
+    uint32_t leaf;              /**< Leaf id, or SNAPSHOT_NONE for a spare slot */
+    uint32_t fingerprint;       /**< Check bits of the command's hash */
+} SnapshotSlot;
+
+/**
+ * @struct SnapshotNode
+ * @brief Path-compressed trie node
+ *
+ * The node's string is the first depth bytes of its best leaf; a node whose
+ * depth equals that leaf's length is the leaf's own terminal node.
+ */
+typedef struct {
+    uint32_t depth;             /**< Length of the prefix this node stands for */
+    uint32_t leaf_lo;           /**< First order position under the node */
+    uint32_t leaf_hi;           /**< One past the last order position under the node */
+    uint32_t best;              /**< Highest-frequency leaf under the node */
+    uint32_t first_edge;        /**< Index of the first child id in the edge section */
+    uint32_t edge_count;        /**< Number of children */
+} SnapshotNode;
+
+/**
+ * @struct Snapshot
+ * @brief A mapped snapshot (section pointers into the read-only mapping)
+ */
+typedef struct {
+    const uint8_t* map;
+    size_t size;
+    const SnapshotHeader* header;
+    const SnapshotLeaf* leaves;
+    const SnapshotNode* nodes;
+    const uint32_t* edges;
+    const uint8_t* labels;
+    const uint32_t* order;
+    const char* strings;
+    const uint16_t* displacements;  /**< Per hash bucket, NULL without a hash section */
+    const SnapshotSlot* slots;
+    uint32_t* heat;             /**< Visits per node, if tracked (snapshot_track_heat()) */
+} Snapshot;
+
+/**
+ * @struct SnapshotWriter
+ * @brief Builds a snapshot from commands added in sorted order
+ *
+ * Only the output is held in memory (leaves, strings, nodes, edges), so
+ * writers can be fed from streams much larger than a trie would allow. The
+ * whole image is built on the heap before it is written: peak memory is
+ * about the size of the output file (roughly 80 bytes per command plus its
+ * text), and finishing adds about 30 bytes per command for the hash.
+ */
+typedef struct SnapshotWriter SnapshotWriter;
+
+/**
+ * Map a snapshot read-only and validate its header.
+ *
+ * @param path  Snapshot file
+ * @return Snapshot (close with snapshot_close()), or NULL if missing or invalid
+ */
+Snapshot* snapshot_open(const char* path);
+
+/**
+ * Unmap and free a snapshot.
+ *
+ * @param snap  Snapshot (can be NULL)
+ */
+void snapshot_close(Snapshot* snap);
+
+/**
+ * Leaf at a position in command order (for walking commands sorted).
+ *
+ * @param snap      Snapshot
+ * @param position  0 .. leaf_count - 1
+ * @return Leaf id, or -1 if out of range
+ */
+long snapshot_sorted_leaf(const Snapshot* snap, long position);
+
+/**
+ * Find a command exactly: one displacement, one slot and (on a fingerprint
+ * match) the leaf's text, or a binary search if the file has no hash.
+ *
+ * @param snap     Snapshot
+ * @param command  Command text
+ * @return Leaf id, or -1 if absent
+ */
+long snapshot_lookup(const Snapshot* snap, const char* command);
+
+/**
+ * Find the node covering every command starting with prefix.
+ *
+ * @param snap    Snapshot
+ * @param prefix  Prefix ("" for the root)
+ * @return Node id, or -1 if no command has the prefix
+ */
+long snapshot_prefix_node(const Snapshot* snap, const char* prefix);
+
+/**
+ * Highest-frequency command starting with prefix (the node's cached best).
+ *
+ * @param snap    Snapshot
+ * @param prefix  Typed prefix
+ * @return Leaf id, or -1 if no command has the prefix
+ */
+long snapshot_best_completion(const Snapshot* snap, const char* prefix);
+
+/**
+ * Command text of a leaf.
+ *
+ * @param snap  Snapshot
+ * @param leaf  Leaf id
+ * @return Pointer into the mapping, or NULL if leaf is out of range
+ */
+const char* snapshot_leaf_text(const Snapshot* snap, long leaf);
+
+/**
+ * Score of a leaf on the same scale as the trie (see trie_score()).
+ *
+ * @param snap  Snapshot
+ * @param leaf  Leaf id
+ * @param now   Current Unix time
+ * @return Score, or -1 if leaf is out of range
+ */
+int snapshot_leaf_score(const Snapshot* snap, long leaf, long now);
+
+/**
+ * Create an empty writer.
+ *
+ * @return Writer (free with snapshot_writer_destroy()), or NULL
+ */
+SnapshotWriter* snapshot_writer_create(void);
+
+/**
+ * Add the next command. Commands must arrive in strictly increasing byte
+ * order (strcmp) so the trie can be built in one pass.
+ *
+ * @param writer     Writer
+ * @param command    Non-empty command text
+ * @param frequency  Use count
+ * @param last_used  Unix time of last use
+ * @return false if out of order, empty, or out of memory
+ */
+bool snapshot_writer_add(SnapshotWriter* writer, const char* command,
+                         uint32_t frequency, int64_t last_used);
+
+/**
+ * Finish the trie and write the snapshot atomically (temp file + rename).
+ *
+ * @param writer  Writer (can be reused only after destroy)
+ * @param path    Output file
+ * @return true on success
+ */
+bool snapshot_writer_finish(SnapshotWriter* writer, const char* path);
+
+/**
+ * Finish the trie and write the snapshot into an open file at its current
+ * offset (e.g. an empty memfd handed to another process). Nothing is synced.
+ * snapshot_open() reads it back through /proc/self/fd/<fd>.
+ *
+ * @param writer  Writer (can be reused only after destroy)
+ * @param fd      Writable file descriptor (not closed)
+ * @return true on success
+ */
+bool snapshot_writer_finish_fd(SnapshotWriter* writer, int fd);
+
+/**
+ * Free a writer.
+ *
+ * @param writer  Writer (can be NULL)
+ */
+void snapshot_writer_destroy(SnapshotWriter* writer);
+
+/**
+ * @enum SnapshotFreqPolicy
+ * @brief How snapshot_merge() combines frequencies of the same command
+ */
+typedef enum {
+    SNAPSHOT_FREQ_SUM,          /**< Add counts (disjoint histories) */
+    SNAPSHOT_FREQ_MAX           /**< Keep the largest (overlapping copies of one history) */
+} SnapshotFreqPolicy;
+
+/**
+ * @enum SnapshotTimePolicy
+ * @brief How snapshot_merge() combines last-used times of the same command
+ */
+typedef enum {
+    SNAPSHOT_TIME_MAX,          /**< Most recent use anywhere */
+    SNAPSHOT_TIME_MIN           /**< Oldest (e.g. to keep a seed corpus from looking fresh) */
+} SnapshotTimePolicy;
+
+/**
+ * Merge sorted snapshots into a new one in a single pass.
+ *
+ * The inputs' leaf arrays are streamed through a k-way min-heap, so memory
+ * is O(k) for the merge itself plus the output being built; inputs are only
+ * read through their mappings. The output is not streamed: it is built by a
+ * SnapshotWriter, so the merged snapshot must fit in memory (about its file
+ * size on the heap, e.g. about 75 MB for 600k commands).
+ *
+ * @param inputs       Snapshots to merge
+ * @param count        Number of inputs
+ * @param freq_policy  Frequency combination
+ * @param time_policy  Last-used combination
+ * @param path         Output file (may be one of the inputs' paths)
+ * @param merged       Output: number of commands written (can be NULL)
+ * @return true on success
+ */
+bool snapshot_merge(Snapshot* const* inputs, int count, SnapshotFreqPolicy freq_policy,
+                    SnapshotTimePolicy time_policy, const char* path, long* merged);
+
+/**
+ * Freeze every command of a trie into a snapshot file.
+ *
+ * @param trie  Source trie
+ * @param path  Output file
+ * @return true on success
+ */
+bool snapshot_write_trie(const Trie* trie, const char* path);
+
+/**
+ * Start counting how often queries visit each node of this mapping. The
+ * counts live in private memory and feed snapshot_write_packed().
+ *
+ * @param snap  Snapshot
+ * @return false if out of memory
+ */
+bool snapshot_track_heat(Snapshot* snap);
+
+/**
+ * Rewrite a snapshot with its hot data first: nodes by visit count, their
+ * edge blocks in the same order, then the leaves those nodes resolve to and
+ * their texts. Untracked or unvisited data keeps its relative order after
+ * the warm region.
+ *
+ * @param snap  Snapshot (heat tracked, or warm counts all 0)
+ * @param path  Output file (may be the snapshot's own path)
+ * @return true on success
+ */
+bool snapshot_write_packed(const Snapshot* snap, const char* path);
+
+/**
+ * Bring the warm region (header, the warm_* prefix of each section and the
+ * hash displacements) into memory: MADV_WILLNEED read-ahead, or mlock() to
+ * keep it resident.
+ *
+ * @param snap  Snapshot
+ * @param lock  mlock() instead of advising
+ * @return Bytes advised or locked (0 if there is no warm region or mlock failed)
+ */
+size_t snapshot_warm(const Snapshot* snap, bool lock);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,87 @@
+/**
+ * @file template.h
+ * @brief Volatile-token classifiers and command templates
+ *
+ * Commands such as `kill 48213`, `git show 3f9a1c2` or `ssh ip-10-2-3-4`
+ * differ only in a token that is almost never typed twice. The classifiers
+ * below recognise those tokens with one pass over their bytes (no regexes),
+ * and template_key() rewrites a command into a key where each volatile
+ * token is a single marker byte, its TokenClass. All PIDs killed so far
+ * then share the key `kill \x01`.
+ *
+ * Tokens are blank-separated words; a word may keep a literal head ending
+ * in '=', '@' or ':' (`--since=2024-05-01`, `root@10.0.0.7`), in which
+ * case only the part after it is replaced.
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Digits a bare number needs to count as volatile (PIDs, ports, epochs) */
+#define TEMPLATE_MIN_DIGITS 4
+
+/** Characters that end a literal head inside a word */
+#define TEMPLATE_SPLITS "=@:"
+
+/**
+ * @enum TokenClass
+ * @brief Kind of token; in a key, a volatile class is spelled as its value
+ */
+typedef enum {
+    TOKEN_LITERAL,              /**< Kept as typed */
+    TOKEN_NUMBER,               /**< TEMPLATE_MIN_DIGITS+ decimal digits */
+    TOKEN_HASH,                 /**< 7-64 lowercase hex digits, letters and digits mixed */
+    TOKEN_UUID,                 /**< 8-4-4-4-12 hex digits */
+    TOKEN_TIME,                 /**< ISO date or date-time, or HH:MM:SS */
+    TOKEN_ADDRESS,              /**< IPv4 (optional :port or /prefix) or ip-a-b-c-d host */
+    TOKEN_TEMP_PATH,            /**< Path under /tmp, /var/tmp, /var/folders or /dev/shm */
+    TOKEN_CLASSES
+} TokenClass;
+
+/**
+ * Classify one token.
+ *
+ * @param token   Token bytes
+ * @param length  Bytes in token
+ * @return Its class (TOKEN_LITERAL if it is not volatile)
+ */
+TokenClass template_classify(const char* token, size_t length);
+
+/**
+ * Classify a word, allowing a literal head (see TEMPLATE_SPLITS).
+ *
+ * @param word    Word bytes
+ * @param length  Bytes in word
+ * @param head    Output: bytes of literal head before the volatile part
+ * @return Class of the volatile part, or TOKEN_LITERAL
+ */
+TokenClass template_classify_word(const char* word, size_t length, size_t* head);
+
+/**
+ * Template key of a command.
+ *
+ * @param command  Command line
+ * @param key      Output: NUL-terminated key
+ * @param size     Capacity of key
+ * @param source   Optional output (size entries): source[i] is the offset in
+ *                 command of key byte i; source[key length] = strlen(command)
+ * @return Key length, or 0 if the command has no volatile token (or its key
+ *         does not fit)
+ */
+size_t template_key(const char* command, char* key, size_t size, int* source);
+
+/**
+ * Name of a class, for reports.
+ *
+ * @param token_class  Class
+ * @return "literal", "number", "hash", "uuid", "time", "address" or "temp-path"
+ */
+const char* template_class_name(TokenClass token_class);
+
+#endif // TEMPLATE_H
@@ -20,6 +20,8 @@
 #define TRIE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /** Maximum number of children per node (ASCII character set) */
 #define ALPHABET_SIZE 128
@@ -27,6 +29,72 @@
 /** Maximum supported command length in characters */
 #define MAX_COMMAND_LENGTH 1024
 
+/** Leaf id of nodes that do not terminate a command */
+#define TRIE_NO_LEAF (-1)
+
+/** Maximum pipeline/chain segments indexed per command */
+#define MAX_SEGMENTS 32
+
+/** Concrete commands sampled per templated leaf (see trie_enable_templates()) */
+#define TRIE_SAMPLES 8
+
+/**
+ * @struct TrieRef
+ * @brief Reference from a secondary-index node into primary leaf storage
+ * 
+ * The referenced text is leaves[leaf_id]->full_command + offset, so secondary
+ * indexes never copy command strings. A templated leaf is indexed by its
+ * template key, and offset counts key bytes: each sample maps it back to its
+ * own text through template_key().
+ */
+typedef struct {
+    /** Id of the primary leaf holding the command string */
+    int leaf_id;
+    
+    /** Byte offset of the indexed text within that command */
+    int offset;
+} TrieRef;
+
+/**
+ * @struct TrieSample
+ * @brief One concrete command behind a templated leaf, with its own statistics
+ */
+typedef struct {
+    /** Command as typed (owned) */
+    char* command;
+    
+    /** Uses of this command */
+    int frequency;
+    
+    /** Unix timestamp of its last use */
+    long last_used;
+} TrieSample;
+
+/**
+ * @struct TrieReservoir
+ * @brief Bounded sample of the concrete commands sharing one template
+ * 
+ * A command not sampled yet always gets a sample, taking the place of the
+ * least used one (the oldest on ties): values used repeatedly stay, and the
+ * latest value is always at hand, while one-off values churn through a
+ * single slot. The leaf's frequency is the sum of the samples' plus evicted,
+ * so the template keeps ranking on every use even though few values are
+ * stored.
+ */
+typedef struct TrieReservoir {
+    /** Sampled commands; the first count entries are in use */
+    TrieSample samples[TRIE_SAMPLES];
+    
+    /** Entries in use */
+    int count;
+    
+    /** Samples handed out so far (distinct values, give or take re-admissions) */
+    long seen;
+    
+    /** Uses of commands that are not (or no longer) sampled */
+    int evicted;
+} TrieReservoir;
+
 /**
  * @struct TrieNode
  * @brief Single node in the trie structure
@@ -42,6 +110,9 @@ typedef struct TrieNode {
     /** True if this node represents the end of a complete command */
     bool is_end_of_word;
     
+    /** Leaves only: the command word failed the trie's command check (see trie_set_command_check) */
+    bool missing;
+    
     /** Complete command string (only set for end-of-word nodes) */
     char* full_command;
     
@@ -50,8 +121,61 @@ typedef struct TrieNode {
     
     /** Unix timestamp of last command execution */
     long last_used;
+    
+    /** Index of this node in Trie::leaves (TRIE_NO_LEAF unless end-of-word) */
+    int leaf_id;
+    
+    /** Secondary indexes only: primary leaves (and offsets) that reach this key */
+    TrieRef* refs;
+    
+    /** Number of entries in refs */
+    int ref_count;
+    
+    /**
+     * Wrapped commands only (sudo X, time X, env A=1 X, nice X): the primary
+     * node of the unwrapped command X. Both spellings rank on the group
+     * statistics held there (X's own leaf plus its refs).
+     */
+    struct TrieNode* entry;
+    
+    /** Number of commands (leaves or refs) stored at or below this node */
+    int subtree_leaves;
+    
+    /**
+     * Templated leaves only (NULL otherwise): the concrete commands seen for
+     * the template. full_command stays the first of them, so secondary
+     * indexes built from its key never move.
+     */
+    struct TrieReservoir* reservoir;
 } TrieNode;
 
+/**
+ * @struct TrieTimeEntry
+ * @brief One entry of the time index: a leaf and the last_used it was filed under
+ * 
+ * Only the entry at the leaf's live position (Trie::time_live) counts; older
+ * ones are stale (the command has been used again and re-filed at the end)
+ * and are skipped.
+ */
+typedef struct {
+    /** last_used of the leaf when this entry was appended */
+    long timestamp;
+    
+    /** Primary leaf id */
+    int leaf_id;
+} TrieTimeEntry;
+
+/**
+ * Decides whether a command word (the first word after any wrappers) names
+ * something that can run on this host.
+ * 
+ * @param word     Command word (not NUL-terminated)
+ * @param length   Bytes in word
+ * @param context  Pointer given to trie_set_command_check()
+ * @return false if the command is missing
+ */
+typedef bool (*TrieCommandCheck)(const char* word, size_t length, void* context);
+
 /**
  * @struct Trie
  * @brief Container structure for the trie with metadata
@@ -64,8 +188,131 @@ typedef struct {
     
     /** Total number of unique commands stored in the trie */
     int total_commands;
+    
+    /** End-of-word nodes indexed by leaf id, in insertion order */
+    TrieNode** leaves;
+    
+    /** Allocated slots in leaves */
+    int leaf_capacity;
+    
+    /**
+     * Root of the case-folded secondary index (NULL unless enabled).
+     * Keys are lowercased commands; end nodes list the original-cased
+     * leaves in refs so every case variant maps back to its own entry.
+     */
+    TrieNode* folded_root;
+    
+    /**
+     * Root of the pipeline/chain segment index (NULL unless enabled).
+     * Keys are the tails of commands starting after |, ||, &&, ; or $( and
+     * refs point at the segment start inside the primary leaf's string.
+     */
+    TrieNode* segment_root;
+    
+    /** Register wrapped commands under their unwrapped key (see trie_enable_wrapper_aliases) */
+    bool wrapper_aliases;
+    
+    /**
+     * Root of the reversed-key index (NULL unless enabled). Keys are commands
+     * spelled backwards, so a suffix is a prefix walk; end nodes reference the
+     * primary leaf ids used to intersect with a forward prefix.
+     */
+    TrieNode* reverse_root;
+    
+    /**
+     * Time index: a run of entries sorted by timestamp (NULL unless enabled).
+     * Uses append a fresh entry at the end, which keeps the run sorted while
+     * the clock moves forward; it is re-sorted and compacted when needed.
+     */
+    TrieTimeEntry* time_index;
+    
+    /** Entries in time_index, live and stale */
+    int time_count;
+    
+    /** Allocated entries in time_index */
+    int time_capacity;
+    
+    /** Per leaf id: position of its one live entry in time_index */
+    int* time_live;
+    
+    /** Allocated entries in time_live */
+    int time_live_capacity;
+    
+    /** False after an out-of-order append; the next query re-sorts */
+    bool time_sorted;
+    
+    /** Store commands with volatile tokens under their template key (see trie_enable_templates) */
+    bool templates;
+    
+    /** Flags leaves whose command is missing (NULL: every command is available) */
+    TrieCommandCheck command_check;
+    
+    /** Context passed to command_check */
+    void* command_context;
+    
+    /** Score of a node that only completes missing commands: 0 demotes, -1 hides */
+    int missing_score;
+    
+    /** Leaves flagged missing by the last check */
+    int missing_commands;
 } Trie;
 
+/**
+ * @struct TrieCursor
+ * @brief Nodes along the last prefix looked up
+ * 
+ * Consecutive ghost queries differ by one typed or deleted character. A
+ * cursor keeps the path of the previous prefix, so the next lookup keeps the
+ * part both prefixes share and only walks the rest: typing a character is
+ * one child step, backspace is a pop, and only an edit further back (a paste,
+ * a recalled history entry) walks again from where the prefixes differ.
+ * Nodes are freed only with the whole trie, so the path stays valid while
+ * commands are added.
+ */
+typedef struct {
+    /** path[i]: node spelled by the first i bytes of text (path[0] = root) */
+    TrieNode* path[MAX_COMMAND_LENGTH + 1];
+    
+    /** Bytes the path spells */
+    char text[MAX_COMMAND_LENGTH];
+    
+    /** Nodes of path in use after the root */
+    int depth;
+    
+    /** Child steps taken over all lookups (a full walk per lookup takes strlen(prefix)) */
+    long steps;
+} TrieCursor;
+
+/** Maximum glob tokens (literals, ?, *, [...]) in a match pattern */
+#define MAX_GLOB_TOKENS 63
+
+/**
+ * @struct TrieMatch
+ * @brief One result of trie_match_glob()
+ */
+typedef struct {
+    /** Matching command (owned by the caller, free with free()) */
+    char* command;
+    
+    /** Ranking score (frequency × 100 + recency bonus, group-merged) */
+    int score;
+} TrieMatch;
+
+/**
+ * @struct TrieIndexStats
+ * @brief Size of one index (primary, folded or segment trie)
+ */
+typedef struct {
+    /** Number of nodes, including the root */
+    long nodes;
+    
+    /** Number of secondary-index references */
+    long refs;
+    
+    /** Bytes held by nodes, reference arrays and command strings */
+    size_t bytes;
+} TrieIndexStats;
+
 /* ============================================================================
  * Public API - Trie Management
  * ============================================================================ */
@@ -144,6 +391,353 @@ char** trie_get_completions(Trie* trie, const char* prefix, int* count);
  */
 char* trie_get_best_completion(Trie* trie, const char* prefix);
 
+/**
+ * Same as trie_get_best_completion(), without copying a stored command.
+ * 
+ * @param trie    Trie to search (must not be NULL)
+ * @param prefix  Prefix to complete
+ * @param owned   Output: the result when it had to be built (a completion
+ *                spliced from a template; caller must free), else NULL
+ * @return Command text, or NULL if none found
+ * 
+ * @note Text owned by the trie is valid until the next insert or frequency
+ *       update
+ */
+const char* trie_peek_best_completion(Trie* trie, const char* prefix, char** owned);
+
+/**
+ * Node spelled by a prefix, resumed from the cursor's last path.
+ * 
+ * @param trie    Trie to search
+ * @param cursor  Cursor (zeroed before its first use; may have served another trie)
+ * @param prefix  Prefix to find
+ * @return Node, or NULL if no command starts with prefix
+ * 
+ * @note Time: O(d) for the d bytes past the longest prefix shared with the
+ *       previous lookup, plus one compare of that shared part
+ */
+TrieNode* trie_cursor_seek(Trie* trie, TrieCursor* cursor, const char* prefix);
+
+/**
+ * Same as trie_peek_best_completion(), with the prefix found through a cursor.
+ * 
+ * @param trie    Trie to search
+ * @param cursor  Cursor of the client typing prefix
+ * @param prefix  Prefix to complete
+ * @param owned   Output: the result when it had to be built (caller must
+ *                free), else NULL
+ * @return Command text, or NULL if none found
+ */
+const char* trie_cursor_best_completion(Trie* trie, TrieCursor* cursor, const char* prefix,
+                                        char** owned);
+
+/**
+ * Enable the case-folded secondary index.
+ * 
+ * Indexes every command already in the trie under its lowercased key and
+ * keeps the index current on subsequent trie_insert() calls. Calling it
+ * again is a no-op.
+ * 
+ * @param trie  Trie to extend (must not be NULL)
+ * @return true on success, false if allocation fails
+ * 
+ * @note Time: O(total characters) once, then O(k) extra per new command
+ */
+bool trie_enable_case_folding(Trie* trie);
+
+/**
+ * Get the best completion for a prefix, ignoring ASCII case.
+ * 
+ * Walks the folded index, so `GIT s` reaches `git status`. Case variants of
+ * one command share a folded leaf and are ranked together: frequencies are
+ * summed and the most recent use counts for the recency bonus. The variant
+ * returned is the highest-scoring one that matches the prefix exactly, or
+ * the highest-scoring variant overall if none does.
+ * 
+ * @param trie    Trie with case folding enabled (must not be NULL)
+ * @param prefix  Prefix to complete
+ * @return Original-cased command (caller must free), or NULL if none found
+ * 
+ * @note Time: O(k + n) where n = nodes in the folded prefix subtree
+ */
+char* trie_get_best_completion_nocase(Trie* trie, const char* prefix);
+
+/**
+ * Enable the pipeline/chain segment index.
+ * 
+ * Every segment that starts after a separator (see trie_segment_starts()) is
+ * indexed by its tail, so `cat log.txt | gr` can complete from any earlier
+ * command containing `| grep ...`. Existing commands are indexed immediately;
+ * later ones on trie_insert(). Calling it again is a no-op.
+ * 
+ * @param trie  Trie to extend (must not be NULL)
+ * @return true on success, false if allocation fails
+ */
+bool trie_enable_segments(Trie* trie);
+
+/**
+ * Get the best completion for a pipeline/chain segment.
+ * 
+ * Commands sharing a segment tail are ranked together (summed frequency,
+ * latest timestamp). An empty prefix suggests the most used segment overall,
+ * which is what the next pipeline stage after `cmd | ` wants.
+ * 
+ * @param trie    Trie with segments enabled (must not be NULL)
+ * @param prefix  Text typed since the start of the current segment
+ * @return Completed segment tail (caller must free), or NULL if none found
+ * 
+ * @note Time: O(k + n) where n = nodes in the segment prefix subtree
+ */
+char* trie_get_best_segment_completion(Trie* trie, const char* prefix);
+
+/**
+ * Find where pipeline and chain segments start in a command line.
+ * 
+ * A segment starts at the first non-blank character after |, ||, |&, &&, ;
+ * or $(. Separators inside single quotes, double quotes (except $() or after
+ * a backslash are ignored. Offset 0 is never reported; a line ending in a
+ * separator reports strlen(command), the start of the still-empty segment.
+ * 
+ * @param command     Command line to split (must not be NULL)
+ * @param starts      Output: byte offsets of segment starts, ascending
+ * @param max_starts  Capacity of starts
+ * @return Number of offsets written
+ */
+int trie_segment_starts(const char* command, int* starts, int max_starts);
+
+/**
+ * Enable shared entry points for wrapped commands.
+ * 
+ * A command run through sudo, doas, time, nice, nohup, env or with leading
+ * VAR=value assignments is also reachable under its unwrapped key: the
+ * primary path for `systemctl restart nginx` gets a reference to the leaf of
+ * `sudo systemctl restart nginx` (no string copy), and the wrapped leaf points
+ * back at that node through TrieNode::entry. Both spellings then complete
+ * with combined ranking. Calling it again is a no-op.
+ * 
+ * @param trie  Trie to extend (must not be NULL)
+ * @return true on success
+ */
+bool trie_enable_wrapper_aliases(Trie* trie);
+
+/**
+ * Enable volatile-token templates.
+ * 
+ * A command with tokens that are rarely typed twice (PIDs and other long
+ * numbers, commit hashes, UUIDs, timestamps, IP addresses, temp paths; see
+ * template.h) is stored once per template: `kill 48213` and `kill 9120`
+ * share the path `kill <number>`, whose leaf ranks on their combined use
+ * and keeps a sample of TRIE_SAMPLES concrete commands. Completion
+ * expands the template back to the best sample that matches what was typed,
+ * or splices the typed tokens into the best sample's tail. The case-folded,
+ * segment, wrapper and suffix indexes key templated commands the same way
+ * and answer with the best sample that matches there. Call it before
+ * inserting; commands already in the trie keep their literal paths.
+ * 
+ * @param trie  Trie to configure (must not be NULL)
+ * @return true
+ */
+bool trie_enable_templates(Trie* trie);
+
+/**
+ * Flag leaves whose command cannot run here.
+ * 
+ * Every leaf's command word (after wrappers such as sudo or env) is passed
+ * to check once now, in one pass over the leaves, and once when a new leaf
+ * is inserted; queries only read the resulting flag. A flagged leaf adds
+ * nothing to the statistics a node ranks on, and a node that completes only
+ * flagged leaves scores 0 (demoted below every available command) or, with
+ * hide, is never offered. Call trie_check_commands() when the answer of
+ * check may have changed.
+ * 
+ * @param trie     Trie (must not be NULL)
+ * @param check    Availability test, or NULL to clear every flag
+ * @param context  Passed to check
+ * @param hide     Never offer missing commands instead of demoting them
+ * @return Leaves flagged missing
+ */
+int trie_set_command_check(Trie* trie, TrieCommandCheck check, void* context, bool hide);
+
+/**
+ * Re-run the command check over every leaf (bulk flag update).
+ * 
+ * @param trie  Trie (must not be NULL)
+ * @return Leaves flagged missing
+ */
+int trie_check_commands(Trie* trie);
+
+/**
+ * Whether a command is stored under a template key.
+ * 
+ * @param trie     Trie (must not be NULL)
+ * @param command  Full command text
+ * @return true if templates are enabled and the command has a volatile token
+ */
+bool trie_command_templated(Trie* trie, const char* command);
+
+/**
+ * Find the top-ranked commands matching a glob pattern.
+ * 
+ * The pattern (`*` any run, `?` any character, `[a-z]`/`[!x]` classes,
+ * backslash escapes) must match the whole command. It is compiled into a
+ * position automaton whose state set is a bitmask; the set is advanced in
+ * lockstep with a DFS over the primary trie and any subtree where it becomes
+ * empty is skipped, so `kubectl * logs -f` only ever visits `kubectl ...`.
+ * 
+ * @param trie         Trie to search (must not be NULL)
+ * @param pattern      Glob pattern
+ * @param results      Output: matches sorted by descending score
+ * @param max_results  Capacity of results (top-K)
+ * @param max_visits   Work limit in trie nodes visited (<= 0 for unlimited)
+ * @param truncated    Output (optional): true if the work limit (or memory) stopped
+ *                     the search before every match was seen
+ * @return Number of results, or -1 if the pattern is invalid or too long (or
+ *         out of memory)
+ * 
+ * @note Time: O(visited nodes × ALPHABET_SIZE), bounded by max_visits
+ */
+int trie_match_glob(Trie* trie, const char* pattern, TrieMatch* results,
+                    int max_results, long max_visits, bool* truncated);
+
+/**
+ * Enable the time index over last_used.
+ * 
+ * Builds a sorted run from the current leaves (call it after timestamps have
+ * been loaded) and keeps it current on trie_insert()/trie_update_frequency().
+ * Calling it again is a no-op.
+ * 
+ * @param trie  Trie to extend (must not be NULL)
+ * @return true on success, false if allocation fails
+ * 
+ * @note Time: O(n log n) once, then amortised O(1) per use
+ */
+bool trie_enable_time_index(Trie* trie);
+
+/**
+ * List commands last used within a time range, oldest first.
+ * 
+ * Binary-searches the time index for since and walks forward until until,
+ * skipping stale entries and commands that do not start with prefix.
+ * 
+ * @param trie      Trie with the time index enabled (must not be NULL)
+ * @param since     Inclusive lower bound (Unix time)
+ * @param until     Inclusive upper bound (Unix time)
+ * @param prefix    Optional command prefix filter (NULL or "" for all)
+ * @param leaf_ids  Output: matching leaf ids in ascending last_used order
+ * @param max_ids   Capacity of leaf_ids; only the newest max_ids are kept
+ * @return Number of ids written
+ * 
+ * @note Time: O(log n + entries in range)
+ */
+int trie_range_by_time(Trie* trie, long since, long until, const char* prefix,
+                       int* leaf_ids, int max_ids);
+
+/**
+ * Enable the reversed-key index used for prefix+suffix queries.
+ * 
+ * Existing commands are indexed immediately; later ones on trie_insert().
+ * Calling it again is a no-op. Building it costs about as much as the trie
+ * itself, so only a long-lived process (serve mode) should enable it.
+ * 
+ * @param trie  Trie to extend (must not be NULL)
+ * @return true on success, false if allocation fails
+ */
+bool trie_enable_suffix_index(Trie* trie);
+
+/**
+ * Get the best command that starts with prefix and ends with suffix.
+ * 
+ * Used when the cursor is mid-line: the text on both sides must survive.
+ * The prefix is walked in the primary trie and the reversed suffix in the
+ * reverse index; whichever subtree holds fewer commands (per-node
+ * subtree_leaves) is enumerated and each candidate leaf id is checked
+ * against the other side, so neither side is scanned in full. Without the
+ * suffix index, the prefix subtree is enumerated and filtered by suffix.
+ * 
+ * @param trie    Trie to search (must not be NULL)
+ * @param prefix  Text left of the cursor
+ * @param suffix  Text right of the cursor (empty behaves like a plain prefix query)
+ * @return Full command (caller must free), or NULL if none found
+ * 
+ * @note Time: O(|prefix| + |suffix| + min(n_prefix, n_suffix) subtree nodes),
+ *       or O(|prefix| + n_prefix subtree nodes) without the suffix index
+ */
+char* trie_get_best_completion_with_suffix(Trie* trie, const char* prefix, const char* suffix);
+
+/**
+ * Get the best completion for a prefix that may start with a wrapper.
+ * 
+ * `sudo sys` competes commands typed with the wrapper against bare commands
+ * under `sys` on combined ranking; a bare winner is returned with the typed
+ * wrapper kept in front. Prefixes without a wrapper behave exactly like
+ * trie_get_best_completion().
+ * 
+ * @param trie    Trie with wrapper aliases enabled (must not be NULL)
+ * @param prefix  Prefix as typed
+ * @return Completion starting with prefix (caller must free), or NULL
+ */
+char* trie_get_best_wrapped_completion(Trie* trie, const char* prefix);
+
+/**
+ * Length of the wrapper prefix of a command.
+ * 
+ * Recognises sudo/doas (with options), time, nice (-n N, -N), nohup,
+ * env (-i, -u NAME, VAR=value) and bare VAR=value assignments, in any
+ * nesting, e.g. `sudo env FOO=1 nice -n 5 make`.
+ * 
+ * @param command  Command line (must not be NULL)
+ * @return Byte offset of the inner command, or 0 if there is no wrapper
+ */
+int trie_wrapper_length(const char* command);
+
+/**
+ * Measure one index of the trie.
+ * 
+ * @param root   Root of the primary, folded or segment trie (can be NULL)
+ * @param stats  Output: node, reference and byte counts
+ */
+void trie_index_stats(const TrieNode* root, TrieIndexStats* stats);
+
+/**
+ * Ranking score: frequency * 100, plus 50 if used within the last hour.
+ * 
+ * Shared with other indexes (e.g. snapshots) so their scores are comparable.
+ * 
+ * @param frequency  Use count
+ * @param last_used  Unix time of last use
+ * @param now        Current Unix time
+ * @return Score
+ */
+int trie_score(int frequency, long last_used, long now);
+
+/**
+ * Score of one exact command.
+ * 
+ * A templated command scores as its template, the path it ranks on, as long
+ * as it is still sampled. A command flagged missing (see
+ * trie_set_command_check()) scores 0.
+ * 
+ * @param trie     Trie to search
+ * @param command  Full command text
+ * @return Score (see trie_score()), or -1 if the command is not in the trie
+ */
+int trie_command_score(Trie* trie, const char* command);
+
+/**
+ * Stored statistics of one exact command (the inverse of trie_set_usage()).
+ * 
+ * A templated command reports its sample's own statistics. Uses of values
+ * the template has dropped only count toward its in-memory total, so a
+ * reloaded template ranks on its samples.
+ * 
+ * @param trie       Trie to search
+ * @param command    Full command text
+ * @param frequency  Output: use count
+ * @param last_used  Output: Unix time of last use
+ * @return false if the command is not in the trie or no longer sampled
+ */
+bool trie_command_usage(Trie* trie, const char* command, int* frequency, long* last_used);
+
 /**
  * Update frequency and timestamp for a command.
  * 
@@ -156,6 +750,21 @@ char* trie_get_best_completion(Trie* trie, const char* prefix);
  */
 void trie_update_frequency(Trie* trie, const char* command);
 
+/**
+ * Overwrite the stored frequency and last-used time of a command.
+ * 
+ * Used when restoring saved statistics; keeps the time index consistent
+ * (unlike assigning the node fields directly). A templated command updates
+ * its sample and the template is re-totalled from the samples.
+ * 
+ * @param trie       Trie containing the command
+ * @param command    Full command text
+ * @param frequency  Use count to store
+ * @param last_used  Unix time to store
+ * @return false if the command is not in the trie
+ */
+bool trie_set_usage(Trie* trie, const char* command, int frequency, long last_used);
+
 /**
  * Print debug information about the trie (DEBUG builds only).
  * 
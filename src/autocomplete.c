@@ -8,15 +8,25 @@
  * 
  * Architecture:
  * - Data Layer: Trie structure for O(k) prefix matching
- * - Storage Layer: Persistent cache in ~/.cache/zsh-autocomplete/
+ * - Storage Layer: Persistent cache in ~/.cache/zsh-autocomplete/, worked on
+ *   from a copy in $XDG_RUNTIME_DIR when that home copy is on a network mount
  * - Processing Layer: Command filtering and completion logic
  * - Interface Layer: Command-line argument parsing
  * 
  * Operations:
  * - init    : Load history from stdin and initialize cache
- * - ghost   : Get best completion for a prefix
- * - history : Navigate filtered command history
+ * - ghost   : Get best completion for a prefix (and suffix, mid-line)
+ * - history : Navigate filtered command history, or list a time range
  * - update  : Update command frequency on execution
+ * - match   : List top-ranked commands matching a glob pattern
+ * - top     : Most used commands, overall or over the last hour/day/week
+ * - events  : Dump the per-execution event log
+ * - freeze  : Write the command index as a read-only snapshot (e.g. a shared base)
+ * - merge   : Combine several snapshots into one (no cache needed)
+ * - pack    : Rewrite a snapshot with what typing touches in its first pages
+ * - serve   : Long-lived coprocess answering requests on stdin while it loads
+ *             (and completing path arguments from cached directory listings)
+ * - sync    : Write the runtime copy of the cache back to the home copy
  * 
  * Performance:
  * - Ghost text: <5ms typical response time
@@ -31,13 +41,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
 #include <stdbool.h>
 #include "../include/trie.h"
+#include "../include/eventlog.h"
+#include "../include/snapshot.h"
+#include "../include/protocol.h"
+#include "../include/persist.h"
+#include "../include/ring.h"
+#include "../include/simd.h"
+#include "../include/pathcache.h"
+#include "../include/execindex.h"
+#include "../include/heavy.h"
 #include <sys/types.h>
 #include <limits.h>
+#include <poll.h>
+#include <sys/syscall.h>
 
 // Global data structures
 static Trie* command_trie = NULL;
@@ -48,6 +73,78 @@ static char** filtered_history = NULL;
 static int filtered_count = 0;
 static int current_position = 0;
 static bool is_initialized = false;
+static long history_since = 0;  // Up/Down only cycles commands used since then (0 = all)
+static Snapshot* base_snapshot = NULL;  // Shared read-only corpus under the user's trie
+static bool base_snapshot_tried = false;
+static Persister* persister = NULL;     // Serve mode: cache writes leave the request loop
+static int journal_lines = 0;           // Cache lines appended since the last full save
+static HistoryRing* history_ring = NULL; // ZSH_AUTOCOMPLETE_RING: updates go through a shared ring
+static RingCursor ring_cursor;           // Ring records applied to the loaded index
+static bool ring_cursor_ready = false;
+static PathCache* path_cache = NULL;     // Serve mode: directory listings for path arguments
+static ExecIndex* exec_index = NULL;     // Serve mode: command names that can run on this host
+static TrieCursor ghost_cursor;          // Serve mode: trie path of the last prefix completed
+static Snapshot* handoff_index = NULL;   // Serve mode: index handed over by the server we replaced
+
+// Appended cache lines tolerated before a full rewrite (or history size, if larger)
+#define CACHE_JOURNAL_MIN 1024
+
+// System-wide base snapshot; ZSH_AUTOCOMPLETE_BASE overrides, empty disables
+#define DEFAULT_BASE_SNAPSHOT "/usr/share/zsh-autocomplete/base.idx"
+
+// Read an environment toggle (e.g. ZSH_AUTOCOMPLETE_IGNORE_CASE): unset/empty
+// means fallback, "0" means off, anything else means on
+static bool env_flag_enabled(const char* name, bool fallback) {
+    const char* value = getenv(name);
+    if (!value || !*value) return fallback;
+    return strcmp(value, "0") != 0;
+}
+
+// Enable the optional secondary indexes before any command is inserted
+static void configure_indexes(Trie* trie) {
+    if (env_flag_enabled("ZSH_AUTOCOMPLETE_IGNORE_CASE", false)) {
+        trie_enable_case_folding(trie);
+    }
+    if (env_flag_enabled("ZSH_AUTOCOMPLETE_SEGMENTS", true)) {
+        trie_enable_segments(trie);
+    }
+    if (env_flag_enabled("ZSH_AUTOCOMPLETE_WRAPPERS", true)) {
+        trie_enable_wrapper_aliases(trie);
+    }
+    if (env_flag_enabled("ZSH_AUTOCOMPLETE_TEMPLATES", true)) {
+        trie_enable_templates(trie);
+    }
+}
+
+// Map the base snapshot on first use (NULL if not installed)
+static Snapshot* base_index(void) {
+    if (!base_snapshot_tried) {
+        const char* path = getenv("ZSH_AUTOCOMPLETE_BASE");
+        base_snapshot = snapshot_open(path ? path : DEFAULT_BASE_SNAPSHOT);
+        base_snapshot_tried = true;
+    }
+    return base_snapshot;
+}
+
+// Server start: read ahead the base's warm region (a packed snapshot's first
+// pages), or keep it resident with ZSH_AUTOCOMPLETE_MLOCK=1
+static void warm_base_index(void) {
+    Snapshot* base = base_index();
+    if (!base) return;
+    bool lock = env_flag_enabled("ZSH_AUTOCOMPLETE_MLOCK", false);
+    size_t bytes = snapshot_warm(base, lock);
+    if (lock && bytes == 0 && base->header->warm_nodes > 0) {
+        fprintf(stderr, "[DEBUG] serve: mlock of the base failed, reading ahead instead\n");
+        lock = false;
+        bytes = snapshot_warm(base, false);
+    }
+    fprintf(stderr, "[DEBUG] serve: base warm region %zu bytes (%s)\n", bytes, lock ? "locked" : "read ahead");
+}
+
+// Default top-K and work limit (trie nodes visited) for 'match'
+#define MATCH_DEFAULT_RESULTS 10
+#define MATCH_MAX_RESULTS 100
+#define MATCH_WORK_LIMIT 200000
 
 // Persistent storage paths
 // #define DATA_DIR "data"
@@ -55,9 +152,42 @@ static bool is_initialized = false;
 
 // Cache paths
 static char CACHE_DIR[PATH_MAX];
-static char TRIE_DATA_FILE[PATH_MAX];
+static char TRIE_DATA_FILE[PATH_MAX];   // Working copy: HOME_DATA_FILE or its runtime copy
+static char HOME_DATA_FILE[PATH_MAX];   // The cache under CACHE_DIR
+static char RUNTIME_STAMP[PATH_MAX];    // Sync state of the runtime copy
+static bool storage_ready = false;
+static bool runtime_cache = false;      // Working on a node-local copy (see open_runtime_cache)
+static bool runtime_dirty = false;      // Updates not yet written back to HOME_DATA_FILE
+static bool writeback_inflight = false; // Serve mode: a write-back is queued on the persister
+static long writeback_failures = 0;     // Persister failures before it was queued
+static time_t last_writeback = 0;
+
+// Seconds between write-backs of the runtime copy (ZSH_AUTOCOMPLETE_WRITEBACK)
+#define DEFAULT_WRITEBACK_SECONDS 300
+
+static bool open_runtime_cache(void);
+static void refresh_runtime_cache(void);
+static void open_history_ring(void);
+static void start_ring_cursor(void);
+static void consume_history_ring(void);
+static uint64_t ring_backlog(void);
+
+// mkdir -p: ~/.cache itself may not exist yet
+static void make_directories(const char* dir) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", dir);
+    for (char* p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(path, 0700);
+        *p = '/';
+    }
+    mkdir(path, 0700);
+}
 
 static void init_storage_paths(void) {
+    if (storage_ready) return;
+    storage_ready = true;
     const char *xdg = getenv("XDG_CACHE_HOME");
     if (!xdg || *xdg=='\0') {
         const char *home = getenv("HOME");
@@ -65,25 +195,100 @@ static void init_storage_paths(void) {
     } else {
         snprintf(CACHE_DIR, sizeof(CACHE_DIR), "%s/zsh-autocomplete", xdg);
     }
-    snprintf(TRIE_DATA_FILE, sizeof(TRIE_DATA_FILE), "%s/trie_data.txt", CACHE_DIR);
+    snprintf(HOME_DATA_FILE, sizeof(HOME_DATA_FILE), "%s/trie_data.txt", CACHE_DIR);
+    strcpy(TRIE_DATA_FILE, HOME_DATA_FILE);
+    runtime_cache = open_runtime_cache();
+    if (env_flag_enabled("ZSH_AUTOCOMPLETE_RING", false)) {
+        open_history_ring();
+    }
+    if (runtime_cache && access(TRIE_DATA_FILE, F_OK) != 0) {
+        // First use since boot: start from the home copy
+        make_directories(CACHE_DIR);
+        refresh_runtime_cache();
+    }
 }
 
 static void ensure_data_directory(void) {
+    // The runtime copy's directory exists already; don't touch a remote home
+    if (runtime_cache) return;
     struct stat st = {0};
     if (stat(CACHE_DIR, &st)==-1) {
-        mkdir(CACHE_DIR, 0700);
+        make_directories(CACHE_DIR);
+    }
+}
+
+// Cut a cache line at separators already located by simd_scan_line(): the
+// last two '|' end the command and the frequency (the command itself may
+// contain '|'). freq is -1 for a bare command line. Returns the command, or
+// NULL for an empty line.
+static char* split_cache_fields(char* line, const SimdLine* fields, int* freq, long* ts) {
+    *freq = -1;
+    *ts = 0;
+    if (fields->previous != SIMD_NONE) {
+        line[fields->previous] = '\0';
+        line[fields->last] = '\0';
+        *freq = atoi(line + fields->previous + 1);
+        *ts = atol(line + fields->last + 1);
+    }
+    return *line ? line : NULL;
+}
+
+// Split a "cmd|freq|last_used" cache line in place (see split_cache_fields())
+static char* parse_cache_line(char* line, int* freq, long* ts) {
+    SimdLine fields;
+    simd_scan_line(line, strlen(line), '|', &fields);
+    return split_cache_fields(line, &fields, freq, ts);
+}
+
+// Strip a zsh EXTENDED_HISTORY prefix (": <start>:<elapsed>;<command>");
+// started is 0 when the line has none
+static char* parse_history_line(char* line, long* started) {
+    *started = 0;
+    if (line[0] == ':' && line[1] == ' ') {
+        char* end;
+        long ts = strtol(line + 2, &end, 10);
+        char* semi = (*end == ':') ? strchr(end, ';') : NULL;
+        if (semi) {
+            *started = ts;
+            return semi + 1;
+        }
     }
+    return line;
 }
 
-// Helper: find the trie node for a full command
-static TrieNode* trie_find_node(Trie *t, const char *cmd) {
-    TrieNode *cur = t->root;
-    for (size_t i=0; i<strlen(cmd); i++) {
-        unsigned char idx = (unsigned char)cmd[i];
-        if (idx>=ALPHABET_SIZE || !cur->children[idx]) return NULL;
-        cur = cur->children[idx];
+// Format one cache line for a command: "cmd|freq|last_used"; nothing for a
+// templated command its template no longer samples (its uses stay counted
+// on the template's line)
+static int format_cache_line(char* buf, size_t size, const char* cmd) {
+    int freq;
+    long ts;
+    if (!trie_command_usage(command_trie, cmd, &freq, &ts)) {
+        if (trie_command_templated(command_trie, cmd)) return 0;
+        freq = 1;
+        ts = time(NULL);
     }
-    return cur->is_end_of_word ? cur : NULL;
+    return snprintf(buf, size, "%s|%d|%ld\n", cmd, freq, ts);
+}
+
+// The whole cache as "cmd|freq|last_used" lines, in history order
+// (malloc'ed; NULL if out of memory)
+static char* format_cache_data(size_t* size) {
+    size_t cap = 4096, used = 0;
+    char *data = malloc(cap);
+    for (int i=0; data && i<history_count; i++) {
+        int n = format_cache_line(data + used, cap - used, history_array[i]);
+        if (n < 0) continue;
+        if (used + n >= cap) {
+            while (used + n >= cap) cap *= 2;
+            char *temp = realloc(data, cap);
+            if (!temp) break;
+            data = temp;
+            n = format_cache_line(data + used, cap - used, history_array[i]);
+        }
+        used += n;
+    }
+    *size = used;
+    return data;
 }
 
 // Save trie + metadata to disk as "cmd|freq|last_used" lines
@@ -91,25 +296,98 @@ void save_trie_to_file(void) {
     if (!command_trie) return;
     init_storage_paths();
     ensure_data_directory();
+    
+    // With the history ring a full save is a fold: it holds every record up
+    // to the new folded mark and is on disk before the mark moves
+    if (history_ring) {
+        ring_lock(history_ring, true, true);
+        consume_history_ring();
+        size_t used;
+        char *data = ring_cursor.next >= ring_folded(history_ring) ? format_cache_data(&used) : NULL;
+        if (data) {
+            if (persister) persist_drain(persister);
+            if (persist_replace_now(TRIE_DATA_FILE, data, used)) {
+                ring_set_folded(history_ring, ring_cursor.next);
+            }
+            journal_lines = 0;
+            free(data);
+        }
+        ring_unlock(history_ring);
+        return;
+    }
+    
+    size_t used;
+    char *data = format_cache_data(&used);
+    if (!data) return;
+    
+    if (persister) {
+        // Serve mode: write, fsync and rename without blocking requests
+        journal_lines = 0;
+        persist_replace(persister, TRIE_DATA_FILE, data, used);
+        return;
+    }
+    if (runtime_cache) {
+        // tmpfs: the rename is free and a killed shell never leaves half a file
+        persist_replace_now(TRIE_DATA_FILE, data, used);
+        free(data);
+        return;
+    }
     FILE *f = fopen(TRIE_DATA_FILE, "w");
-    if (!f) return;
+    if (f) {
+        fwrite(data, 1, used, f);
+        fclose(f);
+    }
+    free(data);
+}
 
-    for (int i=0; i<history_count; i++) {
-        const char *cmd = history_array[i];
-        TrieNode *node = trie_find_node(command_trie, cmd);
-        int freq = node ? node->frequency : 1;
-        long ts   = node ? node->last_used : time(NULL);
-        fprintf(f, "%s|%d|%ld\n", cmd, freq, ts);
+// Serve mode: append one updated command to the cache (later lines win on
+// load) instead of rewriting it; rewrite once the journal outgrows history
+static void journal_cache_update(const char* command) {
+    int limit = history_count > CACHE_JOURNAL_MIN ? history_count : CACHE_JOURNAL_MIN;
+    if (++journal_lines > limit) {
+        save_trie_to_file();
+        return;
     }
-    fclose(f);
+    char line[MAX_COMMAND_LENGTH + 64];
+    int n = format_cache_line(line, sizeof(line), command);
+    if (n == 0) return;
+    if (n < 0 || n >= (int)sizeof(line)) {
+        save_trie_to_file();
+        return;
+    }
+    char *data = malloc(n);
+    if (!data) {
+        // The rewrite picks the update up from the trie instead
+        save_trie_to_file();
+        return;
+    }
+    memcpy(data, line, n);
+    persist_append(persister, TRIE_DATA_FILE, data, n, true);
 }
 
-// Load saved trie entries with their freq & timestamp; rebuild history_array
-void load_trie_from_file(void) {
-    init_storage_paths();
-    FILE *f = fopen(TRIE_DATA_FILE, "r");
-    if (!f) return;
+// Rest of a stream in one NUL-terminated buffer (NULL if out of memory)
+static char* read_stream(FILE* f, size_t* size) {
+    size_t cap = 65536, used = 0;
+    char* data = malloc(cap + 1);
+    while (data) {
+        used += fread(data + used, 1, cap - used, f);
+        if (used < cap) break;
+        char* temp = realloc(data, cap * 2 + 1);
+        if (!temp) {
+            free(data);
+            data = NULL;
+            break;
+        }
+        data = temp;
+        cap *= 2;
+    }
+    if (data) data[used] = '\0';
+    *size = used;
+    return data;
+}
 
+// Read saved trie entries with their freq & timestamp; rebuild history_array
+static void read_cache_lines(FILE* f) {
     // clear existing
     if (history_array) {
         for (int i=0; i<history_count; i++) free(history_array[i]);
@@ -120,21 +398,26 @@ void load_trie_from_file(void) {
 
     size_t cap = 128;
     history_array = malloc(cap * sizeof(char*));
-    char line[4096];
-    while (fgets(line, sizeof(line), f)) {
-        char *nl = strchr(line,'\n'); if(nl)*nl='\0';
-        if (!*line) continue;
-        char *cmd      = strtok(line,"|");
-        char *freq_str = strtok(NULL,"|");
-        char *ts_str   = strtok(NULL,"|");
+    // One pass per line finds both its end and its separators
+    size_t size;
+    char* data = read_stream(f, &size);
+    for (size_t pos = 0; data && pos < size; ) {
+        char* line = data + pos;
+        SimdLine fields;
+        pos += simd_scan_line(line, size - pos, '|', &fields);
+        line[fields.length] = '\0';
+        int freq;
+        long ts;
+        char *cmd = split_cache_fields(line, &fields, &freq, &ts);
         if (!cmd) continue;
 
+        // Journaled updates repeat a command: later lines carry newer stats
+        bool seen = trie_command_score(command_trie, cmd) >= 0;
         trie_insert(command_trie, cmd);
-        TrieNode *node = trie_find_node(command_trie, cmd);
-        if (node && freq_str && ts_str) {
-            node->frequency = atoi(freq_str);
-            node->last_used = atol(ts_str);
+        if (freq >= 0) {
+            trie_set_usage(command_trie, cmd, freq, ts);
         }
+        if (seen) continue;
 
         if (history_count >= (int)cap) {
             cap *= 2;
@@ -142,9 +425,761 @@ void load_trie_from_file(void) {
         }
         history_array[history_count++] = strdup(cmd);
     }
+    free(data);
+}
+
+// Load the cache file, then the history ring records not folded into it yet
+void load_trie_from_file(void) {
+    init_storage_paths();
+    if (history_ring) {
+        // The cache and the folded mark are read as one (a fold moves both)
+        ring_lock(history_ring, false, true);
+        start_ring_cursor();
+    }
+    FILE *f = fopen(TRIE_DATA_FILE, "r");
+    if (f) {
+        read_cache_lines(f);
+        fclose(f);
+    }
+    if (history_ring) {
+        ring_unlock(history_ring);
+        consume_history_ring();
+    }
+}
+
+#pragma region RUNTIME_CACHE
+
+#ifdef __linux__
+// Filesystems where every cache read and write is a network round trip
+static bool on_network_filesystem(const char* path) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    struct statfs fs;
+    // The cache directory may not exist yet: ask its closest existing parent
+    while (statfs(dir, &fs) != 0) {
+        char* slash = strrchr(dir, '/');
+        if (!slash || slash == dir) return false;
+        *slash = '\0';
+    }
+    switch ((unsigned long)fs.f_type) {
+    case 0x6969UL:          // NFS
+    case 0x517BUL:          // SMB
+    case 0xFF534D42UL:      // CIFS
+    case 0xFE534D42UL:      // SMB2
+    case 0x5346414FUL:      // AFS
+    case 0x00C36400UL:      // Ceph
+    case 0x0BD00BD0UL:      // Lustre
+    case 0x47504653UL:      // GPFS
+        return true;
+    default:
+        return false;
+    }
+}
+#endif
+
+// FNV-1a: names the runtime copy after the home copy it mirrors, so
+// different cache homes (e.g. XDG_CACHE_HOME overrides) never share one
+static unsigned int path_hash(const char* path) {
+    unsigned int hash = 2166136261u;
+    for (; *path; path++) {
+        hash ^= (unsigned char)*path;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Sync state kept next to the runtime copy: both copies' mtimes when they
+// last agreed, and when the runtime copy was last written back
+typedef struct {
+    struct timespec home;
+    struct timespec runtime;
+    long written;
+} RuntimeStamp;
+
+// A missing or torn stamp reads as never synced (merge and write back again)
+static void read_runtime_stamp(RuntimeStamp* stamp) {
+    memset(stamp, 0, sizeof(*stamp));
+    FILE* f = fopen(RUNTIME_STAMP, "r");
+    if (!f) return;
+    long home_sec, home_nsec, runtime_sec, runtime_nsec, written;
+    if (fscanf(f, "%ld %ld %ld %ld %ld", &home_sec, &home_nsec,
+               &runtime_sec, &runtime_nsec, &written) == 5) {
+        stamp->home.tv_sec = home_sec;
+        stamp->home.tv_nsec = home_nsec;
+        stamp->runtime.tv_sec = runtime_sec;
+        stamp->runtime.tv_nsec = runtime_nsec;
+        stamp->written = written;
+    }
     fclose(f);
 }
 
+static void write_runtime_stamp(const RuntimeStamp* stamp) {
+    FILE* f = fopen(RUNTIME_STAMP, "w");
+    if (!f) return;
+    fprintf(f, "%ld %ld %ld %ld %ld\n", (long)stamp->home.tv_sec, (long)stamp->home.tv_nsec,
+            (long)stamp->runtime.tv_sec, (long)stamp->runtime.tv_nsec, stamp->written);
+    fclose(f);
+}
+
+// Modification time of a file (zero if it does not exist)
+static struct timespec file_mtime(const char* path) {
+    struct stat st;
+    struct timespec none = { 0, 0 };
+    return stat(path, &st) == 0 ? st.st_mtim : none;
+}
+
+static bool same_time(struct timespec a, struct timespec b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+// Seconds between write-backs (0: after every update)
+static long writeback_interval(void) {
+    const char* value = getenv("ZSH_AUTOCOMPLETE_WRITEBACK");
+    if (!value || !*value) return DEFAULT_WRITEBACK_SECONDS;
+    long seconds = atol(value);
+    return seconds >= 0 ? seconds : DEFAULT_WRITEBACK_SECONDS;
+}
+
+// One cache line while merging two cache files
+typedef struct {
+    char* cmd;
+    int freq;
+    long ts;
+    int seq;                    // Line number across both files (home first)
+} CacheEntry;
+
+static int compare_cache_entries(const void* a, const void* b) {
+    const CacheEntry* x = a;
+    const CacheEntry* y = b;
+    int order = strcmp(x->cmd, y->cmd);
+    return order ? order : (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static int compare_cache_seq(const void* a, const void* b) {
+    const CacheEntry* x = a;
+    const CacheEntry* y = b;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+// Append a cache file's lines to entries; false if it cannot be read
+static bool read_cache_entries(const char* path, CacheEntry** entries, int* count, int* cap) {
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        char *nl = strchr(line,'\n'); if(nl)*nl='\0';
+        int freq;
+        long ts;
+        char* cmd = parse_cache_line(line, &freq, &ts);
+        if (!cmd) continue;
+        if (*count == *cap) {
+            int grown = *cap ? *cap * 2 : 1024;
+            CacheEntry* temp = realloc(*entries, grown * sizeof(CacheEntry));
+            if (!temp) break;
+            *entries = temp;
+            *cap = grown;
+        }
+        CacheEntry entry = { strdup(cmd), freq, ts, *count };
+        if (!entry.cmd) break;
+        (*entries)[(*count)++] = entry;
+    }
+    fclose(f);
+    return true;
+}
+
+// Rewrite the runtime copy as the union of both copies. Per command the
+// larger frequency and the later use win (counts only grow, so merging the
+// same data twice changes nothing); commands only the home copy has come
+// first, then the runtime copy's in its own order.
+static bool merge_cache_files(void) {
+    CacheEntry* entries = NULL;
+    int count = 0, cap = 0;
+    bool have_home = read_cache_entries(HOME_DATA_FILE, &entries, &count, &cap);
+    int home_count = count;
+    bool have_runtime = read_cache_entries(TRIE_DATA_FILE, &entries, &count, &cap);
+    if (!have_home && !have_runtime) return false;
+
+    qsort(entries, count, sizeof(CacheEntry), compare_cache_entries);
+    int merged = 0;
+    size_t size = 0;
+    for (int i = 0; i < count; ) {
+        CacheEntry out = entries[i];
+        int j = i + 1;
+        for (; j < count && strcmp(entries[j].cmd, out.cmd) == 0; j++) {
+            if (entries[j].freq > out.freq) out.freq = entries[j].freq;
+            if (entries[j].ts > out.ts) out.ts = entries[j].ts;
+            if (out.seq < home_count && entries[j].seq >= home_count) out.seq = entries[j].seq;
+            free(entries[j].cmd);
+        }
+        entries[merged++] = out;
+        size += strlen(out.cmd) + 40;
+        i = j;
+    }
+    qsort(entries, merged, sizeof(CacheEntry), compare_cache_seq);
+
+    char* data = malloc(size + 1);
+    size_t used = 0;
+    for (int i = 0; i < merged; i++) {
+        if (data) {
+            used += entries[i].freq >= 0
+                ? sprintf(data + used, "%s|%d|%ld\n", entries[i].cmd, entries[i].freq, entries[i].ts)
+                : sprintf(data + used, "%s\n", entries[i].cmd);
+        }
+        free(entries[i].cmd);
+    }
+    free(entries);
+    bool ok = data && persist_replace_now(TRIE_DATA_FILE, data, used);
+    free(data);
+    fprintf(stderr, "[DEBUG] runtime cache: merged %d home + %d runtime lines into %d commands\n",
+            home_count, count - home_count, merged);
+    return ok;
+}
+
+// Fold the home copy into the runtime copy if it changed since the last
+// sync (another machine wrote back, or this is the first use since boot)
+static void refresh_runtime_cache(void) {
+    if (!runtime_cache) return;
+    RuntimeStamp stamp;
+    read_runtime_stamp(&stamp);
+    struct timespec home = file_mtime(HOME_DATA_FILE);
+    if (same_time(home, stamp.home) && access(TRIE_DATA_FILE, F_OK) == 0) return;
+
+    bool clean = same_time(file_mtime(TRIE_DATA_FILE), stamp.runtime);
+    // Rewriting the runtime copy must not race a fold of the history ring
+    if (history_ring) ring_lock(history_ring, true, true);
+    bool merged = merge_cache_files();
+    if (history_ring) ring_unlock(history_ring);
+    if (!merged) return;
+    stamp.home = home;
+    // Without local changes the runtime copy now holds just the home copy's
+    // data: nothing to write back yet
+    if (clean) {
+        stamp.runtime = file_mtime(TRIE_DATA_FILE);
+        stamp.written = time(NULL);
+        last_writeback = stamp.written;
+    }
+    write_runtime_stamp(&stamp);
+}
+
+// Work on a node-local copy of the cache in $XDG_RUNTIME_DIR (or /dev/shm)
+// when the home copy is slow to reach: ZSH_AUTOCOMPLETE_RUNTIME=1 always,
+// 0 never; unset, when a runtime copy exists or CACHE_DIR is on a network
+// filesystem. Updates go to the runtime copy and are written back later.
+// Linux only (tmpfs runtime directories, statfs magic numbers).
+static bool open_runtime_cache(void) {
+#ifdef __linux__
+    const char* mode = getenv("ZSH_AUTOCOMPLETE_RUNTIME");
+    bool forced = mode && *mode;
+    if (forced && strcmp(mode, "0") == 0) return false;
+
+    char dir[PATH_MAX], path[PATH_MAX], stamp_path[PATH_MAX];
+    const char* xdg = getenv("XDG_RUNTIME_DIR");
+    int n = xdg && *xdg
+        ? snprintf(dir, sizeof(dir), "%s/zsh-autocomplete", xdg)
+        : snprintf(dir, sizeof(dir), "/dev/shm/zsh-autocomplete-%ld", (long)getuid());
+    bool fits = n >= 0 && (size_t)n < sizeof(dir);
+    n = snprintf(path, sizeof(path), "%s/trie_data-%08x.txt", dir, path_hash(HOME_DATA_FILE));
+    fits = fits && n >= 0 && (size_t)n < sizeof(path);
+    n = snprintf(stamp_path, sizeof(stamp_path), "%s.synced", path);
+    if (!fits || n < 0 || (size_t)n >= sizeof(stamp_path)) {
+        fprintf(stderr, "[DEBUG] runtime cache: path too long, using %s\n", HOME_DATA_FILE);
+        return false;
+    }
+    bool exists = access(path, F_OK) == 0;
+    if (!forced && !exists && !on_network_filesystem(CACHE_DIR)) return false;
+
+    // /dev/shm is world-writable: refuse a directory (or symlink) planted by someone else
+    struct stat st;
+    mkdir(dir, 0700);
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+        (st.st_mode & 077) != 0) {
+        fprintf(stderr, "[DEBUG] runtime cache: %s is not private, using %s\n", dir, HOME_DATA_FILE);
+        return false;
+    }
+
+    strcpy(TRIE_DATA_FILE, path);
+    strcpy(RUNTIME_STAMP, stamp_path);
+    RuntimeStamp stamp;
+    read_runtime_stamp(&stamp);
+    last_writeback = stamp.written;
+    runtime_dirty = exists && !same_time(file_mtime(TRIE_DATA_FILE), stamp.runtime);
+    fprintf(stderr, "[DEBUG] runtime cache: %s (%s)\n", TRIE_DATA_FILE, runtime_dirty ? "dirty" : "clean");
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Fold a cache file into the loaded trie, keeping the larger frequency and
+// later use per command; returns how many commands changed
+static int merge_cache_into_trie(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) return 0;
+    int changed = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        char *nl = strchr(line,'\n'); if(nl)*nl='\0';
+        int freq;
+        long ts;
+        char* cmd = parse_cache_line(line, &freq, &ts);
+        if (!cmd) continue;
+
+        int known_freq;
+        long known_ts;
+        if (trie_command_usage(command_trie, cmd, &known_freq, &known_ts)) {
+            if (freq > known_freq || ts > known_ts) {
+                trie_set_usage(command_trie, cmd,
+                               freq > known_freq ? freq : known_freq,
+                               ts > known_ts ? ts : known_ts);
+                changed++;
+            }
+            continue;
+        }
+        trie_insert(command_trie, cmd);
+        if (freq >= 0) {
+            trie_set_usage(command_trie, cmd, freq, ts);
+        }
+        char** temp = realloc(history_array, (history_count + 1) * sizeof(char*));
+        if (!temp) break;
+        history_array = temp;
+        history_array[history_count++] = strdup(cmd);
+        changed++;
+    }
+    fclose(f);
+    return changed;
+}
+
+// Copy the loaded cache back to the home copy (temp file, fsync, rename),
+// first folding in whatever another machine wrote back since our last sync
+static void write_back_cache(void) {
+    if (!runtime_cache || !command_trie) return;
+    RuntimeStamp stamp;
+    read_runtime_stamp(&stamp);
+    bool merged = !same_time(file_mtime(HOME_DATA_FILE), stamp.home) &&
+                  merge_cache_into_trie(HOME_DATA_FILE) > 0;
+    // Fold the ring first: the home copy never holds records the runtime
+    // copy could apply a second time
+    if (merged || ring_backlog() > 0) {
+        save_trie_to_file();
+    }
+
+    size_t size;
+    char* data = format_cache_data(&size);
+    if (!data) return;
+    make_directories(CACHE_DIR);
+    runtime_dirty = false;
+    last_writeback = time(NULL);
+    stamp.written = last_writeback;
+
+    if (persister) {
+        // Serve mode: the new mtimes are stamped once the write has landed
+        writeback_failures = persist_failures(persister);
+        writeback_inflight = true;
+        persist_replace(persister, HOME_DATA_FILE, data, size);
+        write_runtime_stamp(&stamp);
+        return;
+    }
+    if (persist_replace_now(HOME_DATA_FILE, data, size)) {
+        stamp.home = file_mtime(HOME_DATA_FILE);
+        stamp.runtime = file_mtime(TRIE_DATA_FILE);
+    } else {
+        fprintf(stderr, "[DEBUG] runtime cache: write-back to %s failed\n", HOME_DATA_FILE);
+        runtime_dirty = true;
+    }
+    free(data);
+    write_runtime_stamp(&stamp);
+}
+
+// Serve mode: the persister drained after a write-back; record the copies'
+// new mtimes (the runtime one only if no update arrived in between)
+static void finish_write_back(void) {
+    if (!writeback_inflight) return;
+    writeback_inflight = false;
+    if (persist_failures(persister) > writeback_failures) {
+        runtime_dirty = true;
+        return;
+    }
+    RuntimeStamp stamp;
+    read_runtime_stamp(&stamp);
+    stamp.home = file_mtime(HOME_DATA_FILE);
+    if (!runtime_dirty) stamp.runtime = file_mtime(TRIE_DATA_FILE);
+    write_runtime_stamp(&stamp);
+}
+
+// Milliseconds until the next write-back is due (-1: nothing to write back)
+static int writeback_timeout(void) {
+    if (!runtime_cache || !runtime_dirty) return -1;
+    long left = (long)(last_writeback + writeback_interval() - time(NULL));
+    if (left <= 0) return 0;
+    return left > INT_MAX / 1000 ? INT_MAX : (int)(left * 1000);
+}
+
+#pragma endregion RUNTIME_CACHE
+
+#pragma region TOP_COMMANDS
+
+// Windows 'top' answers for (a requested span is rounded up to one of them)
+static const long TOP_WINDOW_SPANS[] = { 3600, 86400, 7 * 86400 };
+#define TOP_WINDOWS (int)(sizeof(TOP_WINDOW_SPANS) / sizeof(TOP_WINDOW_SPANS[0]))
+
+// Default and largest N for 'top'
+#define TOP_DEFAULT_RESULTS 10
+#define TOP_MAX_RESULTS 100
+
+static HeavySummary* top_overall = NULL;      // Heavy hitters by trie frequency
+static HeavyWindow* top_windows[TOP_WINDOWS]; // Heavy hitters by executions, per span
+
+// Count one use of a command (weight: what it added to the trie frequency)
+static void note_top_usage(const char* command, int weight, long when) {
+    if (!top_overall) return;
+    heavy_add(top_overall, command, weight);
+    for (int i = 0; i < TOP_WINDOWS; i++) {
+        heavy_window_add(top_windows[i], command, 1, when);
+    }
+}
+
+static void seed_top_window(const EventRecord* event, const char* command, const char* cwd, void* ctx) {
+    (void)cwd;
+    (void)ctx;
+    for (int i = 0; i < TOP_WINDOWS; i++) {
+        heavy_window_add(top_windows[i], command, 1, event->timestamp);
+    }
+}
+
+static int compare_top_items(const void* a, const void* b) {
+    long ca = ((const HeavyItem*)a)->count, cb = ((const HeavyItem*)b)->count;
+    return (ca < cb) - (ca > cb);
+}
+
+// The trie's frequencies are exact: add only the HEAVY_COUNTERS largest, most
+// frequent first, so no seeded count carries an eviction error
+static void seed_top_overall(void) {
+    long total = 0;
+    for (int i = 0; i < command_trie->total_commands; i++) {
+        const TrieNode* leaf = command_trie->leaves[i];
+        total += leaf->reservoir ? leaf->reservoir->count : 1;
+    }
+    HeavyItem* items = malloc((total + 1) * sizeof(HeavyItem));
+    if (!items) return;
+    
+    long count = 0;
+    for (int i = 0; i < command_trie->total_commands; i++) {
+        const TrieNode* leaf = command_trie->leaves[i];
+        if (!leaf->reservoir) {
+            items[count++] = (HeavyItem){ leaf->full_command, leaf->frequency, 0 };
+            continue;
+        }
+        // Templated: its sampled concrete commands
+        for (int s = 0; s < leaf->reservoir->count; s++) {
+            const TrieSample* sample = &leaf->reservoir->samples[s];
+            items[count++] = (HeavyItem){ sample->command, sample->frequency, 0 };
+        }
+    }
+    qsort(items, count, sizeof(HeavyItem), compare_top_items);
+    for (long i = 0; i < count && i < HEAVY_COUNTERS; i++) {
+        heavy_add(top_overall, items[i].command, items[i].count);
+    }
+    free(items);
+}
+
+static void stop_top_commands(void) {
+    heavy_destroy(top_overall);
+    top_overall = NULL;
+    for (int i = 0; i < TOP_WINDOWS; i++) {
+        heavy_window_destroy(top_windows[i]);
+        top_windows[i] = NULL;
+    }
+}
+
+// Once the index is loaded: seed the summaries from the trie (overall) and
+// from the event log (windows), then keep them current on every use, so a
+// top-N query never has to rank the whole trie. ZSH_AUTOCOMPLETE_TOP=0 skips it.
+static void start_top_commands(void) {
+    if (!env_flag_enabled("ZSH_AUTOCOMPLETE_TOP", true)) return;
+    bool ready = (top_overall = heavy_create(HEAVY_COUNTERS)) != NULL;
+    for (int i = 0; i < TOP_WINDOWS; i++) {
+        ready = (top_windows[i] = heavy_window_create(HEAVY_COUNTERS, TOP_WINDOW_SPANS[i])) && ready;
+    }
+    if (!ready) {
+        stop_top_commands();
+        return;
+    }
+    
+    seed_top_overall();
+    // The largest window reaches back up to twice its span
+    long since = time(NULL) - 2 * TOP_WINDOW_SPANS[TOP_WINDOWS - 1];
+    EventLog* log = eventlog_open(CACHE_DIR);
+    long events = log ? eventlog_scan(log, since, seed_top_window, NULL) : 0;
+    if (log) eventlog_close(log);
+    fprintf(stderr, "[DEBUG] top: summarised %d commands and %ld recent executions\n",
+            command_trie->total_commands, events);
+}
+
+#pragma endregion TOP_COMMANDS
+
+#pragma region HANDOFF
+
+// Internal: memfd holding the index of the server that exec'ed this one
+#define HANDOFF_ENV "ZSH_AUTOCOMPLETE_HANDOFF"
+
+// Minimum interval between two checks of the serve binary for an upgrade
+#define HANDOFF_RECHECK_MS 2000
+
+static char serve_binary[PATH_MAX];      // Resolved at start: argv[0] may be relative or gone
+static struct stat serve_binary_stat;
+static long serve_binary_checked = 0;
+
+// Monotonic clock in milliseconds
+static long handoff_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+// Remember which file this process runs, to notice it being replaced
+static void note_serve_binary(void) {
+    if (!realpath("/proc/self/exe", serve_binary) || stat(serve_binary, &serve_binary_stat) != 0) {
+        serve_binary[0] = '\0';
+    }
+    serve_binary_checked = handoff_now_ms();
+}
+
+// Installed over (a new inode) or rewritten since we started; stats the
+// binary at most every HANDOFF_RECHECK_MS
+static bool serve_binary_replaced(void) {
+    if (!serve_binary[0]) return false;
+    long now = handoff_now_ms();
+    if (now - serve_binary_checked < HANDOFF_RECHECK_MS) return false;
+    serve_binary_checked = now;
+    struct stat st;
+    if (stat(serve_binary, &st) != 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111)) return false;
+    return st.st_dev != serve_binary_stat.st_dev || st.st_ino != serve_binary_stat.st_ino ||
+           st.st_mtim.tv_sec != serve_binary_stat.st_mtim.tv_sec ||
+           st.st_mtim.tv_nsec != serve_binary_stat.st_mtim.tv_nsec;
+}
+
+typedef struct {
+    const char* command;
+    int frequency;
+    long last_used;
+} HandoffEntry;
+
+static int compare_handoff_entries(const void* a, const void* b) {
+    return strcmp(((const HandoffEntry*)a)->command, ((const HandoffEntry*)b)->command);
+}
+
+// Write the loaded index as a snapshot into a new memfd; templated leaves
+// contribute their sampled commands. Returns the fd (inherited across exec),
+// or -1
+static int write_handoff_index(void) {
+    int fd = (int)syscall(__NR_memfd_create, "zsh-autocomplete-index", 0);
+    if (fd < 0) return -1;
+    long total = 0;
+    for (int i = 0; i < command_trie->total_commands; i++) {
+        const TrieNode* leaf = command_trie->leaves[i];
+        total += leaf->reservoir ? leaf->reservoir->count : 1;
+    }
+    HandoffEntry* entries = malloc((total + 1) * sizeof(HandoffEntry));
+    SnapshotWriter* writer = snapshot_writer_create();
+    bool ok = entries && writer;
+    
+    long count = 0;
+    for (int i = 0; ok && i < command_trie->total_commands; i++) {
+        const TrieNode* leaf = command_trie->leaves[i];
+        if (!leaf->reservoir) {
+            entries[count++] = (HandoffEntry){ leaf->full_command, leaf->frequency, leaf->last_used };
+            continue;
+        }
+        for (int s = 0; s < leaf->reservoir->count; s++) {
+            const TrieSample* sample = &leaf->reservoir->samples[s];
+            entries[count++] = (HandoffEntry){ sample->command, sample->frequency, sample->last_used };
+        }
+    }
+    if (ok) qsort(entries, count, sizeof(HandoffEntry), compare_handoff_entries);
+    for (long i = 0; ok && i < count; i++) {
+        // A sample can repeat a stored command: the writer wants each once
+        if (!*entries[i].command || (i > 0 && strcmp(entries[i].command, entries[i - 1].command) == 0)) continue;
+        ok = snapshot_writer_add(writer, entries[i].command,
+                                 entries[i].frequency > 0 ? (uint32_t)entries[i].frequency : 0,
+                                 entries[i].last_used);
+    }
+    ok = ok && snapshot_writer_finish_fd(writer, fd);
+    free(entries);
+    snapshot_writer_destroy(writer);
+    if (!ok) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Replace this server by a fresh exec of its binary (after an upgrade, or
+ * on request) without the shell noticing. Called between batches, once
+ * every reply is written and no request is half read: stdin and stdout are
+ * the same pipes afterwards, so requests sent meanwhile wait in the kernel.
+ * Cache writes are drained first. The index goes along as a snapshot in a
+ * memfd, which the new process answers from while it loads its own trie.
+ * 
+ * @return Only if exec failed (the server carries on)
+ */
+static void hand_off_server(const char* history_path, bool binary) {
+    if (!serve_binary[0]) return;
+    int fd = write_handoff_index();
+    if (runtime_dirty) write_back_cache();
+    if (persister) {
+        persist_drain(persister);
+        finish_write_back();
+    }
+    // Its ring is not close-on-exec
+    persist_destroy(persister);
+    persister = NULL;
+    
+    char value[16];
+    snprintf(value, sizeof(value), "%d", fd);
+    if (fd >= 0) setenv(HANDOFF_ENV, value, 1);
+    char* args[5];
+    int n = 0;
+    args[n++] = serve_binary;
+    args[n++] = "serve";
+    if (binary) args[n++] = "--binary";
+    if (history_path) args[n++] = (char*)history_path;
+    args[n] = NULL;
+    fprintf(stderr, "[DEBUG] serve: handing over %s to %s\n",
+            fd >= 0 ? "the index" : "nothing", serve_binary);
+    fflush(stdout);
+    execv(serve_binary, args);
+    
+    fprintf(stderr, "[DEBUG] serve: exec of %s failed, carrying on\n", serve_binary);
+    unsetenv(HANDOFF_ENV);
+    if (fd >= 0) close(fd);
+    persister = persist_create(env_flag_enabled("ZSH_AUTOCOMPLETE_URING", true));
+    // Do not try the same binary again
+    stat(serve_binary, &serve_binary_stat);
+}
+
+// New server: map the index the previous one handed over, if any
+static void adopt_handoff_index(void) {
+    const char* value = getenv(HANDOFF_ENV);
+    if (!value) return;
+    char* end;
+    long fd = strtol(value, &end, 10);
+    unsetenv(HANDOFF_ENV);
+    if (*end || fd <= STDERR_FILENO || fd > INT_MAX) return;
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%ld", fd);
+    handoff_index = snapshot_open(path);
+    close((int)fd);
+    if (handoff_index) {
+        fprintf(stderr, "[DEBUG] serve: adopted %lu commands from the previous server\n",
+                (unsigned long)handoff_index->header->leaf_count);
+    }
+}
+
+// The trie has caught up: answer from it again
+static void release_handoff_index(void) {
+    snapshot_close(handoff_index);
+    handoff_index = NULL;
+}
+
+#pragma endregion HANDOFF
+
+#pragma region HISTORY_RING
+
+// Ring file next to the working cache: trie_data.txt -> trie_data.ring
+static void open_history_ring(void) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", TRIE_DATA_FILE);
+    char* ext = strrchr(path, '.');
+    if (ext && !strchr(ext, '/')) *ext = '\0';
+    strncat(path, ".ring", sizeof(path) - strlen(path) - 1);
+    ensure_data_directory();
+    history_ring = ring_open(path);
+    if (!history_ring) {
+        fprintf(stderr, "[DEBUG] history ring: cannot map %s\n", path);
+    }
+}
+
+// Add one use of a command at a time to the loaded index (nothing is saved)
+static void note_command_usage(const char* command, long when) {
+    int before = 0, after = 0;
+    long last_used;
+    if (top_overall) trie_command_usage(command_trie, command, &before, &last_used);
+    
+    // Add to trie if not exists
+    trie_insert(command_trie, command);
+    
+    // Add to history array if not exists
+    bool exists = false;
+    for (int i = 0; i < history_count; i++) {
+        if (strcmp(history_array[i], command) == 0) {
+            exists = true;
+            break;
+        }
+    }
+    
+    if (!exists) {
+        history_array = realloc(history_array, (history_count + 1) * sizeof(char*));
+        if (history_array) {
+            history_array[history_count] = strdup(command);
+            history_count++;
+        }
+    }
+    
+    // Update frequency in trie
+    trie_update_frequency(command_trie, command);
+    
+    if (top_overall && trie_command_usage(command_trie, command, &after, &last_used)) {
+        note_top_usage(command, after > before ? after - before : 1, when);
+    }
+}
+
+// Apply one ring record to the loaded index, keeping its execution time
+static void apply_ring_record(const char* text, uint32_t length, int64_t when, void* ctx) {
+    (void)ctx;
+    char command[RING_MAX_SPAN * RING_SLOT_DATA + 1];
+    memcpy(command, text, length);
+    command[length] = '\0';
+    if (!*command) return;
+
+    int freq;
+    long last_used = 0;
+    trie_command_usage(command_trie, command, &freq, &last_used);
+    note_command_usage(command, when);
+    long ts;
+    if (trie_command_usage(command_trie, command, &freq, &ts)) {
+        trie_set_usage(command_trie, command, freq, when > last_used ? when : last_used);
+    }
+    if (runtime_cache) runtime_dirty = true;
+}
+
+// Read the ring from its folded mark (call with the ring locked, as the
+// cache file is read)
+static void start_ring_cursor(void) {
+    memset(&ring_cursor, 0, sizeof(ring_cursor));
+    ring_cursor.next = ring_folded(history_ring);
+    ring_cursor_ready = true;
+}
+
+// Bring the loaded index up to date with records any shell appended
+static void consume_history_ring(void) {
+    if (!history_ring || !command_trie) return;
+    if (!ring_cursor_ready) start_ring_cursor();
+    uint64_t lost = ring_cursor.lost;
+    ring_read(history_ring, &ring_cursor, apply_ring_record, NULL);
+    if (ring_cursor.lost > lost) {
+        fprintf(stderr, "[DEBUG] history ring: %llu slots overwritten or abandoned\n",
+                (unsigned long long)(ring_cursor.lost - lost));
+    }
+}
+
+// Slots appended to the ring but not folded into the cache file yet
+static uint64_t ring_backlog(void) {
+    return history_ring ? ring_tail(history_ring) - ring_folded(history_ring) : 0;
+}
+
+#pragma endregion HISTORY_RING
+
 // Function prototypes
 static void initialize_autocomplete_from_stdin(void);
 static void initialize_autocomplete_from_cache(void);
@@ -153,8 +1188,19 @@ int load_history_from_stdin(void);
 void save_trie_to_file(void);
 void load_trie_from_file(void);
 char* get_ghost_text(const char* prefix);
+char* get_ghost_text_around(const char* prefix, const char* suffix);
 static char* navigate_filtered_history(const char* prefix, const char* direction, int start_index, int* new_index);
 void update_command_usage(const char* command);
+int print_glob_matches(const char* pattern, int k);
+int print_history_range(int argc, char* argv[]);
+int print_events(int argc, char* argv[]);
+int print_top_commands(int argc, char* argv[]);
+int merge_snapshots(int argc, char* argv[]);
+int pack_snapshot(int argc, char* argv[]);
+static char* merge_base_completion(const char* prefix, char* user);
+void record_event(const char* command, int status, const char* cwd, long started);
+void run_update(const char* command, const char* status, const char* cwd, const char* started);
+int serve_requests(const char* history_path, bool binary);
 void filter_history_by_prefix(const char* prefix);
 
 // Create data directory if it doesn't exist
@@ -214,9 +1260,11 @@ static void initialize_autocomplete_from_stdin(void) {
     
     command_trie = trie_create();
     if (!command_trie) return;
+    configure_indexes(command_trie);
     
     init_storage_paths();
     ensure_data_directory();
+    refresh_runtime_cache();
 
     // Try to load from cache first
     int cache_count = 0;
@@ -268,6 +1316,7 @@ static void initialize_autocomplete_from_cache(void) {
 
     command_trie = trie_create();
     if (!command_trie) return;
+    configure_indexes(command_trie);
 
     init_storage_paths();
     ensure_data_directory();
@@ -290,6 +1339,13 @@ int load_history_from_stdin(void) {
     history_array = malloc(capacity * sizeof(char*));
     if (!history_array) return 0;
     
+    // Seed the event log from timestamped history the first time only
+    EventLog* events = eventlog_open(CACHE_DIR);
+    if (events && !eventlog_is_empty(events)) {
+        eventlog_close(events);
+        events = NULL;
+    }
+    
     // Read history entries from stdin  
     while ((read = getline(&line, &len, stdin)) != -1) {
         // Remove newline character
@@ -298,7 +1354,13 @@ int load_history_from_stdin(void) {
             read--;
         }
         
-        if (read == 0) continue;
+        long started;
+        char* command = parse_history_line(line, &started);
+        
+        if (*command == '\0') continue;
+        if (events && started > 0) {
+            eventlog_append(events, command, "", started, EVENT_STATUS_UNKNOWN);
+        }
         
         // Resize if needed
         if (count >= capacity) {
@@ -309,12 +1371,13 @@ int load_history_from_stdin(void) {
         }
         
         // Store and insert into trie
-        history_array[count] = strdup(line);
-        trie_insert(command_trie, line);
+        history_array[count] = strdup(command);
+        trie_insert(command_trie, command);
         count++;
     }
     
     free(line);
+    eventlog_close(events);
     history_count = count; // Update global history count
     fprintf(stderr, "[DEBUG] Loaded %d lines from stdin into trie\n", count);
     return count;
@@ -374,6 +1437,24 @@ void filter_history_by_prefix(const char* prefix) {
     filtered_count = 0;
     current_position = 0;
     
+    if (history_since > 0) {
+        // Time-bounded cycling: read the window straight from the time index
+        trie_enable_time_index(command_trie);
+        int* ids = malloc((command_trie->total_commands + 1) * sizeof(int));
+        filtered_history = malloc((command_trie->total_commands + 1) * sizeof(char*));
+        if (ids && filtered_history) {
+            filtered_count = trie_range_by_time(command_trie, history_since, LONG_MAX, prefix,
+                                                ids, command_trie->total_commands);
+            for (int i = 0; i < filtered_count; i++) {
+                filtered_history[i] = command_trie->leaves[ids[i]]->full_command;
+            }
+        }
+        free(ids);
+        fprintf(stderr, "[DEBUG] filter_history_by_prefix: prefix='%s', since=%ld, count=%d\n",
+                prefix ? prefix : "", history_since, filtered_count);
+        return;
+    }
+    
     if (!prefix || strlen(prefix) == 0) {
         // No prefix, use all history
         filtered_history = malloc(history_count * sizeof(char*));
@@ -405,56 +1486,516 @@ void filter_history_by_prefix(const char* prefix) {
     fprintf(stderr, "[DEBUG] filter_history_by_prefix: prefix='%s', count=%d\n", prefix, filtered_count);
 }
 
+// TrieCommandCheck over the executable index (context)
+static bool command_available(const char* word, size_t length, void* context) {
+    return exec_index_has((const ExecIndex*)context, word, length);
+}
+
+// Serve mode: the command word of text (after wrappers) cannot run here
+static bool command_missing(const char* text) {
+    if (!exec_index) return false;
+    const char* word = text + trie_wrapper_length(text);
+    return !exec_index_has(exec_index, word, strcspn(word, " \t"));
+}
+
+// Serve mode, once the index is loaded: index $PATH and flag every command
+// whose program is missing on this host, then keep the flags current.
+// ZSH_AUTOCOMPLETE_MISSING_COMMANDS=demote (default) ranks them below every
+// available command, hide drops them, show turns the check off.
+static void start_command_check(void) {
+    const char* policy = getenv("ZSH_AUTOCOMPLETE_MISSING_COMMANDS");
+    if (policy && strcmp(policy, "show") == 0) return;
+    exec_index = exec_index_create(getenv("PATH"), getenv("ZSH_AUTOCOMPLETE_SHELL_COMMANDS"));
+    if (!exec_index) return;
+    bool hide = policy && strcmp(policy, "hide") == 0;
+    int missing = trie_set_command_check(command_trie, command_available, exec_index, hide);
+    fprintf(stderr, "[DEBUG] serve: %zu runnable names, %d commands missing here\n",
+            exec_index_count(exec_index), missing);
+}
+
+/**
+ * Layer the shared base snapshot under the user's own completion.
+ * 
+ * A command's score is its user score plus its base score, so the user's
+ * history refines the base ranking instead of replacing it. The candidates
+ * compared are the user's best and the base's best for the prefix. A base
+ * command whose program is missing here is not offered.
+ * 
+ * @param prefix  Typed prefix
+ * @param user    User completion (can be NULL)
+ * @return user, or text inside the base mapping, or NULL
+ */
+static const char* pick_base_completion(const char* prefix, const char* user) {
+    Snapshot* base = base_index();
+    long leaf = base ? snapshot_best_completion(base, prefix) : -1;
+    if (leaf < 0) return user;
+    
+    long now = time(NULL);
+    const char* text = snapshot_leaf_text(base, leaf);
+    if (command_missing(text)) return user;
+    int base_score = snapshot_leaf_score(base, leaf, now);
+    int overlay = trie_command_score(command_trie, text);
+    if (overlay > 0) base_score += overlay;
+    
+    if (user) {
+        // Case-folded or spliced text has no exact score: keep the user's pick
+        int user_score = trie_command_score(command_trie, user);
+        if (user_score < 0) return user;
+        long shared = snapshot_lookup(base, user);
+        if (shared >= 0) user_score += snapshot_leaf_score(base, shared, now);
+        if (user_score >= base_score) return user;
+    }
+    return text;
+}
+
+// pick_base_completion() for an allocated user completion (ownership taken)
+static char* merge_base_completion(const char* prefix, char* user) {
+    const char* pick = pick_base_completion(prefix, user);
+    if (pick == user) return user;
+    free(user);
+    return strdup(pick);
+}
+
 // Get ghost text completion for a prefix
 char* get_ghost_text(const char* prefix) {
     if (!prefix || strlen(prefix) == 0) return NULL;
     
-    char* completion = trie_get_best_completion(command_trie, prefix);
+    char* completion;
+    if (command_trie->folded_root) {
+        // Case-insensitive: keep the typed prefix, borrow the rest of the match
+        completion = trie_get_best_completion_nocase(command_trie, prefix);
+        size_t len = strlen(prefix);
+        if (completion && strncasecmp(completion, prefix, len) == 0) {
+            memcpy(completion, prefix, len);
+        }
+    } else if (command_trie->wrapper_aliases) {
+        // "sudo sys" also ranks bare "systemctl ..." commands, and vice versa
+        completion = trie_get_best_wrapped_completion(command_trie, prefix);
+    } else {
+        completion = trie_get_best_completion(command_trie, prefix);
+    }
+    
+    completion = merge_base_completion(prefix, completion);
+    
+    if (!completion && command_trie->segment_root) {
+        // No whole-line match: complete the pipeline/chain segment under the cursor
+        int starts[MAX_SEGMENTS];
+        int count = trie_segment_starts(prefix, starts, MAX_SEGMENTS);
+        size_t head = count > 0 ? (size_t)starts[count - 1] : 0;
+        
+        if (head > 0) {
+            char* segment = trie_get_best_segment_completion(command_trie, prefix + head);
+            if (segment) {
+                completion = malloc(head + strlen(segment) + 1);
+                if (completion) {
+                    memcpy(completion, prefix, head);
+                    strcpy(completion + head, segment);
+                }
+                free(segment);
+            }
+        }
+    }
+    
+    if (completion) {
+#ifdef DEBUG
+        printf("DEBUG: Ghost text for '%s': '%s'\n", prefix, completion);
+#endif
+        return completion;
+    }
+    
+    return NULL;
+}
+
+// Get a completion for a mid-line cursor: must start with prefix and end with suffix
+char* get_ghost_text_around(const char* prefix, const char* suffix) {
+    if (!suffix || strlen(suffix) == 0) return get_ghost_text(prefix);
+    if (!prefix || strlen(prefix) == 0) return NULL;
+    
+    // The reverse index only pays off in serve mode (see serve_requests());
+    // a one-shot query filters the prefix's subtree by suffix instead
+    char* completion = trie_get_best_completion_with_suffix(command_trie, prefix, suffix);
+#ifdef DEBUG
+    if (completion) {
+        printf("DEBUG: Ghost text for '%s'|'%s': '%s'\n", prefix, suffix, completion);
+    }
+#endif
+    return completion;
+}
+
+// Ghost text without a copy when the answer is a stored command (the trie's
+// or the mapped base's); re-cased or spliced answers are allocated in *owned
+static const char* ghost_text_view(const char* prefix, const char* suffix, char** owned) {
+    *owned = NULL;
+    bool plain = prefix && *prefix && (!suffix || !*suffix) && !command_trie->folded_root &&
+                 !(command_trie->wrapper_aliases && trie_wrapper_length(prefix) > 0);
+    if (plain) {
+        // Until the trie has loaded, the previous server's whole index knows better
+        long adopted = handoff_index ? snapshot_best_completion(handoff_index, prefix) : -1;
+        char* spliced = NULL;
+        const char* user = adopted >= 0 ? snapshot_leaf_text(handoff_index, adopted)
+                         : trie_cursor_best_completion(command_trie, &ghost_cursor, prefix, &spliced);
+        const char* text = pick_base_completion(prefix, user);
+        if (text && text == spliced) *owned = spliced;
+        else free(spliced);
+        if (text) return text;
+    }
+    *owned = get_ghost_text_around(prefix, suffix);
+    return *owned;
+}
+
+// Navigate through filtered history based on prefix
+char* navigate_filtered_history(const char* prefix, const char* direction, int start_index, int* new_index) {
+    // Build filtered history every call (stateless between processes)
+    const char* effective_prefix = (prefix && strlen(prefix) > 0) ? prefix : "";
+    filter_history_by_prefix(effective_prefix);
+
+    if (filtered_count == 0) {
+        *new_index = 0;
+        return strdup(prefix); // No matches, return original
+    }
+
+    int idx = start_index;
+    if (strcmp(direction, "up") == 0) {
+        idx++;
+    } else if (strcmp(direction, "down") == 0) {
+        idx--;
+    }
+
+    // Wrap behaviour: -1 represents the original (unmodified) buffer
+    if (idx >= filtered_count) {
+        idx = -1;
+    } else if (idx < -1) {
+        idx = filtered_count - 1;
+    }
+
+    *new_index = idx;
+
+    if (idx == -1) {
+        return strdup(prefix);
+    } else {
+        int actual_idx = filtered_count - 1 - idx; // Map to newest-to-oldest order
+        if (actual_idx < 0 || actual_idx >= filtered_count) actual_idx = 0;
+        return strdup(filtered_history[actual_idx]);
+    }
+}
+
+/**
+ * Parse a time argument for history range queries.
+ * 
+ * Accepts Unix seconds (`1718000000`) or an age relative to now with a unit
+ * suffix: `90s`, `30m`, `2h`, `1d`, `1w`.
+ * 
+ * @param arg  Argument text
+ * @param now  Current Unix time
+ * @return Unix time, or -1 if arg is not a valid time
+ */
+static long parse_time_arg(const char* arg, long now) {
+    char* end;
+    long value = strtol(arg, &end, 10);
+    if (end == arg || value < 0) return -1;
+    
+    switch (*end) {
+        case '\0': return value;
+        case 's': value *= 1; break;
+        case 'm': value *= 60; break;
+        case 'h': value *= 3600; break;
+        case 'd': value *= 86400; break;
+        case 'w': value *= 7 * 86400; break;
+        default: return -1;
+    }
+    return end[1] == '\0' ? now - value : -1;
+}
+
+/**
+ * Print commands last used in a time range: history --since T [--until T] [--prefix P]
+ * 
+ * Each line is "<unix time>\t<command>", oldest first. Answered from the
+ * time index in O(log n + results) instead of scanning the history.
+ * 
+ * @return 0 on success, 1 on bad arguments
+ */
+int print_history_range(int argc, char* argv[]) {
+    long now = time(NULL);
+    long since = 0, until = now;
+    const char* prefix = "";
+    
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            since = -1;  // Option without a value
+        } else if (strcmp(argv[i], "--since") == 0) {
+            since = parse_time_arg(argv[i + 1], now);
+        } else if (strcmp(argv[i], "--until") == 0) {
+            until = parse_time_arg(argv[i + 1], now);
+        } else if (strcmp(argv[i], "--prefix") == 0) {
+            prefix = argv[i + 1];
+        } else {
+            since = -1;
+        }
+        if (since < 0 || until < 0) {
+            fprintf(stderr, "autocomplete: usage: history --since <time> [--until <time>] [--prefix <text>]\n");
+            return 1;
+        }
+    }
+    
+    trie_enable_time_index(command_trie);
+    int* ids = malloc((command_trie->total_commands + 1) * sizeof(int));
+    if (!ids) return 1;
+    
+    int count = trie_range_by_time(command_trie, since, until, prefix, ids, command_trie->total_commands);
+    for (int i = 0; i < count; i++) {
+        const TrieNode* leaf = command_trie->leaves[ids[i]];
+        printf("%ld\t%s\n", leaf->last_used, leaf->full_command);
+    }
+    free(ids);
+    return 0;
+}
+
+// Append one execution to the event log (status < 0 = unknown, cwd NULL = getcwd,
+// started 0 = now)
+void record_event(const char* command, int status, const char* cwd, long started) {
+    char here[PATH_MAX];
+    if (!cwd || !*cwd) {
+        cwd = getcwd(here, sizeof(here)) ? here : "";
+    }
+    
+    EventLog* log = eventlog_open(CACHE_DIR);
+    if (!log) {
+        fprintf(stderr, "[DEBUG] record_event: cannot open event log in %s\n", CACHE_DIR);
+        return;
+    }
+    eventlog_append(log, command, cwd, started > 0 ? started : time(NULL), status);
+    eventlog_close(log);
+}
+
+// Print one event as "<unix time>\t<status>\t<cwd>\t<command>"
+static void print_event(const EventRecord* event, const char* command, const char* cwd, void* ctx) {
+    (void)ctx;
+    if (event->status == EVENT_STATUS_UNKNOWN) {
+        printf("%lld\t-\t%s\t%s\n", (long long)event->timestamp, cwd, command);
+    } else {
+        printf("%lld\t%d\t%s\t%s\n", (long long)event->timestamp, event->status, cwd, command);
+    }
+}
+
+/**
+ * Dump the execution event log: events [--since T]
+ * 
+ * Prints every recorded execution oldest first, one per line as
+ * "<unix time>\t<exit status or ->\t<cwd>\t<command>", for analytics and
+ * offline re-ranking.
+ * 
+ * @return 0 on success, 1 on bad arguments or a corrupt log
+ */
+int print_events(int argc, char* argv[]) {
+    long since = 0;
+    if (argc > 2) {
+        since = (argc == 4 && strcmp(argv[2], "--since") == 0) ? parse_time_arg(argv[3], time(NULL)) : -1;
+        if (since < 0) {
+            fprintf(stderr, "autocomplete: usage: events [--since <time>]\n");
+            return 1;
+        }
+    }
+    
+    EventLog* log = eventlog_open(CACHE_DIR);
+    if (!log) {
+        fprintf(stderr, "autocomplete: cannot open event log in %s\n", CACHE_DIR);
+        return 1;
+    }
+    long count = eventlog_scan(log, since, print_event, NULL);
+    eventlog_close(log);
+    if (count < 0) {
+        fprintf(stderr, "autocomplete: event log in %s is corrupt\n", CACHE_DIR);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Most used commands, from the heavy-hitter summaries (no trie scan).
+ * 
+ * @param window  "" for all history, else a span as for history --since
+ *                ("30m", "1d"...), rounded up to the next TOP_WINDOW_SPANS
+ *                entry (the largest if none is long enough)
+ * @param out     Output entries
+ * @param n       Capacity of out
+ * @return Entries stored, or -1 if window is not a valid time
+ */
+static int top_commands(const char* window, HeavyItem* out, int n) {
+    if (!*window) return heavy_top(top_overall, out, n);
+    long now = time(NULL);
+    long since = parse_time_arg(window, now);
+    if (since < 0) return -1;
+    int i = 0;
+    while (i < TOP_WINDOWS - 1 && TOP_WINDOW_SPANS[i] < now - since) i++;
+    return heavy_window_top(top_windows[i], now, out, n);
+}
+
+/**
+ * Print the most used commands: top [n] [window]
+ * 
+ * One "<count>\t<command>" line each, most used first. Counts are trie
+ * frequencies overall and executions within a window; with many distinct
+ * commands they are Space-Saving estimates (see heavy.h).
+ * 
+ * @return 0 on success, 1 on bad arguments
+ */
+int print_top_commands(int argc, char* argv[]) {
+    int n = (argc > 2 && *argv[2]) ? atoi(argv[2]) : TOP_DEFAULT_RESULTS;
+    if (n <= 0 || n > TOP_MAX_RESULTS) n = TOP_DEFAULT_RESULTS;
+    start_top_commands();
+    if (!top_overall) {
+        fprintf(stderr, "autocomplete: top commands are disabled (ZSH_AUTOCOMPLETE_TOP=0)\n");
+        return 1;
+    }
+    
+    HeavyItem items[TOP_MAX_RESULTS];
+    int found = top_commands(argc > 3 ? argv[3] : "", items, n);
+    if (found < 0) {
+        fprintf(stderr, "autocomplete: usage: top [n] [window, e.g. 1h|1d|1w]\n");
+    }
+    for (int i = 0; i < found; i++) {
+        printf("%ld\t%s\n", items[i].count, items[i].command);
+    }
+    stop_top_commands();
+    return found < 0;
+}
+
+/**
+ * Merge snapshots: merge [--freq sum|max] [--time max|min] <out> <in>...
+ * 
+ * Streams the sorted inputs through a k-way merge and writes one snapshot,
+ * combining each command's frequency (sum by default; max for overlapping
+ * copies of one history) and last-used time (most recent by default).
+ * 
+ * @return 0 on success, 1 on bad arguments or I/O failure
+ */
+int merge_snapshots(int argc, char* argv[]) {
+    SnapshotFreqPolicy freq_policy = SNAPSHOT_FREQ_SUM;
+    SnapshotTimePolicy time_policy = SNAPSHOT_TIME_MAX;
+    
+    int i = 2;
+    bool usage = false;
+    for (; i + 1 < argc && strncmp(argv[i], "--", 2) == 0; i += 2) {
+        if (strcmp(argv[i], "--freq") == 0 && strcmp(argv[i + 1], "sum") == 0) {
+            freq_policy = SNAPSHOT_FREQ_SUM;
+        } else if (strcmp(argv[i], "--freq") == 0 && strcmp(argv[i + 1], "max") == 0) {
+            freq_policy = SNAPSHOT_FREQ_MAX;
+        } else if (strcmp(argv[i], "--time") == 0 && strcmp(argv[i + 1], "max") == 0) {
+            time_policy = SNAPSHOT_TIME_MAX;
+        } else if (strcmp(argv[i], "--time") == 0 && strcmp(argv[i + 1], "min") == 0) {
+            time_policy = SNAPSHOT_TIME_MIN;
+        } else {
+            usage = true;
+            break;
+        }
+    }
+    if (usage || argc - i < 2) {
+        fprintf(stderr, "autocomplete: usage: merge [--freq sum|max] [--time max|min] <out> <in>...\n");
+        return 1;
+    }
+    
+    const char* out = argv[i++];
+    int count = argc - i;
+    Snapshot** inputs = calloc(count, sizeof(Snapshot*));
+    bool ok = inputs != NULL;
+    for (int k = 0; ok && k < count; k++) {
+        inputs[k] = snapshot_open(argv[i + k]);
+        if (!inputs[k]) {
+            fprintf(stderr, "autocomplete: cannot read snapshot '%s'\n", argv[i + k]);
+            ok = false;
+        }
+    }
+    
+    long merged = 0;
+    if (ok && !snapshot_merge(inputs, count, freq_policy, time_policy, out, &merged)) {
+        fprintf(stderr, "autocomplete: failed to write '%s'\n", out);
+        ok = false;
+    }
+    fprintf(stderr, "[DEBUG] merge: %d inputs -> %ld commands\n", count, merged);
+    
+    for (int k = 0; inputs && k < count; k++) {
+        snapshot_close(inputs[k]);
+    }
+    free(inputs);
+    return ok ? 0 : 1;
+}
+
+/**
+ * Pack a snapshot for cold starts: pack <out> <in> < history
+ * 
+ * Replays each command read from stdin keystroke by keystroke (a ghost query
+ * per prefix, until the ghost text is the command) against <in> with heat
+ * tracking on, then writes <out> with the visited nodes, their edges, leaves
+ * and texts first (snapshot_write_packed()), so a server only needs that warm
+ * region in memory.
+ * 
+ * @return 0 on success, 1 on bad arguments or I/O failure
+ */
+int pack_snapshot(int argc, char* argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "autocomplete: usage: pack <out> <in> < history\n");
+        return 1;
+    }
+    Snapshot* snap = snapshot_open(argv[3]);
+    if (!snap || !snapshot_track_heat(snap)) {
+        fprintf(stderr, "autocomplete: cannot read snapshot '%s'\n", argv[3]);
+        snapshot_close(snap);
+        return 1;
+    }
     
-    if (completion) {
-#ifdef DEBUG
-        printf("DEBUG: Ghost text for '%s': '%s'\n", prefix, completion);
-#endif
-        return completion;
+    char line[MAX_COMMAND_LENGTH];
+    char prefix[MAX_COMMAND_LENGTH];
+    long commands = 0;
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\n")] = '\0';
+        long started;
+        const char* command = parse_history_line(line, &started);
+        // Type until the ghost text shows the command (or nothing matches)
+        for (size_t len = 1; command[len - 1]; len++) {
+            memcpy(prefix, command, len);
+            prefix[len] = '\0';
+            long leaf = snapshot_best_completion(snap, prefix);
+            if (leaf < 0 || strcmp(snapshot_leaf_text(snap, leaf), command) == 0) break;
+        }
+        commands++;
     }
     
-    return NULL;
-}
-
-// Navigate through filtered history based on prefix
-char* navigate_filtered_history(const char* prefix, const char* direction, int start_index, int* new_index) {
-    // Build filtered history every call (stateless between processes)
-    const char* effective_prefix = (prefix && strlen(prefix) > 0) ? prefix : "";
-    filter_history_by_prefix(effective_prefix);
-
-    if (filtered_count == 0) {
-        *new_index = 0;
-        return strdup(prefix); // No matches, return original
+    bool ok = snapshot_write_packed(snap, argv[2]);
+    if (!ok) {
+        fprintf(stderr, "autocomplete: failed to write '%s'\n", argv[2]);
     }
-
-    int idx = start_index;
-    if (strcmp(direction, "up") == 0) {
-        idx++;
-    } else if (strcmp(direction, "down") == 0) {
-        idx--;
+    Snapshot* packed = ok ? snapshot_open(argv[2]) : NULL;
+    if (packed) {
+        fprintf(stderr, "[DEBUG] pack: %ld commands replayed, warm region %u/%u nodes, %u/%u leaves\n",
+                commands, packed->header->warm_nodes, packed->header->node_count,
+                packed->header->warm_leaves, packed->header->leaf_count);
     }
+    snapshot_close(packed);
+    snapshot_close(snap);
+    return ok ? 0 : 1;
+}
 
-    // Wrap behaviour: -1 represents the original (unmodified) buffer
-    if (idx >= filtered_count) {
-        idx = -1;
-    } else if (idx < -1) {
-        idx = filtered_count - 1;
+// Print the top-K commands matching a glob, best first; returns 0 on success
+int print_glob_matches(const char* pattern, int k) {
+    if (k <= 0) k = MATCH_DEFAULT_RESULTS;
+    if (k > MATCH_MAX_RESULTS) k = MATCH_MAX_RESULTS;
+    
+    TrieMatch matches[MATCH_MAX_RESULTS];
+    bool truncated = false;
+    int count = trie_match_glob(command_trie, pattern, matches, k, MATCH_WORK_LIMIT, &truncated);
+    if (count < 0) {
+        fprintf(stderr, "autocomplete: invalid glob pattern '%s'\n", pattern);
+        return 1;
     }
-
-    *new_index = idx;
-
-    if (idx == -1) {
-        return strdup(prefix);
-    } else {
-        int actual_idx = filtered_count - 1 - idx; // Map to newest-to-oldest order
-        if (actual_idx < 0 || actual_idx >= filtered_count) actual_idx = 0;
-        return strdup(filtered_history[actual_idx]);
+    
+    for (int i = 0; i < count; i++) {
+        printf("%s\n", matches[i].command);
+        free(matches[i].command);
     }
+    if (truncated) {
+        fprintf(stderr, "autocomplete: match stopped after %d nodes, results may be incomplete\n", MATCH_WORK_LIMIT);
+    }
+    return 0;
 }
 
 // Update command usage when executed
@@ -465,31 +2006,33 @@ void update_command_usage(const char* command) {
     printf("DEBUG: Updating usage for: '%s'\n", command);
 #endif
     
-    // Add to trie if not exists
-    trie_insert(command_trie, command);
-    
-    // Add to history array if not exists
-    bool exists = false;
-    for (int i = 0; i < history_count; i++) {
-        if (strcmp(history_array[i], command) == 0) {
-            exists = true;
-            break;
+    if (history_ring && ring_append(history_ring, command, strlen(command), time(NULL))) {
+        // Every shell (this one included) picks it up from the ring; whoever
+        // finds the ring half full folds it into the cache file
+        if (ring_backlog() > RING_SLOTS / 2) {
+            initialize_autocomplete_from_cache();
+            save_trie_to_file();
+        } else {
+            consume_history_ring();
         }
-    }
-    
-    if (!exists) {
-        history_array = realloc(history_array, (history_count + 1) * sizeof(char*));
-        if (history_array) {
-            history_array[history_count] = strdup(command);
-            history_count++;
+    } else {
+        // (a one-shot update through the ring has not loaded the index)
+        initialize_autocomplete_from_cache();
+        note_command_usage(command, time(NULL));
+        
+        // Save to cache
+        if (persister) {
+            journal_cache_update(command);
+        } else {
+            save_trie_to_file();
         }
     }
     
-    // Update frequency in trie
-    trie_update_frequency(command_trie, command);
-    
-    // Save to cache
-    save_trie_to_file();
+    if (runtime_cache) {
+        // One-shot: no later moment to write back in, so do it here when due
+        runtime_dirty = true;
+        if (!persister && command_trie && writeback_timeout() == 0) write_back_cache();
+    }
     
 #ifdef DEBUG
     printf("DEBUG: Updated and saved\n");
@@ -502,6 +2045,8 @@ void cleanup_autocomplete(void) {
         trie_destroy(command_trie);
         command_trie = NULL;
     }
+    memset(&ghost_cursor, 0, sizeof(ghost_cursor));
+    release_handoff_index();
     
     if (history_array) {
         for (int i = 0; i < history_count; i++) {
@@ -521,12 +2066,785 @@ void cleanup_autocomplete(void) {
         current_prefix = NULL;
     }
     
+    snapshot_close(base_snapshot);
+    base_snapshot = NULL;
+    base_snapshot_tried = false;
+    ring_cursor_ready = false;
+    
     history_count = 0;
     filtered_count = 0;
     current_position = 0;
     is_initialized = false;
 }
 
+// Record one execution: trie usage plus an event (status/cwd/started optional)
+void run_update(const char* command, const char* status, const char* cwd, const char* started) {
+    update_command_usage(command);
+    if (command && *command) {
+        record_event(command, (status && *status) ? atoi(status) : EVENT_STATUS_UNKNOWN,
+                     cwd, started ? atol(started) : 0);
+    }
+}
+
+// Lines inserted per loading step; requests are answered between steps
+#define SERVE_LOAD_SHARD 256
+
+// Most request fields (op + arguments)
+#define SERVE_MAX_FIELDS 8
+
+/**
+ * @struct ProgressiveLoader
+ * @brief Cache (or raw history) lines still to be inserted, newest first
+ */
+typedef struct {
+    char* data;          // Whole file, split into lines in place
+    char** lines;        // Line starts, oldest first
+    int count;           // Number of lines
+    int next;            // Lines [next, count) have been inserted
+    char** storage;      // Backing array; loaded commands fill it from the end
+    int filled;          // Commands placed in storage
+    bool from_history;   // Raw zsh history rather than the trie cache
+} ProgressiveLoader;
+
+// Read a whole file and split it into lines; false if missing or empty
+static bool loader_open(ProgressiveLoader* loader, const char* path, bool from_history) {
+    memset(loader, 0, sizeof(*loader));
+    loader->from_history = from_history;
+    FILE* f = path ? fopen(path, "r") : NULL;
+    if (!f) return false;
+    
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    loader->data = size > 0 ? malloc(size + 1) : NULL;
+    if (!loader->data || fread(loader->data, 1, size, f) != (size_t)size) {
+        fclose(f);
+        free(loader->data);
+        loader->data = NULL;
+        return false;
+    }
+    fclose(f);
+    loader->data[size] = '\0';
+    
+    int capacity = 1;
+    for (long i = 0; i < size; i++) {
+        if (loader->data[i] == '\n') capacity++;
+    }
+    loader->lines = malloc(capacity * sizeof(char*));
+    loader->storage = malloc(capacity * sizeof(char*));
+    if (!loader->lines || !loader->storage) return false;
+    
+    for (char* line = loader->data; line && *line; ) {
+        char* nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+        loader->lines[loader->count++] = line;
+        line = nl ? nl + 1 : NULL;
+    }
+    loader->next = loader->count;
+    return loader->count > 0;
+}
+
+// Insert up to budget more lines, newest first; true once everything is in
+static bool loader_step(ProgressiveLoader* loader, int budget) {
+    while (budget-- > 0 && loader->next > 0) {
+        char* line = loader->lines[--loader->next];
+        char* cmd;
+        int freq = -1;
+        long ts;
+        if (loader->from_history) {
+            cmd = parse_history_line(line, &ts);
+        } else {
+            cmd = parse_cache_line(line, &freq, &ts);
+        }
+        if (!cmd || !*cmd) continue;
+        // Journaled cache: a command's newest line is read first and wins
+        if (!loader->from_history && trie_command_score(command_trie, cmd) >= 0) continue;
+        
+        trie_insert(command_trie, cmd);
+        if (freq >= 0) {
+            trie_set_usage(command_trie, cmd, freq, ts);
+        }
+        loader->storage[loader->count - ++loader->filled] = strdup(cmd);
+    }
+    
+    // Loaded commands stay in history order: the newest part of the array
+    history_array = loader->storage + loader->count - loader->filled;
+    history_count = loader->filled;
+    return loader->next == 0;
+}
+
+// Loading done: move history to the start of its array so it can grow again
+static void loader_finish(ProgressiveLoader* loader) {
+    memmove(loader->storage, history_array, history_count * sizeof(char*));
+    history_array = loader->storage;
+    
+    if (loader->from_history) {
+        // First start: write the cache and seed the event log in time order
+        save_trie_to_file();
+        EventLog* events = eventlog_open(CACHE_DIR);
+        if (events && eventlog_is_empty(events)) {
+            for (int i = 0; i < loader->count; i++) {
+                long started;
+                char* cmd = parse_history_line(loader->lines[i], &started);
+                if (started > 0 && *cmd) {
+                    eventlog_append(events, cmd, "", started, EVENT_STATUS_UNKNOWN);
+                }
+            }
+        }
+        eventlog_close(events);
+    }
+    free(loader->data);
+    free(loader->lines);
+    loader->data = NULL;
+    loader->lines = NULL;
+    loader->storage = NULL;
+}
+
+// Abandon a partial load (shutdown): history_array points into storage
+static void loader_abort(ProgressiveLoader* loader) {
+    if (loader->storage) {
+        for (int i = 0; i < history_count; i++) free(history_array[i]);
+        free(loader->storage);
+        history_array = NULL;
+        history_count = 0;
+    }
+    free(loader->data);
+    free(loader->lines);
+    memset(loader, 0, sizeof(*loader));
+}
+
+/**
+ * @struct PendingUpdate
+ * @brief An update received mid-load, applied once loading is done
+ */
+typedef struct {
+    char* command;
+    char* status;        // NULL if not given
+    char* cwd;
+    char* started;
+} PendingUpdate;
+
+/**
+ * @struct ServeState
+ * @brief What request handlers need to know about the load in progress
+ */
+typedef struct {
+    bool loading;
+    bool restart;                // Hand off to a fresh exec after this batch
+    int total;                   // Lines being loaded
+    PendingUpdate* pending;
+    int pending_count;
+} ServeState;
+
+/**
+ * @struct ServeReply
+ * @brief Answer to one request, encoded afterwards as a line or a frame
+ * 
+ * Binary replies are written by reference at the end of the batch (see
+ * serve_frames()), so a field may only borrow text that outlives it: stored
+ * trie commands, the mapped snapshots, static strings. Anything else, even
+ * request bytes (freed once the request is answered), is copied into owned
+ * and freed once the reply has been written.
+ */
+typedef struct {
+    ProtoStatus status;
+    int count;
+    ProtoField fields[PROTO_MAX_FIELDS];
+    int owned_count;
+    char* owned[PROTO_MAX_FIELDS];
+} ServeReply;
+
+// Add a field that stays valid until the batch is flushed (see ServeReply)
+static void reply_borrow(ServeReply* reply, const char* data, size_t size) {
+    if (reply->count < PROTO_MAX_FIELDS) {
+        ProtoField field = { data ? data : "", data ? (uint32_t)size : 0 };
+        reply->fields[reply->count++] = field;
+    }
+}
+
+// Add an allocated field (ownership taken)
+static void reply_take(ServeReply* reply, char* text) {
+    if (!text) {
+        reply_borrow(reply, NULL, 0);
+    } else if (reply->count < PROTO_MAX_FIELDS) {
+        reply->owned[reply->owned_count++] = text;
+        reply_borrow(reply, text, strlen(text));
+    } else {
+        free(text);
+    }
+}
+
+static void reply_add_int(ServeReply* reply, long value) {
+    char* number = malloc(24);
+    if (number) snprintf(number, 24, "%ld", value);
+    reply_take(reply, number);
+}
+
+static void reply_clear(ServeReply* reply) {
+    for (int i = 0; i < reply->owned_count; i++) free(reply->owned[i]);
+    reply->owned_count = 0;
+    reply->count = 0;
+}
+
+static char* strdup_or_null(const char* text) {
+    return text ? strdup(text) : NULL;
+}
+
+// Follow n bytes of text down from node (NULL if the trie does not have them)
+static TrieNode* walk_trie(TrieNode* node, const char* text, size_t n) {
+    for (size_t i = 0; node && i < n; i++) {
+        unsigned char c = (unsigned char)text[i];
+        node = c < ALPHABET_SIZE ? node->children[c] : NULL;
+    }
+    return node;
+}
+
+// Names looked at per path completion
+#define PATH_CANDIDATES 64
+
+// Offset of the path in the word being typed ("src/ma", "~/.zs", the part
+// after "--out="), or -1 when that word is no plain path
+static int path_argument(const char* prefix) {
+    const char* word = prefix + strlen(prefix);
+    while (word > prefix && word[-1] != ' ' && word[-1] != '\t') word--;
+    const char* path = word;
+    for (const char* p = word; *p; p++) {
+        if (strchr("$*?[`'\"\\", *p)) return -1;  // Expanded or quoted: not a literal name
+        if (*p == '=') path = p + 1;
+    }
+    if (!strchr(path, '/')) return -1;
+    if (path[0] == '~' && path[1] != '/') return -1;  // ~user
+    return (int)(path - prefix);
+}
+
+// Serve mode: complete the path argument being typed from the cached listing
+// of its directory, ranked by how many history commands go through each name
+// (then directories, then the shortest). History's own completion is kept
+// when the name it continues with still exists. Never touches the
+// filesystem: an unlisted directory is queued and NULL (keep history) is
+// returned until it has been read.
+static char* path_ghost_text(const char* prefix, const char* cwd, const char* history) {
+    int start = path_argument(prefix);
+    if (start < 0) return NULL;
+    const char* path = prefix + start;
+    const char* partial = strrchr(path, '/') + 1;
+    size_t partial_len = strlen(partial);
+    int head = (int)(partial - 1 - path);  // Directory part, without the last '/'
+    
+    char dir[PATH_MAX];
+    int n;
+    if (path[0] == '/') {
+        n = snprintf(dir, sizeof(dir), "%.*s", head, path);
+    } else if (path[0] == '~') {
+        const char* home = getenv("HOME");
+        if (!home) return NULL;
+        n = snprintf(dir, sizeof(dir), "%s%.*s", home, head - 1, path + 1);
+    } else if (cwd && cwd[0] == '/') {
+        // "./src/" and "src/" share a listing, "./" is cwd's own
+        const char* relative = path;
+        while (relative[0] == '.' && relative[1] == '/') relative += 2;
+        head -= (int)(relative - path);
+        n = head > 0 ? snprintf(dir, sizeof(dir), "%s/%.*s", cwd, head, relative)
+                     : snprintf(dir, sizeof(dir), "%s", cwd);
+    } else {
+        return NULL;  // Relative, and the client did not say where it is
+    }
+    if (n < 0 || n >= (int)sizeof(dir) - 1) return NULL;
+    if (n == 0) strcpy(dir, "/");
+    
+    PathEntry entries[PATH_CANDIDATES];
+    bool complete;
+    int found = pathcache_lookup(path_cache, dir, partial, partial_len, entries, PATH_CANDIDATES, &complete);
+    if (found <= 0) return NULL;
+    
+    size_t len = strlen(prefix);
+    if (history && strncmp(history, prefix, len) == 0) {
+        const char* rest = history + len;
+        size_t name_len = strcspn(rest, " \t/");
+        for (int i = 0; i < found; i++) {
+            if (entries[i].length == partial_len + name_len &&
+                memcmp(entries[i].name + partial_len, rest, name_len) == 0 &&
+                (rest[name_len] != '/' || entries[i].directory)) {
+                return NULL;
+            }
+        }
+        // Gone (history is stale), unless the listing could not show it
+        if (!complete || found == PATH_CANDIDATES) return NULL;
+    }
+    
+    TrieNode* typed = trie_cursor_seek(command_trie, &ghost_cursor, prefix);
+    int best = 0, best_score = -1;
+    for (int i = 0; i < found; i++) {
+        const PathEntry* entry = &entries[i];
+        TrieNode* node = walk_trie(typed, entry->name + partial_len, entry->length - partial_len);
+        int score = node ? node->subtree_leaves : 0;
+        if (score == best_score && entry->directory != entries[best].directory) {
+            if (!entry->directory) continue;
+        } else if (score < best_score || (score == best_score && entry->length >= entries[best].length)) {
+            continue;
+        }
+        best = i;
+        best_score = score;
+    }
+    const PathEntry* pick = &entries[best];
+    size_t rest = pick->length - partial_len;
+    if (rest == 0 && !pick->directory) return NULL;  // Typed in full already
+    
+    char* text = malloc(len + rest + 2);
+    if (!text) return NULL;
+    memcpy(text, prefix, len);
+    memcpy(text + len, pick->name + partial_len, rest);
+    text[len + rest] = pick->directory ? '/' : '\0';
+    text[len + rest + pick->directory] = '\0';
+    // Accepting it descends there: have that listing ready for the next key
+    if (pick->directory) {
+        char child[PATH_MAX];
+        n = snprintf(child, sizeof(child), "%s/%s", strcmp(dir, "/") ? dir : "", pick->name);
+        if (n > 0 && n < (int)sizeof(child)) pathcache_prefetch(path_cache, child);
+    }
+    return text;
+}
+
+// Speculative table: the ghost text after each next character the trie knows,
+// so a client can answer the following keystroke without a round trip
+static void serve_table(const char* prefix, ServeReply* reply) {
+    static char characters[ALPHABET_SIZE];
+    TrieNode* node = trie_cursor_seek(command_trie, &ghost_cursor, prefix);
+    if (!node) return;
+    
+    size_t len = strlen(prefix);
+    char* next = malloc(len + 2);
+    if (!next) return;
+    memcpy(next, prefix, len);
+    next[len + 1] = '\0';
+    for (int c = ' '; c < ALPHABET_SIZE - 1 && reply->count + 2 <= PROTO_MAX_FIELDS; c++) {
+        if (!node->children[c]) continue;
+        next[len] = (char)c;
+        char* owned;
+        const char* completion = ghost_text_view(next, NULL, &owned);
+        if (completion) {
+            characters[c] = (char)c;
+            reply_borrow(reply, &characters[c], 1);
+            if (owned) {
+                reply_take(reply, owned);
+            } else {
+                reply_borrow(reply, completion, strlen(completion));
+            }
+        }
+    }
+    free(next);
+}
+
+// Answer one request; args are the op's arguments (see ProtoOp)
+static void serve_dispatch(ServeState* state, int op, char** args, int argc, ServeReply* reply) {
+    reply->status = state->loading ? PROTO_PARTIAL : PROTO_OK;
+    reply->count = 0;
+    reply->owned_count = 0;
+    
+    if (op == PROTO_GHOST && argc >= 1) {
+        const char* suffix = argc > 1 ? args[1] : "";
+        char* owned;
+        const char* result = ghost_text_view(args[0], suffix, &owned);
+        char* path = (path_cache && !*suffix) ? path_ghost_text(args[0], argc > 2 ? args[2] : NULL, result) : NULL;
+        if (path) {
+            free(owned);
+            owned = path;
+        }
+        if (owned) {
+            reply_take(reply, owned);
+        } else {
+            reply_borrow(reply, result, result ? strlen(result) : 0);
+        }
+    } else if (op == PROTO_HISTORY && argc >= 3) {
+        long since = (argc > 3 && *args[3]) ? parse_time_arg(args[3], time(NULL)) : 0;
+        history_since = since > 0 ? since : 0;
+        int new_index;
+        char* result = navigate_filtered_history(args[0], args[1], atoi(args[2]), &new_index);
+        reply_take(reply, result ? result : strdup(args[0]));
+        reply_add_int(reply, new_index);
+    } else if (op == PROTO_UPDATE && argc >= 1) {
+        const char* status = argc > 1 ? args[1] : NULL;
+        const char* cwd = argc > 2 ? args[2] : NULL;
+        const char* started = argc > 3 ? args[3] : NULL;
+        // Commands there are likely to name its files next
+        if (path_cache && cwd && cwd[0] == '/') pathcache_prefetch(path_cache, cwd);
+        if (state->loading) {
+            // Saving now would truncate the cache to what is loaded: apply later
+            PendingUpdate* temp = realloc(state->pending,
+                                          (state->pending_count + 1) * sizeof(PendingUpdate));
+            if (temp) {
+                state->pending = temp;
+                PendingUpdate* update = &state->pending[state->pending_count++];
+                update->command = strdup(args[0]);
+                update->status = strdup_or_null(status);
+                update->cwd = strdup_or_null(cwd);
+                update->started = strdup_or_null(started);
+            }
+        } else {
+            run_update(args[0], status, cwd, started);
+        }
+    } else if (op == PROTO_STATS) {
+        reply_add_int(reply, history_count);
+        reply_add_int(reply, state->total);
+    } else if (op == PROTO_TABLE && argc >= 1) {
+        serve_table(args[0], reply);
+    } else if (op == PROTO_TOP) {
+        // Copied: a later update in the same batch may evict a counter
+        int n = (argc > 0 && *args[0]) ? atoi(args[0]) : TOP_DEFAULT_RESULTS;
+        if (n <= 0 || n > TOP_MAX_RESULTS) n = TOP_DEFAULT_RESULTS;
+        HeavyItem items[TOP_MAX_RESULTS];
+        int found = top_overall ? top_commands(argc > 1 ? args[1] : "", items, n) : 0;
+        for (int i = 0; i < found; i++) {
+            reply_take(reply, strdup(items[i].command));
+            reply_add_int(reply, items[i].count);
+        }
+    } else if (op == PROTO_RESTART) {
+        state->restart = true;
+    } else {
+        reply->status = PROTO_ERROR;
+        reply_borrow(reply, "unknown request", strlen("unknown request"));
+    }
+}
+
+// Apply the updates queued while loading
+static void apply_pending_updates(ServeState* state) {
+    for (int i = 0; i < state->pending_count; i++) {
+        PendingUpdate* update = &state->pending[i];
+        run_update(update->command, update->status, update->cwd, update->started);
+        free(update->command);
+        free(update->status);
+        free(update->cwd);
+        free(update->started);
+    }
+    free(state->pending);
+    state->pending = NULL;
+    state->pending_count = 0;
+}
+
+// Line protocol escapes: a backslash, newline or tab inside a field travels
+// as "\\", "\n" or "\t", so every request and reply is exactly one line.
+// Any other backslash is kept as is.
+static void unescape_field(char* field) {
+    char* out = field;
+    for (const char* p = field; *p; p++) {
+        if (*p == '\\' && (p[1] == '\\' || p[1] == 'n' || p[1] == 't')) {
+            p++;
+            *out++ = *p == 'n' ? '\n' : *p == 't' ? '\t' : '\\';
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+// Print a reply field with the line protocol's escapes
+static void print_escaped(const char* data, size_t size) {
+    size_t run = 0;
+    for (size_t i = 0; i < size; i++) {
+        char c = data[i];
+        if (c != '\\' && c != '\n' && c != '\t') continue;
+        fwrite(data + run, 1, i - run, stdout);
+        putchar('\\');
+        putchar(c == '\n' ? 'n' : c == '\t' ? 't' : '\\');
+        run = i + 1;
+    }
+    fwrite(data + run, 1, size - run, stdout);
+}
+
+// Split a request line on tabs and unescape the fields; returns the count
+static int split_request(char* line, char** fields) {
+    int count = 0;
+    fields[count++] = line;
+    for (char* p = line; *p && count < SERVE_MAX_FIELDS; p++) {
+        if (*p == '\t') {
+            *p = '\0';
+            fields[count++] = p + 1;
+        }
+    }
+    for (int i = 0; i < count; i++) unescape_field(fields[i]);
+    return count;
+}
+
+// Answer one request line as "<ok|partial>\t<what the one-shot call prints>\n"
+static void serve_line(ServeState* state, char* line) {
+    char* fields[SERVE_MAX_FIELDS];
+    int n = split_request(line, fields);
+    const char* name = fields[0];
+    int op = strcmp(name, "ghost") == 0   ? PROTO_GHOST
+           : strcmp(name, "history") == 0 ? PROTO_HISTORY
+           : strcmp(name, "update") == 0  ? PROTO_UPDATE
+           : strcmp(name, "stats") == 0   ? PROTO_STATS
+           : strcmp(name, "table") == 0   ? PROTO_TABLE
+           : strcmp(name, "top") == 0     ? PROTO_TOP
+           : strcmp(name, "restart") == 0 ? PROTO_RESTART
+           : 0;
+    // "update" keeps the one-shot call's empty buffer argument
+    int skip = (op == PROTO_UPDATE) ? 2 : 1;
+    
+    ServeReply reply;
+    serve_dispatch(state, n >= skip ? op : 0, fields + skip, n - skip, &reply);
+    if (reply.status == PROTO_ERROR) {
+        printf("error\tunknown request '");
+        print_escaped(name, strlen(name));
+        printf("'\n");
+        reply_clear(&reply);
+        return;
+    }
+    
+    // Same separators as the one-shot output: "entry|index", "loaded/total"
+    const char* separator = op == PROTO_HISTORY ? "|" : op == PROTO_STATS ? "/" : "\t";
+    printf("%s\t", reply.status == PROTO_PARTIAL ? "partial" : "ok");
+    for (int i = 0; i < reply.count; i++) {
+        if (i) fputs(separator, stdout);
+        print_escaped(reply.fields[i].data, reply.fields[i].size);
+    }
+    putchar('\n');
+    reply_clear(&reply);
+}
+
+// Answer one binary frame (arguments copied so they are NUL-terminated); the
+// reply's fields are queued by reference and its allocations kept until flush
+static void serve_frame(ServeState* state, const ProtoFrame* frame, ProtoWriter* writer) {
+    char* args[PROTO_MAX_FIELDS];
+    for (int i = 0; i < frame->count; i++) {
+        args[i] = strndup(frame->fields[i].data, frame->fields[i].size);
+    }
+    
+    static ServeReply reply;
+    serve_dispatch(state, frame->code, args, frame->count, &reply);
+    if (!proto_writer_add(writer, frame->id, (uint8_t)reply.status, reply.fields, reply.count)) {
+        // Too large for a frame (or out of memory): still answer the id
+        proto_writer_add(writer, frame->id, PROTO_ERROR, NULL, 0);
+    }
+    for (int i = 0; i < reply.owned_count; i++) {
+        proto_writer_keep(writer, reply.owned[i]);
+    }
+    
+    for (int i = 0; i < frame->count; i++) free(args[i]);
+}
+
+// Answer every complete frame in buf, in order; returns bytes consumed, -1 if
+// malformed. Query replies borrow trie and snapshot text, so the replies
+// queued so far are written (one writev per run of queries) before an update
+// can touch the trie.
+static long serve_frames(ServeState* state, const uint8_t* buf, size_t size) {
+    static ProtoFrame frame;
+    static ProtoWriter writer;
+    writer.fd = STDOUT_FILENO;
+    long consumed = 0;
+    long got;
+    
+    while ((got = proto_parse(buf + consumed, size - consumed, &frame)) > 0) {
+        if (frame.code == PROTO_UPDATE) proto_writer_flush(&writer);
+        serve_frame(state, &frame, &writer);
+        consumed += got;
+    }
+    proto_writer_flush(&writer);
+    return got < 0 ? -1 : consumed;
+}
+
+/**
+ * Serve requests on stdin while loading progressively.
+ * 
+ * The cache (or, on first start, the raw zsh history file) is inserted
+ * newest first in shards of SERVE_LOAD_SHARD lines; between shards any
+ * pending requests are answered from whatever is loaded so far, flagged
+ * "partial".
+ * 
+ * Line protocol (default): a request is the argv of the one-shot call,
+ * tab-separated, and the reply is "<ok|partial>\t<what the call prints>".
+ * Backslashes, newlines and tabs inside a field are escaped as \\, \n and
+ * \t both ways, so every request line gets exactly one reply line:
+ *   ghost <prefix> [suffix] [cwd]            (cwd: resolves relative path arguments)
+ *   history <prefix> <dir> <idx> [window]
+ *   update "" <cmd> [status] [cwd] [start]   (applied once loading is done)
+ *   stats                                    (<loaded>/<total lines>)
+ *   table <prefix>                           (<char>\t<completion>... pairs)
+ *   top [n] [window]                         (<command>\t<count>... pairs)
+ *   restart                                  (re-exec once the batch is answered)
+ * 
+ * Binary protocol: length-prefixed frames with request ids (see protocol.h),
+ * for clients that pipeline requests or send commands containing tabs,
+ * '|' or newlines.
+ * 
+ * Cache writes never block a request: updates are appended to the cache as
+ * a journal (fdatasync'ed), full rewrites are fsync'ed and renamed into
+ * place, both through io_uring or a worker thread (see persist.h).
+ * 
+ * Path arguments are completed from directory listings cached here and
+ * kept current by inotify (see pathcache.h); a listing is read after the
+ * replies that needed it have been written, never while answering.
+ * Commands whose program is not on $PATH here are demoted (see
+ * execindex.h).
+ * 
+ * The server re-executes itself when its binary is replaced (an upgrade;
+ * ZSH_AUTOCOMPLETE_UPGRADE=0 turns that off) or on a restart request. It
+ * keeps its pipes, so no request is lost, and hands its index over in a
+ * memfd: the new process answers ghost text from it at full quality while
+ * its own trie loads.
+ * 
+ * @param history_path  Raw history used only when there is no cache yet
+ * @param binary        Speak the framed protocol instead of lines
+ * @return 0 when stdin closes, 1 on a malformed frame
+ */
+int serve_requests(const char* history_path, bool binary) {
+    command_trie = trie_create();
+    if (!command_trie) return 1;
+    configure_indexes(command_trie);
+    // Mid-line queries walk whichever side is smaller; built as commands load
+    trie_enable_suffix_index(command_trie);
+    init_storage_paths();
+    ensure_data_directory();
+    refresh_runtime_cache();
+    is_initialized = true;
+    note_serve_binary();
+    adopt_handoff_index();
+    bool upgrade = env_flag_enabled("ZSH_AUTOCOMPLETE_UPGRADE", true);
+    persister = persist_create(env_flag_enabled("ZSH_AUTOCOMPLETE_URING", true));
+    if (persister) {
+        fprintf(stderr, "[DEBUG] serve: cache writes via %s\n", persist_backend(persister));
+    }
+    warm_base_index();
+    if (env_flag_enabled("ZSH_AUTOCOMPLETE_PATHS", true)) {
+        path_cache = pathcache_create(env_flag_enabled("ZSH_AUTOCOMPLETE_INOTIFY", true));
+        if (path_cache) {
+            fprintf(stderr, "[DEBUG] serve: path listings checked via %s\n", pathcache_backend(path_cache));
+        }
+    }
+    
+    ProgressiveLoader loader;
+    ServeState state = { 0 };
+    if (history_ring) {
+        ring_lock(history_ring, false, true);
+        start_ring_cursor();
+    }
+    state.loading = loader_open(&loader, TRIE_DATA_FILE, false);
+    if (history_ring) ring_unlock(history_ring);
+    if (!state.loading) {
+        loader_abort(&loader);
+        state.loading = loader_open(&loader, history_path, true);
+    }
+    if (!state.loading) {
+        loader_abort(&loader);
+        release_handoff_index();
+        start_command_check();
+        start_top_commands();
+    }
+    state.total = loader.count;
+    
+    // A whole frame fits (one byte is kept back for line mode's too-long
+    // check), so a frame is always consumed before the buffer fills up and
+    // no read is ever issued with zero bytes of room
+    static char buffer[PROTO_MAX_FRAME + 1];
+    size_t used = 0;
+    bool open = true;
+    bool skip_line = false;  // Inside a too-long request line, already answered
+    int status = 0;
+    
+    // Closed mid-load with updates queued: keep loading to apply them
+    while (open || (state.loading && state.pending_count > 0)) {
+        if (state.loading && loader_step(&loader, open ? SERVE_LOAD_SHARD : INT_MAX)) {
+            loader_finish(&loader);
+            state.loading = false;
+            release_handoff_index();
+            consume_history_ring();
+            start_command_check();
+            start_top_commands();
+            fprintf(stderr, "[DEBUG] serve: loaded %d commands\n", command_trie->total_commands);
+            apply_pending_updates(&state);
+        }
+        if (!open) continue;
+        
+        // Wait for requests only once nothing is left to load; finished
+        // cache writes and changed directories wake the loop too
+        struct pollfd pfds[3] = {
+            { .fd = STDIN_FILENO, .events = POLLIN },
+            { .fd = persister ? persist_fd(persister) : -1, .events = POLLIN },
+            { .fd = path_cache ? pathcache_fd(path_cache) : -1, .events = POLLIN },
+        };
+        // Write the runtime copy back once it is due and nothing is asked
+        int ready = poll(pfds, 3, state.loading ? 0 : writeback_timeout());
+        if (ready == 0 && !state.loading && writeback_timeout() == 0) write_back_cache();
+        if (ready <= 0) continue;
+        if ((pfds[1].revents & POLLIN) && persist_reap(persister) == 0) finish_write_back();
+        if (pfds[2].revents & POLLIN) {
+            pathcache_events(path_cache);
+            pathcache_refresh(path_cache);
+        }
+        if (!(pfds[0].revents & (POLLIN | POLLHUP))) continue;
+        
+        ssize_t got = read(STDIN_FILENO, buffer + used, sizeof(buffer) - used - 1);
+        if (got <= 0) {
+            open = false;
+            continue;
+        }
+        used += got;
+        // Answer with what other shells ran in the meantime
+        if (!state.loading) consume_history_ring();
+        
+        size_t consumed;
+        if (binary) {
+            long n = serve_frames(&state, (const uint8_t*)buffer, used);
+            if (n < 0) {
+                fprintf(stderr, "[DEBUG] serve: malformed frame, closing\n");
+                open = false;
+                status = 1;
+                continue;
+            }
+            consumed = n;
+        } else {
+            char* start = buffer;
+            char* nl;
+            while ((nl = memchr(start, '\n', buffer + used - start))) {
+                *nl = '\0';
+                if (!skip_line) serve_line(&state, start);
+                skip_line = false;
+                start = nl + 1;
+            }
+            consumed = start - buffer;
+            if (used - consumed == sizeof(buffer) - 1) {
+                // One reply per request: the rest of the line is dropped
+                if (!skip_line) printf("error\trequest too long\n");
+                skip_line = true;
+                consumed = used;
+            }
+            // One flush per batch: pipelined lines share a write
+            fflush(stdout);
+        }
+        used -= consumed;
+        memmove(buffer, buffer + consumed, used);
+        // Replies are out: now read the listings they found missing, and
+        // re-flag commands if a program was installed or removed
+        if (path_cache) pathcache_refresh(path_cache);
+        if (exec_index && exec_index_refresh(exec_index)) trie_check_commands(command_trie);
+        // Nothing half read or queued: a new binary can take over the pipes
+        if (!state.loading && used == 0 &&
+            (state.restart || (upgrade && serve_binary_replaced()))) {
+            state.restart = false;
+            hand_off_server(history_path, binary);
+        }
+    }
+    
+    if (state.loading) {
+        loader_abort(&loader);
+    } else if (runtime_dirty) {
+        write_back_cache();
+    }
+    if (persister) {
+        persist_drain(persister);
+        finish_write_back();
+    }
+    persist_destroy(persister);
+    persister = NULL;
+    pathcache_destroy(path_cache);
+    path_cache = NULL;
+    exec_index_destroy(exec_index);
+    exec_index = NULL;
+    stop_top_commands();
+    cleanup_autocomplete();
+    return status;
+}
+
 int main(int argc, char *argv[]) {
     fprintf(stderr, "[DEBUG] autocomplete main() invoked with argc=%d\n", argc);
     for (int i = 0; i < argc; i++) {
@@ -540,34 +2858,96 @@ int main(int argc, char *argv[]) {
     char* current_buffer = (argc > 2) ? argv[2] : "";
     char* param3 = (argc > 3) ? argv[3] : "";
     
+    // Snapshot merging works on files only; skip loading the user's cache
+    if (strcmp(operation, "merge") == 0) {
+        return merge_snapshots(argc, argv);
+    }
+    if (strcmp(operation, "pack") == 0) {
+        return pack_snapshot(argc, argv);
+    }
+    // Write the runtime copy back to the home copy (shell exit); nothing to
+    // load when there is none or it is already in sync
+    if (strcmp(operation, "sync") == 0) {
+        init_storage_paths();
+        if (!runtime_cache || (!runtime_dirty && ring_backlog() == 0)) return 0;
+        initialize_autocomplete_from_cache();
+        write_back_cache();
+        cleanup_autocomplete();
+        return 0;
+    }
+    // The server loads the cache itself, progressively
+    if (strcmp(operation, "serve") == 0) {
+        bool binary = argc > 2 && strcmp(argv[2], "--binary") == 0;
+        return serve_requests(argc > 2 + binary ? argv[2 + binary] : NULL, binary);
+    }
+    
     // Initialise system differently depending on operation so we don't block on stdin.
+    // An update through the history ring needs no index at all.
+    init_storage_paths();
     if (strcmp(operation, "init") == 0) {
         initialize_autocomplete_from_stdin();
-    } else {
+    } else if (strcmp(operation, "update") != 0 || !history_ring) {
         initialize_autocomplete_from_cache();
     }
     char* result = NULL;
     if (strcmp(operation, "ghost") == 0) {
-        // Get ghost text completion
-        result = get_ghost_text(current_buffer);
+        // Get ghost text completion (param3 = text right of the cursor, if any)
+        result = get_ghost_text_around(current_buffer, param3);
         if (result) {
             printf("%s", result);
         }
+    } else if (strcmp(operation, "history") == 0 && strncmp(current_buffer, "--", 2) == 0) {
+        // Time-range query: history --since <time> [--until <time>] [--prefix <text>]
+        if (print_history_range(argc, argv) != 0) {
+            cleanup_autocomplete();
+            return 1;
+        }
     } else if (strcmp(operation, "history") == 0) {
-        // Navigate filtered history
+        // Navigate filtered history (optional argv[5]: only commands used since then)
         const char* direction = param3;
         int start_index = 0;
         if (argc > 4) {
             start_index = atoi(argv[4]);
         }
+        if (argc > 5 && *argv[5]) {
+            long since = parse_time_arg(argv[5], time(NULL));
+            history_since = since > 0 ? since : 0;
+        }
         int new_index;
         result = navigate_filtered_history(current_buffer, direction, start_index, &new_index);
         if (result) {
             printf("%s|%d", result, new_index);
         }
     } else if (strcmp(operation, "update") == 0) {
-        // Update command usage
-        update_command_usage(param3);
+        // Update command usage; optional argv[4..6] describe the execution
+        // for the event log: exit status, working directory, start time
+        run_update(param3, argc > 4 ? argv[4] : NULL, argc > 5 ? argv[5] : NULL,
+                   argc > 6 ? argv[6] : NULL);
+    } else if (strcmp(operation, "events") == 0) {
+        // Per-execution log: events [--since <time>]
+        if (print_events(argc, argv) != 0) {
+            cleanup_autocomplete();
+            return 1;
+        }
+    } else if (strcmp(operation, "match") == 0) {
+        // Glob search over history: match <pattern> [k]
+        if (print_glob_matches(current_buffer, atoi(param3)) != 0) {
+            cleanup_autocomplete();
+            return 1;
+        }
+    } else if (strcmp(operation, "top") == 0) {
+        // Most used commands: top [n] [window]
+        if (print_top_commands(argc, argv) != 0) {
+            cleanup_autocomplete();
+            return 1;
+        }
+    } else if (strcmp(operation, "freeze") == 0) {
+        // Snapshot the index: freeze <path> (install as $ZSH_AUTOCOMPLETE_BASE)
+        if (!*current_buffer || !snapshot_write_trie(command_trie, current_buffer)) {
+            fprintf(stderr, "autocomplete: usage: freeze <snapshot path>\n");
+            cleanup_autocomplete();
+            return 1;
+        }
     } else if (strcmp(operation, "init") == 0) {
         // Just initialize (already done above)
     } else {
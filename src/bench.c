@@ -0,0 +1,2469 @@
+/**
+ * @file bench.c
+ * @brief Micro-benchmarks for the trie indexes
+ *
+ * Builds tries in-process from a history file (one command per line) or from
+ * a synthetic, pipeline-heavy history, and reports memory use and query cost.
+ * Timings use CLOCK_MONOTONIC and are averaged over many queries so they are
+ * comparable between builds on the same machine.
+ *
+ * Usage:
+ *   bench segments [history_file]   Segment index memory overhead + query cost
+ *   bench events [history_file]     Event log bytes per event + scan throughput
+ *   bench snapshot [history_file]   Frozen snapshot size, query cost and agreement
+ *   bench protocol [history_file]   Line vs binary serve protocol latency/throughput
+ *   bench persist [history_file]    Loop stalls while saving: blocking vs thread vs io_uring
+ *   bench cold [history_file]       First-query latency after page-cache eviction
+ *   bench heat [history_file]       Page faults per keystroke: command-order vs heat-packed snapshot
+ *   bench ring [history_file]       Concurrent shells: whole-file rewrites vs shared ring appends
+ *   bench simd [history_file]       Scanning kernels per instruction set (scalar/SSE2/AVX2/AVX-512)
+ *   bench templates [history_file]  Index growth with and without volatile-token templates
+ *   bench paths                     Path completion: readdir per keystroke vs cached listings
+ *   bench missing [history_file]    Suggestions for programs not on $PATH: leaf flags vs stat per query
+ *   bench top [history_file]        Top-N commands: Space-Saving summary vs a full trie scan
+ *   bench typing [history_file]     Per-keystroke prefix lookup: walk from the root vs resumed cursor
+ *   bench handoff [history_file]    Server restart: rebuilding the trie vs adopting a handed-over snapshot
+ *
+ * @author sbeeredd04
+ * @date 2025
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../include/trie.h"
+#include "../include/eventlog.h"
+#include "../include/snapshot.h"
+#include "../include/protocol.h"
+#include "../include/persist.h"
+#include "../include/ring.h"
+#include "../include/simd.h"
+#include "../include/template.h"
+#include "../include/pathcache.h"
+#include "../include/execindex.h"
+#include "../include/heavy.h"
+#include <poll.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** Commands generated when no history file is given */
+#define SYNTHETIC_COMMANDS 5000
+
+/** Queries timed per measurement */
+#define QUERY_ROUNDS 20000
+
+/** Synthetic executions encoded by the event benchmark */
+#define BENCH_EVENTS 1000000
+
+/** Distinct working directories in the synthetic event stream */
+#define BENCH_CWDS 40
+
+/** Requests timed per protocol measurement (fewer for the costly ops) */
+#define PROTOCOL_ROUNDS 20000
+
+/** Requests per write when pipelining */
+#define PROTOCOL_BATCH 48
+
+/** Updates (journal appends) timed per persistence backend */
+#define PERSIST_ROUNDS 1000
+
+/** A full cache rewrite is queued every this many updates */
+#define PERSIST_SAVE_EVERY 100
+
+/** Size of the rewritten cache (history lines repeated) */
+#define PERSIST_CACHE_BYTES (8 << 20)
+
+/** Cold (and warm) first queries timed per storage format */
+#define COLD_RUNS 15
+
+/** Files the sharded snapshot is split into */
+#define COLD_SHARDS 16
+
+/** Where the cold-start files live: disk-backed, unlike /tmp on many systems */
+#define COLD_DIR "/var/tmp"
+
+/** Commands in the heat benchmark's snapshot (history lines are varied to reach it) */
+#define HEAT_COMMANDS 200000
+
+/** Commands typed to record heat, then typed again (other picks) to measure */
+#define HEAT_TRAIN 2000
+#define HEAT_TYPED 500
+
+/** Concurrent writer processes in the ring benchmark */
+#define RING_WRITERS 8
+
+/** Updates per writer: ring appends (all of them fit in one lap), whole-file rewrites */
+#define RING_APPENDS 500
+#define RING_REWRITES 200
+
+/** Cache-format text parsed per line-scan measurement */
+#define SIMD_SCAN_BYTES (8 << 20)
+
+/** Prefix compares timed per instruction set */
+#define SIMD_COMPARES 1000000
+
+/** Best-completion queries timed per instruction set (each ranks a whole subtree) */
+#define SIMD_RANK_ROUNDS 200
+
+// Synthetic noise: one volatile command (PID, hash, host...) per history line
+#define TEMPLATE_NOISE_EVERY 1
+
+// Prefix queries against the noisy history, per trie
+#define TEMPLATE_QUERIES 5000
+
+// Synthetic tree for path completion: directories, and files in each
+#define PATH_BENCH_DIRS 8
+#define PATH_BENCH_FILES 2000
+
+// Partial names completed per variant
+#define PATH_BENCH_QUERIES 20000
+
+// Every this many history lines also gets a twin run through a program this
+// host lacks (its command word with a suffix), used twice as often
+#define MISSING_EVERY 4
+
+// Executions streamed into the trie and the summaries (skewed towards the
+// first lines), spread over TOP_STREAM_DAYS; N asked for; queries timed
+#define TOP_STREAM 500000
+#define TOP_STREAM_DAYS 14
+#define TOP_N 10
+#define TOP_QUERIES 2000
+
+// Commands typed key by key; every TYPING_BACKSPACE_EVERY-th key is a typo
+// fixed with a backspace
+#define TYPING_COMMANDS 500
+#define TYPING_BACKSPACE_EVERY 7
+
+// Restarts timed per measurement
+#define HANDOFF_ROUNDS 20
+
+// Monotonic clock in nanoseconds
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Deterministic xorshift PRNG so runs are repeatable
+static unsigned int rng_state = 2463534242u;
+static unsigned int rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static const char* SOURCES[] = {
+    "cat app%d.log", "dmesg", "ps aux", "journalctl -u nginx", "ls -la src%d",
+    "git log --oneline", "kubectl get pods -n team%d", "docker ps -a", "env",
+    "find . -name '*.c'", "history", "du -sh build%d",
+};
+static const char* STAGES[] = {
+    "grep -i error", "grep -v debug", "sort", "sort -rn", "uniq -c", "wc -l",
+    "head -n 20", "tail -f", "awk '{print $1}'", "less", "xargs rm -f",
+    "cut -d: -f1", "sed 's/foo/bar/g'", "tee out%d.txt", "jq .items",
+};
+static const char* CHAINS[] = { " | ", " | ", " | ", " && ", "; " };
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+// Append one formatted template to buf, filling %d with a small random number
+static size_t append_template(char* buf, size_t used, size_t cap, const char* tmpl) {
+    int written = snprintf(buf + used, cap - used, tmpl, (int)(rng_next() % 50));
+    return written > 0 ? used + written : used;
+}
+
+/**
+ * Load history lines from a file, or generate synthetic pipelines.
+ *
+ * @param path   History file, or NULL for synthetic data
+ * @param count  Output: number of lines
+ * @return Array of newly allocated lines (free with free_lines())
+ */
+static char** load_lines(const char* path, int* count) {
+    int capacity = SYNTHETIC_COMMANDS;
+    char** lines = malloc(capacity * sizeof(char*));
+    *count = 0;
+    if (!lines) return NULL;
+
+    if (!path) {
+        char buf[MAX_COMMAND_LENGTH];
+        for (int i = 0; i < SYNTHETIC_COMMANDS; i++) {
+            size_t used = append_template(buf, 0, sizeof(buf), SOURCES[rng_next() % COUNT(SOURCES)]);
+            int stages = rng_next() % 4;
+            for (int s = 0; s < stages; s++) {
+                used = append_template(buf, used, sizeof(buf), CHAINS[rng_next() % COUNT(CHAINS)]);
+                used = append_template(buf, used, sizeof(buf), STAGES[rng_next() % COUNT(STAGES)]);
+            }
+            lines[(*count)++] = strdup(buf);
+        }
+        return lines;
+    }
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        free(lines);
+        return NULL;
+    }
+
+    char* line = NULL;
+    size_t len = 0;
+    ssize_t read;
+    while ((read = getline(&line, &len, file)) != -1) {
+        if (read > 0 && line[read - 1] == '\n') line[--read] = '\0';
+        if (read == 0) continue;
+        if (*count >= capacity) {
+            capacity *= 2;
+            char** temp = realloc(lines, capacity * sizeof(char*));
+            if (!temp) break;
+            lines = temp;
+        }
+        lines[(*count)++] = strdup(line);
+    }
+    free(line);
+    fclose(file);
+    return lines;
+}
+
+static void free_lines(char** lines, int count) {
+    for (int i = 0; i < count; i++) free(lines[i]);
+    free(lines);
+}
+
+// Build a trie over lines, optionally with the segment index
+static Trie* build_trie(char** lines, int count, bool segments, double* build_ms) {
+    double start = now_ns();
+    Trie* trie = trie_create();
+    if (trie && segments) trie_enable_segments(trie);
+    for (int i = 0; trie && i < count; i++) {
+        trie_insert(trie, lines[i]);
+    }
+    *build_ms = (now_ns() - start) / 1e6;
+    return trie;
+}
+
+// Average latency of trie_get_best_completion over short prefixes of lines
+static double time_line_queries(Trie* trie, char** lines, int count) {
+    char prefix[8];
+    double start = now_ns();
+    for (int q = 0; q < QUERY_ROUNDS; q++) {
+        snprintf(prefix, sizeof(prefix), "%.4s", lines[q % count]);
+        free(trie_get_best_completion(trie, prefix));
+    }
+    return (now_ns() - start) / QUERY_ROUNDS;
+}
+
+// Average latency of segment completions for the second segment of lines
+static double time_segment_queries(Trie* trie, char** lines, int count, int* hits) {
+    char prefix[8];
+    int starts[MAX_SEGMENTS];
+    int queries = 0;
+    *hits = 0;
+
+    double start = now_ns();
+    for (int q = 0; queries < QUERY_ROUNDS && q < QUERY_ROUNDS * 4; q++) {
+        const char* line = lines[q % count];
+        if (trie_segment_starts(line, starts, MAX_SEGMENTS) == 0) continue;
+        snprintf(prefix, sizeof(prefix), "%.3s", line + starts[0]);
+        char* result = trie_get_best_segment_completion(trie, prefix);
+        if (result) (*hits)++;
+        free(result);
+        queries++;
+    }
+    return queries ? (now_ns() - start) / queries : 0;
+}
+
+static int bench_segments(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+
+    double plain_ms, seg_ms;
+    Trie* plain = build_trie(lines, count, false, &plain_ms);
+    Trie* seg = build_trie(lines, count, true, &seg_ms);
+    if (!plain || !seg) return 1;
+
+    TrieIndexStats primary, segments;
+    trie_index_stats(plain->root, &primary);
+    trie_index_stats(seg->segment_root, &segments);
+
+    int hits;
+    double line_ns = time_line_queries(plain, lines, count);
+    double line_seg_ns = time_line_queries(seg, lines, count);
+    double segment_ns = time_segment_queries(seg, lines, count, &hits);
+
+    printf("history lines        : %d (%s)\n", count, path ? path : "synthetic");
+    printf("unique commands      : %d\n", plain->total_commands);
+    printf("primary index        : %ld nodes, %.2f MB\n", primary.nodes, primary.bytes / 1048576.0);
+    printf("segment index        : %ld nodes, %ld refs, %.2f MB (+%.1f%%)\n",
+           segments.nodes, segments.refs, segments.bytes / 1048576.0,
+           100.0 * segments.bytes / primary.bytes);
+    printf("build time           : %.2f ms plain, %.2f ms with segments\n", plain_ms, seg_ms);
+    printf("line query           : %.0f ns plain, %.0f ns with segments\n", line_ns, line_seg_ns);
+    printf("segment query        : %.0f ns (%d hits)\n", segment_ns, hits);
+
+    trie_destroy(plain);
+    trie_destroy(seg);
+    free_lines(lines, count);
+    return 0;
+}
+
+// Sum a decoded block so the compiler cannot drop the decode
+static uint64_t checksum_events(const EventRecord* events, int count) {
+    uint64_t sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += events[i].command_id + events[i].cwd_id + events[i].timestamp + events[i].status;
+    }
+    return sum;
+}
+
+static int bench_events(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+
+    // Synthetic executions: commands drawn from the history with a bias
+    // towards recent lines, a few seconds to minutes apart, mostly status 0
+    EventRecord* events = malloc(BENCH_EVENTS * sizeof(EventRecord));
+    if (!events) return 1;
+    int64_t t = 1700000000;
+    for (int i = 0; i < BENCH_EVENTS; i++) {
+        unsigned r = rng_next();
+        events[i].command_id = (r & 1) ? r % count : count - 1 - (rng_next() % 64) % count;
+        events[i].cwd_id = rng_next() % BENCH_CWDS;
+        t += 1 + rng_next() % 300;
+        events[i].timestamp = t;
+        events[i].status = (rng_next() % 10) ? 0 : 1 + rng_next() % 3;
+    }
+
+    // Encode into sealed blocks, back to back as in events.log
+    size_t capacity = (size_t)BENCH_EVENTS * sizeof(EventRecord);
+    uint8_t* log = malloc(capacity);
+    size_t used = 0;
+    double start = now_ns();
+    for (int i = 0; log && i < BENCH_EVENTS; i += EVENT_BLOCK_SIZE) {
+        int n = BENCH_EVENTS - i < EVENT_BLOCK_SIZE ? BENCH_EVENTS - i : EVENT_BLOCK_SIZE;
+        uint32_t size;
+        void* block = eventlog_encode_block(events + i, n, &size);
+        if (!block || used + size > capacity) return 1;
+        memcpy(log + used, block, size);
+        used += size;
+        free(block);
+    }
+    double encode_ms = (now_ns() - start) / 1e6;
+    if (!log) return 1;
+
+    // Scan it the way eventlog_scan() does
+    EventRecord* decoded = malloc(EVENT_BLOCK_SIZE * sizeof(EventRecord));
+    uint64_t sum = 0;
+    long seen = 0;
+    start = now_ns();
+    for (size_t offset = 0; decoded && offset < used;) {
+        uint32_t size;
+        int n = eventlog_decode_block(log + offset, used - offset, decoded, &size);
+        if (n < 0) {
+            fprintf(stderr, "bench: decode failed at offset %zu\n", offset);
+            return 1;
+        }
+        sum += checksum_events(decoded, n);
+        seen += n;
+        offset += size;
+    }
+    double scan_ms = (now_ns() - start) / 1e6;
+    bool ok = seen == BENCH_EVENTS && sum == checksum_events(events, BENCH_EVENTS);
+
+    printf("events               : %d over %d commands, %d cwds\n", BENCH_EVENTS, count, BENCH_CWDS);
+    printf("encoded size         : %.2f MB (%.2f bytes/event, %zu-byte rows)\n",
+           used / 1048576.0, (double)used / BENCH_EVENTS, sizeof(EventRecord));
+    printf("encode time          : %.1f ms\n", encode_ms);
+    printf("scan time            : %.1f ms (%.0f M events/s, %.0f MB/s encoded)\n",
+           scan_ms, BENCH_EVENTS / scan_ms / 1e3, used / 1048576.0 / (scan_ms / 1e3));
+    printf("round trip           : %s\n", ok ? "ok" : "MISMATCH");
+
+    free(decoded);
+    free(log);
+    free(events);
+    free_lines(lines, count);
+    return ok ? 0 : 1;
+}
+
+// Frequency of the command a trie completion resolves to
+static int trie_frequency(Trie* trie, const char* command) {
+    TrieNode* node = trie->root;
+    for (const char* p = command; node && *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        node = c < ALPHABET_SIZE ? node->children[c] : NULL;
+    }
+    return node ? node->frequency : -1;
+}
+
+static int bench_snapshot(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+
+    double build_ms;
+    Trie* trie = build_trie(lines, count, false, &build_ms);
+    if (!trie) return 1;
+
+    char snap_path[64];
+    snprintf(snap_path, sizeof(snap_path), "/tmp/bench-snapshot-%ld.idx", (long)getpid());
+    double start = now_ns();
+    bool written = snapshot_write_trie(trie, snap_path);
+    double freeze_ms = (now_ns() - start) / 1e6;
+    Snapshot* snap = written ? snapshot_open(snap_path) : NULL;
+    unlink(snap_path);
+    if (!snap) {
+        fprintf(stderr, "bench: snapshot write/open failed\n");
+        return 1;
+    }
+
+    // Agreement: every command is found, and the best completion for a short
+    // prefix has the same frequency as the trie's pick
+    int missing = 0, disagree = 0;
+    char prefix[8];
+    for (int i = 0; i < count; i++) {
+        if (snapshot_lookup(snap, lines[i]) < 0) missing++;
+        snprintf(prefix, sizeof(prefix), "%.4s", lines[i]);
+        char* best = trie_get_best_completion(trie, prefix);
+        long leaf = snapshot_best_completion(snap, prefix);
+        if (!best || leaf < 0 || (int)snap->leaves[leaf].frequency != trie_frequency(trie, best)) {
+            disagree++;
+        }
+        free(best);
+    }
+
+    double trie_ns = time_line_queries(trie, lines, count);
+    volatile long sink = 0;
+    start = now_ns();
+    for (int q = 0; q < QUERY_ROUNDS; q++) {
+        snprintf(prefix, sizeof(prefix), "%.4s", lines[q % count]);
+        sink += snapshot_best_completion(snap, prefix);
+    }
+    double snap_ns = (now_ns() - start) / QUERY_ROUNDS;
+
+    // Exact lookups through the hash, then through the same mapping with the
+    // hash hidden (binary search of the order section); misses are commands
+    // with one byte changed
+    Snapshot sorted = *snap;
+    sorted.displacements = NULL;
+    sorted.slots = NULL;
+    char** misses = malloc(count * sizeof(char*));
+    for (int i = 0; misses && i < count; i++) {
+        misses[i] = strdup(lines[i]);
+        if (misses[i]) misses[i][0] ^= 0x40;
+    }
+    double hit_ns[2] = {0, 0}, miss_ns[2] = {0, 0};
+    for (int mode = 0; misses && mode < 2; mode++) {
+        const Snapshot* s = mode ? &sorted : snap;
+        start = now_ns();
+        for (int q = 0; q < QUERY_ROUNDS; q++) sink += snapshot_lookup(s, lines[q % count]);
+        hit_ns[mode] = (now_ns() - start) / QUERY_ROUNDS;
+        start = now_ns();
+        for (int q = 0; q < QUERY_ROUNDS; q++) sink += snapshot_lookup(s, misses[q % count]);
+        miss_ns[mode] = (now_ns() - start) / QUERY_ROUNDS;
+    }
+    (void)sink;
+    if (misses) free_lines(misses, count);
+
+    TrieIndexStats primary;
+    trie_index_stats(trie->root, &primary);
+    printf("history lines        : %d (%s)\n", count, path ? path : "synthetic");
+    printf("unique commands      : %d\n", snap->header->leaf_count);
+    printf("trie                 : %ld nodes, %.2f MB\n", primary.nodes, primary.bytes / 1048576.0);
+    printf("snapshot             : %u nodes, %.2f MB file (%.1fx smaller)\n",
+           snap->header->node_count, snap->size / 1048576.0, (double)primary.bytes / snap->size);
+    printf("freeze time          : %.2f ms\n", freeze_ms);
+    printf("best completion      : %.0f ns trie, %.0f ns snapshot\n", trie_ns, snap_ns);
+    if (snap->slots) {
+        const SnapshotHeader* h = snap->header;
+        printf("exact-match hash     : %u buckets (%.2f bits/command), %u slots, %.2f MB\n",
+               h->hash_buckets, 16.0 * h->hash_buckets / h->leaf_count, h->hash_slots,
+               (h->hash_buckets * sizeof(uint16_t) + h->hash_slots * sizeof(SnapshotSlot)) / 1048576.0);
+    }
+    printf("exact lookup         : %.0f ns hash, %.0f ns binary search (hits)\n", hit_ns[0], hit_ns[1]);
+    printf("exact miss           : %.0f ns hash, %.0f ns binary search\n", miss_ns[0], miss_ns[1]);
+    printf("agreement            : %d missing, %d disagreeing prefixes\n", missing, disagree);
+
+    snapshot_close(snap);
+    trie_destroy(trie);
+    free_lines(lines, count);
+    return missing || disagree ? 1 : 0;
+}
+
+/**
+ * @struct ServerProcess
+ * @brief A spawned "autocomplete serve" child and its pipes
+ */
+typedef struct {
+    pid_t pid;
+    int to_server;
+    int from_server;
+    char buffer[PROTO_MAX_FRAME];
+    size_t used;
+} ServerProcess;
+
+// Start ./autocomplete serve [--binary] with its cache under cache_home
+static bool server_start(ServerProcess* server, bool binary, const char* cache_home,
+                         const char* history) {
+    int in[2], out[2];
+    if (pipe(in) != 0 || pipe(out) != 0) return false;
+    server->used = 0;
+    server->pid = fork();
+    if (server->pid < 0) return false;
+    if (server->pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDERR_FILENO);
+        close(in[1]);
+        close(out[0]);
+        setenv("XDG_CACHE_HOME", cache_home, 1);
+        setenv("ZSH_AUTOCOMPLETE_BASE", "", 1);
+        if (binary) {
+            execl("./autocomplete", "autocomplete", "serve", "--binary", history, (char*)NULL);
+        } else {
+            execl("./autocomplete", "autocomplete", "serve", history, (char*)NULL);
+        }
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    server->to_server = in[1];
+    server->from_server = out[0];
+    return true;
+}
+
+static void server_stop(ServerProcess* server) {
+    close(server->to_server);
+    close(server->from_server);
+    waitpid(server->pid, NULL, 0);
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+    for (size_t done = 0; done < size; ) {
+        ssize_t n = write(fd, (const char*)data + done, size - done);
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+// Read until count replies (lines or frames) have arrived; false on EOF
+static bool server_read_replies(ServerProcess* server, bool binary, int count,
+                                bool* partial) {
+    *partial = false;
+    while (count > 0) {
+        size_t consumed = 0;
+        for (;;) {
+            const uint8_t* p = (const uint8_t*)server->buffer + consumed;
+            size_t left = server->used - consumed;
+            if (binary) {
+                static ProtoFrame frame;
+                long got = proto_parse(p, left, &frame);
+                if (got < 0) return false;
+                if (got == 0) break;
+                *partial |= frame.code == PROTO_PARTIAL;
+                consumed += got;
+            } else {
+                const uint8_t* nl = memchr(p, '\n', left);
+                if (!nl) break;
+                *partial |= strncmp((const char*)p, "partial", 7) == 0;
+                consumed += nl - p + 1;
+            }
+            if (--count == 0) break;
+        }
+        server->used -= consumed;
+        memmove(server->buffer, server->buffer + consumed, server->used);
+        if (count == 0) break;
+        ssize_t n = read(server->from_server, server->buffer + server->used,
+                         sizeof(server->buffer) - server->used);
+        if (n <= 0) return false;
+        server->used += n;
+    }
+    return true;
+}
+
+// Append one request in either protocol
+static void encode_request(ProtoBuffer* out, bool binary, uint32_t id, ProtoOp op,
+                           const char* arg0, const char* arg1, const char* arg2) {
+    static const char* names[] = { "", "ghost", "history", "update", "stats", "table" };
+    const char* args[] = { arg0, arg1, arg2 };
+    int argc = arg2 ? 3 : arg1 ? 2 : arg0 ? 1 : 0;
+    if (binary) {
+        ProtoField fields[3];
+        for (int i = 0; i < argc; i++) fields[i] = proto_field(args[i]);
+        proto_append(out, id, op, fields, argc);
+        return;
+    }
+    // Fields escaped as the plugin does (see serve_requests())
+    char line[2 * MAX_COMMAND_LENGTH + 64];
+    int len = snprintf(line, sizeof(line), "%s", names[op]);
+    for (int i = 0; i < argc; i++) {
+        line[len++] = '\t';
+        for (const char* p = args[i]; *p && len < (int)sizeof(line) - 3; p++) {
+            if (*p == '\\' || *p == '\n' || *p == '\t') {
+                line[len++] = '\\';
+                line[len++] = *p == '\n' ? 'n' : *p == '\t' ? 't' : '\\';
+            } else {
+                line[len++] = *p;
+            }
+        }
+    }
+    line[len++] = '\n';
+    if (out->size + len > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity * 2 : 4096;
+        uint8_t* data = realloc(out->data, capacity);
+        if (!data) return;
+        out->data = data;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->size, line, len);
+    out->size += len;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_strings(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Fill out with PROTOCOL_BATCH requests for keystrokes from q on: stats only
+// (protocol cost alone) or ghost + history + table per keystroke
+static int encode_batch(ProtoBuffer* out, bool binary, bool mixed, char** lines, int count, int q) {
+    char prefix[8];
+    int batch = 0;
+    out->size = 0;
+    while (batch < PROTOCOL_BATCH) {
+        if (!mixed) {
+            encode_request(out, binary, batch++, PROTO_STATS, NULL, NULL, NULL);
+            continue;
+        }
+        snprintf(prefix, sizeof(prefix), "%.4s", lines[(q + batch / 3) % count]);
+        encode_request(out, binary, batch++, PROTO_GHOST, prefix, NULL, NULL);
+        encode_request(out, binary, batch++, PROTO_HISTORY, prefix, "up", "0");
+        encode_request(out, binary, batch++, PROTO_TABLE, prefix, NULL, NULL);
+    }
+    return batch;
+}
+
+// Time rounds requests of one op sent one at a time; prints p50/p99
+static bool measure_latency(ServerProcess* server, bool binary, ProtoOp op, int rounds,
+                            char** lines, int count) {
+    double* samples = malloc(rounds * sizeof(double));
+    ProtoBuffer out = { 0 };
+    bool partial, ok = samples != NULL;
+    char prefix[8];
+    for (int q = 0; ok && q < rounds; q++) {
+        snprintf(prefix, sizeof(prefix), "%.4s", lines[q % count]);
+        double start = now_ns();
+        out.size = 0;
+        encode_request(&out, binary, q, op, op == PROTO_STATS ? NULL : prefix, NULL, NULL);
+        ok = write_all(server->to_server, out.data, out.size) &&
+             server_read_replies(server, binary, 1, &partial);
+        samples[q] = now_ns() - start;
+    }
+    if (ok) {
+        qsort(samples, rounds, sizeof(double), compare_doubles);
+        printf("%-6s %-5s latency  : p50 %7.1f us, p99 %7.1f us (%d requests, one at a time)\n",
+               binary ? "binary" : "line", op == PROTO_STATS ? "stats" : "ghost",
+               samples[rounds / 2] / 1e3, samples[rounds * 99 / 100] / 1e3, rounds);
+    }
+    free(samples);
+    proto_buffer_free(&out);
+    return ok;
+}
+
+// Time batches of PROTOCOL_BATCH requests per write; prints requests/s
+static bool measure_pipelined(ServerProcess* server, bool binary, bool mixed, int rounds,
+                              char** lines, int count) {
+    ProtoBuffer out = { 0 };
+    bool partial, ok = true;
+    long requests = 0;
+    double start = now_ns();
+    for (int q = 0; ok && requests < rounds; q += PROTOCOL_BATCH / 3) {
+        int batch = encode_batch(&out, binary, mixed, lines, count, q);
+        ok = write_all(server->to_server, out.data, out.size) &&
+             server_read_replies(server, binary, batch, &partial);
+        requests += batch;
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    if (ok) {
+        printf("%-6s %-5s pipelined: %9.0f requests/s (%ld requests, %d per write)\n",
+               binary ? "binary" : "line", mixed ? "mixed" : "stats", requests / seconds,
+               requests, PROTOCOL_BATCH);
+    }
+    proto_buffer_free(&out);
+    return ok;
+}
+
+// Latency and pipelined throughput of one protocol against a live server
+static bool bench_server(bool binary, const char* cache_home, const char* history,
+                         char** lines, int count) {
+    ServerProcess* server = malloc(sizeof(ServerProcess));
+    if (!server || !server_start(server, binary, cache_home, history)) {
+        free(server);
+        return false;
+    }
+
+    // Wait for the full index so both protocols query the same data
+    ProtoBuffer out = { 0 };
+    bool partial = true, ok = true;
+    while (ok && partial) {
+        out.size = 0;
+        encode_request(&out, binary, 0, PROTO_STATS, NULL, NULL, NULL);
+        ok = write_all(server->to_server, out.data, out.size) &&
+             server_read_replies(server, binary, 1, &partial);
+    }
+    proto_buffer_free(&out);
+
+    ok = ok && measure_latency(server, binary, PROTO_STATS, PROTOCOL_ROUNDS, lines, count)
+            && measure_latency(server, binary, PROTO_GHOST, PROTOCOL_ROUNDS / 10, lines, count)
+            && measure_pipelined(server, binary, false, PROTOCOL_ROUNDS * 10, lines, count)
+            && measure_pipelined(server, binary, true, PROTOCOL_ROUNDS / 5, lines, count);
+
+    server_stop(server);
+    free(server);
+    return ok;
+}
+
+// Remove the bench's cache directory tree (two levels, files only)
+static void remove_cache_home(const char* cache_home) {
+    char dir[PATH_MAX], file[PATH_MAX + 256];
+    snprintf(dir, sizeof(dir), "%s/zsh-autocomplete", cache_home);
+    DIR* d = opendir(dir);
+    struct dirent* entry;
+    while (d && (entry = readdir(d))) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(file, sizeof(file), "%s/%s", dir, entry->d_name);
+        unlink(file);
+    }
+    if (d) closedir(d);
+    rmdir(dir);
+    rmdir(cache_home);
+}
+
+// Reply assembly alone, into a pipe drained by a child: every reply copied
+// into one buffer and written, or gathered by reference with one writev
+static bool measure_reply_assembly(const char* label, char** lines, int count) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    pid_t drain = fork();
+    if (drain == 0) {
+        static char sink[65536];
+        close(fds[1]);
+        while (read(fds[0], sink, sizeof(sink)) > 0) {}
+        _exit(0);
+    }
+    close(fds[0]);
+
+    ProtoBuffer copied = { 0 };
+    ProtoWriter gathered = { .fd = fds[1] };
+    double copy_ns = 0, gather_ns = 0;
+    long bytes = 0;
+    int borrowed = 0;
+    for (int i = 0; i < count; i++) borrowed += strlen(lines[i]) > PROTO_INLINE_MAX;
+    bool ok = true;
+    for (int round = 0; ok && round < PROTOCOL_ROUNDS; round++) {
+        for (int mode = 0; mode < 2; mode++) {
+            double start = now_ns();
+            for (int i = 0; i < PROTOCOL_BATCH; i++) {
+                ProtoField field = proto_field(lines[(round * PROTOCOL_BATCH + i) % count]);
+                if (mode == 0) {
+                    proto_append(&copied, i, PROTO_OK, &field, 1);
+                } else {
+                    proto_writer_add(&gathered, i, PROTO_OK, &field, 1);
+                }
+            }
+            if (mode == 0) {
+                bytes += copied.size;
+                ok = write_all(fds[1], copied.data, copied.size);
+                copied.size = 0;
+                copy_ns += now_ns() - start;
+            } else {
+                ok = ok && proto_writer_flush(&gathered);
+                gather_ns += now_ns() - start;
+            }
+        }
+    }
+    close(fds[1]);
+    waitpid(drain, NULL, 0);
+
+    if (ok) {
+        printf("%-21s: %.0f ns copied, %.0f ns gathered per %d-reply batch (%.0f bytes/reply, %d%% borrowed)\n",
+               label, copy_ns / PROTOCOL_ROUNDS, gather_ns / PROTOCOL_ROUNDS, PROTOCOL_BATCH,
+               (double)bytes / PROTOCOL_ROUNDS / PROTOCOL_BATCH, 100 * borrowed / count);
+    }
+    proto_buffer_free(&copied);
+    proto_writer_free(&gathered);
+    return ok;
+}
+
+// Long one-liners (history lines chained with &&, near MAX_COMMAND_LENGTH),
+// so every reply field is past PROTO_INLINE_MAX and goes out by reference
+static bool measure_long_replies(char** lines, int count) {
+    int long_count = count < PROTOCOL_BATCH ? count : PROTOCOL_BATCH;
+    char** chained = calloc(long_count, sizeof(char*));
+    bool ok = chained != NULL;
+    for (int i = 0; ok && i < long_count; i++) {
+        chained[i] = malloc(MAX_COMMAND_LENGTH);
+        ok = chained[i] != NULL;
+        size_t used = 0;
+        for (int j = i; ok && used + 4 < MAX_COMMAND_LENGTH - 1; j = (j + 1) % count) {
+            used += snprintf(chained[i] + used, MAX_COMMAND_LENGTH - used, "%s%s",
+                             used ? " && " : "", lines[j]);
+        }
+    }
+    ok = ok && measure_reply_assembly("long reply assembly", chained, long_count);
+    for (int i = 0; chained && i < long_count; i++) free(chained[i]);
+    free(chained);
+    return ok;
+}
+
+static int bench_protocol(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+
+    // Private cache, seeded from the lines as a raw history on first start
+    char cache_home[64], history[96];
+    snprintf(cache_home, sizeof(cache_home), "/tmp/bench-protocol-%ld", (long)getpid());
+    snprintf(history, sizeof(history), "%s/history", cache_home);
+    mkdir(cache_home, 0700);
+    FILE* f = fopen(history, "w");
+    if (!f) {
+        perror(history);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) fprintf(f, "%s\n", lines[i]);
+    fclose(f);
+
+    printf("history lines        : %d (%s)\n", count, path ? path : "synthetic");
+    bool ok = measure_reply_assembly("reply assembly", lines, count) &&
+              measure_long_replies(lines, count) &&
+              bench_server(false, cache_home, history, lines, count) &&
+              bench_server(true, cache_home, history, lines, count);
+    if (!ok) fprintf(stderr, "bench: server failed (run from the directory with ./autocomplete)\n");
+
+    unlink(history);
+    remove_cache_home(cache_home);
+    free_lines(lines, count);
+    return ok ? 0 : 1;
+}
+
+// Blocking reference: write (append or temp + rename) and sync inline
+static bool write_synced(const char* path, const char* data, size_t size, bool replace) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = replace ? open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)
+                     : open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    if (fd < 0) return false;
+    bool ok = write_all(fd, data, size) && (replace ? fsync(fd) : fdatasync(fd)) == 0;
+    ok = close(fd) == 0 && ok;
+    return ok && (!replace || rename(tmp, path) == 0);
+}
+
+static char* copy_bytes(const char* data, size_t size) {
+    char* copy = malloc(size);
+    if (copy) memcpy(copy, data, size);
+    return copy;
+}
+
+// One update per round, a full rewrite every PERSIST_SAVE_EVERY rounds; the
+// time each round spends in persistence calls is what a request waits for
+static bool persist_rounds(const char* mode, const char* path, const char* cache,
+                           size_t cache_size, char** lines, int count) {
+    Persister* persister = NULL;
+    if (strcmp(mode, "blocking") != 0) {
+        persister = persist_create(strcmp(mode, "io_uring") == 0);
+        if (!persister || strcmp(persist_backend(persister), mode) != 0) {
+            printf("%-8s             : unavailable\n", mode);
+            persist_destroy(persister);
+            return true;
+        }
+    }
+
+    double* stalls = malloc(PERSIST_ROUNDS * sizeof(double));
+    if (!stalls) return false;
+    char line[MAX_COMMAND_LENGTH + 64];
+    bool ok = true;
+    double begin = now_ns();
+    for (int i = 0; ok && i < PERSIST_ROUNDS; i++) {
+        int n = snprintf(line, sizeof(line), "%s|1|%ld\n", lines[i % count], (long)time(NULL));
+        if (n >= (int)sizeof(line)) n = sizeof(line) - 1;
+        bool save = i % PERSIST_SAVE_EVERY == PERSIST_SAVE_EVERY - 1;
+
+        double start = now_ns();
+        if (!persister) {
+            ok = write_synced(path, line, n, false) &&
+                 (!save || write_synced(path, cache, cache_size, true));
+        } else {
+            ok = persist_append(persister, path, copy_bytes(line, n), n, true) &&
+                 (!save || persist_replace(persister, path, copy_bytes(cache, cache_size), cache_size));
+        }
+        stalls[i] = now_ns() - start;
+
+        // Keystroke pacing; completions are handled like the serve loop does
+        struct pollfd pfd = { .fd = persister ? persist_fd(persister) : -1, .events = POLLIN };
+        if (poll(&pfd, 1, 1) > 0) {
+            start = now_ns();
+            persist_reap(persister);
+            stalls[i] += now_ns() - start;
+        }
+    }
+    if (persister) persist_drain(persister);
+    double total_ms = (now_ns() - begin) / 1e6;
+
+    if (ok) {
+        qsort(stalls, PERSIST_ROUNDS, sizeof(double), compare_doubles);
+        printf("%-8s             : p50 %7.1f us, p99 %8.1f us, max %8.1f us (%.0f ms total%s)\n",
+               mode, stalls[PERSIST_ROUNDS / 2] / 1e3, stalls[PERSIST_ROUNDS * 99 / 100] / 1e3,
+               stalls[PERSIST_ROUNDS - 1] / 1e3, total_ms,
+               persister && persist_failures(persister) ? ", FAILURES" : "");
+    }
+    free(stalls);
+    persist_destroy(persister);
+    return ok;
+}
+
+static int bench_persist(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+
+    // A large cache: the history's lines repeated up to PERSIST_CACHE_BYTES
+    char* cache = malloc(PERSIST_CACHE_BYTES);
+    size_t cache_size = 0;
+    for (int i = 0; cache; i++) {
+        size_t len = strlen(lines[i % count]);
+        if (cache_size + len + 16 > PERSIST_CACHE_BYTES) break;
+        cache_size += snprintf(cache + cache_size, PERSIST_CACHE_BYTES - cache_size,
+                               "%s|1|1700000000\n", lines[i % count]);
+    }
+    if (!cache) return 1;
+
+    char file[64];
+    snprintf(file, sizeof(file), "/tmp/bench-persist-%ld.txt", (long)getpid());
+    printf("rounds               : %d fdatasync'ed appends, a %.1f MB rewrite every %d\n",
+           PERSIST_ROUNDS, cache_size / 1048576.0, PERSIST_SAVE_EVERY);
+    char* copies[10];
+    double start = now_ns();
+    for (int i = 0; i < 10; i++) copies[i] = copy_bytes(cache, cache_size);
+    double copy_us = (now_ns() - start) / 10 / 1e3;
+    for (int i = 0; i < 10; i++) free(copies[i]);
+    printf("rewrite buffer copy  : %.1f us (in-loop part of every rewrite, any backend)\n", copy_us);
+    printf("stall per update (time spent in persistence calls, on the loop):\n");
+    const char* modes[] = { "blocking", "thread", "io_uring" };
+    bool ok = true;
+    for (int m = 0; ok && m < 3; m++) {
+        ok = persist_rounds(modes[m], file, cache, cache_size, lines, count);
+        unlink(file);
+    }
+
+    free(cache);
+    free_lines(lines, count);
+    return ok ? 0 : 1;
+}
+
+/**
+ * @struct ColdFiles
+ * @brief One corpus in each on-disk form a first query can start from
+ */
+typedef struct {
+    char cache[64];                     /**< Text cache ("cmd|freq|last_used" lines) */
+    char snapshot[64];                  /**< One mapped snapshot */
+    char shards[COLD_SHARDS][64];       /**< Snapshots split by the command's first byte */
+} ColdFiles;
+
+// Shard holding every command that starts with byte c
+static int cold_shard(unsigned char c) {
+    return c % COLD_SHARDS;
+}
+
+// Write the text cache, the snapshot and its shards for one trie
+static bool write_cold_files(Trie* trie, ColdFiles* files) {
+    long pid = (long)getpid();
+    snprintf(files->cache, sizeof(files->cache), "%s/bench-cold-%ld.txt", COLD_DIR, pid);
+    snprintf(files->snapshot, sizeof(files->snapshot), "%s/bench-cold-%ld.idx", COLD_DIR, pid);
+    for (int s = 0; s < COLD_SHARDS; s++) {
+        snprintf(files->shards[s], sizeof(files->shards[s]), "%s/bench-cold-%ld-%d.idx",
+                 COLD_DIR, pid, s);
+    }
+
+    Snapshot* snap = snapshot_write_trie(trie, files->snapshot) ? snapshot_open(files->snapshot) : NULL;
+    FILE* cache = snap ? fopen(files->cache, "w") : NULL;
+    SnapshotWriter* writers[COLD_SHARDS] = { 0 };
+    bool ok = cache != NULL;
+    for (int s = 0; ok && s < COLD_SHARDS; s++) {
+        ok = (writers[s] = snapshot_writer_create()) != NULL;
+    }
+
+    // Leaves are sorted, so each shard receives its commands in order too
+    bool used[COLD_SHARDS] = { false };
+    for (uint32_t i = 0; ok && i < snap->header->leaf_count; i++) {
+        long id = snapshot_sorted_leaf(snap, i);
+        const SnapshotLeaf* leaf = &snap->leaves[id];
+        const char* text = snapshot_leaf_text(snap, id);
+        int s = cold_shard((unsigned char)text[0]);
+        fprintf(cache, "%s|%u|%lld\n", text, leaf->frequency, (long long)leaf->last_used);
+        ok = snapshot_writer_add(writers[s], text, leaf->frequency, leaf->last_used);
+        used[s] = true;
+    }
+    if (cache) ok = fclose(cache) == 0 && ok;
+    for (int s = 0; s < COLD_SHARDS; s++) {
+        // An empty shard has no file; its prefixes simply have no completion
+        if (ok && used[s]) ok = snapshot_writer_finish(writers[s], files->shards[s]);
+        snapshot_writer_destroy(writers[s]);
+    }
+    snapshot_close(snap);
+    return ok;
+}
+
+static void remove_cold_files(const ColdFiles* files) {
+    unlink(files->cache);
+    unlink(files->snapshot);
+    for (int s = 0; s < COLD_SHARDS; s++) unlink(files->shards[s]);
+}
+
+// Write back and drop a file's cached pages so the next read goes to disk
+static bool evict_file(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return true;
+    bool ok = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return ok;
+}
+
+static bool evict_cold_files(const ColdFiles* files) {
+    bool ok = evict_file(files->cache) && evict_file(files->snapshot);
+    for (int s = 0; s < COLD_SHARDS; s++) ok = evict_file(files->shards[s]) && ok;
+    return ok;
+}
+
+// First query from the text cache: parse it into a trie the way the one-shot
+// client does (default indexes on), then complete prefix
+static long first_query_text(const ColdFiles* files, const char* prefix) {
+    FILE* cache = fopen(files->cache, "r");
+    Trie* trie = cache ? trie_create() : NULL;
+    if (!trie) {
+        if (cache) fclose(cache);
+        return -1;
+    }
+    trie_enable_segments(trie);
+    trie_enable_wrapper_aliases(trie);
+
+    char line[MAX_COMMAND_LENGTH + 64];
+    while (fgets(line, sizeof(line), cache)) {
+        line[strcspn(line, "\n")] = '\0';
+        char* ts = strrchr(line, '|');
+        if (!ts) continue;
+        *ts = '\0';
+        char* freq = strrchr(line, '|');
+        if (!freq) continue;
+        *freq = '\0';
+        trie_insert(trie, line);
+        trie_set_usage(trie, line, atoi(freq + 1), atol(ts + 1));
+    }
+    fclose(cache);
+
+    char* best = trie_get_best_completion(trie, prefix);
+    long length = best ? (long)strlen(best) : -1;
+    free(best);
+    trie_destroy(trie);
+    return length;
+}
+
+// First query from a snapshot: map it and walk the prefix
+static long first_query_snapshot(const char* path, const char* prefix) {
+    Snapshot* snap = snapshot_open(path);
+    long leaf = snap ? snapshot_best_completion(snap, prefix) : -1;
+    long length = leaf >= 0 ? (long)strlen(snapshot_leaf_text(snap, leaf)) : -1;
+    snapshot_close(snap);
+    return length;
+}
+
+static long first_query(const ColdFiles* files, int variant, const char* prefix) {
+    switch (variant) {
+    case 0: return first_query_text(files, prefix);
+    case 1: return first_query_snapshot(files->snapshot, prefix);
+    default: return first_query_snapshot(files->shards[cold_shard((unsigned char)prefix[0])], prefix);
+    }
+}
+
+// Bytes read from disk and major faults so far (this process)
+static void io_counters(long* read_kb, long* faults) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    *read_kb = usage.ru_inblock / 2;
+    *faults = usage.ru_majflt;
+}
+
+static int bench_cold(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+
+    double build_ms;
+    Trie* trie = build_trie(lines, count, false, &build_ms);
+    ColdFiles files;
+    if (!trie || !write_cold_files(trie, &files)) {
+        fprintf(stderr, "bench: cannot write cache/snapshot files in %s\n", COLD_DIR);
+        if (trie) remove_cold_files(&files);
+        trie_destroy(trie);
+        free_lines(lines, count);
+        return 1;
+    }
+    trie_destroy(trie);
+
+    struct stat cache_st, snap_st;
+    stat(files.cache, &cache_st);
+    stat(files.snapshot, &snap_st);
+    printf("history lines        : %d (%s)\n", count, path ? path : "synthetic");
+    printf("files                : %.2f MB text cache, %.2f MB snapshot, %d shards (%s)\n",
+           cache_st.st_size / 1048576.0, snap_st.st_size / 1048576.0, COLD_SHARDS, COLD_DIR);
+    printf("first query, %d runs each (files evicted with POSIX_FADV_DONTNEED before cold runs):\n",
+           COLD_RUNS);
+
+    const char* names[] = { "text cache", "snapshot", "sharded snapshot" };
+    double cold[COLD_RUNS], warm[COLD_RUNS];
+    bool ok = true, evicted = false;
+    for (int v = 0; ok && v < 3; v++) {
+        long read_kb = 0, faults = 0, misses = 0;
+        for (int r = 0; ok && r < COLD_RUNS; r++) {
+            char prefix[8];
+            snprintf(prefix, sizeof(prefix), "%.4s", lines[(r * 7919) % count]);
+
+            long kb_before, faults_before, kb_after, faults_after;
+            ok = evict_cold_files(&files);
+            io_counters(&kb_before, &faults_before);
+            double start = now_ns();
+            if (first_query(&files, v, prefix) < 0) misses++;
+            cold[r] = now_ns() - start;
+            io_counters(&kb_after, &faults_after);
+            read_kb += kb_after - kb_before;
+            faults += faults_after - faults_before;
+
+            // Same query again with the pages now cached
+            start = now_ns();
+            first_query(&files, v, prefix);
+            warm[r] = now_ns() - start;
+        }
+        if (!ok) break;
+        qsort(cold, COLD_RUNS, sizeof(double), compare_doubles);
+        qsort(warm, COLD_RUNS, sizeof(double), compare_doubles);
+        printf("%-16s     : cold p50 %8.1f us, max %8.1f us; warm p50 %8.1f us; "
+               "%ld KB read, %ld major faults per cold run%s\n",
+               names[v], cold[COLD_RUNS / 2] / 1e3, cold[COLD_RUNS - 1] / 1e3,
+               warm[COLD_RUNS / 2] / 1e3, read_kb / COLD_RUNS, faults / COLD_RUNS,
+               misses ? " (some prefixes unanswered)" : "");
+        evicted = evicted || read_kb > 0;
+    }
+    if (ok && !evicted) {
+        printf("note                 : nothing was read from disk; %s may not support eviction "
+               "(tmpfs?), so the cold numbers are warm\n", COLD_DIR);
+    }
+    if (!ok) fprintf(stderr, "bench: eviction failed\n");
+
+    remove_cold_files(&files);
+    free_lines(lines, count);
+    return ok ? 0 : 1;
+}
+
+// Corpus for the heat benchmark: history lines, varied with a run number
+// until there are HEAT_COMMANDS of them, sorted and unique
+static char** heat_corpus(char** lines, int count, int* total) {
+    char** corpus = malloc(HEAT_COMMANDS * sizeof(char*));
+    if (!corpus) return NULL;
+    char buf[MAX_COMMAND_LENGTH];
+    for (int i = 0; i < HEAT_COMMANDS; i++) {
+        if (i < count) snprintf(buf, sizeof(buf), "%s", lines[i]);
+        else snprintf(buf, sizeof(buf), "%s #%d", lines[i % count], i / count);
+        corpus[i] = strdup(buf);
+    }
+    qsort(corpus, HEAT_COMMANDS, sizeof(char*), compare_strings);
+    int unique = 0;
+    for (int i = 0; i < HEAT_COMMANDS; i++) {
+        if (!*corpus[i] || (unique > 0 && strcmp(corpus[unique - 1], corpus[i]) == 0)) free(corpus[i]);
+        else corpus[unique++] = corpus[i];
+    }
+    *total = unique;
+    return corpus;
+}
+
+// Pick a command with Zipf-like popularity (~1/rank): a uniform number of
+// bits, then a uniform rank of that length. Which commands are popular is
+// fixed by hot[], so training and measuring agree.
+static const char* heat_pick(char** corpus, const int* hot, int count) {
+    int bits = 0;
+    while ((2 << bits) <= count) bits++;
+    int k = rng_next() % (bits + 1);
+    int rank = (1 << k) - 1 + (int)(rng_next() % (1u << k));
+    return corpus[hot[rank < count ? rank : count - 1]];
+}
+
+// Type typed commands from the heat distribution, one ghost query per
+// keystroke until the ghost text is the command; returns the query count
+static long heat_type(const Snapshot* snap, char** corpus, const int* hot, int count, int typed) {
+    char prefix[MAX_COMMAND_LENGTH];
+    long queries = 0;
+    for (int t = 0; t < typed; t++) {
+        const char* command = heat_pick(corpus, hot, count);
+        for (size_t len = 1; command[len - 1]; len++) {
+            memcpy(prefix, command, len);
+            prefix[len] = '\0';
+            long leaf = snapshot_best_completion(snap, prefix);
+            queries++;
+            if (leaf < 0 || strcmp(snapshot_leaf_text(snap, leaf), command) == 0) break;
+        }
+    }
+    return queries;
+}
+
+// Evict, open and type HEAT_TYPED commands; warm = 0 none, 1 read ahead,
+// 2 mlock. With random set, faults read single pages (no read-around), which
+// shows the layout itself rather than the device's read-ahead window.
+static bool heat_session(const char* path, int warm, bool random, char** corpus, const int* hot,
+                         int count, double* faults_per_k, long* read_kb, double* ms) {
+    if (!evict_file(path)) return false;
+    rng_state = 88172645u;  // Same keystrokes for every layout
+
+    long kb_before, faults_before, kb_after, faults_after;
+    io_counters(&kb_before, &faults_before);
+    double start = now_ns();
+    Snapshot* snap = snapshot_open(path);
+    if (!snap) return false;
+    if (random) posix_madvise((void*)snap->map, snap->size, POSIX_MADV_RANDOM);
+    bool warmed = !warm || snapshot_warm(snap, warm == 2) > 0;
+    long queries = heat_type(snap, corpus, hot, count, HEAT_TYPED);
+    *ms = (now_ns() - start) / 1e6;
+    io_counters(&kb_after, &faults_after);
+    snapshot_close(snap);
+
+    *faults_per_k = (faults_after - faults_before) * 1000.0 / queries;
+    *read_kb = kb_after - kb_before;
+    return warmed;
+}
+
+static bool heat_measure(const char* label, const char* path, int warm, char** corpus,
+                         const int* hot, int count) {
+    double faults[2], ms[2];
+    long read_kb[2];
+    for (int random = 0; random < 2; random++) {
+        if (!heat_session(path, warm, random, corpus, hot, count, &faults[random], &read_kb[random], &ms[random])) {
+            printf("%-22s: %s\n", label, warm == 2 ? "mlock failed (RLIMIT_MEMLOCK?)" : "failed");
+            return warm == 2;
+        }
+    }
+    printf("%-22s: %6.2f faults/1k keys, %6ld KB, %6.1f ms | %6.2f faults/1k keys, %6ld KB, %6.1f ms\n",
+           label, faults[0], read_kb[0], ms[0], faults[1], read_kb[1], ms[1]);
+    return true;
+}
+
+static int bench_heat(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+    int total;
+    char** corpus = heat_corpus(lines, count, &total);
+    int* hot = corpus ? malloc(total * sizeof(int)) : NULL;
+    if (!hot) {
+        if (corpus) free_lines(corpus, total);
+        free_lines(lines, count);
+        return 1;
+    }
+
+    char plain[64], packed[64];
+    snprintf(plain, sizeof(plain), "%s/bench-heat-%ld.idx", COLD_DIR, (long)getpid());
+    snprintf(packed, sizeof(packed), "%s/bench-heat-%ld-packed.idx", COLD_DIR, (long)getpid());
+    SnapshotWriter* writer = snapshot_writer_create();
+    bool ok = writer != NULL;
+    for (int i = 0; ok && i < total; i++) {
+        ok = snapshot_writer_add(writer, corpus[i], 1 + rng_next() % 100, 1700000000);
+    }
+    ok = ok && snapshot_writer_finish(writer, plain);
+    snapshot_writer_destroy(writer);
+
+    // Popularity ranks: a fixed shuffle of the corpus
+    for (int i = 0; i < total; i++) hot[i] = i;
+    for (int i = total - 1; i > 0; i--) {
+        int j = rng_next() % (i + 1), t = hot[i];
+        hot[i] = hot[j];
+        hot[j] = t;
+    }
+
+    // Record heat from one typing session, then pack
+    Snapshot* snap = ok ? snapshot_open(plain) : NULL;
+    double start = now_ns();
+    long trained = snap && snapshot_track_heat(snap) ? heat_type(snap, corpus, hot, total, HEAT_TRAIN) : 0;
+    ok = trained > 0 && snapshot_write_packed(snap, packed);
+    double pack_ms = (now_ns() - start) / 1e6;
+    Snapshot* check = ok ? snapshot_open(packed) : NULL;
+
+    // Packing must not change any answer
+    int disagree = 0;
+    char prefix[8];
+    for (int i = 0; check && i < total; i += 7) {
+        snprintf(prefix, sizeof(prefix), "%.5s", corpus[i]);
+        long a = snapshot_best_completion(snap, prefix), b = snapshot_best_completion(check, prefix);
+        if (snapshot_lookup(check, corpus[i]) < 0 || a < 0 || b < 0 ||
+            strcmp(snapshot_leaf_text(snap, a), snapshot_leaf_text(check, b)) != 0) {
+            disagree++;
+        }
+    }
+
+    if (check) {
+        const SnapshotHeader* h = check->header;
+        size_t warm_bytes = h->warm_leaves * sizeof(SnapshotLeaf) + h->warm_nodes * sizeof(SnapshotNode) +
+                            h->warm_edges * (sizeof(uint32_t) + 1) + h->warm_strings;
+        printf("snapshot             : %d commands, %.2f MB (%s)\n", total, check->size / 1048576.0, COLD_DIR);
+        printf("heat                 : %d commands typed (%ld keystrokes), packed in %.1f ms\n",
+               HEAT_TRAIN, trained, pack_ms);
+        printf("warm region          : %u/%u nodes, %u/%u leaves, %.1f KB\n", h->warm_nodes, h->node_count,
+               h->warm_leaves, h->leaf_count, warm_bytes / 1024.0);
+        printf("agreement            : %d disagreeing prefixes\n", disagree);
+        printf("cold typing session, %d other commands from the same distribution\n", HEAT_TYPED);
+        printf("(major faults per 1000 keystrokes, disk reads, time; default read-around | MADV_RANDOM):\n");
+
+        // Mapped pages cannot be evicted: unmap both first
+        snapshot_close(check);
+        snapshot_close(snap);
+        check = snap = NULL;
+        ok = heat_measure("command order", plain, 0, corpus, hot, total) &&
+             heat_measure("heat-packed", packed, 0, corpus, hot, total) &&
+             heat_measure("heat-packed + WILLNEED", packed, 1, corpus, hot, total) &&
+             heat_measure("heat-packed + mlock", packed, 2, corpus, hot, total);
+    } else {
+        fprintf(stderr, "bench: snapshot write/pack failed\n");
+        ok = false;
+    }
+
+    snapshot_close(check);
+    snapshot_close(snap);
+    unlink(plain);
+    unlink(packed);
+    free(hot);
+    free_lines(corpus, total);
+    free_lines(lines, count);
+    return ok && !disagree ? 0 : 1;
+}
+
+// Children doing one kind of update; each op's latency lands in a shared
+// timing file (slot writer * per_writer + i)
+static bool ring_children(const char* kind, const char* target, size_t cache_size, int per_writer, double* timings, pid_t* pids) {
+    for (int w = 0; w < RING_WRITERS; w++) {
+        pids[w] = fork();
+        if (pids[w] < 0) return false;
+        if (pids[w] > 0) continue;
+
+        bool ok = true;
+        char line[64];
+        if (strcmp(kind, "ring") == 0) {
+            HistoryRing* ring = ring_open(target);
+            for (int i = 0; ring && i < per_writer; i++) {
+                int n = snprintf(line, sizeof(line), "w%d %d", w, i);
+                double start = now_ns();
+                ring_append(ring, line, n, time(NULL));
+                timings[w * per_writer + i] = now_ns() - start;
+            }
+            ok = ring != NULL;
+            ring_close(ring);
+        } else {
+            // Today's update path: lock, read the whole cache, rewrite it
+            char lock_path[PATH_MAX + sizeof(".lock")], tmp[PATH_MAX + 16];
+            snprintf(lock_path, sizeof(lock_path), "%s.lock", target);
+            snprintf(tmp, sizeof(tmp), "%s.%d", target, w);
+            int lock_fd = open(lock_path, O_RDWR | O_CREAT, 0600);
+            char* data = malloc(cache_size + 64);
+            ok = lock_fd >= 0 && data;
+            for (int i = 0; ok && i < per_writer; i++) {
+                struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+                double start = now_ns();
+                fcntl(lock_fd, F_SETLKW, &lock);
+                int fd = open(target, O_RDONLY);
+                ssize_t got = fd >= 0 ? read(fd, data, cache_size + 64) : -1;
+                if (fd >= 0) close(fd);
+                int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+                ok = got >= 0 && out >= 0 && write_all(out, data, got) && close(out) == 0 &&
+                     rename(tmp, target) == 0;
+                lock.l_type = F_UNLCK;
+                fcntl(lock_fd, F_SETLK, &lock);
+                timings[w * per_writer + i] = now_ns() - start;
+            }
+            free(data);
+            if (lock_fd >= 0) close(lock_fd);
+        }
+        _exit(ok ? 0 : 1);
+    }
+    return true;
+}
+
+static bool ring_wait(pid_t* pids) {
+    bool ok = true;
+    for (int w = 0; w < RING_WRITERS; w++) {
+        int status;
+        ok = waitpid(pids[w], &status, 0) == pids[w] && WIFEXITED(status) &&
+             WEXITSTATUS(status) == 0 && ok;
+    }
+    return ok;
+}
+
+static void ring_report(const char* label, double* timings, int count, double wall_ms) {
+    qsort(timings, count, sizeof(double), compare_doubles);
+    printf("%-21s: p50 %8.2f us, p99 %9.2f us, max %9.2f us, %9.0f updates/s\n", label,
+           timings[count / 2] / 1e3, timings[count * 99 / 100] / 1e3, timings[count - 1] / 1e3,
+           count / (wall_ms / 1e3));
+}
+
+/**
+ * @struct RingCheck
+ * @brief What the consumer saw: every writer's records must arrive in order
+ */
+typedef struct {
+    long delivered;
+    long out_of_order;
+    int last[RING_WRITERS];
+} RingCheck;
+
+static void ring_check_record(const char* text, uint32_t length, int64_t when, void* ctx) {
+    (void)when;
+    RingCheck* check = ctx;
+    char line[64];
+    int w, i;
+    snprintf(line, sizeof(line), "%.*s", (int)length, text);
+    if (sscanf(line, "w%d %d", &w, &i) != 2 || w < 0 || w >= RING_WRITERS || i <= check->last[w]) {
+        check->out_of_order++;
+    } else {
+        check->last[w] = i;
+    }
+    check->delivered++;
+}
+
+static int bench_ring(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+
+    // The cache every rewrite copies: one "cmd|freq|last_used" line per command
+    size_t cache_size = 0;
+    for (int i = 0; i < count; i++) cache_size += strlen(lines[i]) + 16;
+    char* cache = malloc(cache_size + 1);
+    size_t used = 0;
+    for (int i = 0; cache && i < count; i++) {
+        used += snprintf(cache + used, cache_size + 1 - used, "%s|1|1700000000\n", lines[i]);
+    }
+
+    char dir[64], cache_path[PATH_MAX], ring_path[PATH_MAX], timing_path[PATH_MAX];
+    snprintf(dir, sizeof(dir), "/tmp/bench-ring-%ld", (long)getpid());
+    snprintf(cache_path, sizeof(cache_path), "%s/trie_data.txt", dir);
+    snprintf(ring_path, sizeof(ring_path), "%s/trie_data.ring", dir);
+    snprintf(timing_path, sizeof(timing_path), "%s/timings", dir);
+    mkdir(dir, 0700);
+
+    // Children report latencies through a shared mapping
+    int total = RING_WRITERS * RING_APPENDS;
+    int fd = open(timing_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    double* timings = NULL;
+    if (fd >= 0 && ftruncate(fd, total * sizeof(double)) == 0) {
+        timings = mmap(NULL, total * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (timings == MAP_FAILED) timings = NULL;
+    }
+    if (fd >= 0) close(fd);
+    bool ok = cache && timings && write_synced(cache_path, cache, used, true);
+    pid_t pids[RING_WRITERS];
+
+    printf("writers              : %d processes (one per shell)\n", RING_WRITERS);
+    printf("cache                : %d commands, %.1f KB\n", count, used / 1024.0);
+    if (ok) {
+        double start = now_ns();
+        ok = ring_children("rewrite", cache_path, used, RING_REWRITES, timings, pids) &&
+             ring_wait(pids);
+        if (ok) ring_report("whole-file rewrite", timings, RING_WRITERS * RING_REWRITES,
+                            (now_ns() - start) / 1e6);
+    }
+
+    // Appends while this process consumes, like a server tailing the ring
+    HistoryRing* ring = ok ? ring_open(ring_path) : NULL;
+    if (ring) {
+        RingCursor cursor = { 0 };
+        RingCheck check;
+        memset(&check, 0, sizeof(check));
+        for (int w = 0; w < RING_WRITERS; w++) check.last[w] = -1;
+
+        double start = now_ns();
+        ok = ring_children("ring", ring_path, 0, RING_APPENDS, timings, pids);
+        int running = RING_WRITERS;
+        while (ok && running > 0) {
+            ring_read(ring, &cursor, ring_check_record, &check);
+            int status;
+            pid_t done = waitpid(-1, &status, WNOHANG);
+            if (done > 0) {
+                ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                running--;
+            }
+        }
+        double wall_ms = (now_ns() - start) / 1e6;
+        ring_read(ring, &cursor, ring_check_record, &check);
+        if (ok) {
+            ring_report("ring append", timings, total, wall_ms);
+            printf("ring reader          : %ld of %d records, %llu slots lost, %ld out of order\n",
+                   check.delivered, total, (unsigned long long)cursor.lost, check.out_of_order);
+            ok = check.out_of_order == 0 &&
+                 check.delivered + (long)cursor.lost == (long)ring_tail(ring);
+        }
+        ring_close(ring);
+    }
+    if (!ok) fprintf(stderr, "bench: ring benchmark failed\n");
+
+    if (timings) munmap(timings, total * sizeof(double));
+    unlink(timing_path);
+    unlink(cache_path);
+    unlink(ring_path);
+    char lock_path[PATH_MAX + sizeof(".lock")];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", cache_path);
+    unlink(lock_path);
+    rmdir(dir);
+    free(cache);
+    free_lines(lines, count);
+    return ok ? 0 : 1;
+}
+
+/**
+ * @struct SimdInputs
+ * @brief Data every kernel variant runs over
+ */
+typedef struct {
+    char** lines;
+    char** twins;               // Copies of lines with the last byte changed
+    size_t* lengths;
+    int count;
+    char* cache;                // Lines in cache format, about SIMD_SCAN_BYTES
+    size_t cache_size;
+    Trie* trie;
+    TrieNode** nodes;           // Every trie node
+    long node_count;
+} SimdInputs;
+
+/**
+ * @struct SimdRun
+ * @brief One variant's timings, and a checksum of its results to compare
+ */
+typedef struct {
+    double compare_ns;
+    double scan_mbs;
+    double mask_ns;
+    double rank_us;
+    uint64_t checksum;
+} SimdRun;
+
+static bool simd_inputs(SimdInputs* in, char** lines, int count) {
+    memset(in, 0, sizeof(*in));
+    in->lines = lines;
+    in->count = count;
+    in->twins = calloc(count, sizeof(char*));
+    in->lengths = malloc(count * sizeof(size_t));
+    in->cache = malloc(SIMD_SCAN_BYTES + 4096);
+    double build_ms;
+    in->trie = build_trie(lines, count, false, &build_ms);
+    if (!in->twins || !in->lengths || !in->cache || !in->trie) return false;
+
+    for (int i = 0; i < count; i++) {
+        in->lengths[i] = strlen(lines[i]);
+        in->twins[i] = strdup(lines[i]);
+        if (!in->twins[i]) return false;
+        if (in->lengths[i]) in->twins[i][in->lengths[i] - 1] ^= 1;
+    }
+    for (int i = 0; in->cache_size < SIMD_SCAN_BYTES; i++) {
+        const char* line = lines[i % count];
+        if (strlen(line) > 4000) continue;
+        in->cache_size += sprintf(in->cache + in->cache_size, "%s|%d|%d\n", line, i % 97, 1700000000 + i);
+    }
+
+    // Every node, for timing the child scan on its own
+    long capacity = 1024;
+    in->nodes = malloc(capacity * sizeof(TrieNode*));
+    if (!in->nodes) return false;
+    in->nodes[in->node_count++] = in->trie->root;
+    for (long next = 0; next < in->node_count; next++) {
+        TrieNode* node = in->nodes[next];
+        for (int c = 0; c < ALPHABET_SIZE; c++) {
+            if (!node->children[c]) continue;
+            if (in->node_count == capacity) {
+                TrieNode** temp = realloc(in->nodes, capacity * 2 * sizeof(TrieNode*));
+                if (!temp) return false;
+                in->nodes = temp;
+                capacity *= 2;
+            }
+            in->nodes[in->node_count++] = node->children[c];
+        }
+    }
+    return true;
+}
+
+static void simd_inputs_free(SimdInputs* in) {
+    if (in->twins) free_lines(in->twins, in->count);
+    free(in->lengths);
+    free(in->cache);
+    free(in->nodes);
+    trie_destroy(in->trie);
+}
+
+static void simd_measure(const SimdInputs* in, SimdRun* run) {
+    memset(run, 0, sizeof(*run));
+
+    double start = now_ns();
+    for (int q = 0; q < SIMD_COMPARES; q++) {
+        int i = q % in->count;
+        run->checksum += simd_mismatch(in->lines[i], in->twins[i], in->lengths[i]);
+    }
+    run->compare_ns = (now_ns() - start) / SIMD_COMPARES;
+
+    start = now_ns();
+    for (size_t pos = 0; pos < in->cache_size; ) {
+        SimdLine line;
+        pos += simd_scan_line(in->cache + pos, in->cache_size - pos, '|', &line);
+        run->checksum += line.length * 31 + line.last * 7 + line.previous;
+    }
+    run->scan_mbs = in->cache_size / 1048576.0 / ((now_ns() - start) / 1e9);
+
+    uint64_t mask[ALPHABET_SIZE / 64];
+    start = now_ns();
+    for (long n = 0; n < in->node_count; n++) {
+        simd_child_mask(in->nodes[n]->children, ALPHABET_SIZE, mask);
+        for (int w = 0; w < ALPHABET_SIZE / 64; w++) run->checksum += __builtin_popcountll(mask[w]) << w;
+    }
+    run->mask_ns = (now_ns() - start) / in->node_count;
+
+    char prefix[8];
+    start = now_ns();
+    for (int q = 0; q < SIMD_RANK_ROUNDS; q++) {
+        snprintf(prefix, sizeof(prefix), "%.4s", in->lines[q * 7919 % in->count]);
+        char* best = trie_get_best_completion(in->trie, prefix);
+        for (const char* p = best; p && *p; p++) run->checksum = run->checksum * 131 + (unsigned char)*p;
+        free(best);
+    }
+    run->rank_us = (now_ns() - start) / SIMD_RANK_ROUNDS / 1e3;
+}
+
+static int bench_simd(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+    SimdInputs in;
+    bool ok = simd_inputs(&in, lines, count);
+    SimdLevel active = simd_level();
+    SimdLevel supported = simd_supported();
+
+    printf("history lines        : %d (%s), %ld trie nodes\n", count, path ? path : "synthetic", in.node_count);
+    printf("instruction sets     : cpu supports up to %s, %s selected\n",
+           simd_level_name(supported), simd_level_name(active));
+    printf("%-21s  %-18s %-16s %-16s %s\n", "", "prefix compare", "line scan", "child scan", "best completion");
+    uint64_t reference = 0;
+    int mismatches = 0;
+    for (int level = SIMD_SCALAR; ok && level <= (int)supported; level++) {
+        SimdRun run;
+        if (!simd_select((SimdLevel)level)) continue;
+        simd_measure(&in, &run);
+        if (level == SIMD_SCALAR) reference = run.checksum;
+        else if (run.checksum != reference) mismatches++;
+        printf("%-21s: %8.1f ns/cmd    %7.0f MB/s     %6.1f ns/node    %8.1f us%s\n",
+               simd_level_name((SimdLevel)level), run.compare_ns, run.scan_mbs, run.mask_ns,
+               run.rank_us, run.checksum == reference ? "" : "  (MISMATCH)");
+    }
+    simd_select(active);
+    if (ok) printf("agreement            : %s\n", mismatches ? "variants DISAGREE with scalar" : "all variants match scalar");
+    else fprintf(stderr, "bench: out of memory\n");
+
+    simd_inputs_free(&in);
+    free_lines(lines, count);
+    return ok && mismatches == 0 ? 0 : 1;
+}
+
+// One command with a fresh volatile token, the kind that never repeats
+static void noise_command(char* buf, size_t size) {
+    unsigned int a = rng_next(), b = rng_next();
+    switch (rng_next() % 7) {
+    case 0: snprintf(buf, size, "kill %u", 1000 + a % 4000000); break;
+    case 1: snprintf(buf, size, "kill -9 %u", 1000 + a % 4000000); break;
+    case 2: snprintf(buf, size, "git show %07x", a & 0xfffffff); break;
+    case 3: snprintf(buf, size, "ssh ip-10-%u-%u-%u", a % 256, b % 256, (a >> 8) % 256); break;
+    case 4: snprintf(buf, size, "docker logs -f %08x-%04x-4%03x-a%03x-%08x%04x",
+                     a, b & 0xffff, a % 0xfff, b % 0xfff, b, a & 0xffff); break;
+    case 5: snprintf(buf, size, "tail -f /tmp/build.%06x/out.log", a & 0xffffff); break;
+    default: snprintf(buf, size, "journalctl --since=2025-%02u-%02uT%02u:%02u:00",
+                      1 + a % 12, 1 + b % 28, a % 24, b % 60); break;
+    }
+}
+
+// A history file as-is, or the synthetic history with noise mixed in
+static char** template_history(const char* path, int* count) {
+    char** lines = load_lines(path, count);
+    if (!lines || path) return lines;
+
+    int total = *count + *count / TEMPLATE_NOISE_EVERY;
+    char** mixed = malloc(total * sizeof(char*));
+    if (!mixed) {
+        free_lines(lines, *count);
+        return NULL;
+    }
+    int n = 0;
+    char buf[MAX_COMMAND_LENGTH];
+    for (int i = 0; i < *count; i++) {
+        mixed[n++] = lines[i];
+        if (i % TEMPLATE_NOISE_EVERY == 0) {
+            noise_command(buf, sizeof(buf));
+            mixed[n++] = strdup(buf);
+        }
+    }
+    free(lines);
+    *count = n;
+    return mixed;
+}
+
+static Trie* template_trie(char** lines, int count, bool templates, double* build_ms) {
+    double start = now_ns();
+    Trie* trie = trie_create();
+    if (trie && templates) trie_enable_templates(trie);
+    for (int i = 0; trie && i < count; i++) {
+        trie_insert(trie, lines[i]);
+    }
+    *build_ms = (now_ns() - start) / 1e6;
+    return trie;
+}
+
+// Complete the first half of recent lines; hits (a completion that keeps the
+// prefix) are split by whether the line has a volatile token. Returns the
+// average latency.
+static double template_queries(Trie* trie, char** lines, int count, int hits[2], int queries[2]) {
+    char prefix[MAX_COMMAND_LENGTH];
+    char key[MAX_COMMAND_LENGTH + 1];
+    hits[0] = hits[1] = queries[0] = queries[1] = 0;
+    double elapsed = 0;
+    for (int q = 0; q < TEMPLATE_QUERIES; q++) {
+        const char* line = lines[count - 1 - q % count];
+        int noisy = template_key(line, key, sizeof(key), NULL) > 0;
+        size_t len = strlen(line) / 2 + 1;
+        snprintf(prefix, sizeof(prefix), "%.*s", (int)len, line);
+
+        double start = now_ns();
+        char* owned;
+        const char* best = trie_peek_best_completion(trie, prefix, &owned);
+        elapsed += now_ns() - start;
+        queries[noisy]++;
+        if (best && strncmp(best, prefix, strlen(prefix)) == 0) hits[noisy]++;
+        free(owned);
+    }
+    return elapsed / TEMPLATE_QUERIES;
+}
+
+static int bench_templates(const char* path) {
+    int count;
+    char** lines = template_history(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+
+    // Classifier cost and what it finds
+    long tokens[TOKEN_CLASSES] = {0};
+    long templated = 0;
+    char key[MAX_COMMAND_LENGTH + 1];
+    double start = now_ns();
+    for (int i = 0; i < count; i++) {
+        size_t len = template_key(lines[i], key, sizeof(key), NULL);
+        templated += len > 0;
+        for (size_t k = 0; k < len; k++) {
+            if ((unsigned char)key[k] < TOKEN_CLASSES) tokens[(unsigned char)key[k]]++;
+        }
+    }
+    double classify_ns = (now_ns() - start) / count;
+
+    double plain_ms, template_ms;
+    Trie* plain = template_trie(lines, count, false, &plain_ms);
+    Trie* tmpl = template_trie(lines, count, true, &template_ms);
+    if (!plain || !tmpl) return 1;
+    TrieIndexStats plain_stats, template_stats;
+    trie_index_stats(plain->root, &plain_stats);
+    trie_index_stats(tmpl->root, &template_stats);
+
+    int plain_hits[2], template_hits[2], queries[2];
+    double plain_ns = template_queries(plain, lines, count, plain_hits, queries);
+    double template_ns = template_queries(tmpl, lines, count, template_hits, queries);
+
+    printf("history lines        : %d (%s)\n", count, path ? path : "synthetic + noise");
+    printf("templated commands   : %ld (%.1f%%), %.0f ns/command to classify\n",
+           templated, 100.0 * templated / count, classify_ns);
+    printf("volatile tokens      :");
+    for (int c = TOKEN_LITERAL + 1; c < TOKEN_CLASSES; c++) {
+        printf(" %s %ld%s", template_class_name((TokenClass)c), tokens[c], c + 1 < TOKEN_CLASSES ? "," : "\n");
+    }
+    printf("%-21s  %-8s %-10s %-8s %-10s %-12s %s\n", "", "leaves", "nodes", "MB", "build",
+           "query", "hits (plain/volatile lines)");
+    printf("%-21s: %-8d %-10ld %-8.2f %-7.1f ms %-9.0f ns %d/%d, %d/%d\n", "literal paths",
+           plain->total_commands, plain_stats.nodes, plain_stats.bytes / 1048576.0, plain_ms,
+           plain_ns, plain_hits[0], queries[0], plain_hits[1], queries[1]);
+    printf("%-21s: %-8d %-10ld %-8.2f %-7.1f ms %-9.0f ns %d/%d, %d/%d\n", "templates",
+           tmpl->total_commands, template_stats.nodes, template_stats.bytes / 1048576.0, template_ms,
+           template_ns, template_hits[0], queries[0], template_hits[1], queries[1]);
+
+    trie_destroy(plain);
+    trie_destroy(tmpl);
+    free_lines(lines, count);
+    return 0;
+}
+
+// Directory i of the synthetic tree
+static void path_bench_dir(char* out, size_t size, const char* root, int i) {
+    snprintf(out, size, "%s/dir%d", root, i);
+}
+
+// Remove the synthetic tree (one level of directories of plain files)
+static void remove_path_tree(const char* root) {
+    char dir[PATH_MAX], file[PATH_MAX + 256];
+    for (int i = 0; i < PATH_BENCH_DIRS; i++) {
+        path_bench_dir(dir, sizeof(dir), root, i);
+        DIR* d = opendir(dir);
+        struct dirent* entry;
+        while (d && (entry = readdir(d))) {
+            if (entry->d_name[0] == '.') continue;
+            snprintf(file, sizeof(file), "%s/%s", dir, entry->d_name);
+            if (unlink(file) != 0) rmdir(file);
+        }
+        if (d) closedir(d);
+        rmdir(dir);
+    }
+    rmdir(root);
+}
+
+static bool make_path_tree(const char* root) {
+    char dir[PATH_MAX], file[PATH_MAX + 64];
+    for (int i = 0; i < PATH_BENCH_DIRS; i++) {
+        path_bench_dir(dir, sizeof(dir), root, i);
+        if (mkdir(dir, 0755) != 0) return false;
+        for (int f = 0; f < PATH_BENCH_FILES; f++) {
+            // Every tenth name a directory, like a source tree
+            snprintf(file, sizeof(file), "%s/%s%04d%s", dir, f % 3 ? "module_" : "test_", f,
+                     f % 10 ? ".c" : "");
+            if (f % 10 == 0) {
+                if (mkdir(file, 0755) != 0) return false;
+            } else {
+                int fd = open(file, O_CREAT | O_WRONLY, 0644);
+                if (fd < 0) return false;
+                close(fd);
+            }
+        }
+    }
+    return true;
+}
+
+// The partial typed for query q: a random name's first 1-8 bytes
+static void path_query(int q, int* dir, char* partial, size_t size) {
+    rng_state = 2463534242u + q;
+    *dir = rng_next() % PATH_BENCH_DIRS;
+    int f = rng_next() % PATH_BENCH_FILES;
+    char name[64];
+    snprintf(name, sizeof(name), "%s%04d", f % 3 ? "module_" : "test_", f);
+    snprintf(partial, size, "%.*s", 1 + (int)(rng_next() % 8), name);
+}
+
+// What the engine would do without the cache: list the directory per query
+static int readdir_matches(const char* dir, const char* partial) {
+    size_t len = strlen(partial);
+    int found = 0;
+    DIR* d = opendir(dir);
+    struct dirent* entry;
+    while (d && (entry = readdir(d))) {
+        if (strncmp(entry->d_name, partial, len) == 0) found++;
+    }
+    if (d) closedir(d);
+    return found;
+}
+
+// Create a file and time until a lookup sees it (-1: not within a recheck
+// interval and a second)
+static double path_change_visible(PathCache* cache, const char* dir) {
+    double limit = (PATHCACHE_RECHECK_MS + 1000) * 1e6;
+    char file[PATH_MAX + 64];
+    snprintf(file, sizeof(file), "%s/fresh_file", dir);
+    PathEntry entry;
+    double start = now_ns();
+    int fd = open(file, O_CREAT | O_WRONLY, 0644);
+    if (fd < 0) return -1;
+    close(fd);
+    while (now_ns() - start < limit) {
+        if (pathcache_fd(cache) >= 0) {
+            struct pollfd pfd = { .fd = pathcache_fd(cache), .events = POLLIN };
+            if (poll(&pfd, 1, 10) > 0) pathcache_events(cache);
+        } else {
+            poll(NULL, 0, 1);
+        }
+        pathcache_refresh(cache);
+        if (pathcache_lookup(cache, dir, "fresh_", 6, &entry, 1, NULL) == 1) {
+            double elapsed = now_ns() - start;
+            unlink(file);
+            return elapsed;
+        }
+    }
+    unlink(file);
+    return -1;
+}
+
+static int bench_paths(void) {
+    char root[] = "/tmp/zsh-ac-paths.XXXXXX";
+    if (!mkdtemp(root)) {
+        fprintf(stderr, "bench: cannot create a temporary directory\n");
+        return 1;
+    }
+    if (!make_path_tree(root)) {
+        fprintf(stderr, "bench: cannot create the directory tree\n");
+        remove_path_tree(root);
+        return 1;
+    }
+    char dirs[PATH_BENCH_DIRS][PATH_MAX];
+    for (int i = 0; i < PATH_BENCH_DIRS; i++) path_bench_dir(dirs[i], sizeof(dirs[i]), root, i);
+
+    char partial[16];
+    int dir;
+    long direct_found = 0, cached_found = 0;
+    double start = now_ns();
+    for (int q = 0; q < PATH_BENCH_QUERIES; q++) {
+        path_query(q, &dir, partial, sizeof(partial));
+        direct_found += readdir_matches(dirs[dir], partial);
+    }
+    double direct_ns = (now_ns() - start) / PATH_BENCH_QUERIES;
+
+    printf("tree                 : %d directories x %d names\n", PATH_BENCH_DIRS, PATH_BENCH_FILES);
+    printf("readdir per query    : %8.0f ns/query\n", direct_ns);
+    int status = 0;
+    for (int watch = 1; watch >= 0; watch--) {
+        PathCache* cache = pathcache_create(watch);
+        if (!cache) {
+            status = 1;
+            break;
+        }
+        start = now_ns();
+        for (int i = 0; i < PATH_BENCH_DIRS; i++) pathcache_prefetch(cache, dirs[i]);
+        pathcache_refresh(cache);
+        double list_ms = (now_ns() - start) / 1e6;
+
+        PathEntry entries[PATH_BENCH_FILES];
+        cached_found = 0;
+        start = now_ns();
+        for (int q = 0; q < PATH_BENCH_QUERIES; q++) {
+            path_query(q, &dir, partial, sizeof(partial));
+            int n = pathcache_lookup(cache, dirs[dir], partial, strlen(partial), entries,
+                                     PATH_BENCH_FILES, NULL);
+            cached_found += n > 0 ? n : 0;
+        }
+        double cached_ns = (now_ns() - start) / PATH_BENCH_QUERIES;
+        double visible = path_change_visible(cache, dirs[0]);
+
+        printf("cached, %-7s      : %8.0f ns/query  (%.1f ms to list, change seen after %s%.2f ms)%s\n",
+               pathcache_backend(cache), cached_ns, list_ms, visible < 0 ? "> " : "",
+               visible < 0 ? PATHCACHE_RECHECK_MS + 1000.0 : visible / 1e6,
+               cached_found == direct_found ? "" : "  (MISMATCH)");
+        if (cached_found != direct_found) status = 1;
+        pathcache_destroy(cache);
+    }
+    remove_path_tree(root);
+    return status;
+}
+
+// History plus twins whose program is missing (see MISSING_EVERY)
+static char** missing_history(const char* path, int* count) {
+    char** lines = load_lines(path, count);
+    if (!lines) return NULL;
+    int total = *count + *count / MISSING_EVERY + 1;
+    char** mixed = realloc(lines, total * sizeof(char*));
+    if (!mixed) {
+        free_lines(lines, *count);
+        return NULL;
+    }
+    int n = *count;
+    char buf[MAX_COMMAND_LENGTH];
+    for (int i = 0; i < *count; i += MISSING_EVERY) {
+        size_t word = strcspn(mixed[i], " \t");
+        snprintf(buf, sizeof(buf), "%.*s-legacy%s", (int)word, mixed[i], mixed[i] + word);
+        mixed[n++] = strdup(buf);
+    }
+    *count = n;
+    return mixed;
+}
+
+static bool check_exec_index(const char* word, size_t length, void* context) {
+    return exec_index_has((const ExecIndex*)context, word, length);
+}
+
+// What a check without the index costs: stat the word in every $PATH entry
+static bool stat_on_path(const char* word, size_t length) {
+    char file[PATH_MAX];
+    for (const char* p = getenv("PATH"); p && *p;) {
+        size_t dir = strcspn(p, ":");
+        struct stat st;
+        snprintf(file, sizeof(file), "%.*s/%.*s", (int)dir, p, (int)length, word);
+        if (stat(file, &st) == 0 && (st.st_mode & 0111)) return true;
+        p += dir + (p[dir] == ':');
+    }
+    return false;
+}
+
+// Two-byte prefix queries; counts suggestions whose program is missing.
+// With stat, every suggestion's program is also looked up on $PATH.
+static double missing_queries(Trie* trie, char** lines, int count, const ExecIndex* index,
+                              bool with_stat, int* missing) {
+    char prefix[4];
+    *missing = 0;
+    double start = now_ns();
+    for (int q = 0; q < QUERY_ROUNDS; q++) {
+        snprintf(prefix, sizeof(prefix), "%.2s", lines[(q * 7919) % count]);
+        char* owned;
+        const char* best = trie_peek_best_completion(trie, prefix, &owned);
+        if (!best) continue;
+        size_t word = strcspn(best, " \t");
+        if (with_stat) stat_on_path(best, word);
+        if (!exec_index_has(index, best, word)) (*missing)++;
+        free(owned);
+    }
+    return (now_ns() - start) / QUERY_ROUNDS;
+}
+
+static int bench_missing(const char* path) {
+    int count;
+    char** lines = missing_history(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+    Trie* trie = trie_create();
+    if (!trie) return 1;
+    for (int i = 0; i < count; i++) {
+        trie_insert(trie, lines[i]);
+        if (strstr(lines[i], "-legacy")) trie_insert(trie, lines[i]);
+    }
+
+    double start = now_ns();
+    ExecIndex* index = exec_index_create(getenv("PATH"), NULL);
+    double index_ms = (now_ns() - start) / 1e6;
+    if (!index) return 1;
+
+    int shown_plain, shown_stat, shown_flagged;
+    double plain_ns = missing_queries(trie, lines, count, index, false, &shown_plain);
+    double stat_ns = missing_queries(trie, lines, count, index, true, &shown_stat);
+    start = now_ns();
+    int flagged = trie_set_command_check(trie, check_exec_index, index, false);
+    double flag_ms = (now_ns() - start) / 1e6;
+    double flagged_ns = missing_queries(trie, lines, count, index, false, &shown_flagged);
+    int shown_hidden;
+    trie_set_command_check(trie, check_exec_index, index, true);
+    double hidden_ns = missing_queries(trie, lines, count, index, false, &shown_hidden);
+
+    printf("history lines        : %d (%s), %d commands\n", count,
+           path ? path : "synthetic + missing twins", trie->total_commands);
+    printf("$PATH index          : %zu names, built in %.2f ms\n", exec_index_count(index), index_ms);
+    printf("leaf flags           : %d commands missing, flagged in %.2f ms\n", flagged, flag_ms);
+    printf("%-21s  %-12s %s\n", "", "query", "suggestions naming a missing program");
+    printf("%-21s: %-9.0f ns %d/%d\n", "no check", plain_ns, shown_plain, QUERY_ROUNDS);
+    printf("%-21s: %-9.0f ns %d/%d (detected, not fixed)\n", "stat per query", stat_ns, shown_stat, QUERY_ROUNDS);
+    printf("%-21s: %-9.0f ns %d/%d (only where nothing else matches)\n", "leaf flags (demote)",
+           flagged_ns, shown_flagged, QUERY_ROUNDS);
+    printf("%-21s: %-9.0f ns %d/%d\n", "leaf flags (hide)", hidden_ns, shown_hidden, QUERY_ROUNDS);
+
+    exec_index_destroy(index);
+    trie_destroy(trie);
+    free_lines(lines, count);
+    return 0;
+}
+
+// Exact top N by frequency: rank every leaf (what 'top' costs without a summary)
+static int scan_top(const Trie* trie, const TrieNode** out, int n) {
+    int found = 0;
+    for (int i = 0; i < trie->total_commands; i++) {
+        const TrieNode* leaf = trie->leaves[i];
+        if (found == n && leaf->frequency <= out[n - 1]->frequency) continue;
+        int j = found < n ? found++ : n - 1;
+        while (j > 0 && out[j - 1]->frequency < leaf->frequency) {
+            out[j] = out[j - 1];
+            j--;
+        }
+        out[j] = leaf;
+    }
+    return found;
+}
+
+static int bench_top(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+    Trie* trie = trie_create();
+    HeavySummary* summary = heavy_create(HEAVY_COUNTERS);
+    HeavyWindow* day = heavy_window_create(HEAVY_COUNTERS, 86400);
+    if (!trie || !summary || !day) return 1;
+
+    // Cubed uniform pick: a few lines take most executions, the rest a long tail
+    long start_time = 1700000000;
+    double update_ns = 0;
+    for (int i = 0; i < TOP_STREAM; i++) {
+        double u = (double)rng_next() / 4294967296.0;
+        const char* command = lines[(int)(u * u * u * count)];
+        long when = start_time + (long)i * TOP_STREAM_DAYS * 86400 / TOP_STREAM;
+        trie_insert(trie, command);
+        double t = now_ns();
+        heavy_add(summary, command, 1);
+        heavy_window_add(day, command, 1, when);
+        update_ns += now_ns() - t;
+    }
+    long now = start_time + (long)TOP_STREAM_DAYS * 86400;
+
+    const TrieNode* exact[TOP_N];
+    HeavyItem items[TOP_N];
+    int found = 0, got = 0;
+    double start = now_ns();
+    for (int q = 0; q < TOP_QUERIES; q++) found = scan_top(trie, exact, TOP_N);
+    double scan_ns = (now_ns() - start) / TOP_QUERIES;
+    start = now_ns();
+    for (int q = 0; q < TOP_QUERIES; q++) got = heavy_top(summary, items, TOP_N);
+    double top_ns = (now_ns() - start) / TOP_QUERIES;
+    start = now_ns();
+    for (int q = 0; q < TOP_QUERIES; q++) heavy_window_top(day, now, items, TOP_N);
+    double window_ns = (now_ns() - start) / TOP_QUERIES;
+
+    // Same commands as the exact answer? Counts off by how much?
+    got = heavy_top(summary, items, TOP_N);
+    int agree = 0;
+    long worst = 0;
+    for (int i = 0; i < found; i++) {
+        for (int j = 0; j < got; j++) {
+            if (strcmp(exact[i]->full_command, items[j].command) != 0) continue;
+            agree++;
+            long off = items[j].count - exact[i]->frequency;
+            if (off > worst) worst = off;
+        }
+    }
+
+    printf("stream               : %d executions of %d commands over %d days (%s)\n", TOP_STREAM,
+           trie->total_commands, TOP_STREAM_DAYS, path ? path : "synthetic");
+    printf("summary update       : %.0f ns per execution (overall + 1-day window)\n", update_ns / TOP_STREAM);
+    printf("top %-2d, trie scan    : %9.0f ns\n", TOP_N, scan_ns);
+    printf("top %-2d, summary      : %9.0f ns  (%d/%d of the exact top, counts at most %ld high,"
+           " error bound %ld)\n", TOP_N, top_ns, agree, found, worst,
+           heavy_total(summary) / HEAVY_COUNTERS);
+    printf("top %-2d, last day     : %9.0f ns  (two periods merged)\n", TOP_N, window_ns);
+
+    heavy_window_destroy(day);
+    heavy_destroy(summary);
+    trie_destroy(trie);
+    free_lines(lines, count);
+    return agree == found ? 0 : 1;
+}
+
+// Append one NUL-terminated prefix (n bytes of text) to a growing buffer
+static bool append_prefix(char** buf, size_t* used, size_t* capacity, const char* text, size_t n) {
+    if (*used + n + 1 > *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 1 << 20;
+        char* temp = realloc(*buf, grown);
+        if (!temp) return false;
+        *buf = temp;
+        *capacity = grown;
+    }
+    memcpy(*buf + *used, text, n);
+    (*buf)[*used + n] = '\0';
+    *used += n + 1;
+    return true;
+}
+
+// The prefix after each keystroke of typing lines, one after another; every
+// TYPING_BACKSPACE_EVERY-th key is a typo erased with backspace first
+static int typing_prefixes(char** lines, int count, char** out) {
+    char* buf = NULL;
+    size_t used = 0, capacity = 0;
+    int prefixes = 0, keys = 0;
+    char typo[MAX_COMMAND_LENGTH + 1];
+    for (int i = 0; i < TYPING_COMMANDS; i++) {
+        const char* line = lines[(i * 7919) % count];
+        size_t len = strlen(line) < MAX_COMMAND_LENGTH ? strlen(line) : MAX_COMMAND_LENGTH;
+        for (size_t n = 1; n <= len; n++) {
+            bool ok = true;
+            if (++keys % TYPING_BACKSPACE_EVERY == 0) {
+                memcpy(typo, line, n - 1);
+                typo[n - 1] = '~';
+                ok = append_prefix(&buf, &used, &capacity, typo, n) &&
+                     append_prefix(&buf, &used, &capacity, line, n - 1);
+                prefixes += 2;
+            }
+            if (!ok || !append_prefix(&buf, &used, &capacity, line, n)) {
+                free(buf);
+                return 0;
+            }
+            prefixes++;
+        }
+    }
+    *out = buf;
+    return prefixes;
+}
+
+static int bench_typing(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+    double build_ms;
+    Trie* trie = build_trie(lines, count, false, &build_ms);
+    char* prefixes;
+    int total = trie ? typing_prefixes(lines, count, &prefixes) : 0;
+    TrieCursor* cursor = calloc(1, sizeof(TrieCursor));
+    if (total == 0 || !cursor) return 1;
+
+    // Node lookups alone, then whole completions (lookup + subtree ranking)
+    long walk_steps = 0;
+    volatile long sink = 0;
+    int mismatches = 0;
+    double start = now_ns();
+    const char* p = prefixes;
+    for (int i = 0; i < total; i++, p += strlen(p) + 1) {
+        TrieNode* node = trie->root;
+        for (const char* c = p; *c && node; c++, walk_steps++) {
+            unsigned char index = (unsigned char)*c;
+            node = index < ALPHABET_SIZE ? node->children[index] : NULL;
+        }
+        sink += node != NULL;
+    }
+    double walk_ns = (now_ns() - start) / total;
+    start = now_ns();
+    p = prefixes;
+    for (int i = 0; i < total; i++, p += strlen(p) + 1) {
+        sink += trie_cursor_seek(trie, cursor, p) != NULL;
+    }
+    double cursor_ns = (now_ns() - start) / total;
+    long cursor_steps = cursor->steps;
+
+    start = now_ns();
+    p = prefixes;
+    char *owned, *resumed_owned;
+    for (int i = 0; i < total; i++, p += strlen(p) + 1) {
+        sink += trie_peek_best_completion(trie, p, &owned) != NULL;
+        free(owned);
+    }
+    double full_ns = (now_ns() - start) / total;
+    start = now_ns();
+    p = prefixes;
+    for (int i = 0; i < total; i++, p += strlen(p) + 1) {
+        sink += trie_cursor_best_completion(trie, cursor, p, &owned) != NULL;
+        free(owned);
+    }
+    double resumed_ns = (now_ns() - start) / total;
+    p = prefixes;
+    for (int i = 0; i < total; i++, p += strlen(p) + 1) {
+        const char* resumed = trie_cursor_best_completion(trie, cursor, p, &resumed_owned);
+        const char* full = trie_peek_best_completion(trie, p, &owned);
+        // Spliced answers are built per call: compare their text
+        if (owned || resumed_owned ? !full || !resumed || strcmp(full, resumed) != 0 : full != resumed) {
+            mismatches++;
+        }
+        free(owned);
+        free(resumed_owned);
+    }
+
+    printf("keystrokes           : %d prefixes typed (%d commands, 1 typo per %d keys)\n",
+           total, TYPING_COMMANDS, TYPING_BACKSPACE_EVERY);
+    printf("walk from the root   : %6.1f child steps, %5.0f ns per lookup\n", (double)walk_steps / total, walk_ns);
+    printf("resumed cursor       : %6.2f child steps, %5.0f ns per lookup\n", (double)cursor_steps / total, cursor_ns);
+    printf("completion, walk     : %9.0f ns\n", full_ns);
+    printf("completion, cursor   : %9.0f ns (%d disagreements with the walk)\n", resumed_ns, mismatches);
+
+    (void)sink;
+    free(cursor);
+    free(prefixes);
+    trie_destroy(trie);
+    free_lines(lines, count);
+    return mismatches ? 1 : 0;
+}
+
+static int compare_leaf_text(const void* a, const void* b) {
+    return strcmp((*(const TrieNode* const*)a)->full_command, (*(const TrieNode* const*)b)->full_command);
+}
+
+// Old server's side: the index as a snapshot written into an open file
+static bool handoff_write(const Trie* trie, int fd) {
+    const TrieNode** leaves = malloc((trie->total_commands + 1) * sizeof(TrieNode*));
+    SnapshotWriter* writer = snapshot_writer_create();
+    bool ok = leaves && writer;
+    if (ok) {
+        memcpy(leaves, trie->leaves, trie->total_commands * sizeof(TrieNode*));
+        qsort(leaves, trie->total_commands, sizeof(TrieNode*), compare_leaf_text);
+    }
+    for (int i = 0; ok && i < trie->total_commands; i++) {
+        ok = snapshot_writer_add(writer, leaves[i]->full_command, leaves[i]->frequency, leaves[i]->last_used);
+    }
+    ok = ok && ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0 && snapshot_writer_finish_fd(writer, fd);
+    free(leaves);
+    snapshot_writer_destroy(writer);
+    return ok;
+}
+
+// Until a restarted server answers from its whole index: inserting every
+// command again, or writing the old index out and mapping it in the new
+// process (an unlinked temp file stands in for the memfd)
+static int bench_handoff(const char* path) {
+    int count;
+    char** lines = load_lines(path, &count);
+    if (!lines || count == 0) {
+        fprintf(stderr, "bench: no history lines\n");
+        return 1;
+    }
+    double build_ms = 0, once_ms;
+    Trie* trie = NULL;
+    for (int r = 0; r < HANDOFF_ROUNDS; r++) {
+        trie_destroy(trie);
+        trie = build_trie(lines, count, false, &once_ms);
+        build_ms += once_ms;
+    }
+    FILE* file = tmpfile();
+    if (!trie || !file) return 1;
+    int fd = fileno(file);
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+
+    double write_ms = 0, adopt_ms = 0;
+    Snapshot* snap = NULL;
+    for (int r = 0; r < HANDOFF_ROUNDS; r++) {
+        snapshot_close(snap);
+        snap = NULL;
+        double start = now_ns();
+        if (!handoff_write(trie, fd)) break;
+        double written = now_ns();
+        snap = snapshot_open(proc_path);
+        if (!snap) break;
+        write_ms += (written - start) / 1e6;
+        adopt_ms += (now_ns() - written) / 1e6;
+    }
+    if (!snap) {
+        fprintf(stderr, "bench: hand-off write/open failed\n");
+        return 1;
+    }
+
+    // The adopted index answers what the trie would
+    int disagree = 0;
+    char prefix[8];
+    for (int i = 0; i < count; i++) {
+        snprintf(prefix, sizeof(prefix), "%.4s", lines[i]);
+        char* best = trie_get_best_completion(trie, prefix);
+        long leaf = snapshot_best_completion(snap, prefix);
+        if (!best || leaf < 0 || (int)snap->leaves[leaf].frequency != trie_frequency(trie, best)) {
+            disagree++;
+        }
+        free(best);
+    }
+
+    printf("index                : %d commands (%s)\n", trie->total_commands, path ? path : "synthetic");
+    printf("rebuild (insert all) : %9.2f ms before answers are complete\n", build_ms / HANDOFF_ROUNDS);
+    printf("hand-off, write      : %9.2f ms (old server, after its last reply)\n", write_ms / HANDOFF_ROUNDS);
+    printf("hand-off, adopt      : %9.3f ms (new server, before its first reply)\n", adopt_ms / HANDOFF_ROUNDS);
+    printf("adopted answers      : %d/%d prefixes differ from the trie\n", disagree, count);
+
+    snapshot_close(snap);
+    fclose(file);
+    trie_destroy(trie);
+    free_lines(lines, count);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s segments|events|snapshot|protocol|persist|cold|heat|ring|simd|templates|paths|missing|top|typing|handoff [history_file]\n", argv[0]);
+        return 1;
+    }
+
+    const char* path = argc > 2 ? argv[2] : NULL;
+    if (strcmp(argv[1], "segments") == 0) {
+        return bench_segments(path);
+    }
+    if (strcmp(argv[1], "events") == 0) {
+        return bench_events(path);
+    }
+    if (strcmp(argv[1], "snapshot") == 0) {
+        return bench_snapshot(path);
+    }
+    if (strcmp(argv[1], "protocol") == 0) {
+        return bench_protocol(path);
+    }
+    if (strcmp(argv[1], "persist") == 0) {
+        return bench_persist(path);
+    }
+    if (strcmp(argv[1], "cold") == 0) {
+        return bench_cold(path);
+    }
+    if (strcmp(argv[1], "heat") == 0) {
+        return bench_heat(path);
+    }
+    if (strcmp(argv[1], "ring") == 0) {
+        return bench_ring(path);
+    }
+    if (strcmp(argv[1], "simd") == 0) {
+        return bench_simd(path);
+    }
+    if (strcmp(argv[1], "templates") == 0) {
+        return bench_templates(path);
+    }
+    if (strcmp(argv[1], "paths") == 0) {
+        return bench_paths();
+    }
+    if (strcmp(argv[1], "missing") == 0) {
+        return bench_missing(path);
+    }
+    if (strcmp(argv[1], "top") == 0) {
+        return bench_top(path);
+    }
+    if (strcmp(argv[1], "typing") == 0) {
+        return bench_typing(path);
+    }
+    if (strcmp(argv[1], "handoff") == 0) {
+        return bench_handoff(path);
+    }
+
+    fprintf(stderr, "bench: unknown benchmark '%s'\n", argv[1]);
+    return 1;
+}
@@ -0,0 +1,580 @@
+/**
+ * @file eventlog.c
+ * @brief Append-only per-execution event log with columnar, bit-packed storage
+ *
+ * Every execution becomes four integers: command id, timestamp, cwd id and
+ * exit status. Rows collect in a small uncompressed tail; once the tail holds
+ * EVENT_BLOCK_SIZE rows it is sealed into one block where each column is
+ * stored separately at the minimum bit width for that block:
+ *
+ *   BlockHeader | command ids | zigzag time deltas | cwd ids | status + 1
+ *
+ * Timestamps are delta-encoded against the previous row (zigzag, so clock
+ * steps and out-of-order backfill stay cheap) and status 0 is stored as 1,
+ * unknown as 0, so a block of backfilled history spends no bits on it.
+ * A typical block costs 3-4 bytes per event instead of the 24-byte row.
+ */
+
+#include "eventlog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define EVENT_MAGIC "ZEV1"
+
+/**
+ * @struct BlockHeader
+ * @brief Fixed header in front of every sealed block
+ */
+typedef struct {
+    char magic[4];
+    uint32_t count;          // Events in the block
+    int64_t base_time;       // Timestamp of the first event
+    int64_t max_time;        // Latest timestamp in the block (for skipping)
+    uint8_t id_bits;         // Width of the command id column
+    uint8_t delta_bits;      // Width of the zigzag delta column
+    uint8_t cwd_bits;        // Width of the cwd id column
+    uint8_t status_bits;     // Width of the status column
+    uint32_t size;           // Block size in bytes, header included
+} BlockHeader;
+
+// Build "<dir>/<name>" into buf
+static void event_path(char* buf, size_t size, const char* dir, const char* name) {
+    snprintf(buf, size, "%s/%s", dir, name);
+}
+
+// Bits needed to store v (0 for v == 0)
+static uint8_t bit_width(uint64_t v) {
+    uint8_t bits = 0;
+    while (v) {
+        bits++;
+        v >>= 1;
+    }
+    return bits;
+}
+
+static uint64_t zigzag_encode(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// 64-bit words needed for count values of the given width
+static size_t column_words(int count, uint8_t bits) {
+    return ((size_t)count * bits + 63) / 64;
+}
+
+// Store value i of a column (words must be zeroed beforehand)
+static void column_put(uint64_t* words, int i, uint8_t bits, uint64_t v) {
+    if (bits == 0) return;
+    size_t pos = (size_t)i * bits;
+    size_t word = pos >> 6;
+    unsigned off = pos & 63;
+    words[word] |= v << off;
+    if (off + bits > 64) {
+        words[word + 1] |= v >> (64 - off);
+    }
+}
+
+// Unpack a whole column sequentially, calling the bit reader once per value
+// with a running word/offset instead of recomputing positions
+#define COLUMN_UNPACK(words, bits, count, STORE)                               \
+    do {                                                                       \
+        if ((bits) == 0) {                                                     \
+            for (int i_ = 0; i_ < (count); i_++) { uint64_t v = 0; STORE; }    \
+            break;                                                             \
+        }                                                                      \
+        const uint64_t mask_ = (bits) == 64 ? ~0ULL : (1ULL << (bits)) - 1;   \
+        const uint64_t* w_ = (words);                                          \
+        unsigned off_ = 0;                                                     \
+        for (int i_ = 0; i_ < (count); i_++) {                                 \
+            uint64_t v = *w_ >> off_;                                          \
+            if (off_ + (bits) >= 64) {                                         \
+                w_++;                                                          \
+                if (off_ + (bits) > 64) v |= *w_ << (64 - off_);               \
+                off_ = off_ + (bits) - 64;                                     \
+            } else {                                                           \
+                off_ += (bits);                                                \
+            }                                                                  \
+            v &= mask_;                                                        \
+            STORE;                                                             \
+        }                                                                      \
+    } while (0)
+
+// Exit status as stored in the status column (0 = unknown)
+static uint64_t status_encode(int32_t status) {
+    return status < 0 ? 0 : (uint64_t)status + 1;
+}
+
+void* eventlog_encode_block(const EventRecord* events, int count, uint32_t* size) {
+    if (!events || count <= 0 || count > EVENT_BLOCK_SIZE) return NULL;
+
+    // First pass: column widths
+    uint64_t max_id = 0, max_delta = 0, max_cwd = 0, max_status = 0;
+    int64_t max_time = events[0].timestamp;
+    for (int i = 0; i < count; i++) {
+        uint64_t delta = zigzag_encode(i ? events[i].timestamp - events[i - 1].timestamp : 0);
+        if (events[i].command_id > max_id) max_id = events[i].command_id;
+        if (delta > max_delta) max_delta = delta;
+        if (events[i].cwd_id > max_cwd) max_cwd = events[i].cwd_id;
+        if (status_encode(events[i].status) > max_status) max_status = status_encode(events[i].status);
+        if (events[i].timestamp > max_time) max_time = events[i].timestamp;
+    }
+
+    BlockHeader header;
+    memcpy(header.magic, EVENT_MAGIC, 4);
+    header.count = count;
+    header.base_time = events[0].timestamp;
+    header.max_time = max_time;
+    header.id_bits = bit_width(max_id);
+    header.delta_bits = bit_width(max_delta);
+    header.cwd_bits = bit_width(max_cwd);
+    header.status_bits = bit_width(max_status);
+
+    size_t id_words = column_words(count, header.id_bits);
+    size_t delta_words = column_words(count, header.delta_bits);
+    size_t cwd_words = column_words(count, header.cwd_bits);
+    size_t status_words = column_words(count, header.status_bits);
+    size_t total = sizeof(BlockHeader) + 8 * (id_words + delta_words + cwd_words + status_words);
+    header.size = (uint32_t)total;
+
+    uint8_t* block = calloc(1, total);
+    if (!block) return NULL;
+    memcpy(block, &header, sizeof(header));
+
+    // Second pass: one column at a time
+    uint64_t* ids = (uint64_t*)(block + sizeof(BlockHeader));
+    uint64_t* deltas = ids + id_words;
+    uint64_t* cwds = deltas + delta_words;
+    uint64_t* statuses = cwds + cwd_words;
+    for (int i = 0; i < count; i++) {
+        column_put(ids, i, header.id_bits, events[i].command_id);
+    }
+    for (int i = 0; i < count; i++) {
+        int64_t delta = i ? events[i].timestamp - events[i - 1].timestamp : 0;
+        column_put(deltas, i, header.delta_bits, zigzag_encode(delta));
+    }
+    for (int i = 0; i < count; i++) {
+        column_put(cwds, i, header.cwd_bits, events[i].cwd_id);
+    }
+    for (int i = 0; i < count; i++) {
+        column_put(statuses, i, header.status_bits, status_encode(events[i].status));
+    }
+
+    *size = header.size;
+    return block;
+}
+
+int eventlog_decode_block(const void* block, uint64_t avail, EventRecord* events, uint32_t* size) {
+    BlockHeader header;
+    if (avail < sizeof(header)) return -1;
+    memcpy(&header, block, sizeof(header));
+    if (memcmp(header.magic, EVENT_MAGIC, 4) != 0 || header.count == 0 ||
+        header.count > EVENT_BLOCK_SIZE || header.size > avail ||
+        header.id_bits > 32 || header.cwd_bits > 32 || header.status_bits > 33 ||
+        header.delta_bits > 64) {
+        return -1;
+    }
+
+    int count = header.count;
+    size_t id_words = column_words(count, header.id_bits);
+    size_t delta_words = column_words(count, header.delta_bits);
+    size_t cwd_words = column_words(count, header.cwd_bits);
+    size_t status_words = column_words(count, header.status_bits);
+    if (sizeof(BlockHeader) + 8 * (id_words + delta_words + cwd_words + status_words) != header.size) {
+        return -1;
+    }
+
+    // Blocks are 8-byte multiples appended back to back, so the columns are
+    // naturally aligned inside the mapping
+    const uint64_t* ids = (const uint64_t*)((const uint8_t*)block + sizeof(BlockHeader));
+    const uint64_t* deltas = ids + id_words;
+    const uint64_t* cwds = deltas + delta_words;
+    const uint64_t* statuses = cwds + cwd_words;
+
+    EventRecord* out = events;
+    COLUMN_UNPACK(ids, header.id_bits, count, out++->command_id = (uint32_t)v);
+    int64_t t = header.base_time;
+    out = events;
+    COLUMN_UNPACK(deltas, header.delta_bits, count, (t += zigzag_decode(v), out++->timestamp = t));
+    out = events;
+    COLUMN_UNPACK(cwds, header.cwd_bits, count, out++->cwd_id = (uint32_t)v);
+    out = events;
+    COLUMN_UNPACK(statuses, header.status_bits, count, out++->status = (int32_t)v - 1);
+
+    *size = header.size;
+    return count;
+}
+
+// 32-bit FNV-1a
+static uint32_t dict_hash(const char* s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Find the slot holding s, or the empty slot where it belongs
+static uint32_t* dict_slot(EventDict* dict, const char* s) {
+    uint32_t mask = dict->slot_count - 1;
+    uint32_t i = dict_hash(s) & mask;
+    while (dict->slots[i] && strcmp(dict->strings[dict->slots[i] - 1], s) != 0) {
+        i = (i + 1) & mask;
+    }
+    return &dict->slots[i];
+}
+
+// Double the hash table once it is half full
+static bool dict_grow(EventDict* dict) {
+    if (dict->slot_count && (dict->count + 1) * 2 <= dict->slot_count) return true;
+
+    int slot_count = dict->slot_count ? dict->slot_count * 2 : 256;
+    uint32_t* slots = calloc(slot_count, sizeof(uint32_t));
+    if (!slots) return false;
+    free(dict->slots);
+    dict->slots = slots;
+    dict->slot_count = slot_count;
+    for (int id = 0; id < dict->count; id++) {
+        *dict_slot(dict, dict->strings[id]) = id + 1;
+    }
+    return true;
+}
+
+// Append s as a new id (the hash keeps the first id of a duplicate); -1 on failure
+static long dict_push(EventDict* dict, const char* s) {
+    if (!dict_grow(dict)) return -1;
+    if (dict->count >= dict->capacity) {
+        int capacity = dict->capacity ? dict->capacity * 2 : 256;
+        char** temp = realloc(dict->strings, capacity * sizeof(char*));
+        if (!temp) return -1;
+        dict->strings = temp;
+        dict->capacity = capacity;
+    }
+    char* copy = strdup(s);
+    if (!copy) return -1;
+    dict->strings[dict->count] = copy;
+    uint32_t* slot = dict_slot(dict, s);
+    if (!*slot) *slot = dict->count + 1;
+    return dict->count++;
+}
+
+// Id of s, adding it if new; -1 on allocation failure
+static long dict_intern(EventDict* dict, const char* s) {
+    if (dict->slot_count) {
+        uint32_t* slot = dict_slot(dict, s);
+        if (*slot) return *slot - 1;
+    }
+    return dict_push(dict, s);
+}
+
+// Dictionary files hold one entry per line; '\' and newlines are escaped
+static void dict_unescape(char* s) {
+    char* out = s;
+    for (char* p = s; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+            *out++ = (*p == 'n') ? '\n' : *p;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+static void dict_write_escaped(FILE* file, const char* s) {
+    for (; *s; s++) {
+        if (*s == '\\') fputs("\\\\", file);
+        else if (*s == '\n') fputs("\\n", file);
+        else fputc(*s, file);
+    }
+    fputc('\n', file);
+}
+
+static bool dict_load(EventDict* dict, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return errno == ENOENT;
+
+    char* line = NULL;
+    size_t len = 0;
+    ssize_t read;
+    bool ok = true;
+    while ((read = getline(&line, &len, file)) != -1) {
+        if (read > 0 && line[read - 1] == '\n') line[read - 1] = '\0';
+        dict_unescape(line);
+        // Ids are line numbers, so duplicates still take an id
+        if (dict_push(dict, line) < 0) {
+            ok = false;
+            break;
+        }
+    }
+    free(line);
+    fclose(file);
+    dict->saved = dict->count;
+    return ok;
+}
+
+// Append entries added since the dictionary was loaded
+static bool dict_save(EventDict* dict, const char* path) {
+    if (dict->saved == dict->count) return true;
+    FILE* file = fopen(path, "a");
+    if (!file) return false;
+    for (int id = dict->saved; id < dict->count; id++) {
+        dict_write_escaped(file, dict->strings[id]);
+    }
+    bool ok = fflush(file) == 0;
+    fclose(file);
+    if (ok) dict->saved = dict->count;
+    return ok;
+}
+
+static void dict_free(EventDict* dict) {
+    for (int id = 0; id < dict->count; id++) {
+        free(dict->strings[id]);
+    }
+    free(dict->strings);
+    free(dict->slots);
+}
+
+// Cut a torn trailing block (a crash mid-seal) off events.log, so blocks
+// sealed later stay reachable; a bad block elsewhere is left for the scan
+static bool eventlog_repair(const char* dir) {
+    char path[4200];
+    event_path(path, sizeof(path), dir, "events.log");
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return errno == ENOENT;
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    uint64_t total = ok ? (uint64_t)st.st_size : 0;
+    uint64_t offset = 0;
+    while (ok && offset < total) {
+        BlockHeader header;
+        if (total - offset < sizeof(header) ||
+            pread(fd, &header, sizeof(header), offset) != (ssize_t)sizeof(header)) {
+            break;
+        }
+        if (memcmp(header.magic, EVENT_MAGIC, 4) != 0 || header.size < sizeof(header)) {
+            offset = total;
+            break;
+        }
+        if (header.size > total - offset) break;
+        offset += header.size;
+    }
+    if (ok && offset < total) ok = ftruncate(fd, offset) == 0;
+    close(fd);
+    return ok;
+}
+
+EventLog* eventlog_open(const char* dir) {
+    if (!dir) return NULL;
+    EventLog* log = calloc(1, sizeof(EventLog));
+    if (!log) return NULL;
+    snprintf(log->dir, sizeof(log->dir), "%s", dir);
+
+    char path[4200];
+    event_path(path, sizeof(path), dir, "events.tail");
+    log->lock_fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (log->lock_fd < 0 || flock(log->lock_fd, LOCK_EX) != 0) {
+        if (log->lock_fd >= 0) close(log->lock_fd);
+        free(log);
+        return NULL;
+    }
+
+    log->tail = malloc(EVENT_BLOCK_SIZE * sizeof(EventRecord));
+    if (!log->tail || !eventlog_repair(dir)) {
+        eventlog_close(log);
+        return NULL;
+    }
+    ssize_t bytes = pread(log->lock_fd, log->tail, EVENT_BLOCK_SIZE * sizeof(EventRecord), 0);
+    log->tail_count = bytes > 0 ? (int)(bytes / sizeof(EventRecord)) : 0;
+
+    event_path(path, sizeof(path), dir, "events.cmds");
+    bool ok = dict_load(&log->commands, path);
+    event_path(path, sizeof(path), dir, "events.cwds");
+    ok = ok && dict_load(&log->cwds, path);
+    if (!ok) {
+        eventlog_close(log);
+        return NULL;
+    }
+    return log;
+}
+
+// Seal the tail into a block at the end of events.log
+static bool eventlog_seal(EventLog* log) {
+    uint32_t size;
+    void* block = eventlog_encode_block(log->tail, log->tail_count, &size);
+    if (!block) return false;
+
+    char path[4200];
+    event_path(path, sizeof(path), log->dir, "events.log");
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    struct stat st;
+    bool ok = fd >= 0 && fstat(fd, &st) == 0;
+    if (ok && write(fd, block, size) != (ssize_t)size) {
+        // Drop the partial block so the next seal starts on a boundary
+        if (ftruncate(fd, st.st_size) != 0) {
+            fprintf(stderr, "eventlog: failed to roll back %s\n", path);
+        }
+        ok = false;
+    }
+    if (fd >= 0) close(fd);
+    free(block);
+
+    if (ok) {
+        // The rows now live in the block; a stale events.tail would seal
+        // them a second time after a crash
+        if (ftruncate(log->lock_fd, 0) != 0) {
+            fprintf(stderr, "eventlog: failed to clear %s/events.tail\n", log->dir);
+        }
+        log->tail_count = 0;
+        log->dirty = true;
+    }
+    return ok;
+}
+
+bool eventlog_append(EventLog* log, const char* command, const char* cwd,
+                     int64_t timestamp, int32_t status) {
+    if (!log || !command || !*command) return false;
+
+    long command_id = dict_intern(&log->commands, command);
+    long cwd_id = dict_intern(&log->cwds, cwd ? cwd : "");
+    if (command_id < 0 || cwd_id < 0) return false;
+
+    EventRecord* event = &log->tail[log->tail_count++];
+    event->command_id = (uint32_t)command_id;
+    event->cwd_id = (uint32_t)cwd_id;
+    event->timestamp = timestamp;
+    event->status = status < 0 ? EVENT_STATUS_UNKNOWN : status;
+    log->dirty = true;
+
+    if (log->tail_count == EVENT_BLOCK_SIZE) {
+        // Dictionary entries must reach disk before a block refers to them
+        char path[4200];
+        event_path(path, sizeof(path), log->dir, "events.cmds");
+        bool ok = dict_save(&log->commands, path);
+        event_path(path, sizeof(path), log->dir, "events.cwds");
+        ok = ok && dict_save(&log->cwds, path);
+        if (!ok || !eventlog_seal(log)) {
+            log->tail_count--;
+            return false;
+        }
+    }
+    return true;
+}
+
+void eventlog_close(EventLog* log) {
+    if (!log) return;
+
+    if (log->dirty && log->tail) {
+        char path[4200];
+        event_path(path, sizeof(path), log->dir, "events.cmds");
+        bool ok = dict_save(&log->commands, path);
+        event_path(path, sizeof(path), log->dir, "events.cwds");
+        ok = ok && dict_save(&log->cwds, path);
+
+        size_t bytes = log->tail_count * sizeof(EventRecord);
+        if (ok && ftruncate(log->lock_fd, 0) == 0 && bytes > 0 &&
+            pwrite(log->lock_fd, log->tail, bytes, 0) != (ssize_t)bytes) {
+            fprintf(stderr, "eventlog: failed to write %s/events.tail\n", log->dir);
+        }
+    }
+
+    if (log->lock_fd >= 0) {
+        flock(log->lock_fd, LOCK_UN);
+        close(log->lock_fd);
+    }
+    dict_free(&log->commands);
+    dict_free(&log->cwds);
+    free(log->tail);
+    free(log);
+}
+
+bool eventlog_is_empty(const EventLog* log) {
+    if (!log) return true;
+    if (log->tail_count > 0) return false;
+
+    char path[4200];
+    struct stat st;
+    event_path(path, sizeof(path), log->dir, "events.log");
+    return stat(path, &st) != 0 || st.st_size == 0;
+}
+
+// Deliver decoded events at or after since
+static long eventlog_deliver(EventLog* log, const EventRecord* events, int count,
+                             int64_t since, EventCallback callback, void* ctx) {
+    long delivered = 0;
+    for (int i = 0; i < count; i++) {
+        if (events[i].timestamp < since) continue;
+        if (events[i].command_id >= (uint32_t)log->commands.count ||
+            events[i].cwd_id >= (uint32_t)log->cwds.count) {
+            continue;
+        }
+        callback(&events[i], log->commands.strings[events[i].command_id],
+                 log->cwds.strings[events[i].cwd_id], ctx);
+        delivered++;
+    }
+    return delivered;
+}
+
+long eventlog_scan(EventLog* log, int64_t since, EventCallback callback, void* ctx) {
+    if (!log || !callback) return -1;
+
+    char path[4200];
+    event_path(path, sizeof(path), log->dir, "events.log");
+    long delivered = 0;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        const uint8_t* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+
+        EventRecord* events = malloc(EVENT_BLOCK_SIZE * sizeof(EventRecord));
+        uint64_t offset = 0;
+        uint64_t total = st.st_size;
+        while (events && offset < total) {
+            BlockHeader header;
+            if (total - offset < sizeof(header)) break;
+            memcpy(&header, map + offset, sizeof(header));
+            if (memcmp(header.magic, EVENT_MAGIC, 4) != 0 || header.size < sizeof(header)) {
+                delivered = -1;
+                break;
+            }
+            // A torn final block ends the log
+            if (header.size > total - offset) break;
+            if (header.max_time < since) {
+                offset += header.size;
+                continue;
+            }
+
+            uint32_t size;
+            int count = eventlog_decode_block(map + offset, total - offset, events, &size);
+            if (count < 0) {
+                delivered = -1;
+                break;
+            }
+            delivered += eventlog_deliver(log, events, count, since, callback, ctx);
+            offset += size;
+        }
+        free(events);
+        munmap((void*)map, st.st_size);
+    }
+    if (fd >= 0) close(fd);
+    if (delivered < 0) return -1;
+
+    return delivered + eventlog_deliver(log, log->tail, log->tail_count, since, callback, ctx);
+}
@@ -0,0 +1,230 @@
+/**
+ * @file execindex.c
+ * @brief Set of command names that can run on this host
+ *
+ * Names are packed into one buffer and found through an open-addressing
+ * table of offsets (FNV-1a, linear probing, at most half full). A rebuild
+ * starts from an empty set; it only happens when $PATH content changed, so
+ * there is no incremental removal.
+ */
+
+#include "execindex.h"
+#include <dirent.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Shell words that are never files on $PATH; the plugin sends the exact
+// builtins, reserved words, aliases and functions of the shell on top
+static const char* const SHELL_BUILTINS[] = {
+    ".", ":", "[", "[[", "{", "}", "!", "alias", "autoload", "bg", "bindkey", "break",
+    "builtin", "case", "cd", "command", "continue", "coproc", "declare", "dirs",
+    "disown", "do", "done", "echo", "elif", "else", "emulate", "esac", "eval", "exec",
+    "exit", "export", "false", "fc", "fg", "fi", "for", "function", "functions",
+    "getopts", "hash", "history", "if", "jobs", "kill", "let", "local", "logout",
+    "noglob", "nocorrect", "popd", "print", "printf", "pushd", "pwd", "read",
+    "readonly", "rehash", "repeat", "return", "select", "set", "setopt", "shift",
+    "source", "test", "then", "time", "trap", "true", "type", "typeset", "ulimit",
+    "umask", "unalias", "unfunction", "unhash", "unset", "unsetopt", "until", "wait",
+    "whence", "where", "which", "while", "zle", "zmodload", "zstyle",
+};
+
+typedef struct {
+    char* path;
+    struct timespec mtime;
+    bool missing;
+} ExecDir;
+
+struct ExecIndex {
+    ExecDir dirs[EXEC_INDEX_MAX_DIRS];
+    int dir_count;
+    char* shell_names;          // Copy of the extra names (blank-separated)
+    char* names;                // Packed, NUL-terminated
+    size_t names_used;
+    size_t names_capacity;
+    uint32_t* slots;            // Offset + 1 into names, 0 = empty
+    size_t slot_count;          // Power of two
+    size_t count;
+    long checked;               // Last mtime check (ms)
+};
+
+// Monotonic clock in milliseconds
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static uint32_t name_hash(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot holding name, or the empty slot where it would go
+static uint32_t* find_slot(const ExecIndex* index, const char* name, size_t length) {
+    size_t mask = index->slot_count - 1;
+    for (size_t i = name_hash(name, length) & mask;; i = (i + 1) & mask) {
+        uint32_t* slot = &index->slots[i];
+        if (*slot == 0) return slot;
+        const char* stored = index->names + *slot - 1;
+        if (strncmp(stored, name, length) == 0 && stored[length] == '\0') return slot;
+    }
+}
+
+// Double the table (rehashing every name)
+static bool grow_slots(ExecIndex* index) {
+    size_t old_count = index->slot_count;
+    uint32_t* old = index->slots;
+    index->slot_count = old_count ? old_count * 2 : 1024;
+    index->slots = calloc(index->slot_count, sizeof(uint32_t));
+    if (!index->slots) {
+        index->slots = old;
+        index->slot_count = old_count;
+        return false;
+    }
+    for (size_t i = 0; i < old_count; i++) {
+        if (!old[i]) continue;
+        const char* name = index->names + old[i] - 1;
+        *find_slot(index, name, strlen(name)) = old[i];
+    }
+    free(old);
+    return true;
+}
+
+static void add_name(ExecIndex* index, const char* name, size_t length) {
+    if (length == 0) return;
+    if ((index->count + 1) * 2 > index->slot_count && !grow_slots(index)) return;
+    uint32_t* slot = find_slot(index, name, length);
+    if (*slot) return;
+    if (index->names_used + length + 1 > index->names_capacity) {
+        size_t capacity = index->names_capacity ? index->names_capacity * 2 : 16384;
+        while (index->names_used + length + 1 > capacity) capacity *= 2;
+        char* names = realloc(index->names, capacity);
+        if (!names) return;
+        index->names = names;
+        index->names_capacity = capacity;
+    }
+    memcpy(index->names + index->names_used, name, length);
+    index->names[index->names_used + length] = '\0';
+    *slot = (uint32_t)index->names_used + 1;
+    index->names_used += length + 1;
+    index->count++;
+}
+
+// Add every executable regular file (or symlink to one) in a directory
+static void scan_dir(ExecIndex* index, ExecDir* dir) {
+    DIR* handle = opendir(dir->path);
+    struct stat st;
+    dir->missing = !handle || fstat(dirfd(handle), &st) != 0;
+    if (dir->missing) {
+        memset(&dir->mtime, 0, sizeof(dir->mtime));
+        if (handle) closedir(handle);
+        return;
+    }
+    dir->mtime = st.st_mtim;
+
+    struct dirent* entry;
+    while ((entry = readdir(handle))) {
+        if (entry->d_name[0] == '.') continue;
+        if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) continue;
+        if (fstatat(dirfd(handle), entry->d_name, &st, 0) != 0) continue;
+        if (S_ISREG(st.st_mode) && (st.st_mode & 0111)) {
+            add_name(index, entry->d_name, strlen(entry->d_name));
+        }
+    }
+    closedir(handle);
+}
+
+static void add_words(ExecIndex* index, const char* words) {
+    for (const char* p = words; p && *p;) {
+        size_t blank = strspn(p, " \t\n");
+        p += blank;
+        size_t length = strcspn(p, " \t\n");
+        add_name(index, p, length);
+        p += length;
+    }
+}
+
+// Build the set from scratch
+static void rebuild(ExecIndex* index) {
+    index->names_used = 0;
+    index->count = 0;
+    if (index->slots) memset(index->slots, 0, index->slot_count * sizeof(uint32_t));
+    for (size_t i = 0; i < sizeof(SHELL_BUILTINS) / sizeof(SHELL_BUILTINS[0]); i++) {
+        add_name(index, SHELL_BUILTINS[i], strlen(SHELL_BUILTINS[i]));
+    }
+    add_words(index, index->shell_names);
+    for (int i = 0; i < index->dir_count; i++) {
+        scan_dir(index, &index->dirs[i]);
+    }
+    index->checked = now_ms();
+}
+
+static bool dir_changed(const ExecDir* dir) {
+    struct stat st;
+    bool exists = stat(dir->path, &st) == 0 && S_ISDIR(st.st_mode);
+    if (exists != !dir->missing) return true;
+    return exists && (st.st_mtim.tv_sec != dir->mtime.tv_sec ||
+                      st.st_mtim.tv_nsec != dir->mtime.tv_nsec);
+}
+
+ExecIndex* exec_index_create(const char* path, const char* shell_names) {
+    ExecIndex* index = calloc(1, sizeof(ExecIndex));
+    if (!index) return NULL;
+    if (shell_names && !(index->shell_names = strdup(shell_names))) {
+        free(index);
+        return NULL;
+    }
+
+    // Relative entries (".", "") depend on the shell's directory: skipped
+    for (const char* p = path; p && *p && index->dir_count < EXEC_INDEX_MAX_DIRS;) {
+        size_t length = strcspn(p, ":");
+        if (p[0] == '/') {
+            char* dir = strndup(p, length);
+            if (dir) index->dirs[index->dir_count++].path = dir;
+        }
+        p += length + (p[length] == ':');
+    }
+    rebuild(index);
+    return index;
+}
+
+void exec_index_destroy(ExecIndex* index) {
+    if (!index) return;
+    for (int i = 0; i < index->dir_count; i++) free(index->dirs[i].path);
+    free(index->shell_names);
+    free(index->names);
+    free(index->slots);
+    free(index);
+}
+
+bool exec_index_refresh(ExecIndex* index) {
+    long now = now_ms();
+    if (now - index->checked < EXEC_INDEX_RECHECK_MS) return false;
+    index->checked = now;
+    for (int i = 0; i < index->dir_count; i++) {
+        if (dir_changed(&index->dirs[i])) {
+            rebuild(index);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool exec_index_has(const ExecIndex* index, const char* word, size_t length) {
+    if (length == 0 || !index->slots) return true;
+    // Paths, expansions, quoting and grouping: not a name to look up
+    for (size_t i = 0; i < length; i++) {
+        if (strchr("/$~`'\"\\=(){}*?[", word[i])) return true;
+    }
+    return *find_slot(index, word, length) != 0;
+}
+
+size_t exec_index_count(const ExecIndex* index) {
+    return index->count;
+}
@@ -0,0 +1,294 @@
+/**
+ * @file heavy.c
+ * @brief Space-Saving summaries of the most used commands
+ *
+ * order[] holds the counters sorted by count, descending, and each counter
+ * knows its position. Adding one use to a counter only has to move it past
+ * the counters that had the same count: it is swapped with the first of
+ * them. Larger weights (seeding from stored frequencies) shift the run it
+ * overtakes instead.
+ *
+ * The hash is open-addressed with linear probing over twice the capacity;
+ * an evicted command's slot is freed by backward-shift deletion, so there
+ * are no tombstones to clean up.
+ */
+
+#include "heavy.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char* command;
+    uint32_t hash;
+    long count;
+    long error;
+    int position;               // In order[]
+} HeavyCounter;
+
+struct HeavySummary {
+    int capacity;
+    int used;
+    long total;
+    HeavyCounter* counters;
+    HeavyCounter** order;       // Sorted by count, descending
+    HeavyCounter** slots;       // Hash (NULL = empty)
+    size_t mask;                // Slots - 1
+};
+
+struct HeavyWindow {
+    long span;
+    long start;                 // Start of the current period (multiple of span)
+    HeavySummary* current;
+    HeavySummary* previous;
+};
+
+static uint32_t command_hash(const char* command) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)command; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot holding command, or the empty slot where it would go
+static size_t find_slot(const HeavySummary* summary, const char* command, uint32_t hash) {
+    size_t i = hash & summary->mask;
+    while (summary->slots[i] && (summary->slots[i]->hash != hash ||
+                                 strcmp(summary->slots[i]->command, command) != 0)) {
+        i = (i + 1) & summary->mask;
+    }
+    return i;
+}
+
+static HeavyCounter* find_counter(const HeavySummary* summary, const char* command, uint32_t hash) {
+    return summary->slots[find_slot(summary, command, hash)];
+}
+
+// Remove a counter from the hash, pulling later entries of its probe run back
+static void unlink_counter(HeavySummary* summary, const HeavyCounter* counter) {
+    size_t i = counter->hash & summary->mask;
+    while (summary->slots[i] != counter) i = (i + 1) & summary->mask;
+    summary->slots[i] = NULL;
+    for (size_t j = (i + 1) & summary->mask; summary->slots[j]; j = (j + 1) & summary->mask) {
+        size_t home = summary->slots[j]->hash & summary->mask;
+        // Entry j may fill the hole at i unless its home lies in (i, j]
+        bool stays = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+        if (stays) continue;
+        summary->slots[i] = summary->slots[j];
+        summary->slots[j] = NULL;
+        i = j;
+    }
+}
+
+// Move a counter whose count grew towards the front of order[]
+static void promote(HeavySummary* summary, HeavyCounter* counter) {
+    int p = counter->position;
+    if (p == 0 || summary->order[p - 1]->count >= counter->count) return;
+
+    // First position holding a smaller count
+    int low = 0, high = p;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (summary->order[mid]->count < counter->count) high = mid;
+        else low = mid + 1;
+    }
+    HeavyCounter* first = summary->order[low];
+    if (first->count == summary->order[p - 1]->count) {
+        // Overtook one run of equal counts: trade places with its head
+        summary->order[p] = first;
+        first->position = p;
+    } else {
+        for (int i = p; i > low; i--) {
+            summary->order[i] = summary->order[i - 1];
+            summary->order[i]->position = i;
+        }
+    }
+    summary->order[low] = counter;
+    counter->position = low;
+}
+
+HeavySummary* heavy_create(int capacity) {
+    HeavySummary* summary = calloc(1, sizeof(HeavySummary));
+    if (!summary) return NULL;
+    size_t slots = 2;
+    while (slots < (size_t)capacity * 2) slots *= 2;
+    summary->capacity = capacity;
+    summary->mask = slots - 1;
+    summary->counters = calloc(capacity, sizeof(HeavyCounter));
+    summary->order = calloc(capacity, sizeof(HeavyCounter*));
+    summary->slots = calloc(slots, sizeof(HeavyCounter*));
+    if (capacity < 1 || !summary->counters || !summary->order || !summary->slots) {
+        heavy_destroy(summary);
+        return NULL;
+    }
+    return summary;
+}
+
+void heavy_destroy(HeavySummary* summary) {
+    if (!summary) return;
+    for (int i = 0; i < summary->used; i++) free(summary->counters[i].command);
+    free(summary->counters);
+    free(summary->order);
+    free(summary->slots);
+    free(summary);
+}
+
+// Forget every command
+static void heavy_clear(HeavySummary* summary) {
+    for (int i = 0; i < summary->used; i++) free(summary->counters[i].command);
+    memset(summary->slots, 0, (summary->mask + 1) * sizeof(HeavyCounter*));
+    summary->used = 0;
+    summary->total = 0;
+}
+
+void heavy_add(HeavySummary* summary, const char* command, long weight) {
+    if (weight <= 0) return;
+    summary->total += weight;
+    uint32_t hash = command_hash(command);
+    size_t slot = find_slot(summary, command, hash);
+    HeavyCounter* counter = summary->slots[slot];
+
+    if (!counter) {
+        char* copy = strdup(command);
+        if (!copy) return;
+        if (summary->used < summary->capacity) {
+            counter = &summary->counters[summary->used];
+            counter->count = 0;
+            counter->error = 0;
+            counter->position = summary->used;
+            summary->order[summary->used++] = counter;
+        } else {
+            // Take over the smallest counter; its count becomes our error
+            counter = summary->order[summary->used - 1];
+            unlink_counter(summary, counter);
+            free(counter->command);
+            counter->error = counter->count;
+            slot = find_slot(summary, command, hash);
+        }
+        counter->command = copy;
+        counter->hash = hash;
+        summary->slots[slot] = counter;
+    }
+    counter->count += weight;
+    promote(summary, counter);
+}
+
+int heavy_top(const HeavySummary* summary, HeavyItem* out, int n) {
+    int count = n < summary->used ? n : summary->used;
+    for (int i = 0; i < count; i++) {
+        const HeavyCounter* counter = summary->order[i];
+        out[i].command = counter->command;
+        out[i].count = counter->count;
+        out[i].error = counter->error;
+    }
+    return count;
+}
+
+long heavy_count(const HeavySummary* summary, const char* command, long* error) {
+    const HeavyCounter* counter = find_counter(summary, command, command_hash(command));
+    if (error) *error = counter ? counter->error : 0;
+    return counter ? counter->count : 0;
+}
+
+long heavy_total(const HeavySummary* summary) {
+    return summary->total;
+}
+
+HeavyWindow* heavy_window_create(int capacity, long span) {
+    HeavyWindow* window = calloc(1, sizeof(HeavyWindow));
+    if (!window) return NULL;
+    window->span = span > 0 ? span : 1;
+    window->current = heavy_create(capacity);
+    window->previous = heavy_create(capacity);
+    if (!window->current || !window->previous) {
+        heavy_window_destroy(window);
+        return NULL;
+    }
+    return window;
+}
+
+void heavy_window_destroy(HeavyWindow* window) {
+    if (!window) return;
+    heavy_destroy(window->current);
+    heavy_destroy(window->previous);
+    free(window);
+}
+
+long heavy_window_span(const HeavyWindow* window) {
+    return window->span;
+}
+
+// Rotate so the current period contains now (time only moves forward)
+static void heavy_window_advance(HeavyWindow* window, long now) {
+    long start = now - now % window->span;
+    if (start <= window->start) return;
+    if (start - window->start == window->span) {
+        HeavySummary* older = window->previous;
+        window->previous = window->current;
+        window->current = older;
+        heavy_clear(window->current);
+    } else {
+        heavy_clear(window->current);
+        heavy_clear(window->previous);
+    }
+    window->start = start;
+}
+
+void heavy_window_add(HeavyWindow* window, const char* command, long weight, long when) {
+    heavy_window_advance(window, when);
+    if (when >= window->start) {
+        heavy_add(window->current, command, weight);
+    } else if (when >= window->start - window->span) {
+        heavy_add(window->previous, command, weight);
+    }
+}
+
+// Insert into the n best so far (sorted, found of them), if it belongs there
+static void keep_best(HeavyItem* out, int n, int* found, const HeavyItem* item) {
+    if (*found == n && out[n - 1].count >= item->count) return;
+    int j = *found < n ? (*found)++ : n - 1;
+    while (j > 0 && out[j - 1].count < item->count) {
+        out[j] = out[j - 1];
+        j--;
+    }
+    out[j] = *item;
+}
+
+int heavy_window_top(HeavyWindow* window, long now, HeavyItem* out, int n) {
+    heavy_window_advance(window, now);
+    // Share of the previous period still inside [now - span, now], in 1/1000
+    long inside = 1000 - (now - window->start) * 1000 / window->span;
+    const HeavySummary* current = window->current;
+    const HeavySummary* previous = window->previous;
+
+    // Walk both orders at once, taking the larger contribution next, until no
+    // command not seen yet can beat the n-th best: usually after a few more
+    // than n steps. A command in both periods is merged where it is met first.
+    int found = 0, i = 0, j = 0;
+    while (n > 0 && (i < current->used || j < previous->used)) {
+        long from_current = i < current->used ? current->order[i]->count : 0;
+        long from_previous = j < previous->used ? previous->order[j]->count * inside / 1000 : 0;
+        if (found == n && out[n - 1].count >= from_current + from_previous) break;
+
+        HeavyItem item;
+        if (i < current->used && from_current >= from_previous) {
+            const HeavyCounter* counter = current->order[i++];
+            const HeavyCounter* older = find_counter(previous, counter->command, counter->hash);
+            if (older && older->position < j) continue;  // Met already
+            item.command = counter->command;
+            item.count = counter->count + (older ? older->count * inside / 1000 : 0);
+            item.error = counter->error + (older ? older->error * inside / 1000 : 0);
+        } else {
+            const HeavyCounter* counter = previous->order[j++];
+            const HeavyCounter* newer = find_counter(current, counter->command, counter->hash);
+            if (newer && newer->position < i) continue;
+            item.command = counter->command;
+            item.count = counter->count * inside / 1000 + (newer ? newer->count : 0);
+            item.error = counter->error * inside / 1000 + (newer ? newer->error : 0);
+        }
+        if (item.count > 0) keep_best(out, n, &found, &item);
+    }
+    return found;
+}
@@ -0,0 +1,332 @@
+/**
+ * @file pathcache.c
+ * @brief Cached directory listings for path-argument completion
+ *
+ * Listings are kept sorted, so the names starting with a partial are one
+ * binary search and a short scan. A directory is found by a linear pass over
+ * at most PATHCACHE_MAX_DIRS hashes, which is cheaper than the one stat it
+ * replaces.
+ *
+ * Watching needs inotify, so elsewhere than Linux every directory is
+ * re-checked by mtime.
+ */
+
+#include "pathcache.h"
+#include <dirent.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#define PATHCACHE_INOTIFY 1
+#include <sys/inotify.h>
+
+// Changes to what a directory lists, and the end of the directory itself
+#define PATHCACHE_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                          IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#endif
+
+typedef struct {
+    char* path;
+    uint32_t hash;
+    int wd;                     // inotify watch, or -1 (mtime checks)
+    bool listed;                // entries describe the directory
+    bool stale;                 // queued for (re)listing
+    bool missing;               // could not be opened at the last listing
+    bool truncated;             // more than PATHCACHE_MAX_ENTRIES names
+    struct timespec mtime;      // At the last listing
+    long checked;               // Last listing or mtime check (ms)
+    long used;                  // Last lookup (ms)
+    char* names;                // Packed, NUL-terminated
+    PathEntry* entries;         // Sorted by name
+    int count;
+} PathDir;
+
+struct PathCache {
+    int fd;                     // inotify, or -1
+    PathDir* dirs[PATHCACHE_MAX_DIRS];
+    int count;
+};
+
+// Monotonic clock in milliseconds (vDSO: no system call)
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static uint32_t path_hash(const char* path) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+#ifdef PATHCACHE_INOTIFY
+static int watch_open(void) {
+    return inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+static int watch_add(int fd, const char* path) {
+    return inotify_add_watch(fd, path, PATHCACHE_EVENTS);
+}
+
+static void watch_remove(int fd, int wd) {
+    inotify_rm_watch(fd, wd);
+}
+#else
+// No inotify: nothing is ever watched
+static int watch_open(void) {
+    return -1;
+}
+
+static int watch_add(int fd, const char* path) {
+    (void)fd;
+    (void)path;
+    return -1;
+}
+
+static void watch_remove(int fd, int wd) {
+    (void)fd;
+    (void)wd;
+}
+#endif
+
+static PathDir* find_dir(PathCache* cache, const char* path, uint32_t hash) {
+    for (int i = 0; i < cache->count; i++) {
+        PathDir* dir = cache->dirs[i];
+        if (dir->hash == hash && strcmp(dir->path, path) == 0) return dir;
+    }
+    return NULL;
+}
+
+// Two paths for one directory (a symlink) share its watch; it goes with the last
+static bool watch_shared(const PathCache* cache, const PathDir* dir) {
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->dirs[i] != dir && cache->dirs[i]->wd == dir->wd) return true;
+    }
+    return false;
+}
+
+static void free_listing(PathDir* dir) {
+    free(dir->names);
+    free(dir->entries);
+    dir->names = NULL;
+    dir->entries = NULL;
+    dir->count = 0;
+}
+
+static void release_dir(PathCache* cache, PathDir* dir) {
+    if (dir->wd >= 0 && !watch_shared(cache, dir)) watch_remove(cache->fd, dir->wd);
+    free_listing(dir);
+    free(dir->path);
+    free(dir);
+}
+
+// New, unlisted entry (queued); evicts the least recently used one when full
+static PathDir* add_dir(PathCache* cache, const char* path, uint32_t hash) {
+    if (cache->count == PATHCACHE_MAX_DIRS) {
+        int oldest = 0;
+        for (int i = 1; i < cache->count; i++) {
+            if (cache->dirs[i]->used < cache->dirs[oldest]->used) oldest = i;
+        }
+        release_dir(cache, cache->dirs[oldest]);
+        cache->dirs[oldest] = cache->dirs[--cache->count];
+    }
+    PathDir* dir = calloc(1, sizeof(PathDir));
+    if (!dir || !(dir->path = strdup(path))) {
+        free(dir);
+        return NULL;
+    }
+    dir->hash = hash;
+    dir->wd = -1;
+    dir->stale = true;
+    cache->dirs[cache->count++] = dir;
+    return dir;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    return strcmp(((const PathEntry*)a)->name, ((const PathEntry*)b)->name);
+}
+
+static bool is_directory(int dir_fd, const struct dirent* entry) {
+    if (entry->d_type == DT_DIR) return true;
+    if (entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) return false;
+    struct stat st;
+    return fstatat(dir_fd, entry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Read the directory into a fresh listing. The watch is added first, so a
+// change made while reading still marks the result stale.
+static void list_dir(PathCache* cache, PathDir* dir) {
+    if (dir->wd < 0 && cache->fd >= 0) {
+        dir->wd = watch_add(cache->fd, dir->path);
+    }
+    dir->stale = false;
+    dir->listed = true;
+    dir->checked = now_ms();
+    free_listing(dir);
+
+    DIR* handle = opendir(dir->path);
+    struct stat st;
+    dir->missing = !handle || fstat(dirfd(handle), &st) != 0;
+    if (dir->missing) {
+        memset(&dir->mtime, 0, sizeof(dir->mtime));
+        if (handle) closedir(handle);
+        return;
+    }
+    dir->mtime = st.st_mtim;
+    dir->truncated = false;
+
+    size_t used = 0, capacity = 0;
+    int entry_capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(handle))) {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+        if (dir->count == PATHCACHE_MAX_ENTRIES) {
+            dir->truncated = true;
+            break;
+        }
+        size_t length = strlen(name);
+        if (used + length + 1 > capacity || dir->count == entry_capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 4096;
+            while (used + length + 1 > new_capacity) new_capacity *= 2;
+            int new_entries = entry_capacity ? entry_capacity * 2 : 64;
+            char* names = realloc(dir->names, new_capacity);
+            if (names) dir->names = names;
+            PathEntry* entries = names ? realloc(dir->entries, new_entries * sizeof(PathEntry)) : NULL;
+            if (entries) dir->entries = entries;
+            if (!names || !entries) {
+                dir->truncated = true;
+                break;
+            }
+            capacity = new_capacity;
+            entry_capacity = new_entries;
+        }
+        memcpy(dir->names + used, name, length + 1);
+        // Offset for now: names may still move
+        dir->entries[dir->count].name = (const char*)(uintptr_t)used;
+        dir->entries[dir->count].length = length;
+        dir->entries[dir->count].directory = is_directory(dirfd(handle), entry);
+        dir->count++;
+        used += length + 1;
+    }
+    closedir(handle);
+
+    for (int i = 0; i < dir->count; i++) {
+        dir->entries[i].name = dir->names + (uintptr_t)dir->entries[i].name;
+    }
+    qsort(dir->entries, dir->count, sizeof(PathEntry), compare_entries);
+}
+
+// Unwatched and looked up since its last check: has it changed?
+static bool mtime_changed(PathDir* dir, long now) {
+    dir->checked = now;
+    struct stat st;
+    bool exists = stat(dir->path, &st) == 0 && S_ISDIR(st.st_mode);
+    if (exists != !dir->missing) return true;
+    return exists && (st.st_mtim.tv_sec != dir->mtime.tv_sec ||
+                      st.st_mtim.tv_nsec != dir->mtime.tv_nsec);
+}
+
+PathCache* pathcache_create(bool watch) {
+    PathCache* cache = calloc(1, sizeof(PathCache));
+    if (!cache) return NULL;
+    cache->fd = watch ? watch_open() : -1;
+    return cache;
+}
+
+void pathcache_destroy(PathCache* cache) {
+    if (!cache) return;
+    while (cache->count > 0) {
+        release_dir(cache, cache->dirs[--cache->count]);
+    }
+    if (cache->fd >= 0) close(cache->fd);
+    free(cache);
+}
+
+const char* pathcache_backend(const PathCache* cache) {
+    return cache->fd >= 0 ? "inotify" : "mtime";
+}
+
+int pathcache_fd(const PathCache* cache) {
+    return cache->fd;
+}
+
+void pathcache_events(PathCache* cache) {
+#ifdef PATHCACHE_INOTIFY
+    if (cache->fd < 0) return;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t got;
+    while ((got = read(cache->fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + got; ) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            for (int i = 0; i < cache->count; i++) {
+                PathDir* dir = cache->dirs[i];
+                // Queue overflow (wd -1): anything may have changed
+                if (event->wd != -1 && dir->wd != event->wd) continue;
+                dir->stale = true;
+                if (event->mask & IN_IGNORED) dir->wd = -1;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#else
+    (void)cache;
+#endif
+}
+
+int pathcache_refresh(PathCache* cache) {
+    long now = now_ms();
+    int listed = 0;
+    for (int i = 0; i < cache->count; i++) {
+        PathDir* dir = cache->dirs[i];
+        if (!dir->stale && dir->wd < 0 && dir->used > dir->checked &&
+            now - dir->checked >= PATHCACHE_RECHECK_MS) {
+            dir->stale = mtime_changed(dir, now);
+        }
+        if (dir->stale) {
+            list_dir(cache, dir);
+            listed++;
+        }
+    }
+    return listed;
+}
+
+void pathcache_prefetch(PathCache* cache, const char* dir) {
+    uint32_t hash = path_hash(dir);
+    if (!find_dir(cache, dir, hash)) add_dir(cache, dir, hash);
+}
+
+int pathcache_lookup(PathCache* cache, const char* dir, const char* partial, size_t length,
+                     PathEntry* out, int max, bool* complete) {
+    uint32_t hash = path_hash(dir);
+    PathDir* entry = find_dir(cache, dir, hash);
+    if (!entry) entry = add_dir(cache, dir, hash);
+    if (!entry) return -1;
+    entry->used = now_ms();
+    if (!entry->listed) return -1;
+    if (complete) *complete = !entry->truncated;
+
+    // First name not ordered before partial
+    int low = 0, high = entry->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (strncmp(entry->entries[mid].name, partial, length) < 0) low = mid + 1;
+        else high = mid;
+    }
+    bool hidden = length > 0 && partial[0] == '.';
+    int found = 0;
+    for (int i = low; i < entry->count && found < max; i++) {
+        const PathEntry* name = &entry->entries[i];
+        if (strncmp(name->name, partial, length) != 0) break;
+        if (name->name[0] == '.' && !hidden) continue;
+        out[found++] = *name;
+    }
+    return found;
+}
@@ -0,0 +1,628 @@
+/**
+ * @file persist.c
+ * @brief Asynchronous file persistence for the serve loop
+ *
+ * io_uring is driven with raw syscalls (no liburing): one small ring, one
+ * linked chain per job, and an eventfd registered for completions. The
+ * files themselves are opened synchronously (a metadata operation that does
+ * not wait on the disk); everything that can stall - the write and the
+ * fsync - goes through the ring.
+ *
+ * Elsewhere than Linux only the worker thread is built, and completions are
+ * signalled through a pipe instead of an eventfd.
+ */
+
+#include "persist.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#define PERSIST_URING 1
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/** Submission queue entries; a job needs at most four */
+#define PERSIST_RING_ENTRIES 8
+
+typedef enum {
+    PERSIST_REPLACE,
+    PERSIST_APPEND
+} PersistKind;
+
+// Chain steps, carried in each SQE's user_data
+enum { STEP_WRITE, STEP_FSYNC, STEP_CLOSE, STEP_RENAME };
+
+typedef struct PersistJob {
+    PersistKind kind;
+    char* path;
+    char* data;
+    size_t size;
+    bool sync;
+    struct PersistJob* next;
+} PersistJob;
+
+#ifdef PERSIST_URING
+typedef struct {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+} PersistRing;
+#else
+typedef struct {
+    int fd;
+} PersistRing;
+#endif
+
+struct Persister {
+    bool uring;
+    int event_fd;                // Polled by the owner
+    int signal_fd;               // Written on completion (event_fd on Linux)
+    PersistJob* head;            // Queued, not started
+    PersistJob* tail;
+    PersistJob* active;          // In flight
+    long failures;
+
+    // io_uring backend: the active chain
+    PersistRing ring;
+    int active_fd;
+    char tmp_path[PATH_MAX];
+    int cqes_left;
+    int close_result;
+    bool chain_ok;
+
+    // Thread backend: the worker runs active until active_done
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool active_done;
+    bool active_ok;
+    bool stop;
+};
+
+static void job_free(PersistJob* job) {
+    if (!job) return;
+    free(job->path);
+    free(job->data);
+    free(job);
+}
+
+// Create the temporary file a replace writes before renaming, named into
+// buf; unique per call, so other servers and a synchronous write-back of the
+// same file never share it. Returns its descriptor, or -1
+static int temp_open(char* buf, size_t size, const char* path) {
+    if (snprintf(buf, size, "%s.tmp.XXXXXX", path) >= (int)size) return -1;
+    return mkstemp(buf);
+}
+
+// Write all of data to fd (plain syscalls)
+static bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Run a job with blocking syscalls (worker thread)
+static bool job_run_sync(const PersistJob* job) {
+    if (job->kind == PERSIST_APPEND) {
+        int fd = open(job->path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+        if (fd < 0) return false;
+        bool ok = write_all(fd, job->data, job->size) && (!job->sync || fdatasync(fd) == 0);
+        return close(fd) == 0 && ok;
+    }
+
+    char tmp[PATH_MAX];
+    int fd = temp_open(tmp, sizeof(tmp), job->path);
+    if (fd < 0) return false;
+    bool ok = write_all(fd, job->data, job->size) && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok && rename(tmp, job->path) == 0;
+    if (!ok) unlink(tmp);
+    return ok;
+}
+
+static void* worker_main(void* arg) {
+    Persister* persister = arg;
+    pthread_mutex_lock(&persister->lock);
+    for (;;) {
+        while (!persister->stop && (!persister->active || persister->active_done)) {
+            pthread_cond_wait(&persister->wake, &persister->lock);
+        }
+        if (persister->stop) break;
+        PersistJob* job = persister->active;
+        pthread_mutex_unlock(&persister->lock);
+
+        bool ok = job_run_sync(job);
+
+        pthread_mutex_lock(&persister->lock);
+        persister->active_ok = ok;
+        persister->active_done = true;
+        uint64_t one = 1;
+        if (write(persister->signal_fd, &one, sizeof(one)) < 0) {
+            // Counter saturated (pipe full): a wakeup is pending anyway
+        }
+        pthread_cond_broadcast(&persister->wake);
+    }
+    pthread_mutex_unlock(&persister->lock);
+    return NULL;
+}
+
+#ifdef PERSIST_URING
+static int ring_setup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, NULL, 0);
+}
+
+static int ring_register(int fd, unsigned opcode, void* arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static void ring_close(PersistRing* ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map && ring->sq_map != MAP_FAILED) munmap(ring->sq_map, ring->sq_map_size);
+    if (ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+// Whether the kernel runs every opcode a chain uses: setup succeeds on
+// kernels that predate IORING_OP_CLOSE (5.6) or IORING_OP_RENAMEAT (5.11)
+static bool ring_supports_chain(int fd) {
+    static const uint8_t needed[] = {
+        IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE, IORING_OP_RENAMEAT
+    };
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+    if (!probe) return false;
+    
+    bool ok = ring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; ok && i < sizeof(needed); i++) {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok;
+}
+
+// Map the rings; false if io_uring is missing, forbidden (e.g. seccomp) or
+// too old for the chain's opcodes
+static bool ring_open(PersistRing* ring, int event_fd) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = ring_setup(PERSIST_RING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return false;
+    }
+    if (!ring_supports_chain(ring->fd)) {
+        ring_close(ring);
+        return false;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring_close(ring);
+        return false;
+    }
+    ring->cq_map = single ? ring->sq_map
+                          : mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        ring_close(ring);
+        return false;
+    }
+
+    uint8_t* sq = ring->sq_map;
+    uint8_t* cq = ring->cq_map;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    if (ring_register(ring->fd, IORING_REGISTER_EVENTFD, &event_fd, 1) != 0) {
+        ring_close(ring);
+        return false;
+    }
+    return true;
+}
+
+// Next free submission entry, zeroed (the ring never holds more than one job)
+static struct io_uring_sqe* ring_sqe(PersistRing* ring, unsigned* queued) {
+    unsigned tail = *ring->sq_tail + *queued;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    (*queued)++;
+    return sqe;
+}
+
+// Submit the active job as one linked chain
+static bool ring_submit_job(Persister* persister) {
+    PersistJob* job = persister->active;
+    PersistRing* ring = &persister->ring;
+    persister->active_fd = job->kind == PERSIST_APPEND
+        ? open(job->path, O_WRONLY | O_CREAT | O_APPEND, 0600)
+        : temp_open(persister->tmp_path, sizeof(persister->tmp_path), job->path);
+    if (persister->active_fd < 0) return false;
+
+    unsigned queued = 0;
+    struct io_uring_sqe* sqe = ring_sqe(ring, &queued);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = persister->active_fd;
+    sqe->addr = (uintptr_t)job->data;
+    sqe->len = (unsigned)job->size;
+    sqe->off = job->kind == PERSIST_APPEND ? (uint64_t)-1 : 0;
+    // Buffered writes may otherwise be copied inline, inside io_uring_enter()
+    sqe->flags = IOSQE_IO_LINK | IOSQE_ASYNC;
+    sqe->user_data = STEP_WRITE;
+
+    if (job->sync || job->kind == PERSIST_REPLACE) {
+        sqe = ring_sqe(ring, &queued);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = persister->active_fd;
+        sqe->fsync_flags = job->kind == PERSIST_APPEND ? IORING_FSYNC_DATASYNC : 0;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = STEP_FSYNC;
+    }
+
+    sqe = ring_sqe(ring, &queued);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = persister->active_fd;
+    sqe->user_data = STEP_CLOSE;
+
+    if (job->kind == PERSIST_REPLACE) {
+        sqe->flags = IOSQE_IO_LINK;
+        sqe = ring_sqe(ring, &queued);
+        sqe->opcode = IORING_OP_RENAMEAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uintptr_t)persister->tmp_path;
+        sqe->len = AT_FDCWD;
+        sqe->addr2 = (uintptr_t)job->path;
+        sqe->user_data = STEP_RENAME;
+    }
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + queued, __ATOMIC_RELEASE);
+    persister->cqes_left = (int)queued;
+    persister->close_result = -ECANCELED;
+    persister->chain_ok = true;
+    int submitted;
+    do {
+        submitted = ring_enter(ring->fd, queued, 0, 0);
+    } while (submitted < 0 && errno == EINTR);
+    if (submitted != (int)queued) {
+        // The kernel did not take the chain: undo it and run it the slow way
+        __atomic_store_n(ring->sq_tail, *ring->sq_tail - queued, __ATOMIC_RELEASE);
+        close(persister->active_fd);
+        return false;
+    }
+    return true;
+}
+
+// Harvest completions of the active chain; true once all of them arrived
+static bool ring_reap(Persister* persister) {
+    PersistRing* ring = &persister->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        if (cqe->user_data == STEP_CLOSE) {
+            // Kept apart: a cancelled close must be redone by hand
+            persister->close_result = cqe->res;
+        } else if (cqe->res < 0) {
+            persister->chain_ok = false;
+        } else if (cqe->user_data == STEP_WRITE && (size_t)cqe->res != persister->active->size) {
+            // A short write also breaks the link, cancelling the rest
+            persister->chain_ok = false;
+        }
+        persister->cqes_left--;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return persister->cqes_left == 0;
+}
+
+// Block until the active chain has another completion
+static void ring_wait(PersistRing* ring) {
+    ring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+}
+#else
+// No io_uring here: persist_create() always picks the worker thread
+static bool ring_open(PersistRing* ring, int event_fd) {
+    (void)event_fd;
+    ring->fd = -1;
+    return false;
+}
+
+static void ring_close(PersistRing* ring) {
+    (void)ring;
+}
+
+static bool ring_submit_job(Persister* persister) {
+    (void)persister;
+    return false;
+}
+
+static bool ring_reap(Persister* persister) {
+    (void)persister;
+    return true;
+}
+
+static void ring_wait(PersistRing* ring) {
+    (void)ring;
+}
+#endif
+
+// Take the next queued job and hand it to the backend
+static void start_next(Persister* persister) {
+    while (!persister->active && persister->head) {
+        PersistJob* job = persister->head;
+        persister->head = job->next;
+        if (!persister->head) persister->tail = NULL;
+        job->next = NULL;
+
+        if (persister->uring) {
+            persister->active = job;
+            if (ring_submit_job(persister)) return;
+            // Could not open or submit: fall back to a blocking run
+            persister->active = NULL;
+            if (!job_run_sync(job)) persister->failures++;
+            job_free(job);
+            continue;
+        }
+
+        pthread_mutex_lock(&persister->lock);
+        persister->active = job;
+        persister->active_done = false;
+        pthread_cond_broadcast(&persister->wake);
+        pthread_mutex_unlock(&persister->lock);
+    }
+}
+
+// Finish the active job if its backend is done with it
+static void finish_active(Persister* persister) {
+    PersistJob* job = persister->active;
+    if (!job) return;
+
+    if (persister->uring) {
+        if (!ring_reap(persister)) return;
+        if (persister->close_result == -ECANCELED) close(persister->active_fd);
+        if (!persister->chain_ok || persister->close_result < 0) {
+            persister->failures++;
+            if (job->kind == PERSIST_REPLACE) unlink(persister->tmp_path);
+        }
+    } else {
+        pthread_mutex_lock(&persister->lock);
+        bool done = persister->active_done;
+        bool ok = persister->active_ok;
+        pthread_mutex_unlock(&persister->lock);
+        if (!done) return;
+        if (!ok) persister->failures++;
+    }
+    persister->active = NULL;
+    job_free(job);
+}
+
+static bool enqueue(Persister* persister, PersistKind kind, const char* path,
+                    char* data, size_t size, bool sync) {
+    // data == NULL with a size is a caller's failed allocation
+    if (!persister || !path || (!data && size)) {
+        free(data);
+        return false;
+    }
+
+    // Group commit: extend a queued append to the same file
+    PersistJob* last = persister->tail;
+    if (kind == PERSIST_APPEND && last && last->kind == PERSIST_APPEND &&
+        last->sync == sync && strcmp(last->path, path) == 0) {
+        char* grown = realloc(last->data, last->size + size);
+        if (grown) {
+            memcpy(grown + last->size, data, size);
+            last->data = grown;
+            last->size += size;
+            free(data);
+            return true;
+        }
+    }
+
+    // A replace carries the whole file: queued jobs on it are superseded
+    if (kind == PERSIST_REPLACE) {
+        PersistJob** link = &persister->head;
+        persister->tail = NULL;
+        while (*link) {
+            PersistJob* job = *link;
+            if (strcmp(job->path, path) == 0) {
+                *link = job->next;
+                job_free(job);
+            } else {
+                persister->tail = job;
+                link = &job->next;
+            }
+        }
+    }
+
+    PersistJob* job = calloc(1, sizeof(PersistJob));
+    if (!job || !(job->path = strdup(path))) {
+        free(job);
+        free(data);
+        return false;
+    }
+    job->kind = kind;
+    job->data = data;
+    job->size = size;
+    job->sync = sync;
+    if (persister->tail) {
+        persister->tail->next = job;
+    } else {
+        persister->head = job;
+    }
+    persister->tail = job;
+
+    start_next(persister);
+    return true;
+}
+
+// Open the completion descriptors: an eventfd, or a non-blocking pipe
+static bool signal_open(Persister* persister) {
+#ifdef __linux__
+    persister->event_fd = persister->signal_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return persister->event_fd >= 0;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    persister->event_fd = fds[0];
+    persister->signal_fd = fds[1];
+    return true;
+#endif
+}
+
+static void signal_close(Persister* persister) {
+    if (persister->signal_fd != persister->event_fd) close(persister->signal_fd);
+    close(persister->event_fd);
+}
+
+Persister* persist_create(bool use_uring) {
+    Persister* persister = calloc(1, sizeof(Persister));
+    if (!persister) return NULL;
+    persister->ring.fd = -1;
+    if (!signal_open(persister)) {
+        free(persister);
+        return NULL;
+    }
+
+    persister->uring = use_uring && ring_open(&persister->ring, persister->event_fd);
+    if (persister->uring) return persister;
+
+    pthread_mutex_init(&persister->lock, NULL);
+    pthread_cond_init(&persister->wake, NULL);
+    if (pthread_create(&persister->worker, NULL, worker_main, persister) != 0) {
+        signal_close(persister);
+        free(persister);
+        return NULL;
+    }
+    return persister;
+}
+
+const char* persist_backend(const Persister* persister) {
+    return persister && persister->uring ? "io_uring" : "thread";
+}
+
+bool persist_replace(Persister* persister, const char* path, char* data, size_t size) {
+    return enqueue(persister, PERSIST_REPLACE, path, data, size, true);
+}
+
+bool persist_replace_now(const char* path, const char* data, size_t size) {
+    PersistJob job = { 0 };
+    job.kind = PERSIST_REPLACE;
+    job.path = (char*)path;
+    job.data = (char*)data;
+    job.size = size;
+    job.sync = true;
+    return job_run_sync(&job);
+}
+
+bool persist_append(Persister* persister, const char* path, char* data, size_t size, bool sync) {
+    return enqueue(persister, PERSIST_APPEND, path, data, size, sync);
+}
+
+int persist_fd(const Persister* persister) {
+    return persister->event_fd;
+}
+
+int persist_reap(Persister* persister) {
+    uint64_t count;
+    while (read(persister->event_fd, &count, sizeof(count)) > 0 &&
+           persister->signal_fd != persister->event_fd) {
+        // A pipe holds one record per signal: drain them all
+    }
+    finish_active(persister);
+    start_next(persister);
+
+    int pending = persister->active ? 1 : 0;
+    for (PersistJob* job = persister->head; job; job = job->next) pending++;
+    return pending;
+}
+
+void persist_drain(Persister* persister) {
+    while (persist_reap(persister) > 0) {
+        if (persister->uring) {
+            ring_wait(&persister->ring);
+        } else {
+            pthread_mutex_lock(&persister->lock);
+            while (persister->active && !persister->active_done) {
+                pthread_cond_wait(&persister->wake, &persister->lock);
+            }
+            pthread_mutex_unlock(&persister->lock);
+        }
+    }
+}
+
+long persist_failures(const Persister* persister) {
+    return persister->failures;
+}
+
+void persist_destroy(Persister* persister) {
+    if (!persister) return;
+    persist_drain(persister);
+
+    if (persister->uring) {
+        ring_close(&persister->ring);
+    } else {
+        pthread_mutex_lock(&persister->lock);
+        persister->stop = true;
+        pthread_cond_broadcast(&persister->wake);
+        pthread_mutex_unlock(&persister->lock);
+        pthread_join(persister->worker, NULL);
+        pthread_mutex_destroy(&persister->lock);
+        pthread_cond_destroy(&persister->wake);
+    }
+    signal_close(persister);
+    free(persister);
+}
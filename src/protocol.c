@@ -0,0 +1,246 @@
+/**
+ * @file protocol.c
+ * @brief Length-prefixed binary framing for the serve mode
+ *
+ * Parsing never copies: field slices point into the receive buffer, and the
+ * whole frame is bounds-checked against its length prefix first. Writing
+ * gathers header bytes and borrowed field bytes into one writev().
+ */
+
+#include "protocol.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static uint32_t read_u32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void write_u32(uint8_t* p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+// Make room for extra more bytes at the end of a buffer
+static bool buffer_reserve(ProtoBuffer* out, size_t extra) {
+    if (out->size + extra <= out->capacity) return true;
+    size_t capacity = out->capacity ? out->capacity : 4096;
+    while (capacity < out->size + extra) capacity *= 2;
+    uint8_t* data = realloc(out->data, capacity);
+    if (!data) return false;
+    out->data = data;
+    out->capacity = capacity;
+    return true;
+}
+
+long proto_parse(const uint8_t* buf, size_t size, ProtoFrame* frame) {
+    if (size < 4) return 0;
+    uint32_t length = read_u32(buf);
+    if (length < PROTO_HEADER_SIZE - 4 || length > PROTO_MAX_FRAME - 4) return -1;
+    if (size < 4 + (size_t)length) return 0;
+
+    const uint8_t* end = buf + 4 + length;
+    frame->id = read_u32(buf + 4);
+    frame->code = buf[8];
+    frame->count = buf[9];
+
+    const uint8_t* p = buf + PROTO_HEADER_SIZE;
+    for (int i = 0; i < frame->count; i++) {
+        if (end - p < 4) return -1;
+        uint32_t field_size = read_u32(p);
+        p += 4;
+        if ((size_t)(end - p) < field_size) return -1;
+        frame->fields[i].data = (const char*)p;
+        frame->fields[i].size = field_size;
+        p += field_size;
+    }
+    return p == end ? (long)(4 + length) : -1;
+}
+
+bool proto_append(ProtoBuffer* out, uint32_t id, uint8_t code,
+                  const ProtoField* fields, int count) {
+    if (count < 0 || count > PROTO_MAX_FIELDS) return false;
+
+    size_t frame_size = PROTO_HEADER_SIZE;
+    for (int i = 0; i < count; i++) {
+        frame_size += 4 + fields[i].size;
+    }
+    if (frame_size > PROTO_MAX_FRAME) return false;
+
+    if (!buffer_reserve(out, frame_size)) return false;
+
+    uint8_t* p = out->data + out->size;
+    write_u32(p, (uint32_t)(frame_size - 4));
+    write_u32(p + 4, id);
+    p[8] = code;
+    p[9] = (uint8_t)count;
+    p += PROTO_HEADER_SIZE;
+    for (int i = 0; i < count; i++) {
+        write_u32(p, fields[i].size);
+        if (fields[i].size) memcpy(p + 4, fields[i].data, fields[i].size);
+        p += 4 + fields[i].size;
+    }
+    out->size += frame_size;
+    return true;
+}
+
+// Queue one slice, merging header bytes that follow the previous header slice
+static bool writer_push(ProtoWriter* writer, const char* data, size_t offset, size_t size) {
+    if (writer->slice_count > 0) {
+        ProtoSlice* last = &writer->slices[writer->slice_count - 1];
+        if (!data && !last->data && last->offset + last->size == offset) {
+            last->size += size;
+            return true;
+        }
+    }
+    if (writer->slice_count == writer->slice_capacity) {
+        int capacity = writer->slice_capacity ? writer->slice_capacity * 2 : 256;
+        ProtoSlice* slices = realloc(writer->slices, capacity * sizeof(ProtoSlice));
+        if (!slices) return false;
+        writer->slices = slices;
+        writer->slice_capacity = capacity;
+    }
+    ProtoSlice slice = { data, offset, size };
+    writer->slices[writer->slice_count++] = slice;
+    return true;
+}
+
+// Drop the slices of a frame that could not be queued whole
+static void writer_rollback(ProtoWriter* writer, int slice_count, size_t last_size) {
+    writer->slice_count = slice_count;
+    if (slice_count > 0) writer->slices[slice_count - 1].size = last_size;
+}
+
+bool proto_writer_add(ProtoWriter* writer, uint32_t id, uint8_t code,
+                      const ProtoField* fields, int count) {
+    if (count < 0 || count > PROTO_MAX_FIELDS) return false;
+
+    size_t frame_size = PROTO_HEADER_SIZE;
+    size_t inline_size = PROTO_HEADER_SIZE;
+    for (int i = 0; i < count; i++) {
+        frame_size += 4 + fields[i].size;
+        inline_size += 4 + (fields[i].size <= PROTO_INLINE_MAX ? fields[i].size : 0);
+    }
+    if (frame_size > PROTO_MAX_FRAME) return false;
+    if (!buffer_reserve(&writer->headers, inline_size)) return false;
+    int slice_count = writer->slice_count;
+    size_t last_size = slice_count > 0 ? writer->slices[slice_count - 1].size : 0;
+
+    // Headers and small fields are packed contiguously; a large field ends
+    // the packed run and is queued by reference
+    uint8_t* base = writer->headers.data;
+    size_t start = writer->headers.size;
+    size_t end = start;
+    write_u32(base + end, (uint32_t)(frame_size - 4));
+    write_u32(base + end + 4, id);
+    base[end + 8] = code;
+    base[end + 9] = (uint8_t)count;
+    end += PROTO_HEADER_SIZE;
+    for (int i = 0; i < count; i++) {
+        write_u32(base + end, fields[i].size);
+        end += 4;
+        if (fields[i].size <= PROTO_INLINE_MAX) {
+            if (fields[i].size) memcpy(base + end, fields[i].data, fields[i].size);
+            end += fields[i].size;
+        } else {
+            if (!writer_push(writer, NULL, start, end - start) ||
+                !writer_push(writer, fields[i].data, 0, fields[i].size)) {
+                writer_rollback(writer, slice_count, last_size);
+                return false;
+            }
+            start = end;
+        }
+    }
+    if (end != start && !writer_push(writer, NULL, start, end - start)) {
+        writer_rollback(writer, slice_count, last_size);
+        return false;
+    }
+    writer->headers.size = end;
+    return true;
+}
+
+void proto_writer_keep(ProtoWriter* writer, void* owned) {
+    if (!owned) return;
+    if (writer->kept_count == writer->kept_capacity) {
+        int capacity = writer->kept_capacity ? writer->kept_capacity * 2 : 64;
+        void** kept = realloc(writer->kept, capacity * sizeof(void*));
+        if (!kept) {
+            // Cannot defer the free: write out what references it first
+            proto_writer_flush(writer);
+            free(owned);
+            return;
+        }
+        writer->kept = kept;
+        writer->kept_capacity = capacity;
+    }
+    writer->kept[writer->kept_count++] = owned;
+}
+
+bool proto_writer_flush(ProtoWriter* writer) {
+    struct iovec iov[IOV_MAX];
+    bool ok = true;
+
+    for (int first = 0; ok && first < writer->slice_count; ) {
+        int n = writer->slice_count - first < IOV_MAX ? writer->slice_count - first : IOV_MAX;
+        for (int i = 0; i < n; i++) {
+            const ProtoSlice* slice = &writer->slices[first + i];
+            iov[i].iov_base = (void*)(slice->data ? slice->data
+                                                  : (const char*)writer->headers.data + slice->offset);
+            iov[i].iov_len = slice->size;
+        }
+        first += n;
+
+        // Resume after short writes (large batches into a full pipe)
+        struct iovec* next = iov;
+        while (n > 0) {
+            ssize_t written = writev(writer->fd, next, n);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) {
+                ok = false;
+                break;
+            }
+            while (n > 0 && (size_t)written >= next->iov_len) {
+                written -= next->iov_len;
+                next++;
+                n--;
+            }
+            if (n > 0) {
+                next->iov_base = (char*)next->iov_base + written;
+                next->iov_len -= written;
+            }
+        }
+    }
+
+    for (int i = 0; i < writer->kept_count; i++) free(writer->kept[i]);
+    writer->kept_count = 0;
+    writer->slice_count = 0;
+    writer->headers.size = 0;
+    return ok;
+}
+
+void proto_writer_free(ProtoWriter* writer) {
+    for (int i = 0; i < writer->kept_count; i++) free(writer->kept[i]);
+    free(writer->kept);
+    free(writer->slices);
+    proto_buffer_free(&writer->headers);
+    memset(writer, 0, sizeof(*writer));
+}
+
+ProtoField proto_field(const char* text) {
+    ProtoField field = { text ? text : "", text ? (uint32_t)strlen(text) : 0 };
+    return field;
+}
+
+void proto_buffer_free(ProtoBuffer* out) {
+    free(out->data);
+    out->data = NULL;
+    out->size = out->capacity = 0;
+}
@@ -0,0 +1,227 @@
+/**
+ * @file ring.c
+ * @brief Shared, memory-mapped ring of executed commands
+ *
+ * Slots are published seqlock-style: a writer clears the slot's marker,
+ * fills the slot, then stores the marker with release semantics. A reader
+ * loads the marker, copies the slot and checks the marker again; a change in
+ * between means a later lap overwrote the slot while it was being read.
+ * A multi-slot record publishes its continuation slots before its first
+ * slot, so a record whose first slot is published is complete.
+ */
+
+#include "ring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RING_MAGIC "ZACRING1"
+
+// Header and slots must keep their on-disk sizes
+typedef char ring_header_size_check[sizeof(RingHeader) == RING_SLOT_SIZE ? 1 : -1];
+typedef char ring_slot_size_check[sizeof(RingSlot) == RING_SLOT_SIZE ? 1 : -1];
+
+static size_t ring_file_size(void) {
+    return sizeof(RingHeader) + (size_t)RING_SLOTS * sizeof(RingSlot);
+}
+
+static RingSlot* ring_slot(const HistoryRing* ring, uint64_t seq) {
+    return &ring->slots[seq & (RING_SLOTS - 1)];
+}
+
+// Size and header match this build's geometry
+static bool ring_file_valid(int fd) {
+    struct stat st;
+    RingHeader header;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != ring_file_size()) return false;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) return false;
+    return memcmp(header.magic, RING_MAGIC, sizeof(header.magic)) == 0 &&
+           header.slot_size == RING_SLOT_SIZE && header.slot_count == RING_SLOTS;
+}
+
+// Create the file (or start over with a different geometry) under the
+// exclusive lock, so a racing opener waits for the header instead of
+// initialising twice
+static bool ring_file_init(int fd) {
+    if (flock(fd, LOCK_EX) != 0) return false;
+    bool ok = ring_file_valid(fd);
+    if (!ok) {
+        RingHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, RING_MAGIC, sizeof(header.magic));
+        header.slot_size = RING_SLOT_SIZE;
+        header.slot_count = RING_SLOTS;
+        ok = ftruncate(fd, 0) == 0 && ftruncate(fd, ring_file_size()) == 0 &&
+             pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    }
+    flock(fd, LOCK_UN);
+    return ok;
+}
+
+HistoryRing* ring_open(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return NULL;
+    if (!ring_file_valid(fd) && !ring_file_init(fd)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = ring_file_size();
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    HistoryRing* ring = map != MAP_FAILED ? malloc(sizeof(HistoryRing)) : NULL;
+    if (!ring) {
+        if (map != MAP_FAILED) munmap(map, size);
+        close(fd);
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->header = map;
+    ring->slots = (RingSlot*)((char*)map + sizeof(RingHeader));
+    ring->size = size;
+    return ring;
+}
+
+void ring_close(HistoryRing* ring) {
+    if (!ring) return;
+    munmap(ring->header, ring->size);
+    close(ring->fd);
+    free(ring);
+}
+
+bool ring_append(HistoryRing* ring, const char* text, size_t length, int64_t when) {
+    size_t span = length ? (length + RING_SLOT_DATA - 1) / RING_SLOT_DATA : 1;
+    if (span > RING_MAX_SPAN) return false;
+    uint64_t seq = __atomic_fetch_add(&ring->header->tail, span, __ATOMIC_RELAXED);
+
+    // Last slot first: the first slot's marker publishes the whole record
+    for (size_t i = span; i-- > 0; ) {
+        RingSlot* slot = ring_slot(ring, seq + i);
+        __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        size_t offset = i * RING_SLOT_DATA;
+        size_t n = length - offset < RING_SLOT_DATA ? length - offset : RING_SLOT_DATA;
+        memcpy(slot->data, text + offset, n);
+        slot->when = when;
+        slot->length = i ? 0 : (uint32_t)length;
+        slot->span = i ? 0 : (uint16_t)span;
+        __atomic_store_n(&slot->seq, seq + i + 1, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+static int64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// A reserved slot that is still unwritten: its writer is mid-copy, or died
+// between the fetch-add and the publish. Give up on it once it has been seen
+// unwritten for RING_STALL_MS or the ring has moved a quarter lap past it.
+static bool ring_slot_abandoned(RingCursor* cursor, uint64_t seq, uint64_t tail) {
+    if (tail - seq >= RING_SLOTS / 4) return true;
+    int64_t now = monotonic_ms();
+    if (cursor->stalled_at != seq || cursor->stalled_since == 0) {
+        cursor->stalled_at = seq;
+        cursor->stalled_since = now;
+        return false;
+    }
+    return now - cursor->stalled_since >= RING_STALL_MS;
+}
+
+// Markers of a record's slots still say it is there (after copying it out)
+static bool ring_record_intact(const HistoryRing* ring, uint64_t seq, int span) {
+    for (int i = 0; i < span; i++) {
+        if (__atomic_load_n(&ring_slot(ring, seq + i)->seq, __ATOMIC_RELAXED) != seq + i + 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+long ring_read(HistoryRing* ring, RingCursor* cursor, RingCallback callback, void* ctx) {
+    char text[RING_MAX_SPAN * RING_SLOT_DATA];
+    long delivered = 0;
+    uint64_t tail = ring_tail(ring);
+
+    // A re-created ring starts over; a reader more than a lap behind lost the gap
+    if (cursor->next > tail) cursor->next = ring_folded(ring);
+    if (tail - cursor->next > RING_SLOTS) {
+        cursor->lost += tail - RING_SLOTS - cursor->next;
+        cursor->next = tail - RING_SLOTS;
+    }
+
+    while (cursor->next < tail) {
+        uint64_t seq = cursor->next;
+        const RingSlot* first = ring_slot(ring, seq);
+        uint64_t marker = __atomic_load_n(&first->seq, __ATOMIC_ACQUIRE);
+        if (marker < seq + 1 && !ring_slot_abandoned(cursor, seq, tail)) break;
+        if (marker != seq + 1) {
+            // Overwritten by a later lap, or abandoned
+            cursor->lost++;
+            cursor->next++;
+            continue;
+        }
+
+        int span = first->span;
+        uint32_t length = first->length;
+        int64_t when = first->when;
+        if (span == 0) {
+            // Continuation of a record skipped above
+            cursor->next++;
+            continue;
+        }
+        // Read before validation: only trust a span that fits the length
+        size_t expected = length ? (length + RING_SLOT_DATA - 1) / RING_SLOT_DATA : 1;
+        bool complete = (size_t)span == expected && span <= RING_MAX_SPAN;
+        for (int i = 0; complete && i < span; i++) {
+            const RingSlot* slot = ring_slot(ring, seq + i);
+            complete = i == 0 || __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == seq + i + 1;
+            size_t offset = (size_t)i * RING_SLOT_DATA;
+            size_t n = length - offset < RING_SLOT_DATA ? length - offset : RING_SLOT_DATA;
+            if (complete) memcpy(text + offset, slot->data, n);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!complete || !ring_record_intact(ring, seq, span)) {
+            cursor->lost++;
+            cursor->next++;
+            continue;
+        }
+
+        cursor->next = seq + span;
+        callback(text, length, when, ctx);
+        delivered++;
+    }
+    return delivered;
+}
+
+uint64_t ring_tail(const HistoryRing* ring) {
+    return __atomic_load_n(&ring->header->tail, __ATOMIC_ACQUIRE);
+}
+
+uint64_t ring_folded(const HistoryRing* ring) {
+    return __atomic_load_n(&ring->header->folded, __ATOMIC_ACQUIRE);
+}
+
+void ring_set_folded(HistoryRing* ring, uint64_t seq) {
+    __atomic_store_n(&ring->header->folded, seq, __ATOMIC_RELEASE);
+}
+
+bool ring_lock(HistoryRing* ring, bool exclusive, bool wait) {
+    int op = (exclusive ? LOCK_EX : LOCK_SH) | (wait ? 0 : LOCK_NB);
+    int rc;
+    while ((rc = flock(ring->fd, op)) != 0 && errno == EINTR) {
+    }
+    return rc == 0;
+}
+
+void ring_unlock(HistoryRing* ring) {
+    flock(ring->fd, LOCK_UN);
+}
@@ -0,0 +1,340 @@
+/**
+ * @file simd.c
+ * @brief Byte-scanning kernels with the instruction set chosen at run time
+ *
+ * Every variant is compiled into the same object with a per-function target
+ * attribute, so the build needs no -m flags and the binary still starts on
+ * a CPU without AVX. The table is picked once (benign race: every thread
+ * computes the same answer) and read through one pointer afterwards.
+ *
+ * Block kernels turn a comparison into a bitmask (bit i = byte i of the
+ * block) and work on the mask. A short tail is finished with one more block
+ * that ends at the last byte and overlaps the previous one (bits already
+ * seen are masked off), or with masked loads under AVX-512; only ranges
+ * shorter than one block fall back to narrower code.
+ */
+
+#include "simd.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    SimdLevel level;
+    size_t (*mismatch)(const char* a, const char* b, size_t n);
+    size_t (*scan_line)(const char* text, size_t n, char sep, SimdLine* line);
+    void (*child_mask)(const void* slots, size_t count, uint64_t* mask);
+} SimdKernels;
+
+static const char* const level_names[SIMD_LEVELS] = {"scalar", "sse2", "avx2", "avx512"};
+
+static size_t mismatch_tail(const char* a, const char* b, size_t n, size_t i) {
+    while (i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+static size_t mismatch_scalar(const char* a, const char* b, size_t n) {
+    return mismatch_tail(a, b, n, 0);
+}
+
+static void scan_start(SimdLine* line) {
+    line->last = SIMD_NONE;
+    line->previous = SIMD_NONE;
+}
+
+// Scan bytes from i on one at a time
+static size_t scan_line_tail(const char* text, size_t n, char sep, SimdLine* line, size_t i) {
+    for (; i < n; i++) {
+        if (text[i] == '\n') {
+            line->length = i;
+            return i + 1;
+        }
+        if (text[i] == sep) {
+            line->previous = line->last;
+            line->last = i;
+        }
+    }
+    line->length = n;
+    return n;
+}
+
+static size_t scan_line_scalar(const char* text, size_t n, char sep, SimdLine* line) {
+    scan_start(line);
+    return scan_line_tail(text, n, sep, line, 0);
+}
+
+static void child_mask_scalar(const void* slots, size_t count, uint64_t* mask) {
+    const char* p = slots;
+    for (size_t w = 0; w < count / 64; w++) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 64; i++) {
+            void* slot;
+            memcpy(&slot, p + (w * 64 + i) * sizeof(void*), sizeof(slot));
+            if (slot) bits |= 1ULL << i;
+        }
+        mask[w] = bits;
+    }
+}
+
+#ifdef SIMD_X86
+
+// Fold a block's separator bits into line: only the two highest matter
+static void scan_note_separators(SimdLine* line, size_t base, uint64_t seps) {
+    if (!seps) return;
+    int high = 63 - __builtin_clzll(seps);
+    seps &= ~(1ULL << high);
+    line->previous = seps ? base + 63 - __builtin_clzll(seps) : line->last;
+    line->last = base + high;
+}
+
+// Apply one block's masks; true once the newline was in it
+static bool scan_block(SimdLine* line, size_t base, uint64_t newlines, uint64_t seps) {
+    if (!newlines) {
+        scan_note_separators(line, base, seps);
+        return false;
+    }
+    int at = __builtin_ctzll(newlines);
+    scan_note_separators(line, base, seps & ((1ULL << at) - 1));
+    line->length = base + at;
+    return true;
+}
+
+// Final (overlapping) block of a scan that reaches the end of the buffer
+static size_t scan_last_block(SimdLine* line, size_t n, size_t base, uint64_t newlines, uint64_t seps) {
+    if (scan_block(line, base, newlines, seps)) return line->length + 1;
+    line->length = n;
+    return n;
+}
+
+__attribute__((target("sse2")))
+static size_t mismatch_sse2(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        unsigned equal = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (equal != 0xffff) return i + __builtin_ctz(~equal);
+    }
+    if (i == n || n < 16) return mismatch_tail(a, b, n, i);
+    // Bytes before i are known equal, so the first difference is at or after it
+    __m128i x = _mm_loadu_si128((const __m128i*)(a + n - 16));
+    __m128i y = _mm_loadu_si128((const __m128i*)(b + n - 16));
+    unsigned equal = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+    return equal == 0xffff ? n : n - 16 + __builtin_ctz(~equal);
+}
+
+__attribute__((target("sse2")))
+static size_t scan_line_sse2(const char* text, size_t n, char sep, SimdLine* line) {
+    scan_start(line);
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i separator = _mm_set1_epi8(sep);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+        uint64_t newlines = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        uint64_t seps = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, separator));
+        if (scan_block(line, i, newlines, seps)) return line->length + 1;
+    }
+    if (i == n || n < 16) return scan_line_tail(text, n, sep, line, i);
+    __m128i v = _mm_loadu_si128((const __m128i*)(text + n - 16));
+    uint64_t fresh = ~0ULL << (i - (n - 16));
+    uint64_t newlines = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) & fresh;
+    uint64_t seps = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, separator)) & fresh;
+    return scan_last_block(line, n, n - 16, newlines, seps);
+}
+
+__attribute__((target("sse2")))
+static void child_mask_sse2(const void* slots, size_t count, uint64_t* mask) {
+    const char* p = slots;
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t w = 0; w < count / 64; w++) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 64; i += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + (w * 64 + i) * 8));
+            // No 64-bit compare in SSE2: both 32-bit halves must be zero
+            __m128i z = _mm_cmpeq_epi32(v, zero);
+            z = _mm_and_si128(z, _mm_shuffle_epi32(z, _MM_SHUFFLE(2, 3, 0, 1)));
+            uint64_t null = (unsigned)_mm_movemask_pd(_mm_castsi128_pd(z));
+            bits |= (~null & 3) << i;
+        }
+        mask[w] = bits;
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t mismatch_avx2(const char* a, const char* b, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        uint32_t equal = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (equal != UINT32_MAX) return i + __builtin_ctz(~equal);
+    }
+    if (i == n) return n;
+    if (n < 32) return mismatch_sse2(a, b, n);
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + n - 32));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(b + n - 32));
+    uint32_t equal = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+    return equal == UINT32_MAX ? n : n - 32 + __builtin_ctz(~equal);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_line_avx2(const char* text, size_t n, char sep, SimdLine* line) {
+    scan_start(line);
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i separator = _mm256_set1_epi8(sep);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+        uint64_t newlines = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        uint64_t seps = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, separator));
+        if (scan_block(line, i, newlines, seps)) return line->length + 1;
+    }
+    if (i == n) {
+        line->length = n;
+        return n;
+    }
+    if (n < 32) return scan_line_sse2(text, n, sep, line);
+    __m256i v = _mm256_loadu_si256((const __m256i*)(text + n - 32));
+    uint64_t fresh = ~0ULL << (i - (n - 32));
+    uint64_t newlines = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline)) & fresh;
+    uint64_t seps = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, separator)) & fresh;
+    return scan_last_block(line, n, n - 32, newlines, seps);
+}
+
+__attribute__((target("avx2")))
+static void child_mask_avx2(const void* slots, size_t count, uint64_t* mask) {
+    const char* p = slots;
+    const __m256i zero = _mm256_setzero_si256();
+    for (size_t w = 0; w < count / 64; w++) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 64; i += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(p + (w * 64 + i) * 8));
+            uint64_t null = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, zero)));
+            bits |= (~null & 15) << i;
+        }
+        mask[w] = bits;
+    }
+}
+
+// Lanes of a 64-byte block that hold one of the remaining bytes
+__attribute__((target("avx512f,avx512bw")))
+static __mmask64 block_lanes(size_t remaining) {
+    return remaining >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << remaining) - 1;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t mismatch_avx512(const char* a, const char* b, size_t n) {
+    for (size_t i = 0; i < n; i += 64) {
+        __mmask64 lanes = block_lanes(n - i);
+        __m512i x = _mm512_maskz_loadu_epi8(lanes, a + i);
+        __m512i y = _mm512_maskz_loadu_epi8(lanes, b + i);
+        uint64_t differ = _mm512_mask_cmpneq_epi8_mask(lanes, x, y);
+        if (differ) return i + __builtin_ctzll(differ);
+    }
+    return n;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t scan_line_avx512(const char* text, size_t n, char sep, SimdLine* line) {
+    scan_start(line);
+    const __m512i newline = _mm512_set1_epi8('\n');
+    const __m512i separator = _mm512_set1_epi8(sep);
+    for (size_t i = 0; i < n; i += 64) {
+        __mmask64 lanes = block_lanes(n - i);
+        __m512i v = _mm512_maskz_loadu_epi8(lanes, text + i);
+        uint64_t newlines = _mm512_mask_cmpeq_epi8_mask(lanes, v, newline);
+        uint64_t seps = _mm512_mask_cmpeq_epi8_mask(lanes, v, separator);
+        if (scan_block(line, i, newlines, seps)) return line->length + 1;
+    }
+    line->length = n;
+    return n;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void child_mask_avx512(const void* slots, size_t count, uint64_t* mask) {
+    const char* p = slots;
+    for (size_t w = 0; w < count / 64; w++) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 64; i += 8) {
+            __m512i v = _mm512_loadu_si512((const void*)(p + (w * 64 + i) * 8));
+            bits |= (uint64_t)_mm512_test_epi64_mask(v, v) << i;
+        }
+        mask[w] = bits;
+    }
+}
+
+#endif // SIMD_X86
+
+static const SimdKernels tables[SIMD_LEVELS] = {
+    {SIMD_SCALAR, mismatch_scalar, scan_line_scalar, child_mask_scalar},
+#ifdef SIMD_X86
+    {SIMD_SSE2, mismatch_sse2, scan_line_sse2, child_mask_sse2},
+    {SIMD_AVX2, mismatch_avx2, scan_line_avx2, child_mask_avx2},
+    {SIMD_AVX512, mismatch_avx512, scan_line_avx512, child_mask_avx512},
+#else
+    {SIMD_SCALAR, mismatch_scalar, scan_line_scalar, child_mask_scalar},
+    {SIMD_SCALAR, mismatch_scalar, scan_line_scalar, child_mask_scalar},
+    {SIMD_SCALAR, mismatch_scalar, scan_line_scalar, child_mask_scalar},
+#endif
+};
+
+static const SimdKernels* active = NULL;
+
+SimdLevel simd_supported(void) {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    // cpu_supports also checks that the OS saves the wider registers
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+// Best supported level, capped by ZSH_AUTOCOMPLETE_SIMD
+static const SimdKernels* simd_init(void) {
+    SimdLevel level = simd_supported();
+    const char* forced = getenv("ZSH_AUTOCOMPLETE_SIMD");
+    for (int l = 0; forced && l < SIMD_LEVELS; l++) {
+        if (strcmp(forced, level_names[l]) == 0 && (SimdLevel)l < level) level = (SimdLevel)l;
+    }
+    const SimdKernels* kernels = &tables[level];
+    __atomic_store_n(&active, kernels, __ATOMIC_RELEASE);
+    return kernels;
+}
+
+static const SimdKernels* simd_kernels(void) {
+    const SimdKernels* kernels = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    return kernels ? kernels : simd_init();
+}
+
+SimdLevel simd_level(void) {
+    return simd_kernels()->level;
+}
+
+bool simd_select(SimdLevel level) {
+    if (level >= SIMD_LEVELS || level > simd_supported()) return false;
+    __atomic_store_n(&active, &tables[level], __ATOMIC_RELEASE);
+    return true;
+}
+
+const char* simd_level_name(SimdLevel level) {
+    return level < SIMD_LEVELS ? level_names[level] : "unknown";
+}
+
+size_t simd_mismatch(const char* a, const char* b, size_t n) {
+    return simd_kernels()->mismatch(a, b, n);
+}
+
+size_t simd_scan_line(const char* text, size_t n, char sep, SimdLine* line) {
+    return simd_kernels()->scan_line(text, n, sep, line);
+}
+
+void simd_child_mask(const void* slots, size_t count, uint64_t* mask) {
+    simd_kernels()->child_mask(slots, count, mask);
+}
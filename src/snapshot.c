@@ -0,0 +1,1001 @@
+/**
+ * @file snapshot.c
+ * @brief Frozen, position-independent command index that can be mmap'ed read-only
+ *
+ * Writing: commands arrive in sorted order and the path-compressed trie is
+ * built in one pass with a stack of open nodes. The longest common prefix
+ * with the previous command says how many open nodes are complete; those are
+ * emitted (children before parents) and a split node is inserted where the
+ * new command branches off inside an edge.
+ *
+ * Reading: the file is mapped read-only and shared; lookups touch only the
+ * nodes on the prefix path, their edge labels and the best leaves/strings
+ * they point at, and every index read from the file is range-checked before
+ * use.
+ *
+ * Hashing: write_image() builds the CHD hash over whatever leaves it is
+ * given, so the writer, merges and packed rewrites all get one. Buckets are
+ * placed largest first, each trying displacements until all its commands
+ * land on free slots; if some bucket runs out of displacements the build
+ * starts over with another seed, and after SNAPSHOT_HASH_SEEDS failures the
+ * file is written without a hash.
+ *
+ * Packing: a rewrite that permutes nodes, edge blocks, leaves and strings so
+ * what queries visited comes first; nothing else about the trie changes.
+ */
+
+#include "snapshot.h"
+#include "simd.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Seeds write_image() tries before giving up on the hash */
+#define SNAPSHOT_HASH_SEEDS 8
+
+// An open (not yet emitted) node on the writer's stack
+typedef struct {
+    uint32_t depth;
+    uint32_t leaf_lo;
+    uint32_t best;
+    uint32_t* children;
+    uint32_t child_count;
+    uint32_t child_capacity;
+} WriterFrame;
+
+struct SnapshotWriter {
+    SnapshotLeaf* leaves;
+    size_t leaf_count, leaf_capacity;
+    char* strings;
+    size_t strings_size, strings_capacity;
+    SnapshotNode* nodes;
+    size_t node_count, node_capacity;
+    uint32_t* edges;
+    size_t edge_count, edge_capacity;
+    WriterFrame* stack;
+    size_t stack_count, stack_capacity;
+    bool failed;
+};
+
+// Ensure room for need elements of size elem in *array
+static bool grow_array(void** array, size_t* capacity, size_t need, size_t elem) {
+    if (need <= *capacity) return true;
+    size_t next = *capacity ? *capacity : 64;
+    while (next < need) next *= 2;
+    void* temp = realloc(*array, next * elem);
+    if (!temp) return false;
+    *array = temp;
+    *capacity = next;
+    return true;
+}
+
+// Round up to the 8-byte section alignment
+static uint64_t align8(uint64_t value) {
+    return (value + 7) & ~(uint64_t)7;
+}
+
+// splitmix64 finalizer
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Seeded command hash: FNV-1a, then mixed so every bit depends on every byte
+static uint64_t hash_command(const char* text, size_t length, uint64_t seed) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)text[i];
+        h *= 0x100000001b3ULL;
+    }
+    return mix64(h);
+}
+
+// Map 32 random bits onto 0 .. n - 1 without a division
+static uint32_t hash_reduce(uint32_t bits, uint32_t n) {
+    return (uint32_t)(((uint64_t)bits * n) >> 32);
+}
+
+static uint32_t hash_bucket(uint64_t hash, uint32_t buckets) {
+    return hash_reduce((uint32_t)(hash >> 32), buckets);
+}
+
+static uint32_t hash_slot(uint64_t hash, uint16_t displacement, uint32_t slots) {
+    return hash_reduce((uint32_t)mix64(hash + displacement * 0x9e3779b97f4a7c15ULL), slots);
+}
+
+static uint32_t hash_fingerprint(uint64_t hash) {
+    return (uint32_t)mix64(hash ^ 0x5a4353505a435350ULL);
+}
+
+// Offset of the slot array that follows the displacements
+static uint64_t hash_slots_offset(const SnapshotHeader* h) {
+    return align8(h->hash_offset + (uint64_t)h->hash_buckets * sizeof(uint16_t));
+}
+
+Snapshot* snapshot_open(const char* path) {
+    if (!path || !*path) return NULL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    // Validate through pread(): a fault on the mapping would read around the
+    // touched page (up to the device's whole read-ahead window), while a
+    // small read only pulls in a few pages
+    struct stat st;
+    SnapshotHeader header;
+    char last = 1;
+    const SnapshotHeader* h = &header;
+    bool valid = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SnapshotHeader) &&
+                 pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+    uint64_t size = valid ? (uint64_t)st.st_size : 0;
+    valid = valid && memcmp(h->magic, SNAPSHOT_MAGIC, 4) == 0 &&
+                     (h->version == SNAPSHOT_VERSION || h->version == 2) &&
+                     h->file_size == size &&
+                     h->node_count > 0 && h->root < h->node_count &&
+                     (h->leaves_offset | h->nodes_offset | h->edges_offset | h->order_offset) % 8 == 0 &&
+                     h->leaves_offset + (uint64_t)h->leaf_count * sizeof(SnapshotLeaf) <= size &&
+                     h->nodes_offset + (uint64_t)h->node_count * sizeof(SnapshotNode) <= size &&
+                     h->edges_offset + (uint64_t)h->edge_count * sizeof(uint32_t) <= size &&
+                     h->labels_offset + (uint64_t)h->edge_count <= size &&
+                     h->order_offset + (uint64_t)h->leaf_count * sizeof(uint32_t) <= size &&
+                     h->warm_leaves <= h->leaf_count && h->warm_nodes <= h->node_count &&
+                     h->warm_edges <= h->edge_count && h->warm_strings <= h->strings_size &&
+                     h->strings_offset <= size && h->strings_size > 0 &&
+                     h->strings_size <= size - h->strings_offset &&
+                     pread(fd, &last, 1, h->strings_offset + h->strings_size - 1) == 1 && last == '\0';
+    // Version 2 headers end before the hash fields
+    bool hashed = valid && h->version >= 3 && h->hash_buckets > 0;
+    valid = valid && (!hashed || (h->hash_offset % 8 == 0 && h->hash_slots > 0 &&
+                                  h->hash_slots >= h->leaf_count &&
+                                  h->hash_offset <= size &&
+                                  hash_slots_offset(h) + (uint64_t)h->hash_slots * sizeof(SnapshotSlot) <= size));
+    if (!valid) {
+        close(fd);
+        return NULL;
+    }
+
+    // MAP_SHARED on a read-only file: every process maps the same page cache
+    void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    Snapshot* snap = malloc(sizeof(Snapshot));
+    if (!snap) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    snap->map = map;
+    snap->size = size;
+    snap->header = map;
+    snap->leaves = (const SnapshotLeaf*)(snap->map + h->leaves_offset);
+    snap->nodes = (const SnapshotNode*)(snap->map + h->nodes_offset);
+    snap->edges = (const uint32_t*)(snap->map + h->edges_offset);
+    snap->labels = snap->map + h->labels_offset;
+    snap->order = (const uint32_t*)(snap->map + h->order_offset);
+    snap->strings = (const char*)(snap->map + h->strings_offset);
+    snap->displacements = hashed ? (const uint16_t*)(snap->map + h->hash_offset) : NULL;
+    snap->slots = hashed ? (const SnapshotSlot*)(snap->map + hash_slots_offset(h)) : NULL;
+    snap->heat = NULL;
+    return snap;
+}
+
+void snapshot_close(Snapshot* snap) {
+    if (!snap) return;
+    munmap((void*)snap->map, snap->size);
+    free(snap->heat);
+    free(snap);
+}
+
+long snapshot_sorted_leaf(const Snapshot* snap, long position) {
+    if (!snap || position < 0 || (uint64_t)position >= snap->header->leaf_count) return -1;
+    uint32_t leaf = snap->order[position];
+    return leaf < snap->header->leaf_count ? (long)leaf : -1;
+}
+
+const char* snapshot_leaf_text(const Snapshot* snap, long leaf) {
+    if (!snap || leaf < 0 || (uint64_t)leaf >= snap->header->leaf_count) return NULL;
+    const SnapshotLeaf* l = &snap->leaves[leaf];
+    if ((uint64_t)l->text + l->length >= snap->header->strings_size) return NULL;
+    return snap->strings + l->text;
+}
+
+int snapshot_leaf_score(const Snapshot* snap, long leaf, long now) {
+    if (!snapshot_leaf_text(snap, leaf)) return -1;
+    return trie_score((int)snap->leaves[leaf].frequency, (long)snap->leaves[leaf].last_used, now);
+}
+
+// Exact lookup by binary search of the order section (files without a hash)
+static long snapshot_search(const Snapshot* snap, const char* command) {
+    long lo = 0, hi = (long)snap->header->leaf_count;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        long leaf = snapshot_sorted_leaf(snap, mid);
+        const char* text = snapshot_leaf_text(snap, leaf);
+        if (!text) return -1;
+        int cmp = strcmp(text, command);
+        if (cmp == 0) return leaf;
+        if (cmp < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+long snapshot_lookup(const Snapshot* snap, const char* command) {
+    if (!snap || !command) return -1;
+    if (!snap->slots) return snapshot_search(snap, command);
+
+    const SnapshotHeader* h = snap->header;
+    size_t length = strlen(command);
+    uint64_t hash = hash_command(command, length, h->hash_seed);
+    uint16_t displacement = snap->displacements[hash_bucket(hash, h->hash_buckets)];
+    const SnapshotSlot* slot = &snap->slots[hash_slot(hash, displacement, h->hash_slots)];
+    // Absent commands land on someone else's slot (or a spare one): the
+    // fingerprint turns nearly all of them away before the text is read
+    if (slot->leaf == SNAPSHOT_NONE || slot->fingerprint != hash_fingerprint(hash)) return -1;
+    const char* text = snapshot_leaf_text(snap, slot->leaf);
+    if (!text || snap->leaves[slot->leaf].length != length || memcmp(text, command, length) != 0) {
+        return -1;
+    }
+    return (long)slot->leaf;
+}
+
+// Node's defining text (first depth bytes are its prefix), NULL if corrupt
+static const char* snapshot_node_text(const Snapshot* snap, uint32_t node) {
+    if (node >= snap->header->node_count) return NULL;
+    const SnapshotNode* n = &snap->nodes[node];
+    const char* text = snapshot_leaf_text(snap, n->best);
+    if (!text || n->depth > snap->leaves[n->best].length) return NULL;
+    return text;
+}
+
+// Child of node whose edge starts with byte c (children are in byte order);
+// only the labels are searched, so sibling nodes are never touched
+static long snapshot_child(const Snapshot* snap, const SnapshotNode* node, unsigned char c) {
+    if ((uint64_t)node->first_edge + node->edge_count > snap->header->edge_count) return -1;
+    const uint8_t* labels = snap->labels + node->first_edge;
+    long lo = 0, hi = node->edge_count;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        unsigned char edge = labels[mid];
+        if (edge == c) return snap->edges[node->first_edge + mid];
+        if (edge < c) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+long snapshot_prefix_node(const Snapshot* snap, const char* prefix) {
+    if (!snap || !prefix || snap->header->leaf_count == 0) return -1;
+
+    size_t len = strlen(prefix);
+    size_t pos = 0;
+    long node = snap->header->root;
+    for (;;) {
+        const char* text = snapshot_node_text(snap, node);
+        if (!text) return -1;
+        const SnapshotNode* n = &snap->nodes[node];
+        if (snap->heat && snap->heat[node] < UINT32_MAX) snap->heat[node]++;
+
+        // Match the rest of this node's edge
+        size_t limit = n->depth < len ? n->depth : len;
+        if (pos < limit) {
+            if (simd_mismatch(text + pos, prefix + pos, limit - pos) != limit - pos) return -1;
+            pos = limit;
+        }
+        if (pos == len) return node;
+
+        node = snapshot_child(snap, n, (unsigned char)prefix[pos]);
+        if (node < 0) return -1;
+    }
+}
+
+long snapshot_best_completion(const Snapshot* snap, const char* prefix) {
+    long node = snapshot_prefix_node(snap, prefix);
+    if (node < 0) return -1;
+    uint32_t best = snap->nodes[node].best;
+    return (best == SNAPSHOT_NONE || best >= snap->header->leaf_count) ? -1 : (long)best;
+}
+
+SnapshotWriter* snapshot_writer_create(void) {
+    SnapshotWriter* writer = calloc(1, sizeof(SnapshotWriter));
+    if (!writer) return NULL;
+
+    // Root frame: depth 0, covers everything
+    if (!grow_array((void**)&writer->stack, &writer->stack_capacity, 1, sizeof(WriterFrame))) {
+        free(writer);
+        return NULL;
+    }
+    memset(&writer->stack[0], 0, sizeof(WriterFrame));
+    writer->stack[0].best = SNAPSHOT_NONE;
+    writer->stack_count = 1;
+    return writer;
+}
+
+void snapshot_writer_destroy(SnapshotWriter* writer) {
+    if (!writer) return;
+    for (size_t i = 0; i < writer->stack_count; i++) {
+        free(writer->stack[i].children);
+    }
+    free(writer->stack);
+    free(writer->leaves);
+    free(writer->strings);
+    free(writer->nodes);
+    free(writer->edges);
+    free(writer);
+}
+
+// Better of two leaves: higher frequency, then more recent, then earlier
+static uint32_t writer_better(const SnapshotWriter* writer, uint32_t a, uint32_t b) {
+    if (a == SNAPSHOT_NONE) return b;
+    if (b == SNAPSHOT_NONE) return a;
+    const SnapshotLeaf* la = &writer->leaves[a];
+    const SnapshotLeaf* lb = &writer->leaves[b];
+    if (la->frequency != lb->frequency) return la->frequency > lb->frequency ? a : b;
+    if (la->last_used != lb->last_used) return la->last_used > lb->last_used ? a : b;
+    return a < b ? a : b;
+}
+
+static bool frame_add_child(WriterFrame* frame, uint32_t child) {
+    size_t capacity = frame->child_capacity;
+    if (!grow_array((void**)&frame->children, &capacity, frame->child_count + 1, sizeof(uint32_t))) {
+        return false;
+    }
+    frame->child_capacity = (uint32_t)capacity;
+    frame->children[frame->child_count++] = child;
+    return true;
+}
+
+// Emit a finished frame as a node; returns its id or SNAPSHOT_NONE on failure
+static uint32_t writer_emit(SnapshotWriter* writer, WriterFrame* frame, uint32_t leaf_hi) {
+    if (!grow_array((void**)&writer->nodes, &writer->node_capacity, writer->node_count + 1, sizeof(SnapshotNode)) ||
+        !grow_array((void**)&writer->edges, &writer->edge_capacity, writer->edge_count + frame->child_count, sizeof(uint32_t))) {
+        return SNAPSHOT_NONE;
+    }
+
+    SnapshotNode* node = &writer->nodes[writer->node_count];
+    node->depth = frame->depth;
+    node->leaf_lo = frame->leaf_lo;
+    node->leaf_hi = leaf_hi;
+    node->best = frame->best;
+    node->first_edge = (uint32_t)writer->edge_count;
+    node->edge_count = frame->child_count;
+    if (frame->child_count) {
+        memcpy(writer->edges + writer->edge_count, frame->children, frame->child_count * sizeof(uint32_t));
+    }
+    writer->edge_count += frame->child_count;
+
+    free(frame->children);
+    frame->children = NULL;
+    frame->child_count = frame->child_capacity = 0;
+    return (uint32_t)writer->node_count++;
+}
+
+// Close every open node deeper than depth, splitting an edge at depth if the
+// stack jumps over it
+static bool writer_close_to(SnapshotWriter* writer, uint32_t depth, uint32_t leaf_hi) {
+    while (writer->stack_count > 1 && writer->stack[writer->stack_count - 1].depth > depth) {
+        WriterFrame closed = writer->stack[--writer->stack_count];
+        uint32_t best = closed.best;
+        uint32_t leaf_lo = closed.leaf_lo;
+        uint32_t id = writer_emit(writer, &closed, leaf_hi);
+        free(closed.children);
+        if (id == SNAPSHOT_NONE) return false;
+
+        WriterFrame* parent = &writer->stack[writer->stack_count - 1];
+        if (parent->depth < depth) {
+            // Branch point inside the edge: a new node at depth takes over
+            if (!grow_array((void**)&writer->stack, &writer->stack_capacity,
+                            writer->stack_count + 1, sizeof(WriterFrame))) {
+                return false;
+            }
+            parent = &writer->stack[writer->stack_count++];
+            memset(parent, 0, sizeof(WriterFrame));
+            parent->depth = depth;
+            parent->leaf_lo = leaf_lo;
+            parent->best = SNAPSHOT_NONE;
+        }
+        if (!frame_add_child(parent, id)) return false;
+        parent->best = writer_better(writer, parent->best, best);
+    }
+    return true;
+}
+
+bool snapshot_writer_add(SnapshotWriter* writer, const char* command,
+                         uint32_t frequency, int64_t last_used) {
+    if (!writer || writer->failed || !command || !*command) return false;
+
+    size_t length = strlen(command);
+    size_t lcp = 0;
+    if (writer->leaf_count > 0) {
+        const char* prev = writer->strings + writer->leaves[writer->leaf_count - 1].text;
+        while (prev[lcp] && prev[lcp] == command[lcp]) lcp++;
+        if (strcmp(prev, command) >= 0) return false;  // Not strictly increasing
+    }
+    if (writer->strings_size + length + 1 > UINT32_MAX || writer->leaf_count >= UINT32_MAX - 1) {
+        return false;
+    }
+
+    uint32_t id = (uint32_t)writer->leaf_count;
+    if (!writer_close_to(writer, (uint32_t)lcp, id) ||
+        !grow_array((void**)&writer->leaves, &writer->leaf_capacity, writer->leaf_count + 1, sizeof(SnapshotLeaf)) ||
+        !grow_array((void**)&writer->strings, &writer->strings_capacity, writer->strings_size + length + 1, 1) ||
+        !grow_array((void**)&writer->stack, &writer->stack_capacity, writer->stack_count + 1, sizeof(WriterFrame))) {
+        writer->failed = true;
+        return false;
+    }
+
+    SnapshotLeaf* leaf = &writer->leaves[writer->leaf_count++];
+    leaf->text = (uint32_t)writer->strings_size;
+    leaf->length = (uint32_t)length;
+    leaf->frequency = frequency;
+    leaf->flags = 0;
+    leaf->last_used = last_used;
+    memcpy(writer->strings + writer->strings_size, command, length + 1);
+    writer->strings_size += length + 1;
+
+    // The command's own terminal node stays open until a later command
+    // diverges above it
+    WriterFrame* frame = &writer->stack[writer->stack_count++];
+    memset(frame, 0, sizeof(WriterFrame));
+    frame->depth = (uint32_t)length;
+    frame->leaf_lo = id;
+    frame->best = id;
+    return true;
+}
+
+// Write one section at its offset, zero-padding up to it
+static bool write_section(FILE* file, uint64_t* written, uint64_t offset, const void* data, size_t size) {
+    static const char zeros[8] = {0};
+    while (*written < offset) {
+        size_t pad = offset - *written > sizeof(zeros) ? sizeof(zeros) : offset - *written;
+        if (fwrite(zeros, 1, pad, file) != pad) return false;
+        *written += pad;
+    }
+    if (size && fwrite(data, 1, size, file) != size) return false;
+    *written += size;
+    return true;
+}
+
+// Keys of one hash build, grouped by bucket
+typedef struct {
+    uint64_t* hashes;           // Per leaf
+    uint32_t* bucket_start;     // Per bucket + 1: first entry in members
+    uint32_t* members;          // Leaf ids grouped by bucket
+    uint64_t* by_size;          // Bucket ids (low half), largest bucket first
+    uint8_t* taken;             // Per slot
+    uint32_t* placed;           // Slots of the bucket being placed
+} HashBuild;
+
+// Ascending order of (UINT32_MAX - size, bucket) keys: big buckets first
+static int bucket_key_compare(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Try every displacement for one bucket; marks its slots taken on success
+static bool place_bucket(HashBuild* build, uint32_t bucket, uint32_t slot_count, uint16_t* displacement) {
+    uint32_t lo = build->bucket_start[bucket], hi = build->bucket_start[bucket + 1];
+    for (uint32_t d = 0; d <= UINT16_MAX; d++) {
+        uint32_t n = 0;
+        for (uint32_t k = lo; k < hi; k++) {
+            uint32_t slot = hash_slot(build->hashes[build->members[k]], (uint16_t)d, slot_count);
+            if (build->taken[slot]) break;
+            build->taken[slot] = 1;  // Also catches two members on one slot
+            build->placed[n++] = slot;
+        }
+        if (n == hi - lo) {
+            *displacement = (uint16_t)d;
+            return true;
+        }
+        for (uint32_t k = 0; k < n; k++) build->taken[build->placed[k]] = 0;
+    }
+    return false;
+}
+
+// Build the CHD hash over leaves: fills hash_* in the header and returns the
+// displacement and slot arrays, or leaves hash_buckets 0 if none was found
+static void build_hash(SnapshotHeader* header, const SnapshotLeaf* leaves, const char* strings,
+                       uint16_t** displacements, SnapshotSlot** slots) {
+    *displacements = NULL;
+    *slots = NULL;
+    header->hash_buckets = 0;
+    header->hash_slots = 0;
+    header->hash_seed = 0;
+    uint32_t n = header->leaf_count;
+    if (n == 0) return;
+
+    uint32_t bucket_count = (n + SNAPSHOT_HASH_LOAD - 1) / SNAPSHOT_HASH_LOAD;
+    uint32_t slot_count = (uint32_t)((uint64_t)n * SNAPSHOT_HASH_SLOTS / 100) + 1;
+    HashBuild build;
+    build.hashes = malloc(n * sizeof(uint64_t));
+    build.bucket_start = malloc((bucket_count + 1) * sizeof(uint32_t));
+    build.members = malloc(n * sizeof(uint32_t));
+    build.by_size = malloc(bucket_count * sizeof(uint64_t));
+    build.taken = malloc(slot_count);
+    build.placed = malloc(n * sizeof(uint32_t));
+    uint16_t* displace = malloc(bucket_count * sizeof(uint16_t));
+    SnapshotSlot* table = malloc(slot_count * sizeof(SnapshotSlot));
+    bool ok = build.hashes && build.bucket_start && build.members && build.by_size &&
+              build.taken && build.placed && displace && table;
+
+    for (uint32_t attempt = 0; ok && attempt < SNAPSHOT_HASH_SEEDS; attempt++) {
+        uint64_t seed = mix64(attempt + 1);
+        memset(build.bucket_start, 0, (bucket_count + 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; i < n; i++) {
+            build.hashes[i] = hash_command(strings + leaves[i].text, leaves[i].length, seed);
+            build.bucket_start[hash_bucket(build.hashes[i], bucket_count) + 1]++;
+        }
+        for (uint32_t b = 0; b < bucket_count; b++) build.bucket_start[b + 1] += build.bucket_start[b];
+        // Counting sort: bucket_start[b] walks to the end of b's range, then
+        // everything is shifted back one bucket
+        for (uint32_t i = 0; i < n; i++) {
+            build.members[build.bucket_start[hash_bucket(build.hashes[i], bucket_count)]++] = i;
+        }
+        memmove(build.bucket_start + 1, build.bucket_start, bucket_count * sizeof(uint32_t));
+        build.bucket_start[0] = 0;
+        for (uint32_t b = 0; b < bucket_count; b++) {
+            uint32_t size = build.bucket_start[b + 1] - build.bucket_start[b];
+            build.by_size[b] = (uint64_t)(UINT32_MAX - size) << 32 | b;
+        }
+        qsort(build.by_size, bucket_count, sizeof(uint64_t), bucket_key_compare);
+
+        memset(build.taken, 0, slot_count);
+        bool placed = true;
+        for (uint32_t b = 0; placed && b < bucket_count; b++) {
+            uint32_t bucket = (uint32_t)build.by_size[b];
+            displace[bucket] = 0;
+            placed = place_bucket(&build, bucket, slot_count, &displace[bucket]);
+        }
+        if (!placed) continue;
+
+        for (uint32_t s = 0; s < slot_count; s++) {
+            table[s].leaf = SNAPSHOT_NONE;
+            table[s].fingerprint = 0;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t hash = build.hashes[i];
+            uint32_t bucket = hash_bucket(hash, bucket_count);
+            SnapshotSlot* slot = &table[hash_slot(hash, displace[bucket], slot_count)];
+            slot->leaf = i;
+            slot->fingerprint = hash_fingerprint(hash);
+        }
+        header->hash_buckets = bucket_count;
+        header->hash_slots = slot_count;
+        header->hash_seed = seed;
+        *displacements = displace;
+        *slots = table;
+        displace = NULL;
+        table = NULL;
+        break;
+    }
+
+    free(build.hashes);
+    free(build.bucket_start);
+    free(build.members);
+    free(build.by_size);
+    free(build.taken);
+    free(build.placed);
+    free(displace);
+    free(table);
+}
+
+// Fill in the section offsets, build the hash and write a complete image:
+// to a path atomically (temp file + rename), or into an open file (path NULL,
+// e.g. a memfd) at its offset; header counts, root, created and warm_* are
+// the caller's
+static bool write_image(const char* path, int fd, SnapshotHeader* header, const SnapshotLeaf* leaves,
+                        const SnapshotNode* nodes, const uint32_t* edges, const uint8_t* labels,
+                        const uint32_t* order, const char* strings, size_t strings_size) {
+    memcpy(header->magic, SNAPSHOT_MAGIC, 4);
+    header->version = SNAPSHOT_VERSION;
+    header->leaves_offset = align8(sizeof(SnapshotHeader));
+    header->nodes_offset = align8(header->leaves_offset + (uint64_t)header->leaf_count * sizeof(SnapshotLeaf));
+    header->edges_offset = align8(header->nodes_offset + (uint64_t)header->node_count * sizeof(SnapshotNode));
+    header->labels_offset = header->edges_offset + (uint64_t)header->edge_count * sizeof(uint32_t);
+    header->order_offset = align8(header->labels_offset + header->edge_count);
+    uint16_t* displacements;
+    SnapshotSlot* slots;
+    build_hash(header, leaves, strings, &displacements, &slots);
+    header->hash_offset = align8(header->order_offset + (uint64_t)header->leaf_count * sizeof(uint32_t));
+    uint64_t slots_offset = hash_slots_offset(header);
+    header->strings_offset = align8(slots_offset + (uint64_t)header->hash_slots * sizeof(SnapshotSlot));
+    header->strings_size = strings_size + 1;  // Trailing NUL guards empty snapshots
+    header->file_size = header->strings_offset + header->strings_size;
+
+    char temp_path[4200];
+    FILE* file = NULL;
+    if (path) {
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp.%ld", path, (long)getpid());
+        file = fopen(temp_path, "wb");
+    } else {
+        int copy = dup(fd);
+        if (copy >= 0 && !(file = fdopen(copy, "wb"))) close(copy);
+    }
+    if (!file) {
+        free(displacements);
+        free(slots);
+        return false;
+    }
+
+    uint64_t written = 0;
+    bool ok = write_section(file, &written, 0, header, sizeof(*header)) &&
+              write_section(file, &written, header->leaves_offset, leaves, header->leaf_count * sizeof(SnapshotLeaf)) &&
+              write_section(file, &written, header->nodes_offset, nodes, header->node_count * sizeof(SnapshotNode)) &&
+              write_section(file, &written, header->edges_offset, edges, header->edge_count * sizeof(uint32_t)) &&
+              write_section(file, &written, header->labels_offset, labels, header->edge_count) &&
+              write_section(file, &written, header->order_offset, order, header->leaf_count * sizeof(uint32_t)) &&
+              write_section(file, &written, header->hash_offset, displacements, header->hash_buckets * sizeof(uint16_t)) &&
+              write_section(file, &written, slots_offset, slots, header->hash_slots * sizeof(SnapshotSlot)) &&
+              write_section(file, &written, header->strings_offset, strings, strings_size) &&
+              write_section(file, &written, written, "", 1);
+    free(displacements);
+    free(slots);
+    if (!path) {
+        // Handed to another process, never to the disk: no sync
+        return fclose(file) == 0 && ok;
+    }
+    ok = fflush(file) == 0 && fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    // Readers see either the old snapshot or the complete new one
+    if (ok && chmod(temp_path, 0644) == 0 && rename(temp_path, path) == 0) return true;
+    unlink(temp_path);
+    return false;
+}
+
+// Finish the trie and write it to path, or into fd when path is NULL
+static bool writer_finish(SnapshotWriter* writer, const char* path, int fd) {
+    if (!writer || writer->failed) return false;
+
+    uint32_t leaf_count = (uint32_t)writer->leaf_count;
+    if (!writer_close_to(writer, 0, leaf_count)) return false;
+    WriterFrame* root_frame = &writer->stack[0];
+    uint32_t root = writer_emit(writer, root_frame, leaf_count);
+    if (root == SNAPSHOT_NONE) return false;
+    writer->failed = true;  // The stack is consumed; no more adds
+
+    // Leaves were added sorted, so the order section is the identity; each
+    // label is the child's byte at the parent's depth
+    uint32_t* order = malloc((leaf_count ? leaf_count : 1) * sizeof(uint32_t));
+    uint8_t* labels = malloc(writer->edge_count ? writer->edge_count : 1);
+    if (!order || !labels) {
+        free(order);
+        free(labels);
+        return false;
+    }
+    for (uint32_t i = 0; i < leaf_count; i++) order[i] = i;
+    for (size_t n = 0; n < writer->node_count; n++) {
+        const SnapshotNode* node = &writer->nodes[n];
+        for (uint32_t e = node->first_edge; e < node->first_edge + node->edge_count; e++) {
+            const SnapshotLeaf* leaf = &writer->leaves[writer->nodes[writer->edges[e]].best];
+            labels[e] = (uint8_t)writer->strings[leaf->text + node->depth];
+        }
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.leaf_count = leaf_count;
+    header.node_count = (uint32_t)writer->node_count;
+    header.edge_count = (uint32_t)writer->edge_count;
+    header.root = root;
+    header.created = time(NULL);
+    bool ok = write_image(path, fd, &header, writer->leaves, writer->nodes, writer->edges, labels,
+                          order, writer->strings, writer->strings_size);
+    free(order);
+    free(labels);
+    return ok;
+}
+
+bool snapshot_writer_finish(SnapshotWriter* writer, const char* path) {
+    return path && writer_finish(writer, path, -1);
+}
+
+bool snapshot_writer_finish_fd(SnapshotWriter* writer, int fd) {
+    return fd >= 0 && writer_finish(writer, NULL, fd);
+}
+
+// One input of a k-way merge: the snapshot and its next unread leaf
+typedef struct {
+    Snapshot* snap;
+    uint32_t next;              // Position in command order
+    long leaf;
+    const char* text;
+} MergeCursor;
+
+// Min-heap order: by current text
+static bool cursor_less(const MergeCursor* a, const MergeCursor* b) {
+    return strcmp(a->text, b->text) < 0;
+}
+
+static void heap_sift_down(MergeCursor* heap, int size, int i) {
+    for (;;) {
+        int smallest = i, left = 2 * i + 1, right = left + 1;
+        if (left < size && cursor_less(&heap[left], &heap[smallest])) smallest = left;
+        if (right < size && cursor_less(&heap[right], &heap[smallest])) smallest = right;
+        if (smallest == i) return;
+        MergeCursor temp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = temp;
+        i = smallest;
+    }
+}
+
+// Advance a cursor to its next valid leaf; false when the input is exhausted
+static bool cursor_load(MergeCursor* cursor) {
+    while (cursor->next < cursor->snap->header->leaf_count) {
+        cursor->leaf = snapshot_sorted_leaf(cursor->snap, cursor->next);
+        cursor->text = snapshot_leaf_text(cursor->snap, cursor->leaf);
+        if (cursor->text && *cursor->text) return true;
+        cursor->next++;
+    }
+    return false;
+}
+
+bool snapshot_merge(Snapshot* const* inputs, int count, SnapshotFreqPolicy freq_policy,
+                    SnapshotTimePolicy time_policy, const char* path, long* merged) {
+    if (merged) *merged = 0;
+    if (!inputs || count <= 0 || !path) return false;
+
+    MergeCursor* heap = malloc(count * sizeof(MergeCursor));
+    SnapshotWriter* writer = snapshot_writer_create();
+    if (!heap || !writer) {
+        free(heap);
+        snapshot_writer_destroy(writer);
+        return false;
+    }
+
+    int size = 0;
+    for (int i = 0; i < count; i++) {
+        heap[size].snap = inputs[i];
+        heap[size].next = 0;
+        if (inputs[i] && cursor_load(&heap[size])) size++;
+    }
+    for (int i = size / 2 - 1; i >= 0; i--) heap_sift_down(heap, size, i);
+
+    bool ok = true;
+    long written = 0;
+    while (ok && size > 0) {
+        // Pop every cursor positioned on the smallest text and combine them
+        const char* text = heap[0].text;
+        uint64_t frequency = 0;
+        int64_t last_used = 0;
+        bool first = true;
+        while (size > 0 && strcmp(heap[0].text, text) == 0) {
+            const SnapshotLeaf* leaf = &heap[0].snap->leaves[heap[0].leaf];
+            if (freq_policy == SNAPSHOT_FREQ_SUM) frequency += leaf->frequency;
+            else if (leaf->frequency > frequency) frequency = leaf->frequency;
+            if (first || (time_policy == SNAPSHOT_TIME_MAX ? leaf->last_used > last_used
+                                                           : leaf->last_used < last_used)) {
+                last_used = leaf->last_used;
+            }
+            first = false;
+
+            // text stays valid: inputs remain mapped for the whole merge
+            heap[0].next++;
+            if (!cursor_load(&heap[0])) heap[0] = heap[--size];
+            heap_sift_down(heap, size, 0);
+        }
+        ok = snapshot_writer_add(writer, text, frequency > UINT32_MAX ? UINT32_MAX : (uint32_t)frequency,
+                                 last_used);
+        written++;
+    }
+    ok = ok && snapshot_writer_finish(writer, path);
+
+    free(heap);
+    snapshot_writer_destroy(writer);
+    if (merged) *merged = ok ? written : 0;
+    return ok;
+}
+
+// qsort comparator over TrieNode* leaves by command text
+static int leaf_text_compare(const void* a, const void* b) {
+    const TrieNode* la = *(const TrieNode* const*)a;
+    const TrieNode* lb = *(const TrieNode* const*)b;
+    return strcmp(la->full_command, lb->full_command);
+}
+
+bool snapshot_write_trie(const Trie* trie, const char* path) {
+    if (!trie || !path) return false;
+
+    size_t count = trie->total_commands;
+    const TrieNode** sorted = malloc((count ? count : 1) * sizeof(TrieNode*));
+    SnapshotWriter* writer = snapshot_writer_create();
+    if (!sorted || !writer) {
+        free(sorted);
+        snapshot_writer_destroy(writer);
+        return false;
+    }
+
+    memcpy(sorted, trie->leaves, count * sizeof(TrieNode*));
+    qsort(sorted, count, sizeof(TrieNode*), leaf_text_compare);
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < count; i++) {
+        if (!*sorted[i]->full_command) continue;
+        ok = snapshot_writer_add(writer, sorted[i]->full_command,
+                                 sorted[i]->frequency > 0 ? (uint32_t)sorted[i]->frequency : 0,
+                                 sorted[i]->last_used);
+    }
+    ok = ok && snapshot_writer_finish(writer, path);
+
+    free(sorted);
+    snapshot_writer_destroy(writer);
+    return ok;
+}
+
+bool snapshot_track_heat(Snapshot* snap) {
+    if (!snap) return false;
+    if (!snap->heat) snap->heat = calloc(snap->header->node_count, sizeof(uint32_t));
+    return snap->heat != NULL;
+}
+
+// A node or leaf and how hot it is, for ordering hot-first
+typedef struct {
+    uint64_t heat;
+    uint32_t id;
+} HeatRank;
+
+// Hottest first; equal heat keeps the current order
+static int heat_rank_compare(const void* a, const void* b) {
+    const HeatRank* x = a;
+    const HeatRank* y = b;
+    if (x->heat != y->heat) return x->heat > y->heat ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+bool snapshot_write_packed(const Snapshot* snap, const char* path) {
+    if (!snap || !path) return false;
+    const SnapshotHeader* h = snap->header;
+    uint32_t node_count = h->node_count, leaf_count = h->leaf_count, edge_count = h->edge_count;
+
+    HeatRank* node_rank = malloc(node_count * sizeof(HeatRank));
+    HeatRank* leaf_rank = malloc((leaf_count ? leaf_count : 1) * sizeof(HeatRank));
+    uint32_t* node_map = malloc(node_count * sizeof(uint32_t));
+    uint32_t* leaf_map = malloc((leaf_count ? leaf_count : 1) * sizeof(uint32_t));
+    SnapshotNode* nodes = malloc(node_count * sizeof(SnapshotNode));
+    SnapshotLeaf* leaves = malloc((leaf_count ? leaf_count : 1) * sizeof(SnapshotLeaf));
+    uint32_t* edges = malloc((edge_count ? edge_count : 1) * sizeof(uint32_t));
+    uint8_t* labels = malloc(edge_count ? edge_count : 1);
+    uint32_t* order = malloc((leaf_count ? leaf_count : 1) * sizeof(uint32_t));
+    char* strings = malloc(h->strings_size);
+    bool ok = node_rank && leaf_rank && node_map && leaf_map && nodes && leaves &&
+              edges && labels && order && strings;
+
+    // Heat is this mapping's visits; a previous packing's warm region counts
+    // as one visit so repacking without new data keeps it. A walk reads the
+    // text of each visited node's best leaf, so leaves inherit node heat.
+    for (uint32_t i = 0; ok && i < leaf_count; i++) {
+        leaf_rank[i].heat = i < h->warm_leaves;
+        leaf_rank[i].id = i;
+    }
+    for (uint32_t n = 0; ok && n < node_count; n++) {
+        node_rank[n].heat = (snap->heat ? snap->heat[n] : 0) + (n < h->warm_nodes);
+        node_rank[n].id = n;
+        uint32_t best = snap->nodes[n].best;
+        if (best < leaf_count) leaf_rank[best].heat += node_rank[n].heat;
+        else if (best != SNAPSHOT_NONE) ok = false;
+    }
+    if (ok) {
+        qsort(node_rank, node_count, sizeof(HeatRank), heat_rank_compare);
+        qsort(leaf_rank, leaf_count, sizeof(HeatRank), heat_rank_compare);
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    size_t strings_size = 0;
+    for (uint32_t i = 0; ok && i < leaf_count; i++) {
+        uint32_t old = leaf_rank[i].id;
+        const char* text = snapshot_leaf_text(snap, old);
+        uint32_t length = snap->leaves[old].length;
+        if (!text || strings_size + length + 1 > h->strings_size) {
+            ok = false;
+            break;
+        }
+        leaf_map[old] = i;
+        leaves[i] = snap->leaves[old];
+        leaves[i].text = (uint32_t)strings_size;
+        memcpy(strings + strings_size, text, length);
+        strings[strings_size + length] = '\0';
+        strings_size += length + 1;
+        if (leaf_rank[i].heat > 0) {
+            header.warm_leaves = i + 1;
+            header.warm_strings = strings_size;
+        }
+    }
+    for (uint32_t j = 0; ok && j < node_count; j++) node_map[node_rank[j].id] = j;
+
+    // Each node's edge block follows the node order, so warm nodes' children
+    // and labels are contiguous too
+    uint32_t edge = 0;
+    for (uint32_t j = 0; ok && j < node_count; j++) {
+        const SnapshotNode* old = &snap->nodes[node_rank[j].id];
+        if ((uint64_t)old->first_edge + old->edge_count > edge_count) {
+            ok = false;
+            break;
+        }
+        nodes[j] = *old;
+        nodes[j].best = old->best == SNAPSHOT_NONE ? SNAPSHOT_NONE : leaf_map[old->best];
+        nodes[j].first_edge = edge;
+        for (uint32_t e = 0; e < old->edge_count; e++) {
+            uint32_t child = snap->edges[old->first_edge + e];
+            if (child >= node_count) {
+                ok = false;
+                break;
+            }
+            edges[edge] = node_map[child];
+            labels[edge++] = snap->labels[old->first_edge + e];
+        }
+        if (node_rank[j].heat > 0) {
+            header.warm_nodes = j + 1;
+            header.warm_edges = edge;
+        }
+    }
+    for (uint32_t r = 0; ok && r < leaf_count; r++) {
+        long leaf = snapshot_sorted_leaf(snap, r);
+        if (leaf < 0) ok = false;
+        else order[r] = leaf_map[leaf];
+    }
+
+    if (ok) {
+        header.leaf_count = leaf_count;
+        header.node_count = node_count;
+        header.edge_count = edge;
+        header.root = node_map[h->root];
+        header.created = h->created;
+        ok = write_image(path, -1, &header, leaves, nodes, edges, labels, order, strings, strings_size);
+    }
+
+    free(node_rank);
+    free(leaf_rank);
+    free(node_map);
+    free(leaf_map);
+    free(nodes);
+    free(leaves);
+    free(edges);
+    free(labels);
+    free(order);
+    free(strings);
+    return ok;
+}
+
+// Advise or lock the pages spanning size bytes at offset; adds to *total
+static bool warm_range(const Snapshot* snap, uint64_t offset, uint64_t size, bool lock, size_t* total) {
+    if (size == 0) return true;
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t start = offset & ~(page - 1);
+    void* addr = (void*)(snap->map + start);
+    size_t length = offset + size - start;
+    if ((lock ? mlock(addr, length) : madvise(addr, length, MADV_WILLNEED)) != 0) return false;
+    *total += length;
+    return true;
+}
+
+size_t snapshot_warm(const Snapshot* snap, bool lock) {
+    if (!snap) return 0;
+    const SnapshotHeader* h = snap->header;
+    if (h->warm_nodes == 0) return 0;
+
+    size_t total = 0;
+    bool ok = warm_range(snap, 0, sizeof(SnapshotHeader), lock, &total) &&
+              warm_range(snap, h->leaves_offset, (uint64_t)h->warm_leaves * sizeof(SnapshotLeaf), lock, &total) &&
+              warm_range(snap, h->nodes_offset, (uint64_t)h->warm_nodes * sizeof(SnapshotNode), lock, &total) &&
+              warm_range(snap, h->edges_offset, (uint64_t)h->warm_edges * sizeof(uint32_t), lock, &total) &&
+              warm_range(snap, h->labels_offset, h->warm_edges, lock, &total) &&
+              warm_range(snap, h->strings_offset, h->warm_strings, lock, &total) &&
+              (!snap->displacements ||
+               warm_range(snap, h->hash_offset, (uint64_t)h->hash_buckets * sizeof(uint16_t), lock, &total));
+    if (!ok && lock) {
+        // Typically RLIMIT_MEMLOCK; undo the partial lock
+        int saved = errno;
+        munlock(snap->map, snap->size);
+        errno = saved;
+    }
+    return ok ? total : 0;
+}
@@ -0,0 +1,192 @@
+/**
+ * @file template.c
+ * @brief Volatile-token classifiers and command templates
+ *
+ * Each classifier is a single forward scan that gives up at the first byte
+ * its class cannot contain; template_classify() dispatches on the first byte
+ * so most literal words are rejected after one comparison.
+ */
+
+#include "template.h"
+#include <string.h>
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool is_hex_letter(char c) {
+    return c >= 'a' && c <= 'f';
+}
+
+// s[at, at + count) are all digits, within n bytes
+static bool digits_at(const char* s, size_t n, size_t at, size_t count) {
+    if (at + count > n) return false;
+    for (size_t i = at; i < at + count; i++) {
+        if (!is_digit(s[i])) return false;
+    }
+    return true;
+}
+
+// Every byte from s[at] on is one of chars
+static bool only_chars(const char* s, size_t n, size_t at, const char* chars) {
+    for (size_t i = at; i < n; i++) {
+        if (!strchr(chars, s[i])) return false;
+    }
+    return true;
+}
+
+static bool is_number(const char* s, size_t n) {
+    return n >= TEMPLATE_MIN_DIGITS && digits_at(s, n, 0, n);
+}
+
+// Lowercase hex with at least one digit and one letter, so plain words
+// ("deadbeef", "facade") and numbers stay out
+static bool is_hash(const char* s, size_t n) {
+    if (n < 7 || n > 64) return false;
+    bool digit = false, letter = false;
+    for (size_t i = 0; i < n; i++) {
+        if (is_digit(s[i])) digit = true;
+        else if (is_hex_letter(s[i])) letter = true;
+        else return false;
+    }
+    return digit && letter;
+}
+
+static bool is_uuid(const char* s, size_t n) {
+    if (n != 36) return false;
+    for (size_t i = 0; i < n; i++) {
+        bool dash = i == 8 || i == 13 || i == 18 || i == 23;
+        char c = s[i] | 0x20;  // Either case
+        if (dash ? s[i] != '-' : !(is_digit(s[i]) || is_hex_letter(c))) return false;
+    }
+    return true;
+}
+
+// YYYY-MM-DD[(T|_)HH:MM...] or HH:MM:SS[.fff], with trailing seconds,
+// fractions and zone offsets allowed
+static bool is_time(const char* s, size_t n) {
+    if (digits_at(s, n, 0, 4) && n >= 10 && s[4] == '-' && digits_at(s, n, 5, 2) &&
+        s[7] == '-' && digits_at(s, n, 8, 2)) {
+        if (n == 10) return true;
+        return (s[10] == 'T' || s[10] == '_') && digits_at(s, n, 11, 2) && n >= 16 &&
+               s[13] == ':' && digits_at(s, n, 14, 2) && only_chars(s, n, 16, "0123456789:.+-Z");
+    }
+    return digits_at(s, n, 0, 2) && n >= 8 && s[2] == ':' && digits_at(s, n, 3, 2) &&
+           s[5] == ':' && digits_at(s, n, 6, 2) && only_chars(s, n, 8, "0123456789.");
+}
+
+// Four 1-3 digit octets joined by sep from s[at]; returns the end, or 0
+static size_t octets_at(const char* s, size_t n, size_t at, char sep) {
+    size_t i = at;
+    for (int octet = 0; octet < 4; octet++) {
+        if (octet > 0) {
+            if (i >= n || s[i] != sep) return 0;
+            i++;
+        }
+        size_t start = i;
+        while (i < n && i - start < 4 && is_digit(s[i])) i++;
+        if (i == start || i - start > 3) return 0;
+    }
+    return i;
+}
+
+// 10.0.0.7, 10.0.0.7:22, 10.0.0.0/8, ip-10-0-0-7[.domain]
+static bool is_address(const char* s, size_t n) {
+    if (n > 3 && memcmp(s, "ip-", 3) == 0) {
+        size_t end = octets_at(s, n, 3, '-');
+        return end && (end == n || s[end] == '.');
+    }
+    size_t end = octets_at(s, n, 0, '.');
+    if (!end) return false;
+    if (end == n) return true;
+    return (s[end] == ':' || s[end] == '/') && end + 1 < n && digits_at(s, n, end + 1, n - end - 1);
+}
+
+static bool is_temp_path(const char* s, size_t n) {
+    static const char* const roots[] = { "/tmp/", "/var/tmp/", "/var/folders/", "/dev/shm/" };
+    for (size_t r = 0; r < sizeof(roots) / sizeof(roots[0]); r++) {
+        size_t len = strlen(roots[r]);
+        if (n > len && memcmp(s, roots[r], len) == 0) return true;
+    }
+    return false;
+}
+
+TokenClass template_classify(const char* token, size_t length) {
+    if (length == 0) return TOKEN_LITERAL;
+    char c = token[0];
+    if (c == '/') {
+        return is_temp_path(token, length) ? TOKEN_TEMP_PATH : TOKEN_LITERAL;
+    }
+    if (c == 'i') {
+        return is_address(token, length) ? TOKEN_ADDRESS : TOKEN_LITERAL;
+    }
+    if (is_digit(c)) {
+        if (is_number(token, length)) return TOKEN_NUMBER;
+        if (is_uuid(token, length)) return TOKEN_UUID;
+        if (is_time(token, length)) return TOKEN_TIME;
+        if (is_address(token, length)) return TOKEN_ADDRESS;
+        if (is_hash(token, length)) return TOKEN_HASH;
+        return TOKEN_LITERAL;
+    }
+    if (is_hex_letter(c) || (c >= 'A' && c <= 'F')) {
+        if (is_uuid(token, length)) return TOKEN_UUID;
+        if (is_hash(token, length)) return TOKEN_HASH;
+    }
+    return TOKEN_LITERAL;
+}
+
+TokenClass template_classify_word(const char* word, size_t length, size_t* head) {
+    *head = 0;
+    TokenClass token_class = template_classify(word, length);
+    // Leftmost split first: the longest tail that is volatile wins
+    for (size_t i = 0; token_class == TOKEN_LITERAL && i + 1 < length; i++) {
+        if (!strchr(TEMPLATE_SPLITS, word[i])) continue;
+        token_class = template_classify(word + i + 1, length - i - 1);
+        if (token_class != TOKEN_LITERAL) *head = i + 1;
+    }
+    return token_class;
+}
+
+size_t template_key(const char* command, char* key, size_t size, int* source) {
+    size_t out = 0;
+    size_t i = 0;
+    bool templated = false;
+
+    while (command[i]) {
+        size_t start = i;
+        size_t head = 0;
+        TokenClass token_class = TOKEN_LITERAL;
+        if (command[i] != ' ' && command[i] != '\t') {
+            while (command[i] && command[i] != ' ' && command[i] != '\t') i++;
+            token_class = template_classify_word(command + start, i - start, &head);
+        } else {
+            i++;
+        }
+
+        // Literal bytes (all of them, or the head), then one marker
+        size_t literal = token_class == TOKEN_LITERAL ? i - start : head;
+        size_t needed = literal + (token_class != TOKEN_LITERAL);
+        if (out + needed >= size) return 0;
+        for (size_t j = 0; j < literal; j++) {
+            if (source) source[out] = (int)(start + j);
+            key[out++] = command[start + j];
+        }
+        if (token_class != TOKEN_LITERAL) {
+            if (source) source[out] = (int)(start + head);
+            key[out++] = (char)token_class;
+            templated = true;
+        }
+    }
+
+    if (!templated) return 0;
+    if (source) source[out] = (int)i;
+    key[out] = '\0';
+    return out;
+}
+
+const char* template_class_name(TokenClass token_class) {
+    static const char* const names[TOKEN_CLASSES] = {
+        "literal", "number", "hash", "uuid", "time", "address", "temp-path"
+    };
+    return token_class < TOKEN_CLASSES ? names[token_class] : "literal";
+}
@@ -14,10 +14,14 @@
  */
 
 #include "trie.h"
+#include "simd.h"
+#include "template.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
+#include <ctype.h>
 
 /**
  * Create a new trie node with initialized values.
@@ -35,9 +39,16 @@ TrieNode* trie_node_create(void) {
     if (!node) return NULL;
     
     node->is_end_of_word = false;
+    node->missing = false;
     node->full_command = NULL;
     node->frequency = 0;
     node->last_used = 0;
+    node->leaf_id = TRIE_NO_LEAF;
+    node->refs = NULL;
+    node->ref_count = 0;
+    node->entry = NULL;
+    node->subtree_leaves = 0;
+    node->reservoir = NULL;
     
     for (int i = 0; i < ALPHABET_SIZE; i++) {
         node->children[i] = NULL;
@@ -59,6 +70,13 @@ void trie_node_destroy(TrieNode* node) {
     if (node->full_command) {
         free(node->full_command);
     }
+    free(node->refs);
+    if (node->reservoir) {
+        for (int i = 0; i < node->reservoir->count; i++) {
+            free(node->reservoir->samples[i].command);
+        }
+        free(node->reservoir);
+    }
     free(node);
 }
 
@@ -74,6 +92,23 @@ Trie* trie_create(void) {
     }
     
     trie->total_commands = 0;
+    trie->leaves = NULL;
+    trie->leaf_capacity = 0;
+    trie->folded_root = NULL;
+    trie->segment_root = NULL;
+    trie->wrapper_aliases = false;
+    trie->reverse_root = NULL;
+    trie->time_index = NULL;
+    trie->time_count = 0;
+    trie->time_capacity = 0;
+    trie->time_live = NULL;
+    trie->time_live_capacity = 0;
+    trie->time_sorted = true;
+    trie->templates = false;
+    trie->command_check = NULL;
+    trie->command_context = NULL;
+    trie->missing_score = 0;
+    trie->missing_commands = 0;
     return trie;
 }
 
@@ -82,9 +117,671 @@ void trie_destroy(Trie* trie) {
     if (!trie) return;
     
     trie_node_destroy(trie->root);
+    trie_node_destroy(trie->folded_root);
+    trie_node_destroy(trie->segment_root);
+    trie_node_destroy(trie->reverse_root);
+    free(trie->leaves);
+    free(trie->time_index);
+    free(trie->time_live);
     free(trie);
 }
 
+// Score used to rank completions: frequency * 100 + 1-hour recency bonus
+int trie_score(int frequency, long last_used, long now) {
+    int recency_bonus = (now - last_used < 3600) ? 50 : 0;
+    return frequency * 100 + recency_bonus;
+}
+
+// Append a reference to primary leaf storage to a secondary-index node
+static bool trie_node_add_ref(TrieNode* node, int leaf_id, int offset) {
+    TrieRef* refs = realloc(node->refs, (node->ref_count + 1) * sizeof(TrieRef));
+    if (!refs) return false;
+    refs[node->ref_count].leaf_id = leaf_id;
+    refs[node->ref_count].offset = offset;
+    node->ref_count++;
+    node->refs = refs;
+    return true;
+}
+
+// Register a freshly created end-of-word node in the leaf table
+static bool trie_add_leaf(Trie* trie, TrieNode* node) {
+    if (trie->total_commands >= trie->leaf_capacity) {
+        int capacity = trie->leaf_capacity ? trie->leaf_capacity * 2 : 128;
+        TrieNode** leaves = realloc(trie->leaves, capacity * sizeof(TrieNode*));
+        if (!leaves) return false;
+        trie->leaves = leaves;
+        trie->leaf_capacity = capacity;
+    }
+    node->leaf_id = trie->total_commands;
+    trie->leaves[trie->total_commands] = node;
+    return true;
+}
+
+// Walk a prefix from root; NULL if the path does not exist
+static TrieNode* trie_walk(TrieNode* root, const char* prefix) {
+    TrieNode* current = root;
+    for (const char* p = prefix; *p && current; p++) {
+        unsigned char index = (unsigned char)*p;
+        if (index >= ALPHABET_SIZE) return NULL;
+        current = current->children[index];
+    }
+    return current;
+}
+
+// Path key of a command: its template (written to buf, MAX_COMMAND_LENGTH + 1
+// bytes) when templates are on and it has a volatile token, else the command
+static const char* trie_key(const Trie* trie, const char* command, char* buf) {
+    if (!trie->templates) return command;
+    return template_key(command, buf, MAX_COMMAND_LENGTH + 1, NULL) ? buf : command;
+}
+
+// Sample of a templated leaf holding a concrete command, or NULL
+static TrieSample* trie_find_sample(const TrieNode* leaf, const char* command) {
+    if (!leaf->reservoir) return NULL;
+    for (int i = 0; i < leaf->reservoir->count; i++) {
+        if (strcmp(leaf->reservoir->samples[i].command, command) == 0) {
+            return &leaf->reservoir->samples[i];
+        }
+    }
+    return NULL;
+}
+
+// Give a command that is not sampled yet a (zeroed) sample, in place of the
+// least used one (the oldest on ties) once the reservoir is full; NULL if
+// out of memory
+static TrieSample* trie_add_sample(TrieNode* leaf, const char* command) {
+    if (!leaf->reservoir) {
+        leaf->reservoir = calloc(1, sizeof(TrieReservoir));
+        if (!leaf->reservoir) return NULL;
+    }
+    TrieReservoir* reservoir = leaf->reservoir;
+    reservoir->seen++;
+    
+    TrieSample* slot = &reservoir->samples[reservoir->count];
+    if (reservoir->count == TRIE_SAMPLES) {
+        slot = &reservoir->samples[0];
+        for (int i = 1; i < TRIE_SAMPLES; i++) {
+            const TrieSample* sample = &reservoir->samples[i];
+            if (sample->frequency < slot->frequency ||
+                (sample->frequency == slot->frequency && sample->last_used < slot->last_used)) {
+                slot = &reservoir->samples[i];
+            }
+        }
+    }
+    
+    char* copy = strdup(command);
+    if (!copy) return NULL;
+    if (reservoir->count == TRIE_SAMPLES) {
+        reservoir->evicted += slot->frequency;
+        free(slot->command);
+    } else {
+        reservoir->count++;
+    }
+    slot->command = copy;
+    slot->frequency = 0;
+    slot->last_used = 0;
+    return slot;
+}
+
+// Count one use of a concrete command on its templated leaf
+static void trie_sample_use(TrieNode* leaf, const char* command, long now) {
+    TrieSample* sample = trie_find_sample(leaf, command);
+    if (!sample) sample = trie_add_sample(leaf, command);
+    if (sample) {
+        sample->frequency++;
+        sample->last_used = now;
+    } else if (leaf->reservoir) {
+        leaf->reservoir->evicted++;
+    }
+}
+
+// Highest-scoring sample of a templated leaf that starts with prefix (any
+// sample if prefix is NULL), or NULL
+static const TrieSample* trie_best_sample(const TrieNode* leaf, const char* prefix,
+                                          long now, int* score) {
+    const TrieSample* best = NULL;
+    size_t len = prefix ? strlen(prefix) : 0;
+    *score = -1;
+    for (int i = 0; leaf->reservoir && i < leaf->reservoir->count; i++) {
+        const TrieSample* sample = &leaf->reservoir->samples[i];
+        if (prefix && strncmp(sample->command, prefix, len) != 0) continue;
+        int sample_score = trie_score(sample->frequency, sample->last_used, now);
+        if (sample_score > *score) {
+            *score = sample_score;
+            best = sample;
+        }
+    }
+    return best;
+}
+
+/**
+ * Score a node for ranking, or -1 if it completes nothing.
+ * 
+ * Statistics are merged over the node's own leaf (if it ends a command) and
+ * every leaf it references: case variants, commands sharing a segment tail,
+ * or wrapped spellings of the same command. A wrapped leaf is scored through
+ * its entry node so `sudo X` and `X` always rank identically.
+ */
+static int trie_node_score(Trie* trie, const TrieNode* node, long now) {
+    if (node->entry) node = node->entry;
+    
+    int frequency = 0;
+    long last_used = 0;
+    bool completes = false;
+    bool available = false;  // At least one counted leaf can run here
+    
+    if (node->leaf_id != TRIE_NO_LEAF) {
+        completes = true;
+        if (!node->missing) {
+            frequency = node->frequency;
+            last_used = node->last_used;
+            available = true;
+        }
+    }
+    for (int r = 0; r < node->ref_count; r++) {
+        TrieNode* leaf = trie->leaves[node->refs[r].leaf_id];
+        completes = true;
+        if (leaf->missing) continue;
+        frequency += leaf->frequency;
+        if (leaf->last_used > last_used) last_used = leaf->last_used;
+        available = true;
+    }
+    if (!completes) return -1;
+    return available ? trie_score(frequency, last_used, now) : trie->missing_score;
+}
+
+/**
+ * @struct TrieSampleFilter
+ * @brief What a sample of a templated leaf must spell to answer a query
+ */
+typedef struct {
+    /** Typed text the indexed part of the command must start with */
+    const char* prefix;
+    size_t prefix_len;
+    
+    /** Text the whole command must end with (NULL: any) */
+    const char* suffix;
+    size_t suffix_len;
+    
+    /** Compare the prefix ignoring case (folded index) */
+    bool nocase;
+} TrieSampleFilter;
+
+// Whether a command, indexed from text on, passes a filter
+static bool trie_sample_fits(const char* command, const char* text, const TrieSampleFilter* filter) {
+    if (filter->nocase ? strncasecmp(text, filter->prefix, filter->prefix_len) != 0
+                       : strncmp(text, filter->prefix, filter->prefix_len) != 0) {
+        return false;
+    }
+    if (!filter->suffix) return true;
+    
+    // Prefix and suffix may not overlap
+    size_t len = strlen(command);
+    return len >= (size_t)(text - command) + filter->prefix_len + filter->suffix_len &&
+           memcmp(command + len - filter->suffix_len, filter->suffix, filter->suffix_len) == 0;
+}
+
+// Best sample of a templated leaf that passes a filter, read from key byte
+// offset on (mapped into each sample through its template key); returns that
+// text, or NULL with *score -1
+static const char* trie_sample_text(const TrieNode* leaf, int offset, const TrieSampleFilter* filter,
+                                    long now, int* score) {
+    const char* best = NULL;
+    *score = -1;
+    for (int i = 0; leaf->reservoir && i < leaf->reservoir->count; i++) {
+        const TrieSample* sample = &leaf->reservoir->samples[i];
+        const char* text = sample->command;
+        if (offset > 0) {
+            char key[MAX_COMMAND_LENGTH + 1];
+            int source[MAX_COMMAND_LENGTH + 1];
+            if (template_key(sample->command, key, sizeof(key), source) < (size_t)offset) continue;
+            text += source[offset];
+        }
+        if (!trie_sample_fits(sample->command, text, filter)) continue;
+        
+        int sample_score = trie_score(sample->frequency, sample->last_used, now);
+        if (sample_score > *score) {
+            *score = sample_score;
+            best = text;
+        }
+    }
+    return best;
+}
+
+// Text a node completes to: its own command, else a referenced text. A
+// templated leaf answers with its best sample that passes the filter; *score
+// (optional) is then that sample's score, else the node's
+static const char* trie_node_text(Trie* trie, const TrieNode* node, const TrieSampleFilter* filter,
+                                  long now, int* score) {
+    int sample_score;
+    if (score) *score = trie_node_score(trie, node, now);
+    if (node->full_command && !node->reservoir) return node->full_command;
+    if (node->full_command) {
+        const char* text = trie_sample_text(node, 0, filter, now, &sample_score);
+        if (score) *score = sample_score;
+        return text;
+    }
+    
+    const char* best = NULL;
+    int best_score = -1;
+    for (int r = 0; r < node->ref_count; r++) {
+        const TrieNode* leaf = trie->leaves[node->refs[r].leaf_id];
+        if (!leaf->reservoir) return leaf->full_command + node->refs[r].offset;
+        const char* text = trie_sample_text(leaf, node->refs[r].offset, filter, now, &sample_score);
+        if (text && sample_score > best_score) {
+            best = text;
+            best_score = sample_score;
+        }
+    }
+    if (score) *score = best_score;
+    return best;
+}
+
+/**
+ * @struct TrieStack
+ * @brief DFS stack of nodes, grown as needed: a bounded one would silently
+ *        drop whole subtrees once full
+ */
+typedef struct {
+    TrieNode** nodes;
+    int top;
+    int capacity;
+} TrieStack;
+
+// Room for count more nodes; false if out of memory
+static bool trie_stack_reserve(TrieStack* stack, int count) {
+    if (stack->top + count <= stack->capacity) return true;
+    int capacity = stack->capacity ? stack->capacity : 1024;
+    while (capacity < stack->top + count) capacity *= 2;
+    TrieNode** nodes = realloc(stack->nodes, capacity * sizeof(TrieNode*));
+    if (!nodes) return false;
+    stack->nodes = nodes;
+    stack->capacity = capacity;
+    return true;
+}
+
+// Start a DFS at node (the stack is empty and may be reused)
+static bool trie_stack_start(TrieStack* stack, TrieNode* node) {
+    stack->top = 0;
+    if (!trie_stack_reserve(stack, 1)) return false;
+    stack->nodes[stack->top++] = node;
+    return true;
+}
+
+// Push a node's children onto a DFS stack in byte order; the non-NULL slots
+// come from one vector scan instead of 128 branches. Out of memory skips the
+// subtree
+static void trie_stack_push_children(TrieStack* stack, const TrieNode* node) {
+    if (!trie_stack_reserve(stack, ALPHABET_SIZE)) return;
+    uint64_t mask[ALPHABET_SIZE / 64];
+    simd_child_mask(node->children, ALPHABET_SIZE, mask);
+    for (int w = 0; w < ALPHABET_SIZE / 64; w++) {
+        for (uint64_t bits = mask[w]; bits; bits &= bits - 1) {
+            stack->nodes[stack->top++] = node->children[w * 64 + __builtin_ctzll(bits)];
+        }
+    }
+}
+
+// DFS a subtree, keeping the highest-scoring node seen so far
+static void trie_best_in_subtree(Trie* trie, TrieNode* start, long now,
+                                 TrieNode** best_node, int* best_score) {
+    TrieStack stack = { 0 };
+    if (!trie_stack_start(&stack, start)) return;
+    
+    while (stack.top > 0) {
+        TrieNode* node = stack.nodes[--stack.top];
+        
+        int score = trie_node_score(trie, node, now);
+        if (score > *best_score) {
+            *best_score = score;
+            *best_node = node;
+        }
+        
+        trie_stack_push_children(&stack, node);
+    }
+    free(stack.nodes);
+}
+
+// Index one primary leaf under its lowercased key in the folded trie
+static void trie_fold_leaf(Trie* trie, int leaf_id) {
+    char buf[MAX_COMMAND_LENGTH + 1];
+    const char* command = trie_key(trie, trie->leaves[leaf_id]->full_command, buf);
+    TrieNode* current = trie->folded_root;
+    
+    for (const char* p = command; *p; p++) {
+        unsigned char index = (unsigned char)tolower((unsigned char)*p);
+        if (index >= ALPHABET_SIZE) continue;  // Mirror trie_insert()
+        
+        if (current->children[index] == NULL) {
+            current->children[index] = trie_node_create();
+            if (!current->children[index]) return;
+        }
+        current = current->children[index];
+    }
+    
+    current->is_end_of_word = true;
+    trie_node_add_ref(current, leaf_id, 0);
+}
+
+int trie_segment_starts(const char* command, int* starts, int max_starts) {
+    int count = 0;
+    bool in_single = false, in_double = false;
+    
+    for (int i = 0; command[i] && count < max_starts; i++) {
+        char c = command[i];
+        int sep_len = 0;
+        
+        if (c == '\\' && !in_single) {
+            if (command[i + 1]) i++;  // Skip the escaped character
+            continue;
+        } else if (c == '\'' && !in_double) {
+            in_single = !in_single;
+        } else if (c == '"' && !in_single) {
+            in_double = !in_double;
+        } else if (c == '$' && command[i + 1] == '(' && !in_single) {
+            sep_len = 2;
+            in_double = false;  // A substitution opens a fresh quoting context
+        } else if (in_single || in_double) {
+            continue;
+        } else if (c == '|') {
+            sep_len = (command[i + 1] == '|' || command[i + 1] == '&') ? 2 : 1;
+        } else if (c == '&' && command[i + 1] == '&') {
+            sep_len = 2;
+        } else if (c == ';') {
+            sep_len = 1;
+        }
+        
+        if (sep_len == 0) continue;
+        
+        int start = i + sep_len;
+        while (command[start] == ' ' || command[start] == '\t') start++;
+        if (count == 0 || starts[count - 1] != start) {
+            starts[count++] = start;
+        }
+        i = start - 1;
+    }
+    return count;
+}
+
+// Index every segment tail of one primary leaf's key in the segment trie
+static void trie_segment_leaf(Trie* trie, int leaf_id) {
+    char buf[MAX_COMMAND_LENGTH + 1];
+    const char* command = trie_key(trie, trie->leaves[leaf_id]->full_command, buf);
+    int starts[MAX_SEGMENTS];
+    int count = trie_segment_starts(command, starts, MAX_SEGMENTS);
+    
+    for (int s = 0; s < count; s++) {
+        TrieNode* current = trie->segment_root;
+        if (!command[starts[s]]) continue;  // Trailing separator, empty segment
+        
+        for (const char* p = command + starts[s]; *p; p++) {
+            unsigned char index = (unsigned char)*p;
+            if (index >= ALPHABET_SIZE) continue;  // Mirror trie_insert()
+            
+            if (current->children[index] == NULL) {
+                current->children[index] = trie_node_create();
+                if (!current->children[index]) return;
+            }
+            current = current->children[index];
+        }
+        
+        current->is_end_of_word = true;
+        trie_node_add_ref(current, leaf_id, starts[s]);
+    }
+}
+
+// Bounds of the next blank-separated word at *pos (quotes kept inside words)
+static bool next_word(const char* command, int* pos, int* start, int* end) {
+    int i = *pos;
+    while (command[i] == ' ' || command[i] == '\t') i++;
+    if (!command[i]) return false;
+    
+    *start = i;
+    char quote = 0;
+    for (; command[i]; i++) {
+        char c = command[i];
+        if (quote) {
+            if (c == quote) quote = 0;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '\\' && command[i + 1]) {
+            i++;
+        } else if (c == ' ' || c == '\t') {
+            break;
+        }
+    }
+    *end = i;
+    *pos = i;
+    return true;
+}
+
+// Word [start, end) equals a literal
+static bool word_is(const char* command, int start, int end, const char* literal) {
+    size_t len = strlen(literal);
+    return (size_t)(end - start) == len && strncmp(command + start, literal, len) == 0;
+}
+
+// Word [start, end) is a shell assignment NAME=value
+static bool word_is_assignment(const char* command, int start, int end) {
+    if (!(isalpha((unsigned char)command[start]) || command[start] == '_')) return false;
+    for (int i = start + 1; i < end; i++) {
+        if (command[i] == '=') return true;
+        if (!(isalnum((unsigned char)command[i]) || command[i] == '_')) return false;
+    }
+    return false;
+}
+
+int trie_wrapper_length(const char* command) {
+    int pos = 0, start, end;
+    int inner = 0;
+    
+    while (next_word(command, &pos, &start, &end)) {
+        if (word_is(command, start, end, "sudo") || word_is(command, start, end, "doas")) {
+            // Options; those taking a separate argument consume the next word
+            int peek = pos, s2, e2;
+            while (next_word(command, &peek, &s2, &e2) && command[s2] == '-') {
+                pos = peek;
+                if (word_is(command, s2, e2, "--")) break;
+                if (e2 - s2 == 2 && strchr("ugCDhprtU", command[s2 + 1]) &&
+                    next_word(command, &peek, &s2, &e2)) {
+                    pos = peek;
+                }
+            }
+        } else if (word_is(command, start, end, "nice")) {
+            int peek = pos, s2, e2;
+            if (next_word(command, &peek, &s2, &e2) && command[s2] == '-') {
+                pos = peek;
+                if (word_is(command, s2, e2, "-n") && next_word(command, &peek, &s2, &e2)) {
+                    pos = peek;
+                }
+            }
+        } else if (word_is(command, start, end, "env")) {
+            int peek = pos, s2, e2;
+            while (next_word(command, &peek, &s2, &e2) && command[s2] == '-') {
+                pos = peek;
+                if (word_is(command, s2, e2, "-u") && next_word(command, &peek, &s2, &e2)) {
+                    pos = peek;
+                }
+            }
+        } else if (!word_is(command, start, end, "time") &&
+                   !word_is(command, start, end, "nohup") &&
+                   !word_is_assignment(command, start, end)) {
+            break;  // First word of the inner command
+        }
+        inner = pos;
+    }
+    
+    // Skip to the inner command itself; a bare wrapper is not an alias
+    while (command[inner] == ' ' || command[inner] == '\t') inner++;
+    return command[inner] ? inner : 0;
+}
+
+// Run the command check on a leaf's command word (the one after wrappers)
+static bool trie_leaf_missing(Trie* trie, const TrieNode* leaf) {
+    const char* command = leaf->full_command;
+    int pos = trie_wrapper_length(command), start, end;
+    if (!next_word(command, &pos, &start, &end)) return false;
+    return !trie->command_check(command + start, end - start, trie->command_context);
+}
+
+int trie_check_commands(Trie* trie) {
+    trie->missing_commands = 0;
+    for (int i = 0; i < trie->total_commands; i++) {
+        TrieNode* leaf = trie->leaves[i];
+        leaf->missing = trie->command_check && trie_leaf_missing(trie, leaf);
+        trie->missing_commands += leaf->missing;
+    }
+    return trie->missing_commands;
+}
+
+int trie_set_command_check(Trie* trie, TrieCommandCheck check, void* context, bool hide) {
+    trie->command_check = check;
+    trie->command_context = context;
+    trie->missing_score = hide ? -1 : 0;
+    return trie_check_commands(trie);
+}
+
+// Give a wrapped leaf an entry point under its unwrapped key (no string copy)
+static void trie_alias_leaf(Trie* trie, int leaf_id) {
+    TrieNode* leaf = trie->leaves[leaf_id];
+    char buf[MAX_COMMAND_LENGTH + 1];
+    const char* key = trie_key(trie, leaf->full_command, buf);
+    int offset = trie_wrapper_length(key);
+    if (offset == 0) return;
+    
+    TrieNode* current = trie->root;
+    for (const char* p = key + offset; *p; p++) {
+        unsigned char index = (unsigned char)*p;
+        if (index >= ALPHABET_SIZE) continue;  // Mirror trie_insert()
+        
+        if (current->children[index] == NULL) {
+            current->children[index] = trie_node_create();
+            if (!current->children[index]) return;
+        }
+        current = current->children[index];
+    }
+    
+    if (trie_node_add_ref(current, leaf_id, offset)) {
+        leaf->entry = current;
+    }
+}
+
+// Count a new primary leaf on every node along its path (root included)
+static void trie_count_leaf_path(TrieNode* root, const char* command) {
+    TrieNode* current = root;
+    current->subtree_leaves++;
+    for (const char* p = command; *p && current; p++) {
+        unsigned char index = (unsigned char)*p;
+        if (index >= ALPHABET_SIZE) continue;  // Mirror trie_insert()
+        current = current->children[index];
+        if (current) current->subtree_leaves++;
+    }
+}
+
+// Index one primary leaf under its reversed key in the reverse trie
+static void trie_reverse_leaf(Trie* trie, int leaf_id) {
+    char buf[MAX_COMMAND_LENGTH + 1];
+    const char* command = trie_key(trie, trie->leaves[leaf_id]->full_command, buf);
+    TrieNode* current = trie->reverse_root;
+    current->subtree_leaves++;
+    
+    for (int i = (int)strlen(command) - 1; i >= 0; i--) {
+        unsigned char index = (unsigned char)command[i];
+        if (index >= ALPHABET_SIZE) continue;  // Mirror trie_insert()
+        
+        if (current->children[index] == NULL) {
+            current->children[index] = trie_node_create();
+            if (!current->children[index]) return;
+        }
+        current = current->children[index];
+        current->subtree_leaves++;
+    }
+    
+    current->is_end_of_word = true;
+    trie_node_add_ref(current, leaf_id, 0);
+}
+
+// Order time entries by timestamp, then leaf id for a stable run
+static int time_entry_compare(const void* a, const void* b) {
+    const TrieTimeEntry* x = a;
+    const TrieTimeEntry* y = b;
+    if (x->timestamp != y->timestamp) return x->timestamp < y->timestamp ? -1 : 1;
+    return x->leaf_id - y->leaf_id;
+}
+
+// Make room for the live position of every leaf id up to leaf_id (-1: none yet)
+static bool trie_time_reserve_live(Trie* trie, int leaf_id) {
+    if (leaf_id < trie->time_live_capacity) return true;
+    int capacity = trie->time_live_capacity ? trie->time_live_capacity : 128;
+    while (capacity <= leaf_id) capacity *= 2;
+    int* live = realloc(trie->time_live, capacity * sizeof(int));
+    if (!live) return false;
+    for (int i = trie->time_live_capacity; i < capacity; i++) live[i] = -1;
+    trie->time_live = live;
+    trie->time_live_capacity = capacity;
+    return true;
+}
+
+// Rebuild the time index from the leaves: one live entry per leaf, sorted
+static bool trie_time_rebuild(Trie* trie) {
+    if (!trie->time_index || trie->time_capacity < trie->total_commands) {
+        int capacity = trie->total_commands > 128 ? trie->total_commands : 128;
+        TrieTimeEntry* entries = realloc(trie->time_index, capacity * sizeof(TrieTimeEntry));
+        if (!entries) return false;
+        trie->time_index = entries;
+        trie->time_capacity = capacity;
+    }
+    if (!trie_time_reserve_live(trie, trie->total_commands)) return false;
+    
+    for (int i = 0; i < trie->total_commands; i++) {
+        trie->time_index[i].timestamp = trie->leaves[i]->last_used;
+        trie->time_index[i].leaf_id = i;
+    }
+    trie->time_count = trie->total_commands;
+    qsort(trie->time_index, trie->time_count, sizeof(TrieTimeEntry), time_entry_compare);
+    for (int i = 0; i < trie->time_count; i++) {
+        trie->time_live[trie->time_index[i].leaf_id] = i;
+    }
+    trie->time_sorted = true;
+    return true;
+}
+
+// File a leaf under its new last_used; the old entry goes stale. One update
+// can touch a leaf several times (insert, then frequency): a leaf already
+// filed last under this timestamp keeps its entry.
+static void trie_time_touch(Trie* trie, const TrieNode* leaf) {
+    if (!trie->time_index) return;
+    if (!trie_time_reserve_live(trie, leaf->leaf_id)) return;
+    int live = trie->time_live[leaf->leaf_id];
+    if (live >= 0 && live == trie->time_count - 1 &&
+        trie->time_index[live].timestamp == leaf->last_used) {
+        return;
+    }
+    
+    // Mostly stale entries: compact instead of growing
+    if (trie->time_count >= 2 * trie->total_commands + 64) {
+        trie_time_rebuild(trie);
+        return;
+    }
+    
+    if (trie->time_count >= trie->time_capacity) {
+        int capacity = trie->time_capacity ? trie->time_capacity * 2 : 128;
+        TrieTimeEntry* entries = realloc(trie->time_index, capacity * sizeof(TrieTimeEntry));
+        if (!entries) return;
+        trie->time_index = entries;
+        trie->time_capacity = capacity;
+    }
+    
+    if (trie->time_count > 0 &&
+        trie->time_index[trie->time_count - 1].timestamp > leaf->last_used) {
+        trie->time_sorted = false;  // Clock went backwards
+    }
+    trie->time_index[trie->time_count].timestamp = leaf->last_used;
+    trie->time_index[trie->time_count].leaf_id = leaf->leaf_id;
+    trie->time_live[leaf->leaf_id] = trie->time_count;
+    trie->time_count++;
+}
+
 /**
  * Insert a command into the trie with automatic frequency tracking.
  * 
@@ -112,12 +809,16 @@ void trie_destroy(Trie* trie) {
 void trie_insert(Trie* trie, const char* command) {
     if (!trie || !command || strlen(command) == 0) return;
     
+    // Commands with volatile tokens share their template's path
+    char buf[MAX_COMMAND_LENGTH + 1];
+    const char* key = trie_key(trie, command, buf);
+    
     TrieNode* current = trie->root;
-    int len = strlen(command);
+    int len = strlen(key);
     
     // Traverse/create path for each character in the command
     for (int i = 0; i < len; i++) {
-        unsigned char index = (unsigned char)command[i];
+        unsigned char index = (unsigned char)key[i];
         if (index >= ALPHABET_SIZE) continue;  // Skip invalid characters
         
         if (current->children[index] == NULL) {
@@ -129,14 +830,35 @@ void trie_insert(Trie* trie, const char* command) {
     
     // Mark end of word and store the full command
     if (!current->is_end_of_word) {
+        if (!trie_add_leaf(trie, current)) return;
         current->is_end_of_word = true;
         current->full_command = strdup(command);
         trie->total_commands++;
+        trie_count_leaf_path(trie->root, key);
+        
+        if (trie->folded_root) {
+            trie_fold_leaf(trie, current->leaf_id);
+        }
+        if (trie->segment_root) {
+            trie_segment_leaf(trie, current->leaf_id);
+        }
+        if (trie->wrapper_aliases) {
+            trie_alias_leaf(trie, current->leaf_id);
+        }
+        if (trie->reverse_root) {
+            trie_reverse_leaf(trie, current->leaf_id);
+        }
+        if (trie->command_check && trie_leaf_missing(trie, current)) {
+            current->missing = true;
+            trie->missing_commands++;
+        }
     }
     
     // Update frequency and last used time
     current->frequency++;
     current->last_used = time(NULL);
+    if (key != command) trie_sample_use(current, command, current->last_used);
+    trie_time_touch(trie, current);
     
     // Only show debug output in debug mode
 #ifdef DEBUG
@@ -163,95 +885,1026 @@ bool trie_search(Trie* trie, const char* prefix) {
     return true;  // Prefix exists
 }
 
+// Best sample that passes the filter among the templated leaves (own or
+// referenced) under key in root; with splice, also the best templated leaf
+// of its own there (see trie_splice_sample())
+static void trie_template_candidates(Trie* trie, TrieNode* root, const char* key,
+                                     const TrieSampleFilter* filter, long now,
+                                     const char** best, int* best_score,
+                                     TrieNode** splice, int* splice_score) {
+    TrieNode* start = trie_walk(root, key);
+    TrieStack stack = { 0 };
+    if (!start || !trie_stack_start(&stack, start)) return;
+    
+    while (stack.top > 0) {
+        TrieNode* node = stack.nodes[--stack.top];
+        
+        // Candidate leaves: the node itself, then its refs
+        for (int c = -1; c < node->ref_count; c++) {
+            const TrieNode* leaf = c < 0 ? node : trie->leaves[node->refs[c].leaf_id];
+            if (!leaf->reservoir) continue;
+            int score;
+            const char* text = trie_sample_text(leaf, c < 0 ? 0 : node->refs[c].offset, filter, now, &score);
+            if (leaf->missing && score >= 0) score = trie->missing_score;
+            if (score > *best_score) {
+                *best_score = score;
+                *best = text;
+            }
+        }
+        if (splice && node->reservoir) {
+            int score = trie_node_score(trie, node, now);
+            if (score > *splice_score) {
+                *splice_score = score;
+                *splice = node;
+            }
+        }
+        trie_stack_push_children(&stack, node);
+    }
+    free(stack.nodes);
+}
+
+// The typed prefix followed by the tail of a templated leaf's best sample
+// after its first key_len key bytes (caller frees)
+static char* trie_splice_sample(const TrieNode* leaf, const char* prefix,
+                                size_t key_len, long now) {
+    int score;
+    const TrieSample* sample = trie_best_sample(leaf, NULL, now, &score);
+    if (!sample) return NULL;
+    
+    char key[MAX_COMMAND_LENGTH + 1];
+    int source[MAX_COMMAND_LENGTH + 1];
+    if (template_key(sample->command, key, sizeof(key), source) < key_len) return NULL;
+    
+    const char* tail = sample->command + source[key_len];
+    size_t prefix_len = strlen(prefix);
+    size_t tail_len = strlen(tail);
+    char* spliced = malloc(prefix_len + tail_len + 1);
+    if (!spliced) return NULL;
+    memcpy(spliced, prefix, prefix_len);
+    memcpy(spliced + prefix_len, tail, tail_len + 1);
+    return spliced;
+}
+
+/** Called with each template key a typed text can stand for; whole: the
+ *  key templates the typed words exactly, without guessing a partial token */
+typedef void (*TrieKeyVisit)(const char* key, bool whole, void* context);
+
+// Lowercase key bytes [from, to) for the folded index (class bytes stay put)
+static void trie_fold_key(char* key, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) key[i] = (char)tolower((unsigned char)key[i]);
+}
+
+/**
+ * Visit the template keys a prefix without a raw path can continue as.
+ * 
+ * The complete words are templated. Under them the last, partial word is
+ * tried as typed (only if the head templated, else that is the raw path)
+ * and as the start of each token class after any literal head such as
+ * `root@`. Returns the key length of the as-typed variant, for splicing.
+ */
+static size_t trie_template_prefix_keys(const char* prefix, bool nocase,
+                                        TrieKeyVisit visit, void* context) {
+    size_t len = strlen(prefix);
+    if (len > MAX_COMMAND_LENGTH) return 0;
+    size_t word = len;
+    while (word > 0 && prefix[word - 1] != ' ' && prefix[word - 1] != '\t') word--;
+    size_t partial = len - word;
+    
+    char head[MAX_COMMAND_LENGTH + 1];
+    char key[MAX_COMMAND_LENGTH + 2];
+    memcpy(head, prefix, word);
+    head[word] = '\0';
+    size_t head_len = template_key(head, key, sizeof(key), NULL);
+    bool templated = head_len > 0;
+    if (!templated) {
+        memcpy(key, head, word + 1);
+        head_len = word;
+    }
+    
+    // The partial word as typed, under the templated head
+    if (templated) {
+        memcpy(key + head_len, prefix + word, partial + 1);
+        if (nocase) trie_fold_key(key, 0, head_len + partial);
+        visit(key, true, context);
+    }
+    
+    // The partial word (or its tail after a literal head) as a volatile token
+    for (size_t j = 0; j < partial; j++) {
+        if (j > 0 && !strchr(TEMPLATE_SPLITS, prefix[word + j - 1])) continue;
+        memcpy(key + head_len, prefix + word, j);
+        if (nocase) trie_fold_key(key, 0, head_len + j);
+        for (int token_class = TOKEN_LITERAL + 1; token_class < TOKEN_CLASSES; token_class++) {
+            key[head_len + j] = (char)token_class;
+            key[head_len + j + 1] = '\0';
+            visit(key, false, context);
+        }
+    }
+    return head_len + partial;
+}
+
+/**
+ * @struct TemplateSearch
+ * @brief State of one trie_template_completion() over the prefix's keys
+ */
+typedef struct {
+    Trie* trie;
+    TrieNode* root;
+    const TrieSampleFilter* filter;
+    long now;
+    
+    /** Best sample text passing the filter so far, and its score */
+    const char* best;
+    int best_score;
+    
+    /** Best templated leaf to splice (primary index, exact case only) */
+    bool splicing;
+    TrieNode* splice;
+    int splice_score;
+} TemplateSearch;
+
+// TrieKeyVisit for trie_template_completion()
+static void trie_template_search_key(const char* key, bool whole, void* context) {
+    TemplateSearch* search = context;
+    trie_template_candidates(search->trie, search->root, key, search->filter, search->now,
+                             &search->best, &search->best_score,
+                             whole && search->splicing ? &search->splice : NULL,
+                             &search->splice_score);
+}
+
+/**
+ * Complete a prefix that has no raw path in an index because it contains a
+ * volatile token, or ends inside one.
+ * 
+ * Every template key the prefix can continue as is walked (see
+ * trie_template_prefix_keys()); a sample that starts with the prefix as
+ * typed wins. In the primary index the best template's tail is otherwise
+ * spliced after it: a half-typed hash has no tail to splice, so only keys
+ * that template whole words can. *score (optional) is the answer's score;
+ * a spliced answer is allocated and also stored in *owned (else NULL).
+ */
+static const char* trie_template_completion(Trie* trie, TrieNode* root, const char* prefix,
+                                            bool nocase, int* score, char** owned) {
+    TrieSampleFilter filter = { prefix, strlen(prefix), NULL, 0, nocase };
+    TemplateSearch search = {
+        trie, root, &filter, time(NULL), NULL, -1, root == trie->root && !nocase, NULL, -1
+    };
+    size_t key_len = trie_template_prefix_keys(prefix, nocase, trie_template_search_key, &search);
+    
+    if (score) *score = search.best ? search.best_score : search.splice_score;
+    *owned = NULL;
+    if (search.best) return search.best;
+    if (search.splice) *owned = trie_splice_sample(search.splice, prefix, key_len, search.now);
+    return *owned;
+}
+
+// Best completion below the node a prefix reaches (NULL: no such node); a
+// spliced answer is allocated and also stored in *owned (else NULL)
+static const char* trie_best_below(Trie* trie, TrieNode* current, const char* prefix, char** owned) {
+    *owned = NULL;
+    if (!current) {
+#ifdef DEBUG
+        printf("DEBUG: Prefix '%s' not found in trie\n", prefix);
+#endif
+        return trie->templates ? trie_template_completion(trie, trie->root, prefix, false, NULL, owned) : NULL;
+    }
+    
+    // Find the best completion from this node
+    TrieNode* best_node = NULL;
+    int best_score = -1;
+    
+    // Wrapped commands and their unwrapped entry points rank as one group
+    trie_best_in_subtree(trie, current, time(NULL), &best_node, &best_score);
+    
+    TrieSampleFilter filter = { prefix, strlen(prefix), NULL, 0, false };
+    const char* text = best_node ? trie_node_text(trie, best_node, &filter, time(NULL), NULL) : NULL;
+    if (text) {
+#ifdef DEBUG
+        printf("DEBUG: Best completion for '%s': '%s' (score: %d)\n", 
+               prefix, text, best_score);
+#endif
+        return text;
+    }
+    
+#ifdef DEBUG
+    printf("DEBUG: No completion found for prefix '%s'\n", prefix);
+#endif
+    return NULL;
+}
+
+// Best completion for a prefix (highest frequency + most recent), not copied
+const char* trie_peek_best_completion(Trie* trie, const char* prefix, char** owned) {
+    *owned = NULL;
+    if (!trie || !prefix) return NULL;
+    return trie_best_below(trie, trie_walk(trie->root, prefix), prefix, owned);
+}
+
+TrieNode* trie_cursor_seek(Trie* trie, TrieCursor* cursor, const char* prefix) {
+    size_t len = strlen(prefix);
+    if (len > MAX_COMMAND_LENGTH) return trie_walk(trie->root, prefix);
+    if (cursor->path[0] != trie->root) {
+        cursor->path[0] = trie->root;
+        cursor->depth = 0;
+    }
+    
+    // Keep what this prefix shares with the last one (backspace: all of it)
+    size_t shared = (size_t)cursor->depth < len ? (size_t)cursor->depth : len;
+    size_t depth = 0;
+    if (shared >= 32) {
+        depth = simd_mismatch(cursor->text, prefix, shared);
+    } else {
+        while (depth < shared && cursor->text[depth] == prefix[depth]) depth++;
+    }
+    for (; depth < len; depth++) {
+        unsigned char index = (unsigned char)prefix[depth];
+        TrieNode* child = index < ALPHABET_SIZE ? cursor->path[depth]->children[index] : NULL;
+        if (!child) break;
+        cursor->text[depth] = (char)index;
+        cursor->path[depth + 1] = child;
+        cursor->steps++;
+    }
+    cursor->depth = (int)depth;
+    return depth == len ? cursor->path[depth] : NULL;
+}
+
+const char* trie_cursor_best_completion(Trie* trie, TrieCursor* cursor, const char* prefix,
+                                        char** owned) {
+    *owned = NULL;
+    if (!trie || !prefix) return NULL;
+    return trie_best_below(trie, trie_cursor_seek(trie, cursor, prefix), prefix, owned);
+}
+
 // Get the best completion for a prefix (highest frequency + most recent)
 char* trie_get_best_completion(Trie* trie, const char* prefix) {
-    if (!trie || !prefix) return NULL;
+    char* owned;
+    const char* text = trie_peek_best_completion(trie, prefix, &owned);
+    return owned ? owned : text ? strdup(text) : NULL;
+}
+
+bool trie_enable_case_folding(Trie* trie) {
+    if (!trie) return false;
+    if (trie->folded_root) return true;
     
-    TrieNode* current = trie->root;
-    int len = strlen(prefix);
+    trie->folded_root = trie_node_create();
+    if (!trie->folded_root) return false;
     
-    // Navigate to the prefix node
-    for (int i = 0; i < len; i++) {
-        unsigned char index = (unsigned char)prefix[i];
+    for (int i = 0; i < trie->total_commands; i++) {
+        trie_fold_leaf(trie, i);
+    }
+    return true;
+}
+
+/**
+ * Get the best completion for a prefix through the case-folded index.
+ * 
+ * The prefix is lowercased and walked in the folded trie, so the lookup costs
+ * the same as an exact one. Each folded leaf aggregates its case variants
+ * (summed frequency, latest timestamp); the winning leaf is then resolved to
+ * one original-cased command, preferring variants that match the typed
+ * prefix byte-for-byte so the caller can keep what the user typed.
+ * 
+ * @param trie    Trie with case folding enabled
+ * @param prefix  Prefix to complete, in any case
+ * @return Newly allocated original-cased command, or NULL
+ */
+char* trie_get_best_completion_nocase(Trie* trie, const char* prefix) {
+    if (!trie || !prefix || !trie->folded_root) return NULL;
+    
+    TrieNode* current = trie->folded_root;
+    size_t len = strlen(prefix);
+    
+    for (size_t i = 0; i < len; i++) {
+        unsigned char index = (unsigned char)tolower((unsigned char)prefix[i]);
         if (index >= ALPHABET_SIZE || current->children[index] == NULL) {
-#ifdef DEBUG
-            printf("DEBUG: Prefix '%s' not found in trie\n", prefix);
-#endif
-            return NULL;
+            if (!trie->templates) return NULL;
+            char* owned;
+            const char* text = trie_template_completion(trie, trie->folded_root, prefix, true, NULL, &owned);
+            return owned ? owned : text ? strdup(text) : NULL;
         }
         current = current->children[index];
     }
     
-    // Find the best completion from this node
+    // Folded leaves merge statistics across every case variant
+    long now = time(NULL);
     TrieNode* best_node = NULL;
     int best_score = -1;
+    trie_best_in_subtree(trie, current, now, &best_node, &best_score);
+    
+    if (!best_node) return NULL;
     
-    // Simple DFS to find best completion
-    // We'll use a stack-based approach to avoid recursion limits
-    TrieNode* stack[1000];
+    // Pick the variant to show: exact-case prefix matches first, then score.
+    // A templated variant stands for its samples that match the prefix.
+    TrieSampleFilter filters[2] = {
+        { prefix, len, NULL, 0, false },
+        { prefix, len, NULL, 0, true },
+    };
+    const char* best_text = NULL;
+    bool best_exact = false;
+    int best_variant_score = -1;
+    
+    for (int r = 0; r < best_node->ref_count; r++) {
+        TrieNode* leaf = trie->leaves[best_node->refs[r].leaf_id];
+        for (int f = 0; f < 2; f++) {
+            bool exact = f == 0;
+            int score;
+            const char* text;
+            if (leaf->reservoir) {
+                text = trie_sample_text(leaf, 0, &filters[f], now, &score);
+            } else {
+                text = leaf->full_command;
+                if (exact && strncmp(text, prefix, len) != 0) continue;
+                score = trie_score(leaf->frequency, leaf->last_used, now);
+            }
+            
+            if (text && ((exact && !best_exact) ||
+                         (exact == best_exact && score > best_variant_score))) {
+                best_text = text;
+                best_exact = exact;
+                best_variant_score = score;
+            }
+        }
+    }
+    if (!best_text) return NULL;
+    
+#ifdef DEBUG
+    printf("DEBUG: Case-insensitive completion for '%s': '%s' (score: %d, variants: %d)\n",
+           prefix, best_text, best_score, best_node->ref_count);
+#endif
+    return strdup(best_text);
+}
+
+bool trie_enable_wrapper_aliases(Trie* trie) {
+    if (!trie) return false;
+    if (trie->wrapper_aliases) return true;
+    
+    trie->wrapper_aliases = true;
+    for (int i = 0; i < trie->total_commands; i++) {
+        trie_alias_leaf(trie, i);
+    }
+    return true;
+}
+
+/**
+ * Get the best completion for a prefix that starts with a wrapper.
+ * 
+ * Candidates under the typed prefix (`sudo sys...`) and under its unwrapped
+ * remainder (`sys...`) compete on group score; a winner from the unwrapped
+ * side is returned with the typed wrapper kept in front of it. Templated
+ * winners resolve to a sample, which also breaks group-score ties (both
+ * sides reach the same group); a side without a raw path is completed
+ * through its template keys.
+ * 
+ * @param trie    Trie with wrapper aliases enabled
+ * @param prefix  Prefix as typed, wrapper included
+ * @return Newly allocated completion, or NULL
+ */
+char* trie_get_best_wrapped_completion(Trie* trie, const char* prefix) {
+    if (!trie || !prefix || !trie->wrapper_aliases) return NULL;
+    
+    int wrapper = trie_wrapper_length(prefix);
+    if (wrapper == 0) return trie_get_best_completion(trie, prefix);
+    
+    long now = time(NULL);
+    const char* texts[2] = { NULL, NULL };
+    int scores[2] = { -1, -1 };
+    int text_scores[2] = { -1, -1 };
+    char* owned[2] = { NULL, NULL };
+    
+    // Side 0: as typed; side 1: the unwrapped remainder
+    for (int side = 0; side < 2; side++) {
+        const char* typed = side == 0 ? prefix : prefix + wrapper;
+        TrieSampleFilter filter = { typed, strlen(typed), NULL, 0, false };
+        TrieNode* start = trie_walk(trie->root, typed);
+        if (start) {
+            TrieNode* best_node = NULL;
+            trie_best_in_subtree(trie, start, now, &best_node, &scores[side]);
+            if (best_node) texts[side] = trie_node_text(trie, best_node, &filter, now, &text_scores[side]);
+        } else if (trie->templates) {
+            texts[side] = trie_template_completion(trie, trie->root, typed, false, &scores[side],
+                                                   &owned[side]);
+            text_scores[side] = scores[side];
+        }
+        if (!texts[side]) scores[side] = -1;
+    }
+    
+    bool unwrapped = scores[1] > scores[0] ||
+                     (scores[1] == scores[0] && text_scores[1] > text_scores[0]);
+    const char* text = texts[unwrapped];
+    char* completion = NULL;
+    if (text && !unwrapped) {
+        completion = owned[0] ? owned[0] : strdup(text);
+        owned[0] = NULL;
+    } else if (text && (completion = malloc(wrapper + strlen(text) + 1))) {
+        memcpy(completion, prefix, wrapper);
+        strcpy(completion + wrapper, text);
+    }
+    free(owned[0]);
+    free(owned[1]);
+    return completion;
+}
+
+/**
+ * @struct GlobToken
+ * @brief One compiled glob position: a literal, ?, * or a [...] class
+ */
+typedef struct {
+    /** '*' for a run, '?' for any character, 'c' for a character set */
+    char kind;
+    
+    /** Accepted characters for kind 'c' (one bit per ASCII code) */
+    uint64_t set[2];
+} GlobToken;
+
+// Add one character to a token's set
+static void glob_set_add(GlobToken* token, unsigned char c) {
+    if (c < ALPHABET_SIZE) token->set[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+// Compile a glob into tokens; returns the token count or -1 if invalid
+static int glob_compile(const char* pattern, GlobToken* tokens) {
+    int n = 0;
+    
+    for (const char* p = pattern; *p; p++) {
+        if (n >= MAX_GLOB_TOKENS) return -1;
+        GlobToken* token = &tokens[n];
+        memset(token, 0, sizeof(*token));
+        
+        if (*p == '*') {
+            if (n > 0 && tokens[n - 1].kind == '*') continue;  // ** == *
+            token->kind = '*';
+        } else if (*p == '?') {
+            token->kind = '?';
+        } else if (*p == '[') {
+            const char* q = p + 1;
+            bool negate = (*q == '!' || *q == '^');
+            if (negate) q++;
+            
+            token->kind = 'c';
+            const char* first = q;
+            for (; *q && (*q != ']' || q == first); q++) {
+                if (q[1] == '-' && q[2] && q[2] != ']') {
+                    for (int c = (unsigned char)q[0]; c <= (unsigned char)q[2]; c++) {
+                        glob_set_add(token, (unsigned char)c);
+                    }
+                    q += 2;
+                } else {
+                    glob_set_add(token, (unsigned char)*q);
+                }
+            }
+            if (*q != ']') return -1;  // Unterminated class
+            
+            if (negate) {
+                token->set[0] = ~token->set[0];
+                token->set[1] = ~token->set[1];
+            }
+            p = q;
+        } else {
+            if (*p == '\\' && p[1]) p++;
+            token->kind = 'c';
+            glob_set_add(token, (unsigned char)*p);
+        }
+        n++;
+    }
+    return n;
+}
+
+// Add the states reachable without input: a * may match the empty string
+static uint64_t glob_closure(const GlobToken* tokens, int n, uint64_t states) {
+    for (int i = 0; i < n; i++) {
+        if ((states >> i & 1) && tokens[i].kind == '*') states |= (uint64_t)1 << (i + 1);
+    }
+    return states;
+}
+
+// Advance the automaton over one character
+static uint64_t glob_step(const GlobToken* tokens, int n, uint64_t states, unsigned char c) {
+    uint64_t next = 0;
+    for (int i = 0; i < n; i++) {
+        if (!(states >> i & 1)) continue;
+        const GlobToken* token = &tokens[i];
+        if (token->kind == '*') {
+            next |= (uint64_t)1 << i;
+        } else if (token->kind == '?' || (token->set[c >> 6] >> (c & 63) & 1)) {
+            next |= (uint64_t)1 << (i + 1);
+        }
+    }
+    return glob_closure(tokens, n, next);
+}
+
+// Insert a match into the score-sorted top-K array, evicting the lowest if full
+static void match_keep_top(TrieMatch* results, int* count, int max_results,
+                           const char* command, int score) {
+    int pos;
+    if (*count < max_results) {
+        pos = (*count)++;
+    } else if (score > results[*count - 1].score) {
+        pos = *count - 1;
+        free(results[pos].command);
+    } else {
+        return;
+    }
+    
+    while (pos > 0 && results[pos - 1].score < score) {
+        results[pos] = results[pos - 1];
+        pos--;
+    }
+    results[pos].command = strdup(command);
+    results[pos].score = score;
+}
+
+int trie_match_glob(Trie* trie, const char* pattern, TrieMatch* results,
+                    int max_results, long max_visits, bool* truncated) {
+    if (truncated) *truncated = false;
+    if (!trie || !pattern || !results || max_results <= 0) return -1;
+    
+    GlobToken tokens[MAX_GLOB_TOKENS];
+    int n = glob_compile(pattern, tokens);
+    if (n < 0) return -1;
+    uint64_t accept = (uint64_t)1 << n;
+    
+    // Grown as needed: a bounded stack would silently drop matching subtrees
+    typedef struct { TrieNode* node; uint64_t states; } GlobFrame;
+    int stack_capacity = 1024;
+    GlobFrame* stack = malloc(stack_capacity * sizeof(GlobFrame));
+    if (!stack) return -1;
     int stack_top = 0;
+    int count = 0;
+    long visits = 0;
+    long now = time(NULL);
     
-    stack[stack_top++] = current;
+    stack[stack_top].node = trie->root;
+    stack[stack_top++].states = glob_closure(tokens, n, 1);
     
     while (stack_top > 0) {
-        TrieNode* node = stack[--stack_top];
+        if (max_visits > 0 && ++visits > max_visits) {
+            if (truncated) *truncated = true;
+            break;
+        }
+        TrieNode* node = stack[--stack_top].node;
+        uint64_t states = stack[stack_top].states;
         
-        if (node->is_end_of_word) {
-            // Calculate score: frequency * 100 + recency bonus
-            int recency_bonus = (time(NULL) - node->last_used < 3600) ? 50 : 0;  // 1 hour recency
-            int score = node->frequency * 100 + recency_bonus;
-            
-            if (score > best_score) {
-                best_score = score;
-                best_node = node;
+        if ((states & accept) && node->leaf_id != TRIE_NO_LEAF) {
+            match_keep_top(results, &count, max_results, node->full_command,
+                           trie_node_score(trie, node, now));
+        }
+        
+        if (stack_top + ALPHABET_SIZE > stack_capacity) {
+            GlobFrame* grown = realloc(stack, 2 * stack_capacity * sizeof(GlobFrame));
+            if (!grown) {
+                if (truncated) *truncated = true;  // Out of memory: report, don't hide
+                continue;
             }
+            stack = grown;
+            stack_capacity *= 2;
+        }
+        for (int i = 0; i < ALPHABET_SIZE; i++) {
+            if (!node->children[i]) continue;
+            uint64_t next = glob_step(tokens, n, states, (unsigned char)i);
+            if (next == 0) continue;  // Automaton rejects this whole subtree
+            stack[stack_top].node = node->children[i];
+            stack[stack_top++].states = next;
         }
+    }
+    free(stack);
+    
+#ifdef DEBUG
+    printf("DEBUG: Glob '%s' matched %d command(s), visited %ld node(s)\n", pattern, count, visits);
+#endif
+    return count;
+}
+
+bool trie_enable_time_index(Trie* trie) {
+    if (!trie) return false;
+    if (trie->time_index) return true;
+    return trie_time_rebuild(trie);
+}
+
+int trie_range_by_time(Trie* trie, long since, long until, const char* prefix,
+                       int* leaf_ids, int max_ids) {
+    if (!trie || !trie->time_index || !leaf_ids || max_ids <= 0) return 0;
+    if (!trie->time_sorted) trie_time_rebuild(trie);
+    
+    // Range bounds: [first entry >= since, first entry > until)
+    int lo = 0, hi = trie->time_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (trie->time_index[mid].timestamp < since) lo = mid + 1;
+        else hi = mid;
+    }
+    int first = lo;
+    hi = trie->time_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (trie->time_index[mid].timestamp <= until) lo = mid + 1;
+        else hi = mid;
+    }
+    
+    // Walk newest to oldest so a full output keeps the most recent commands
+    size_t prefix_len = prefix ? strlen(prefix) : 0;
+    int count = 0;
+    
+    for (int i = lo - 1; i >= first && count < max_ids; i--) {
+        const TrieTimeEntry* entry = &trie->time_index[i];
+        const TrieNode* leaf = trie->leaves[entry->leaf_id];
         
-        // Add children to stack
-        for (int i = 0; i < ALPHABET_SIZE && stack_top < 999; i++) {
-            if (node->children[i]) {
-                stack[stack_top++] = node->children[i];
+        if (trie->time_live[entry->leaf_id] != i) continue;  // Stale: used again later
+        if (prefix_len && strncmp(leaf->full_command, prefix, prefix_len) != 0) continue;
+        leaf_ids[count++] = entry->leaf_id;
+    }
+    
+    // Report oldest first
+    for (int i = 0; i < count / 2; i++) {
+        int tmp = leaf_ids[i];
+        leaf_ids[i] = leaf_ids[count - 1 - i];
+        leaf_ids[count - 1 - i] = tmp;
+    }
+    return count;
+}
+
+bool trie_enable_suffix_index(Trie* trie) {
+    if (!trie) return false;
+    if (trie->reverse_root) return true;
+    
+    trie->reverse_root = trie_node_create();
+    if (!trie->reverse_root) return false;
+    
+    for (int i = 0; i < trie->total_commands; i++) {
+        trie_reverse_leaf(trie, i);
+    }
+    return true;
+}
+
+/** Most start nodes one side of a prefix+suffix search keeps */
+#define TRIE_MAX_STARTS 64
+
+/**
+ * @struct TrieStarts
+ * @brief Nodes one side of a prefix+suffix search is enumerated from
+ */
+typedef struct {
+    /** Index walked: the primary trie (forward) or the reverse trie */
+    TrieNode* root;
+    
+    TrieNode* nodes[TRIE_MAX_STARTS];
+    int count;
+    
+    /** Commands below the nodes (subtree_leaves summed) */
+    int leaves;
+} TrieStarts;
+
+// Add a start node once (NULL: the walk failed)
+static void trie_starts_add(TrieStarts* starts, TrieNode* node) {
+    if (!node || starts->count == TRIE_MAX_STARTS) return;
+    for (int i = 0; i < starts->count; i++) {
+        if (starts->nodes[i] == node) return;
+    }
+    starts->nodes[starts->count++] = node;
+    starts->leaves += node->subtree_leaves;
+}
+
+// Node the end of a command reaches in the reverse trie, or NULL
+static TrieNode* trie_walk_reversed(TrieNode* root, const char* text) {
+    TrieNode* current = root;
+    for (size_t i = strlen(text); i > 0 && current; i--) {
+        unsigned char index = (unsigned char)text[i - 1];
+        current = index < ALPHABET_SIZE ? current->children[index] : NULL;
+    }
+    return current;
+}
+
+// TrieKeyVisit adding the node a key reaches from the front
+static void trie_forward_start(const char* key, bool whole, void* context) {
+    TrieStarts* starts = context;
+    (void)whole;
+    trie_starts_add(starts, trie_walk(starts->root, key));
+}
+
+// TrieKeyVisit adding the node a key reaches from the back
+static void trie_backward_start(const char* key, bool whole, void* context) {
+    TrieStarts* starts = context;
+    (void)whole;
+    trie_starts_add(starts, trie_walk_reversed(starts->root, key));
+}
+
+// Visit the template keys a suffix can end: itself templated, and its first,
+// partial word as the tail of a volatile token before the rest templated
+static void trie_template_suffix_keys(const char* suffix, TrieKeyVisit visit, void* context) {
+    size_t len = strlen(suffix);
+    if (len > MAX_COMMAND_LENGTH) return;
+    
+    char key[MAX_COMMAND_LENGTH + 2];
+    if (template_key(suffix, key, sizeof(key), NULL)) visit(key, true, context);
+    
+    size_t word = 0;
+    while (suffix[word] && suffix[word] != ' ' && suffix[word] != '\t') word++;
+    if (word == 0) return;  // Cursor between words: no token to finish
+    if (!template_key(suffix + word, key + 1, sizeof(key) - 1, NULL)) {
+        memcpy(key + 1, suffix + word, len - word + 1);
+    }
+    for (int token_class = TOKEN_LITERAL + 1; token_class < TOKEN_CLASSES; token_class++) {
+        key[0] = (char)token_class;
+        visit(key, false, context);
+    }
+}
+
+/**
+ * Get the best command matching both a prefix and a suffix.
+ * 
+ * Both sides are located with a walk (forward prefix, reversed suffix). The
+ * side with the smaller subtree_leaves count is enumerated; each leaf id found
+ * there is checked against the other constraint with a single compare, which
+ * is the intersection of the two leaf-id sets without building either.
+ * 
+ * With templates, a side without a raw path starts from every template key
+ * it can stand for instead, and a templated leaf answers with its best
+ * sample that has both the prefix and the suffix.
+ * 
+ * @param trie    Trie with the suffix index enabled
+ * @param prefix  Text left of the cursor
+ * @param suffix  Text right of the cursor
+ * @return Newly allocated command, or NULL
+ */
+char* trie_get_best_completion_with_suffix(Trie* trie, const char* prefix, const char* suffix) {
+    if (!trie || !prefix || !suffix) return NULL;
+    if (!*suffix) return trie_get_best_completion(trie, prefix);
+    
+    size_t prefix_len = strlen(prefix);
+    size_t suffix_len = strlen(suffix);
+    
+    TrieStarts forward = { .root = trie->root };
+    TrieStarts backward = { .root = trie->reverse_root };
+    trie_starts_add(&forward, trie_walk(trie->root, prefix));
+    if (trie->templates && forward.count == 0) {
+        trie_template_prefix_keys(prefix, false, trie_forward_start, &forward);
+    }
+    if (forward.count == 0) return NULL;
+    
+    // Without the reverse index, only the prefix side is enumerated
+    if (trie->reverse_root) {
+        trie_starts_add(&backward, trie_walk_reversed(trie->reverse_root, suffix));
+        if (trie->templates && backward.count == 0) {
+            trie_template_suffix_keys(suffix, trie_backward_start, &backward);
+        }
+        if (backward.count == 0) return NULL;
+    }
+    
+    bool from_prefix = !trie->reverse_root || forward.leaves <= backward.leaves;
+    const TrieStarts* side = from_prefix ? &forward : &backward;
+    TrieSampleFilter filter = { prefix, prefix_len, suffix, suffix_len, false };
+    long now = time(NULL);
+    const char* best_text = NULL;
+    int best_score = -1;
+    
+    TrieStack stack = { 0 };
+    for (int s = 0; s < side->count && trie_stack_start(&stack, side->nodes[s]); s++) {
+        while (stack.top > 0) {
+            TrieNode* node = stack.nodes[--stack.top];
+            
+            // Candidate leaves: the node itself (forward) or its refs (backward)
+            int candidates = from_prefix ? (node->leaf_id != TRIE_NO_LEAF) : node->ref_count;
+            for (int c = 0; c < candidates; c++) {
+                TrieNode* leaf = from_prefix ? node : trie->leaves[node->refs[c].leaf_id];
+                const char* command = leaf->full_command;
+                int score;
+                
+                if (leaf->reservoir) {
+                    command = trie_sample_text(leaf, 0, &filter, now, &score);
+                    if (!command) continue;
+                    if (leaf->missing) score = trie->missing_score;
+                } else {
+                    size_t len = strlen(command);
+                    if (len < prefix_len + suffix_len) continue;  // Prefix and suffix may not overlap
+                    if (from_prefix ? simd_mismatch(command + len - suffix_len, suffix, suffix_len) != suffix_len
+                                    : simd_mismatch(command, prefix, prefix_len) != prefix_len) continue;
+                    score = trie_node_score(trie, leaf, now);
+                }
+                
+                if (score > best_score) {
+                    best_score = score;
+                    best_text = command;
+                }
             }
+            
+            trie_stack_push_children(&stack, node);
         }
     }
+    free(stack.nodes);
     
-    if (best_node && best_node->full_command) {
+    if (!best_text) return NULL;
 #ifdef DEBUG
-        printf("DEBUG: Best completion for '%s': '%s' (score: %d)\n", 
-               prefix, best_node->full_command, best_score);
+    printf("DEBUG: Completion for '%s'...'%s': '%s' (score: %d, via %s index)\n",
+           prefix, suffix, best_text, best_score, from_prefix ? "prefix" : "suffix");
 #endif
-        return strdup(best_node->full_command);
+    return strdup(best_text);
+}
+
+bool trie_enable_segments(Trie* trie) {
+    if (!trie) return false;
+    if (trie->segment_root) return true;
+    
+    trie->segment_root = trie_node_create();
+    if (!trie->segment_root) return false;
+    
+    for (int i = 0; i < trie->total_commands; i++) {
+        trie_segment_leaf(trie, i);
     }
+    return true;
+}
+
+/**
+ * Get the best segment completion from the segment and primary indexes.
+ * 
+ * A segment can be any earlier pipeline stage (segment index) or any whole
+ * command (primary index), so both subtrees under the prefix compete on
+ * score. Segment nodes carry no strings of their own; their text is read
+ * back through a reference (all references of one node spell the same tail,
+ * or the same template of it) and copied once for the caller. An index the
+ * prefix has no raw path in is searched through its template keys.
+ * 
+ * @param trie    Trie with segments enabled
+ * @param prefix  Text typed since the start of the current segment
+ * @return Newly allocated segment tail, or NULL
+ */
+char* trie_get_best_segment_completion(Trie* trie, const char* prefix) {
+    if (!trie || !prefix || !trie->segment_root) return NULL;
+    
+    long now = time(NULL);
+    TrieNode* best_node = NULL;
+    int best_score = -1;
+    
+    TrieNode* segment_start = trie_walk(trie->segment_root, prefix);
+    if (segment_start) {
+        trie_best_in_subtree(trie, segment_start, now, &best_node, &best_score);
+    }
+    TrieNode* primary_start = *prefix ? trie_walk(trie->root, prefix) : NULL;
+    if (primary_start) {
+        trie_best_in_subtree(trie, primary_start, now, &best_node, &best_score);
+    }
+    
+    TrieSampleFilter filter = { prefix, strlen(prefix), NULL, 0, false };
+    const char* text = best_node ? trie_node_text(trie, best_node, &filter, now, NULL) : NULL;
+    
+    // A volatile token typed: the template keys the prefix can continue as
+    char* owned = NULL;
+    for (int index = 0; trie->templates && *prefix && index < 2; index++) {
+        if (index == 0 ? segment_start != NULL : primary_start != NULL) continue;
+        int score;
+        char* spliced;
+        const char* templated = trie_template_completion(trie, index == 0 ? trie->segment_root : trie->root,
+                                                         prefix, false, &score, &spliced);
+        if (templated && score > best_score) {
+            free(owned);
+            owned = spliced;
+            text = templated;
+            best_score = score;
+        } else {
+            free(spliced);
+        }
+    }
+    if (!text) return NULL;
     
 #ifdef DEBUG
-    printf("DEBUG: No completion found for prefix '%s'\n", prefix);
+    printf("DEBUG: Segment completion for '%s': '%s' (score: %d)\n",
+           prefix, text, best_score);
 #endif
-    return NULL;
+    return owned ? owned : strdup(text);
+}
+
+void trie_index_stats(const TrieNode* root, TrieIndexStats* stats) {
+    stats->nodes = 0;
+    stats->refs = 0;
+    stats->bytes = 0;
+    if (!root) return;
+    
+    const TrieNode** stack = malloc(MAX_COMMAND_LENGTH * ALPHABET_SIZE * sizeof(TrieNode*));
+    if (!stack) return;
+    int stack_top = 0;
+    stack[stack_top++] = root;
+    
+    while (stack_top > 0) {
+        const TrieNode* node = stack[--stack_top];
+        
+        stats->nodes++;
+        stats->refs += node->ref_count;
+        stats->bytes += sizeof(TrieNode) + node->ref_count * sizeof(TrieRef);
+        if (node->full_command) {
+            stats->bytes += strlen(node->full_command) + 1;
+        }
+        if (node->reservoir) {
+            stats->bytes += sizeof(TrieReservoir);
+            for (int i = 0; i < node->reservoir->count; i++) {
+                stats->bytes += strlen(node->reservoir->samples[i].command) + 1;
+            }
+        }
+        
+        for (int i = 0; i < ALPHABET_SIZE; i++) {
+            if (node->children[i] && stack_top < MAX_COMMAND_LENGTH * ALPHABET_SIZE) {
+                stack[stack_top++] = node->children[i];
+            }
+        }
+    }
+    free(stack);
+}
+
+// Leaf a command is stored on (its template's, if it has one), or NULL;
+// *templated says whether it is a template
+static TrieNode* trie_command_leaf(Trie* trie, const char* command, bool* templated) {
+    char buf[MAX_COMMAND_LENGTH + 1];
+    const char* key = trie_key(trie, command, buf);
+    *templated = key != command;
+    TrieNode* leaf = trie_walk(trie->root, key);
+    return leaf && leaf->is_end_of_word ? leaf : NULL;
+}
+
+// Score of an exact command, or -1 if the trie does not contain it
+int trie_command_score(Trie* trie, const char* command) {
+    if (!trie || !command) return -1;
+    
+    bool templated;
+    TrieNode* leaf = trie_command_leaf(trie, command, &templated);
+    if (!leaf || (templated && !trie_find_sample(leaf, command))) return -1;
+    if (leaf->missing) return 0;
+    return trie_score(leaf->frequency, leaf->last_used, time(NULL));
+}
+
+bool trie_command_usage(Trie* trie, const char* command, int* frequency, long* last_used) {
+    if (!trie || !command) return false;
+    
+    bool templated;
+    TrieNode* leaf = trie_command_leaf(trie, command, &templated);
+    if (!leaf) return false;
+    if (!templated) {
+        *frequency = leaf->frequency;
+        *last_used = leaf->last_used;
+        return true;
+    }
+    
+    const TrieSample* sample = trie_find_sample(leaf, command);
+    if (!sample) return false;
+    *frequency = sample->frequency;
+    *last_used = sample->last_used;
+    return true;
 }
 
 // Update frequency of a command (when user executes it)
 void trie_update_frequency(Trie* trie, const char* command) {
     if (!trie || !command) return;
     
-    TrieNode* current = trie->root;
-    int len = strlen(command);
+    bool templated;
+    TrieNode* current = trie_command_leaf(trie, command, &templated);
+    if (!current) return;  // Command not found
     
-    // Navigate to the command node
-    for (int i = 0; i < len; i++) {
-        unsigned char index = (unsigned char)command[i];
-        if (index >= ALPHABET_SIZE || current->children[index] == NULL) {
-            return;  // Command not found
+    current->frequency++;
+    current->last_used = time(NULL);
+    if (templated) trie_sample_use(current, command, current->last_used);
+    trie_time_touch(trie, current);
+#ifdef DEBUG
+    printf("DEBUG: Updated frequency for '%s' to %d\n", command, current->frequency);
+#endif
+}
+
+// Set stored statistics for a command (e.g. when loading a cache)
+bool trie_set_usage(Trie* trie, const char* command, int frequency, long last_used) {
+    if (!trie || !command) return false;
+    
+    bool templated;
+    TrieNode* current = trie_command_leaf(trie, command, &templated);
+    if (!current) return false;
+    
+    if (templated) {
+        TrieSample* sample = trie_find_sample(current, command);
+        if (!sample) return false;
+        sample->frequency = frequency;
+        sample->last_used = last_used;
+        
+        // Re-total the template
+        const TrieReservoir* reservoir = current->reservoir;
+        frequency = reservoir->evicted;
+        last_used = 0;
+        for (int i = 0; i < reservoir->count; i++) {
+            frequency += reservoir->samples[i].frequency;
+            if (reservoir->samples[i].last_used > last_used) {
+                last_used = reservoir->samples[i].last_used;
+            }
         }
-        current = current->children[index];
     }
     
-    if (current->is_end_of_word) {
-        current->frequency++;
-        current->last_used = time(NULL);
-#ifdef DEBUG
-        printf("DEBUG: Updated frequency for '%s' to %d\n", command, current->frequency);
-#endif
+    current->frequency = frequency;
+    if (current->last_used != last_used) {
+        current->last_used = last_used;
+        trie_time_touch(trie, current);
     }
+    return true;
+}
+
+bool trie_enable_templates(Trie* trie) {
+    if (!trie) return false;
+    trie->templates = true;
+    return true;
+}
+
+bool trie_command_templated(Trie* trie, const char* command) {
+    char buf[MAX_COMMAND_LENGTH + 1];
+    return trie && command && trie_key(trie, command, buf) != command;
 }
 
 // Print debug information about the trie
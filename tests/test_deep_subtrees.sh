@@ -0,0 +1,45 @@
+#!/bin/bash
+
+# test_deep_subtrees.sh - Best completions from deep, wide subtrees
+#
+# Under `x` every level has 94 siblings, so a depth-first search holds more
+# than a thousand pending nodes before it reaches the most used command;
+# no lookup may drop the subtrees that do not fit a fixed-size stack.
+
+echo "Testing deep subtrees"
+echo "====================="
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+export HOME="$WORK" ZSH_AUTOCOMPLETE_BASE=
+BEST='xxxxxxxxxxxxxx!q'
+{
+    for depth in $(seq 1 14); do
+        head=$(printf 'x%.0s' $(seq 1 "$depth"))
+        for c in $(seq 33 126); do
+            printf '%s%b\n' "$head" "\\$(printf '%03o' "$c")q"
+        done
+    done
+    for i in 1 2 3 4 5; do echo "$BEST"; done
+} | ./autocomplete init "" >/dev/null 2>&1
+
+FAILED=0
+check() {
+    local expected="$1"
+    shift
+    local got
+    got=$(./autocomplete ghost "$@" 2>/dev/null)
+    if [[ "$got" == "$expected" ]]; then
+        echo "   [PASS] '$1'${2:+ ...'$2'} -> '$got'"
+    else
+        echo "   [FAIL] '$1'${2:+ ...'$2'} -> '$got' (expected '$expected')"
+        FAILED=1
+    fi
+}
+
+check "$BEST" 'x'
+check "echo hi | $BEST" 'echo hi | x'
+ZSH_AUTOCOMPLETE_IGNORE_CASE=1 check "X${BEST#x}" 'X'
+check "sudo $BEST" 'sudo x'
+check "$BEST" 'x' 'q'
+exit $FAILED
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# test_event_log.sh - The event log survives a crash in the middle of a seal
+#
+# A torn block at the end of events.log must not hide events appended after
+# it, and sealed rows must not come back from events.tail.
+
+echo "Testing event log recovery"
+echo "=========================="
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+export HOME="$WORK" ZSH_AUTOCOMPLETE_BASE=
+LOG="$WORK/.cache/zsh-autocomplete/events.log"
+
+# 1500 timestamped commands: one sealed block plus a tail
+for i in $(seq 1 1500); do
+    echo ": $((1700000000 + i)):0;cmd$i"
+done | ./autocomplete init "" >/dev/null 2>&1
+
+FAILED=0
+check() {
+    if [[ "$2" == "$3" ]]; then
+        echo "   [PASS] $1"
+    else
+        echo "   [FAIL] $1: expected '$3', got '$2'"
+        FAILED=1
+    fi
+}
+
+check "Backfill recorded once" "$(./autocomplete events 2>/dev/null | wc -l)" 1500
+
+# Simulate a crash mid-seal: half a block header left at the end
+head -c 40 "$LOG" >> "$LOG"
+./autocomplete update "" "after crash" 0 /tmp >/dev/null 2>&1
+EVENTS=$(./autocomplete events 2>/dev/null)
+check "Events after a torn block are reachable" "$(echo "$EVENTS" | tail -n 1 | cut -f 4)" "after crash"
+check "No event lost or repeated" "$(echo "$EVENTS" | wc -l)" 1501
+exit $FAILED
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# test_line_escapes.sh - One reply line per request line in serve mode
+#
+# A multi-line buffer (PS2 continuation) travels with its newline escaped;
+# replies escape theirs, so a client reading one line per request never
+# falls behind.
+
+echo "Testing line protocol escapes"
+echo "============================="
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+: > "$WORK/history"
+
+REPLIES=$({
+    printf 'update\t\tfor i in 1 2; do\\necho ma; done\n'
+    printf 'update\t\tprintf "a\\\\tb"\n'
+    printf 'ghost\tfor i in 1 2; do\\necho m\t\t/tmp\n'
+    printf 'history\tfor\tup\t-1\n'
+    printf 'ghost\tprintf\n'
+    head -c 70000 /dev/zero | tr '\0' a
+    printf '\nstats\n'
+} | HOME="$WORK" ZSH_AUTOCOMPLETE_BASE= ./autocomplete serve "$WORK/history" 2>/dev/null)
+
+EXPECTED=$(printf '%s\n' 'ok	' 'ok	' \
+    'ok	for i in 1 2; do\necho ma; done' \
+    'ok	for i in 1 2; do\necho ma; done|0' \
+    'ok	printf "a\\tb"' \
+    'error	request too long' \
+    'ok	2/0')
+if [[ "$REPLIES" == "$EXPECTED" ]]; then
+    echo "   [PASS] $(echo "$REPLIES" | wc -l) requests, one reply each"
+    exit 0
+fi
+echo "   [FAIL] Replies out of step:"
+diff <(echo "$EXPECTED") <(echo "$REPLIES") | cut -c1-100 | sed 's/^/     /'
+exit 1
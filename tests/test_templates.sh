@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# test_templates.sh - Templated commands complete through every index
+#
+# `kill 48213` and `kill 51234` share the template `kill <number>`; the
+# segment, wrapper, case-folded and suffix lookups must still answer with
+# the sample that matches what was typed, not the template's first command.
+
+echo "Testing templated completions"
+echo "============================="
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+export HOME="$WORK" ZSH_AUTOCOMPLETE_BASE=
+printf '%s\n' 'kill 48213' 'kill 51234' 'kill 51234' 'kill 51234' \
+    'sudo kill 77777' 'echo a && kill 51234' | ./autocomplete init "" >/dev/null 2>&1
+
+FAILED=0
+check() {
+    local expected="$1"
+    shift
+    local got
+    got=$(./autocomplete ghost "$@" 2>/dev/null)
+    if [[ "$got" == "$expected" ]]; then
+        echo "   [PASS] '$1'${2:+ ...'$2'} -> '$got'"
+    else
+        echo "   [FAIL] '$1'${2:+ ...'$2'} -> '$got' (expected '$expected')"
+        FAILED=1
+    fi
+}
+
+check 'echo b && kill 51234' 'echo b && kill '
+check 'echo b && kill 48213' 'echo b && kill 4'
+check 'sudo kill 51234' 'sudo kill 5'
+check 'kill 51234' 'ki' ' 51234'
+check 'kill 48213' 'ki' '8213'
+
+ZSH_AUTOCOMPLETE_IGNORE_CASE=1 check 'Kill 51234' 'Kill '
+ZSH_AUTOCOMPLETE_IGNORE_CASE=1 check 'KILL 51234' 'KILL 5'
+exit $FAILED
@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# test_time_window.sh - Time-bounded history cycling lists each command once
+#
+# One update touches the time index more than once (insert, then frequency);
+# a window query must still return every command in it exactly once.
+
+echo "Testing time-window history cycling"
+echo "==================================="
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+printf 'ls -la\ngit status\nmake clean\n' > "$WORK/history"
+
+# Serve mode keeps the time index across updates: cycle the 1-day window
+# after updating commands in the same second
+REPLIES=$({
+    printf 'stats\nhistory\t\tup\t-1\t1d\n'
+    printf 'update\t\tgit status\nupdate\t\tls -la\nupdate\t\tls -la\n'
+    for i in -1 0 1 2; do printf 'history\t\tup\t%s\t1d\n' "$i"; done
+} | HOME="$WORK" ZSH_AUTOCOMPLETE_BASE= ./autocomplete serve "$WORK/history" 2>/dev/null)
+
+SEEN=$(echo "$REPLIES" | tail -n 4 | sed -n 's/^[a-z]*\t\(.*\)|[0-9-]*$/\1/p' | grep -v '^$')
+FAILED=0
+if [[ $(echo "$SEEN" | sort | uniq -d) ]]; then
+    echo "   [FAIL] Window listed a command twice:"
+    echo "$SEEN" | sed 's/^/     /'
+    FAILED=1
+elif [[ $(echo "$SEEN" | wc -l) -ne 3 ]]; then
+    echo "   [FAIL] Window lost commands:"
+    echo "$SEEN" | sed 's/^/     /'
+    FAILED=1
+else
+    echo "   [PASS] Each command listed once"
+fi
+exit $FAILED